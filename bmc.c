@@ -69,6 +69,19 @@ int dscmp2(struct dataset *a, struct dataset *b)
 	return 0;
 }
 
+/* A data set has padding, so compare it one field at a time. */
+int dataset_eq(struct dataset *a, struct dataset *b)
+{
+	return a->priority1 == b->priority1 &&
+		!memcmp(&a->identity, &b->identity, sizeof(a->identity)) &&
+		!memcmp(&a->quality, &b->quality, sizeof(a->quality)) &&
+		a->priority2 == b->priority2 &&
+		a->localPriority == b->localPriority &&
+		a->stepsRemoved == b->stepsRemoved &&
+		!memcmp(&a->sender, &b->sender, sizeof(a->sender)) &&
+		!memcmp(&a->receiver, &b->receiver, sizeof(a->receiver));
+}
+
 int dscmp(struct dataset *a, struct dataset *b)
 {
 	int diff;
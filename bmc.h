@@ -44,6 +44,14 @@ enum {
 enum port_state bmc_state_decision(struct clock *c, struct port *r,
 				   int (*comapre)(struct dataset *a, struct dataset *b));
 
+/**
+ * Test two data sets for equality, field by field.
+ * @param a A dataset to compare.
+ * @param b A dataset to compare.
+ * @return One if the data sets are equal, zero otherwise.
+ */
+int dataset_eq(struct dataset *a, struct dataset *b);
+
 /**
  * Compare two data sets using the algorithm defined in IEEE 1588.
  * @param a A dataset to compare.
@@ -17,11 +17,13 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include <errno.h>
+#include <inttypes.h>
 #include <linux/net_tstamp.h>
-#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
 #include <sys/queue.h>
 
 #include "address.h"
@@ -29,6 +31,7 @@
 #include "clock.h"
 #include "clockadj.h"
 #include "clockcheck.h"
+#include "contain.h"
 #include "foreign.h"
 #include "filter.h"
 #include "missing.h"
@@ -37,20 +40,36 @@
 #include "port.h"
 #include "servo.h"
 #include "stats.h"
+#include "status.h"
 #include "print.h"
 #include "rtnl.h"
 #include "tlv.h"
+#include "trace.h"
 #include "tsproc.h"
 #include "uds.h"
 #include "util.h"
 
-#define N_CLOCK_PFD (N_POLLFD + 1) /* one extra per port, for the fault timer */
+#define CLOCK_MAX_EVENTS 64
 #define POW2_41 ((double)(1ULL << 41))
 
 struct port {
 	LIST_ENTRY(port) list;
 };
 
+/* Registered with epoll as the cookie of one descriptor of a port. */
+struct clock_fd {
+	struct clock_port *cp;
+	int index;
+	int fd;
+};
+
+struct clock_port {
+	LIST_ENTRY(clock_port) list;
+	struct port *port;
+	unsigned int faulty; /* poll round in which the port became faulty */
+	struct clock_fd fd[N_POLLFD];
+};
+
 struct freq_estimator {
 	tmv_t origin1;
 	tmv_t ingress1;
@@ -80,6 +99,8 @@ struct clock {
 	clockid_t clkid;
 	struct servo *servo;
 	enum servo_type servo_type;
+	struct trace *trace;
+	struct status *status_seg;
 	int (*dscmp)(struct dataset *a, struct dataset *b);
 	struct defaultDS dds;
 	struct dataset default_dataset;
@@ -91,11 +112,19 @@ struct clock {
 	struct ClockIdentity best_id;
 	LIST_HEAD(ports_head, port) ports;
 	struct port *uds_port;
-	struct pollfd *pollfd;
-	int pollfd_valid;
+	int epfd;
+	unsigned int poll_round;
+	struct tmq *tmq;
+	struct clock_fd tmq_fd; /* cookie of the timer queue, with no port */
+	LIST_HEAD(clock_ports_head, clock_port) fd_ports;
 	int nports; /* does not include the UDS port */
 	int last_port_number;
 	int sde;
+	/* inputs of the last state decision */
+	int bmca_full;
+	struct defaultDS bmca_dds;
+	struct dataset bmca_best_ds;
+	struct bmca_stats_np bmca_stats;
 	int free_running;
 	int freq_est_interval;
 	int grand_master_capable; /* for 802.1AS only */
@@ -128,7 +157,8 @@ struct clock {
 struct clock the_clock;
 
 static void handle_state_decision_event(struct clock *c);
-static int clock_resize_pollfd(struct clock *c, int new_nports);
+static int clock_watch_port(struct clock *c, struct port *p);
+static void clock_unwatch_port(struct clock *c, struct port *p);
 static void clock_remove_port(struct clock *c, struct port *p);
 
 static int cid_eq(struct ClockIdentity *a, struct ClockIdentity *b)
@@ -268,11 +298,19 @@ void clock_destroy(struct clock *c)
 		clock_remove_port(c, p);
 	}
 	port_close(c->uds_port);
-	free(c->pollfd);
+	clock_unwatch_port(c, c->uds_port);
+	close(c->epfd);
+	tmq_destroy(c->tmq);
 	if (c->clkid != CLOCK_REALTIME) {
 		phc_close(c->clkid);
 	}
 	servo_destroy(c->servo);
+	if (c->trace) {
+		trace_close(c->trace);
+	}
+	if (c->status_seg) {
+		status_destroy(c->status_seg);
+	}
 	tsproc_destroy(c->tsproc);
 	stats_destroy(c->stats.offset);
 	stats_destroy(c->stats.freq);
@@ -317,6 +355,55 @@ static void clock_freq_est_reset(struct clock *c)
 	c->fest.count = 0;
 }
 
+static void clock_time_status(struct clock *c, struct time_status_np *tsn)
+{
+	tsn->master_offset = tmv_to_nanoseconds(c->master_offset);
+	tsn->ingress_time = tmv_to_nanoseconds(c->ingress_ts);
+	tsn->cumulativeScaledRateOffset =
+		(Integer32) (c->status.cumulativeScaledRateOffset +
+			      c->nrr * POW2_41 - POW2_41);
+	tsn->scaledLastGmPhaseChange = c->status.scaledLastGmPhaseChange;
+	tsn->gmTimeBaseIndicator = c->status.gmTimeBaseIndicator;
+	tsn->lastGmPhaseChange = c->status.lastGmPhaseChange;
+	if (cid_eq(&c->dad.pds.grandmasterIdentity, &c->dds.clockIdentity))
+		tsn->gmPresent = 0;
+	else
+		tsn->gmPresent = 1;
+	tsn->gmIdentity = c->dad.pds.grandmasterIdentity;
+}
+
+void clock_update_status(struct clock *c)
+{
+	struct status_data *data;
+	struct timespec now;
+	struct port *piter;
+	unsigned int n = 0;
+
+	if (!c->status_seg) {
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	data = status_begin(c->status_seg);
+	data->update_time = now.tv_sec * NS_PER_SEC + now.tv_nsec;
+	data->updates++;
+	data->servo_state = c->servo_state;
+	data->cds = c->cur;
+	data->pds = c->dad.pds;
+	data->tds = c->tds;
+	clock_time_status(c, &data->tsn);
+	LIST_FOREACH(piter, &c->ports, list) {
+		if (n == STATUS_MAX_PORTS) {
+			break;
+		}
+		data->port[n].portIdentity = port_identity(piter);
+		data->port[n].portState = port_state(piter);
+		n++;
+	}
+	data->num_ports = n;
+	status_end(c->status_seg);
+}
+
 static void clock_management_send_error(struct port *p,
 					struct ptp_message *msg, int error_id)
 {
@@ -337,18 +424,19 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 	struct subscribe_events_np *sen;
 	struct management_tlv *tlv;
 	struct time_status_np *tsn;
+	struct msg_pool_stats pool;
+	struct msg_pool_np *mpn;
+	struct bmca_stats_np *bsn;
+	uint8_t buf[sizeof(*tlv) + MANAGEMENT_MAX_DATALEN];
 	struct tlv_extra *extra;
 	struct PTPText *text;
 	int datalen = 0;
 
-	extra = tlv_extra_alloc();
-	if (!extra) {
-		pr_err("failed to allocate TLV descriptor");
-		return 0;
-	}
-	extra->tlv = (struct TLV *) rsp->management.suffix;
-
-	tlv = (struct management_tlv *) rsp->management.suffix;
+	/*
+	 * The answer is filled in aside, and then goes after any answers
+	 * already in the response if its actual length fits.
+	 */
+	tlv = (struct management_tlv *) buf;
 	tlv->type = TLV_MANAGEMENT;
 	tlv->id = id;
 
@@ -412,19 +500,7 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 		break;
 	case TLV_TIME_STATUS_NP:
 		tsn = (struct time_status_np *) tlv->data;
-		tsn->master_offset = tmv_to_nanoseconds(c->master_offset);
-		tsn->ingress_time = tmv_to_nanoseconds(c->ingress_ts);
-		tsn->cumulativeScaledRateOffset =
-			(Integer32) (c->status.cumulativeScaledRateOffset +
-				      c->nrr * POW2_41 - POW2_41);
-		tsn->scaledLastGmPhaseChange = c->status.scaledLastGmPhaseChange;
-		tsn->gmTimeBaseIndicator = c->status.gmTimeBaseIndicator;
-		tsn->lastGmPhaseChange = c->status.lastGmPhaseChange;
-		if (cid_eq(&c->dad.pds.grandmasterIdentity, &c->dds.clockIdentity))
-			tsn->gmPresent = 0;
-		else
-			tsn->gmPresent = 1;
-		tsn->gmIdentity = c->dad.pds.grandmasterIdentity;
+		clock_time_status(c, tsn);
 		datalen = sizeof(*tsn);
 		break;
 	case TLV_GRANDMASTER_SETTINGS_NP:
@@ -435,6 +511,23 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 		gsn->time_source = c->time_source;
 		datalen = sizeof(*gsn);
 		break;
+	case TLV_MSG_POOL_NP:
+		mpn = (struct msg_pool_np *) tlv->data;
+		msg_pool_get_stats(&pool);
+		mpn->allocations = pool.allocations;
+		mpn->misses = pool.misses;
+		mpn->trims = pool.trims;
+		mpn->in_use = pool.in_use;
+		mpn->peak_in_use = pool.peak_in_use;
+		mpn->free = pool.free;
+		mpn->slabs = pool.slabs;
+		datalen = sizeof(*mpn);
+		break;
+	case TLV_BMCA_STATS_NP:
+		bsn = (struct bmca_stats_np *) tlv->data;
+		*bsn = c->bmca_stats;
+		datalen = sizeof(*bsn);
+		break;
 	case TLV_SUBSCRIBE_EVENTS_NP:
 		if (p != c->uds_port) {
 			/* Only the UDS port allowed. */
@@ -452,8 +545,12 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 		datalen++;
 	}
 	tlv->length = sizeof(tlv->id) + datalen;
-	rsp->header.messageLength += sizeof(*tlv) + datalen;
-	msg_tlv_attach(rsp, extra);
+	extra = msg_tlv_append(rsp, sizeof(*tlv) + datalen);
+	if (!extra) {
+		return !port_management_append_error(rsp, id,
+						     TLV_RESPONSE_TOO_BIG);
+	}
+	memcpy(extra->tlv, tlv, sizeof(*tlv) + datalen);
 
 	/* The caller can respond to this message. */
 	return 1;
@@ -556,6 +653,14 @@ static void clock_stats_update(struct clock_stats *s,
 	stats_reset(s->delay);
 }
 
+static void clock_trace(struct clock *c, int type, int arg, double value,
+			tmv_t t0, tmv_t t1, tmv_t t2)
+{
+	if (c->trace) {
+		trace_write(c->trace, type, arg, value, t0, t1, t2);
+	}
+}
+
 static enum servo_state clock_no_adjust(struct clock *c, tmv_t ingress,
 					tmv_t origin)
 {
@@ -774,12 +879,12 @@ static int clock_add_port(struct clock *c, int phc_index,
 {
 	struct port *p, *piter, *lastp = NULL;
 
-	if (clock_resize_pollfd(c, c->nports + 1)) {
-		return -1;
-	}
 	p = port_open(phc_index, timestamping, ++c->last_port_number, iface, c);
 	if (!p) {
-		/* No need to shrink pollfd */
+		return -1;
+	}
+	if (clock_watch_port(c, p)) {
+		port_close(p);
 		return -1;
 	}
 	LIST_FOREACH(piter, &c->ports, list) {
@@ -791,22 +896,16 @@ static int clock_add_port(struct clock *c, int phc_index,
 		LIST_INSERT_HEAD(&c->ports, p, list);
 	}
 	c->nports++;
-	clock_fda_changed(c);
 
 	return 0;
 }
 
 static void clock_remove_port(struct clock *c, struct port *p)
 {
-	/* Do not call clock_resize_pollfd, it's pointless to shrink
-	 * the allocated memory at this point, clock_destroy will free
-	 * it all anyway. This function is usable from other parts of
-	 * the code, but even then we don't mind if pollfd is larger
-	 * than necessary. */
 	LIST_REMOVE(p, list);
 	c->nports--;
-	clock_fda_changed(c);
 	port_close(p);
+	clock_unwatch_port(c, p);
 }
 
 int clock_required_modes(struct clock *c)
@@ -860,12 +959,16 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	unsigned char oui[OUI_LEN];
 	char phc[32], *tmp;
 	struct interface *iface, *udsif = &c->uds_interface;
+	struct epoll_event ev;
 	struct timespec ts;
 	int sfl;
 
 	clock_gettime(CLOCK_REALTIME, &ts);
 	srandom(ts.tv_sec ^ ts.tv_nsec);
 
+	msg_pool_set_high_water(config_get_int(config, NULL,
+					       "message_pool_high_water"));
+
 	if (c->nports) {
 		clock_destroy(c);
 	}
@@ -1016,6 +1119,7 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	c->config = config;
 	c->free_running = config_get_int(config, NULL, "free_running");
 	c->freq_est_interval = config_get_int(config, NULL, "freq_est_interval");
+	c->bmca_full = 1;
 	c->grand_master_capable = config_get_int(config, NULL, "gmCapable");
 	c->kernel_leap = config_get_int(config, NULL, "kernel_leap");
 	c->utc_offset = config_get_int(config, NULL, "utc_offset");
@@ -1064,6 +1168,25 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	}
 	c->servo_state = SERVO_UNLOCKED;
 	c->servo_type = servo;
+	if (config_get_string(config, NULL, "trace_file")) {
+		c->trace = trace_create(config_get_string(config, NULL,
+							  "trace_file"),
+					config_get_int(config, NULL,
+						       "trace_records"),
+					-fadj, max_adj, sw_ts);
+		if (!c->trace) {
+			pr_err("Failed to create trace file");
+			return NULL;
+		}
+	}
+	if (config_get_string(config, NULL, "status_segment")) {
+		c->status_seg = status_create(config_get_string(config, NULL,
+							"status_segment"));
+		if (!c->status_seg) {
+			pr_err("Failed to create status segment");
+			return NULL;
+		}
+	}
 	if (config_get_int(config, NULL, "dataset_comparison") == DS_CMP_G8275) {
 		c->dscmp = telecom_dscmp;
 	} else {
@@ -1071,7 +1194,8 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	}
 	c->tsproc = tsproc_create(config_get_int(config, NULL, "tsproc_mode"),
 				  config_get_int(config, NULL, "delay_filter"),
-				  config_get_int(config, NULL, "delay_filter_length"));
+				  config_get_int(config, NULL, "delay_filter_length"),
+				  config_get_int(config, NULL, "delay_filter_percentile"));
 	if (!c->tsproc) {
 		pr_err("Failed to create time stamp processor");
 		return NULL;
@@ -1109,8 +1233,22 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	LIST_INIT(&c->ports);
 	c->last_port_number = 0;
 
-	if (clock_resize_pollfd(c, 0)) {
-		pr_err("failed to allocate pollfd");
+	LIST_INIT(&c->fd_ports);
+	c->epfd = epoll_create1(0);
+	if (c->epfd < 0) {
+		pr_err("epoll_create1 failed: %m");
+		return NULL;
+	}
+	c->tmq = tmq_create();
+	if (!c->tmq) {
+		pr_err("failed to create the timer queue");
+		return NULL;
+	}
+	c->tmq_fd.fd = tmq_fd(c->tmq);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &c->tmq_fd;
+	if (epoll_ctl(c->epfd, EPOLL_CTL_ADD, c->tmq_fd.fd, &ev)) {
+		pr_err("epoll_ctl failed: %m");
 		return NULL;
 	}
 
@@ -1120,7 +1258,9 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 		pr_err("failed to open the UDS port");
 		return NULL;
 	}
-	clock_fda_changed(c);
+	if (clock_watch_port(c, c->uds_port)) {
+		return NULL;
+	}
 
 	/* Create the ports. */
 	STAILQ_FOREACH(iface, &config->interfaces, list) {
@@ -1202,54 +1342,104 @@ struct ClockIdentity clock_identity(struct clock *c)
 	return c->dds.clockIdentity;
 }
 
-static int clock_resize_pollfd(struct clock *c, int new_nports)
+static struct clock_port *clock_find_port(struct clock *c, struct port *p)
 {
-	struct pollfd *new_pollfd;
+	struct clock_port *cp;
 
-	/* Need to allocate one whole extra block of fds for UDS. */
-	new_pollfd = realloc(c->pollfd,
-			     (new_nports + 1) * N_CLOCK_PFD *
-			     sizeof(struct pollfd));
-	if (!new_pollfd) {
-		return -1;
+	LIST_FOREACH(cp, &c->fd_ports, list) {
+		if (cp->port == p) {
+			return cp;
+		}
+	}
+	return NULL;
+}
+
+static void clock_sync_port(struct clock *c, struct clock_port *cp)
+{
+	int *fd = port_fda(cp->port)->fd, i;
+	struct epoll_event ev;
+
+	/*
+	 * Drop the stale descriptors first, since a number might have
+	 * been reused for a different index. Closing a descriptor already
+	 * removes it from the epoll set, so errors are expected here.
+	 */
+	for (i = 0; i < N_POLLFD; i++) {
+		if (cp->fd[i].fd >= 0 && cp->fd[i].fd != fd[i]) {
+			epoll_ctl(c->epfd, EPOLL_CTL_DEL, cp->fd[i].fd, NULL);
+			cp->fd[i].fd = -1;
+		}
+	}
+	for (i = 0; i < N_POLLFD; i++) {
+		if (fd[i] < 0) {
+			continue;
+		}
+		ev.events = EPOLLIN | EPOLLPRI;
+		ev.data.ptr = &cp->fd[i];
+		/* The same number may belong to a freshly opened socket. */
+		if (cp->fd[i].fd == fd[i] &&
+		    !epoll_ctl(c->epfd, EPOLL_CTL_MOD, fd[i], &ev)) {
+			continue;
+		}
+		if (epoll_ctl(c->epfd, EPOLL_CTL_ADD, fd[i], &ev)) {
+			pr_err("port %d: epoll_ctl failed: %m",
+			       port_number(cp->port));
+			cp->fd[i].fd = -1;
+			continue;
+		}
+		cp->fd[i].fd = fd[i];
 	}
-	c->pollfd = new_pollfd;
-	return 0;
 }
 
-static void clock_fill_pollfd(struct pollfd *dest, struct port *p)
+static int clock_watch_port(struct clock *c, struct port *p)
 {
-	struct fdarray *fda;
+	struct clock_port *cp;
 	int i;
 
-	fda = port_fda(p);
+	cp = calloc(1, sizeof(*cp));
+	if (!cp) {
+		return -1;
+	}
+	cp->port = p;
 	for (i = 0; i < N_POLLFD; i++) {
-		dest[i].fd = fda->fd[i];
-		dest[i].events = POLLIN|POLLPRI;
+		cp->fd[i].cp = cp;
+		cp->fd[i].index = i;
+		cp->fd[i].fd = -1;
 	}
-	dest[i].fd = port_fault_fd(p);
-	dest[i].events = POLLIN|POLLPRI;
+	LIST_INSERT_HEAD(&c->fd_ports, cp, list);
+	clock_sync_port(c, cp);
+	return 0;
 }
 
-static void clock_check_pollfd(struct clock *c)
+static void clock_unwatch_port(struct clock *c, struct port *p)
 {
-	struct port *p;
-	struct pollfd *dest = c->pollfd;
+	struct clock_port *cp = clock_find_port(c, p);
+	int i;
 
-	if (c->pollfd_valid) {
+	if (!cp) {
 		return;
 	}
-	LIST_FOREACH(p, &c->ports, list) {
-		clock_fill_pollfd(dest, p);
-		dest += N_CLOCK_PFD;
+	for (i = 0; i < N_POLLFD; i++) {
+		if (cp->fd[i].fd >= 0) {
+			epoll_ctl(c->epfd, EPOLL_CTL_DEL, cp->fd[i].fd, NULL);
+		}
 	}
-	clock_fill_pollfd(dest, c->uds_port);
-	c->pollfd_valid = 1;
+	LIST_REMOVE(cp, list);
+	free(cp);
 }
 
-void clock_fda_changed(struct clock *c)
+struct tmq *clock_tmq(struct clock *c)
 {
-	c->pollfd_valid = 0;
+	return c->tmq;
+}
+
+void clock_fda_changed(struct clock *c, struct port *p)
+{
+	struct clock_port *cp = clock_find_port(c, p);
+
+	if (cp) {
+		clock_sync_port(c, cp);
+	}
 }
 
 static int clock_do_forward_mgmt(struct clock *c,
@@ -1305,6 +1495,117 @@ tmv_t clock_ingress_time(struct clock *c)
 	return c->ingress_ts;
 }
 
+static int clock_management_id(int id)
+{
+	switch (id) {
+	case TLV_USER_DESCRIPTION:
+	case TLV_SAVE_IN_NON_VOLATILE_STORAGE:
+	case TLV_RESET_NON_VOLATILE_STORAGE:
+	case TLV_INITIALIZE:
+	case TLV_FAULT_LOG:
+	case TLV_FAULT_LOG_RESET:
+	case TLV_DEFAULT_DATA_SET:
+	case TLV_CURRENT_DATA_SET:
+	case TLV_PARENT_DATA_SET:
+	case TLV_TIME_PROPERTIES_DATA_SET:
+	case TLV_PRIORITY1:
+	case TLV_PRIORITY2:
+	case TLV_DOMAIN:
+	case TLV_SLAVE_ONLY:
+	case TLV_TIME:
+	case TLV_CLOCK_ACCURACY:
+	case TLV_UTC_PROPERTIES:
+	case TLV_TRACEABILITY_PROPERTIES:
+	case TLV_TIMESCALE_PROPERTIES:
+	case TLV_PATH_TRACE_LIST:
+	case TLV_PATH_TRACE_ENABLE:
+	case TLV_GRANDMASTER_CLUSTER_TABLE:
+	case TLV_ACCEPTABLE_MASTER_TABLE:
+	case TLV_ACCEPTABLE_MASTER_MAX_TABLE_SIZE:
+	case TLV_ALTERNATE_TIME_OFFSET_ENABLE:
+	case TLV_ALTERNATE_TIME_OFFSET_NAME:
+	case TLV_ALTERNATE_TIME_OFFSET_MAX_KEY:
+	case TLV_ALTERNATE_TIME_OFFSET_PROPERTIES:
+	case TLV_TRANSPARENT_CLOCK_DEFAULT_DATA_SET:
+	case TLV_PRIMARY_DOMAIN:
+	case TLV_TIME_STATUS_NP:
+	case TLV_GRANDMASTER_SETTINGS_NP:
+	case TLV_SUBSCRIBE_EVENTS_NP:
+	case TLV_MSG_POOL_NP:
+	case TLV_BMCA_STATS_NP:
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Answer a GET carrying several management TLVs. All of the clock
+ * management IDs are answered in one response, and each port answers
+ * all of the port management IDs in one response of its own.
+ */
+static void clock_manage_get_all(struct clock *c, struct port *p,
+				 struct ptp_message *req)
+{
+	struct PortIdentity pid = port_identity(p);
+	int answers = 0, err = 0, port_ids = 0, res;
+	struct management_tlv *mgt;
+	struct ptp_message *rsp;
+	struct tlv_extra *extra;
+	struct port *piter;
+
+	LIST_FOREACH(piter, &c->ports, list) {
+		res = port_manage(piter, p, req);
+		if (res < 0)
+			break;
+		if (res > 0)
+			answers++;
+	}
+
+	rsp = port_management_reply(pid, p, req);
+	if (!rsp) {
+		return;
+	}
+	TAILQ_FOREACH(extra, &req->tlv_list, list) {
+		if (extra->tlv->type != TLV_MANAGEMENT) {
+			continue;
+		}
+		mgt = (struct management_tlv *) extra->tlv;
+		if (port_management_id(mgt->id)) {
+			port_ids++;
+			continue;
+		}
+		if (!clock_management_id(mgt->id)) {
+			err = port_management_append_error(rsp, mgt->id,
+							   TLV_NO_SUCH_ID);
+		} else if (!clock_management_fill_response(c, p, req, rsp,
+							   mgt->id)) {
+			err = port_management_append_error(rsp, mgt->id,
+							   TLV_NOT_SUPPORTED);
+		}
+		if (err) {
+			break;
+		}
+	}
+	if (port_ids && !answers) {
+		/* No port answered, see the single TLV case below. */
+		TAILQ_FOREACH(extra, &req->tlv_list, list) {
+			mgt = (struct management_tlv *) extra->tlv;
+			if (extra->tlv->type != TLV_MANAGEMENT ||
+			    !port_management_id(mgt->id)) {
+				continue;
+			}
+			if (port_management_append_error(rsp, mgt->id,
+							 TLV_WRONG_VALUE)) {
+				break;
+			}
+		}
+	}
+	if (rsp->tlv_count) {
+		port_prepare_and_send(p, rsp, TRANS_GENERAL);
+	}
+	msg_put(rsp);
+}
+
 int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
 {
 	int changed = 0, res, answers;
@@ -1322,6 +1623,10 @@ int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
 	if (!cid_eq(tcid, &wildcard) && !cid_eq(tcid, &c->dds.clockIdentity)) {
 		return changed;
 	}
+	if (msg->tlv_count > 1 && management_action(msg) == GET) {
+		clock_manage_get_all(c, p, msg);
+		return changed;
+	}
 	if (msg->tlv_count != 1) {
 		return changed;
 	}
@@ -1366,43 +1671,9 @@ int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
 		}
 	}
 
-	switch (mgt->id) {
-	case TLV_USER_DESCRIPTION:
-	case TLV_SAVE_IN_NON_VOLATILE_STORAGE:
-	case TLV_RESET_NON_VOLATILE_STORAGE:
-	case TLV_INITIALIZE:
-	case TLV_FAULT_LOG:
-	case TLV_FAULT_LOG_RESET:
-	case TLV_DEFAULT_DATA_SET:
-	case TLV_CURRENT_DATA_SET:
-	case TLV_PARENT_DATA_SET:
-	case TLV_TIME_PROPERTIES_DATA_SET:
-	case TLV_PRIORITY1:
-	case TLV_PRIORITY2:
-	case TLV_DOMAIN:
-	case TLV_SLAVE_ONLY:
-	case TLV_TIME:
-	case TLV_CLOCK_ACCURACY:
-	case TLV_UTC_PROPERTIES:
-	case TLV_TRACEABILITY_PROPERTIES:
-	case TLV_TIMESCALE_PROPERTIES:
-	case TLV_PATH_TRACE_LIST:
-	case TLV_PATH_TRACE_ENABLE:
-	case TLV_GRANDMASTER_CLUSTER_TABLE:
-	case TLV_ACCEPTABLE_MASTER_TABLE:
-	case TLV_ACCEPTABLE_MASTER_MAX_TABLE_SIZE:
-	case TLV_ALTERNATE_TIME_OFFSET_ENABLE:
-	case TLV_ALTERNATE_TIME_OFFSET_NAME:
-	case TLV_ALTERNATE_TIME_OFFSET_MAX_KEY:
-	case TLV_ALTERNATE_TIME_OFFSET_PROPERTIES:
-	case TLV_TRANSPARENT_CLOCK_DEFAULT_DATA_SET:
-	case TLV_PRIMARY_DOMAIN:
-	case TLV_TIME_STATUS_NP:
-	case TLV_GRANDMASTER_SETTINGS_NP:
-	case TLV_SUBSCRIBE_EVENTS_NP:
+	if (clock_management_id(mgt->id)) {
 		clock_management_send_error(p, msg, TLV_NOT_SUPPORTED);
-		break;
-	default:
+	} else {
 		answers = 0;
 		LIST_FOREACH(piter, &c->ports, list) {
 			res = port_manage(piter, p, msg);
@@ -1416,7 +1687,6 @@ int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
 			 * TLV_WRONG_VALUE for ports that do not exist */
 			clock_management_send_error(p, msg, TLV_WRONG_VALUE);
 		}
-		break;
 	}
 	return changed;
 }
@@ -1462,17 +1732,78 @@ struct PortIdentity clock_parent_identity(struct clock *c)
 void clock_set_sde(struct clock *c, int sde)
 {
 	c->sde = sde;
+	if (sde) {
+		c->bmca_full = 1;
+	}
+}
+
+static void clock_port_event(struct clock *c, struct port *p,
+			     enum fsm_event event)
+{
+	struct clock_port *cp;
+
+	if (EV_STATE_DECISION_EVENT == event) {
+		c->sde = 1;
+	}
+	if (EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES == event) {
+		c->sde = 1;
+	}
+	port_dispatch(p, event, 0);
+	/* Clear any fault after a little while. */
+	if (PS_FAULTY == port_state(p)) {
+		clock_fault_timeout(p, 1);
+		cp = clock_find_port(c, p);
+		if (cp) {
+			cp->faulty = c->poll_round;
+		}
+	}
+}
+
+static void clock_timer_expired(void *ctx, void *owner, int index)
+{
+	struct clock *c = ctx;
+	struct port *p = owner;
+	enum fsm_event event;
+
+	/*
+	 * When the fault timer expires we clear the fault,
+	 * but only if the link is up.
+	 */
+	if (index == FD_FAULT_TIMER) {
+		clock_fault_timeout(p, 0);
+		if (port_link_status_get(p)) {
+			port_dispatch(p, EV_FAULT_CLEARED, 0);
+		}
+		return;
+	}
+	/*
+	 * Ignore the rest of a port which became faulty earlier in
+	 * this round, like the descriptors of clock_poll() do.
+	 */
+	if (PS_FAULTY == port_state(p)) {
+		return;
+	}
+
+	event = port_event(p, index);
+	if (p == c->uds_port) {
+		if (EV_STATE_DECISION_EVENT == event) {
+			clock_set_sde(c, 1);
+		}
+		return;
+	}
+	clock_port_event(c, p, event);
 }
 
 int clock_poll(struct clock *c)
 {
-	int cnt, i;
+	struct epoll_event ev[CLOCK_MAX_EVENTS];
 	enum fsm_event event;
-	struct pollfd *cur;
+	struct clock_port *cp;
+	struct clock_fd *cfd;
+	int cnt, i, index;
 	struct port *p;
 
-	clock_check_pollfd(c);
-	cnt = poll(c->pollfd, (c->nports + 1) * N_CLOCK_PFD, -1);
+	cnt = epoll_wait(c->epfd, ev, CLOCK_MAX_EVENTS, -1);
 	if (cnt < 0) {
 		if (EINTR == errno) {
 			return 0;
@@ -1484,50 +1815,57 @@ int clock_poll(struct clock *c)
 		return 0;
 	}
 
-	cur = c->pollfd;
+	c->poll_round++;
 
-	LIST_FOREACH(p, &c->ports, list) {
-		/* Let the ports handle their events. */
-		for (i = 0; i < N_POLLFD; i++) {
-			if (cur[i].revents & (POLLIN|POLLPRI)) {
-				event = port_event(p, i);
-				if (EV_STATE_DECISION_EVENT == event) {
-					c->sde = 1;
-				}
-				if (EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES == event) {
-					c->sde = 1;
-				}
-				port_dispatch(p, event, 0);
-				/* Clear any fault after a little while. */
-				if (PS_FAULTY == port_state(p)) {
-					clock_fault_timeout(p, 1);
-					break;
-				}
+	for (i = 0; i < cnt; i++) {
+		cfd = ev[i].data.ptr;
+		cp = cfd->cp;
+
+		/* The timers of all the ports share one descriptor. */
+		if (!cp) {
+			if (tmq_run(c->tmq, clock_timer_expired, c)) {
+				return -1;
 			}
+			continue;
 		}
 
-		/*
-		 * When the fault timer expires we clear the fault,
-		 * but only if the link is up.
-		 */
-		if (cur[N_POLLFD].revents & (POLLIN|POLLPRI)) {
-			clock_fault_timeout(p, 0);
-			if (port_link_status_get(p)) {
-				port_dispatch(p, EV_FAULT_CLEARED, 0);
+		p = cp->port;
+		index = cfd->index;
+
+		/* Skip descriptors closed by an earlier event. */
+		if (cfd->fd < 0) {
+			continue;
+		}
+
+		if (p == c->uds_port) {
+			if (ev[i].events & (EPOLLIN|EPOLLPRI)) {
+				event = port_event(p, index);
+				if (EV_STATE_DECISION_EVENT == event) {
+					clock_set_sde(c, 1);
+				}
 			}
+			continue;
 		}
 
-		cur += N_CLOCK_PFD;
-	}
+		/* Ignore the rest of a port which just became faulty. */
+		if (cp->faulty == c->poll_round) {
+			continue;
+		}
 
-	/* Check the UDS port. */
-	for (i = 0; i < N_POLLFD; i++) {
-		if (cur[i].revents & (POLLIN|POLLPRI)) {
-			event = port_event(c->uds_port, i);
-			if (EV_STATE_DECISION_EVENT == event) {
-				c->sde = 1;
-			}
+		/*
+		 * Transmit time stamps raise POLLERR (and POLLPRI) on the
+		 * event socket. Any pending packet will be read on the next
+		 * time around.
+		 */
+		if (index == FD_EVENT && ev[i].events & EPOLLERR &&
+		    port_txts_deferred(p)) {
+			event = port_txts_event(p);
+		} else if (ev[i].events & (EPOLLIN|EPOLLPRI)) {
+			event = port_event(p, index);
+		} else {
+			continue;
 		}
+		clock_port_event(c, p, event);
 	}
 
 	if (c->sde) {
@@ -1538,17 +1876,30 @@ int clock_poll(struct clock *c)
 	return 0;
 }
 
-void clock_path_delay(struct clock *c, tmv_t req, tmv_t rx)
+int clock_path_delay(struct clock *c, tmv_t req, tmv_t rx, tmv_t corr)
 {
-	tsproc_up_ts(c->tsproc, req, rx);
+	clock_trace(c, TRACE_DELAY, 0, 0.0, req, rx, corr);
+	tsproc_up_ts(c->tsproc, req, tmv_sub(rx, corr));
 
 	if (tsproc_update_delay(c->tsproc, &c->path_delay))
-		return;
+		return -1;
 
 	c->cur.meanPathDelay = tmv_to_TimeInterval(c->path_delay);
 
 	if (c->stats.delay)
 		stats_add_value(c->stats.delay, tmv_dbl(c->path_delay));
+
+	return 0;
+}
+
+tmv_t clock_mean_path_delay(struct clock *c)
+{
+	return c->path_delay;
+}
+
+tmv_t clock_master_offset(struct clock *c)
+{
+	return c->master_offset;
 }
 
 void clock_peer_delay(struct clock *c, tmv_t ppd, tmv_t req, tmv_t rx,
@@ -1559,6 +1910,7 @@ void clock_peer_delay(struct clock *c, tmv_t ppd, tmv_t req, tmv_t rx,
 
 	tsproc_set_delay(c->tsproc, ppd);
 	tsproc_up_ts(c->tsproc, req, rx);
+	clock_trace(c, TRACE_PEER_DELAY, 0, nrr, ppd, req, rx);
 
 	if (c->stats.delay)
 		stats_add_value(c->stats.delay, tmv_dbl(ppd));
@@ -1609,13 +1961,16 @@ int clock_switch_phc(struct clock *c, int phc_index)
 	return 0;
 }
 
-enum servo_state clock_synchronize(struct clock *c, tmv_t ingress, tmv_t origin)
+enum servo_state clock_synchronize(struct clock *c, tmv_t ingress,
+				   tmv_t origin, tmv_t corr)
 {
 	double adj, weight;
 	enum servo_state state = SERVO_UNLOCKED;
 
 	c->ingress_ts = ingress;
 
+	clock_trace(c, TRACE_SYNC, 0, 0.0, ingress, origin, corr);
+	origin = tmv_add(origin, corr);
 	tsproc_down_ts(c->tsproc, origin, ingress);
 
 	if (tsproc_update_offset(c->tsproc, &c->master_offset, &weight)) {
@@ -1639,6 +1994,8 @@ enum servo_state clock_synchronize(struct clock *c, tmv_t ingress, tmv_t origin)
 	adj = servo_sample(c->servo, tmv_dbl(c->master_offset),
 			   tmv_to_nanoseconds(ingress), weight, &state);
 	c->servo_state = state;
+	clock_trace(c, TRACE_SERVO, state, adj, c->master_offset, tmv_zero(),
+		    tmv_zero());
 
 	if (c->stats.max_count > 1) {
 		clock_stats_update(&c->stats, tmv_dbl(c->master_offset), adj);
@@ -1674,6 +2031,7 @@ enum servo_state clock_synchronize(struct clock *c, tmv_t ingress, tmv_t origin)
 		}
 		break;
 	}
+	clock_update_status(c);
 	return state;
 }
 
@@ -1700,6 +2058,8 @@ void clock_sync_interval(struct clock *c, int n)
 	c->stats.max_count = (1 << shift);
 
 	servo_sync_interval(c->servo, n < 0 ? 1.0 / (1 << -n) : 1 << n);
+	clock_trace(c, TRACE_INTERVAL, n, 0.0, tmv_zero(), tmv_zero(),
+		    tmv_zero());
 }
 
 struct timePropertiesDS *clock_time_properties(struct clock *c)
@@ -1715,9 +2075,14 @@ void clock_update_time_properties(struct clock *c, struct timePropertiesDS tds)
 static void handle_state_decision_event(struct clock *c)
 {
 	struct foreign_clock *best = NULL, *fc;
+	struct bmca_stats_np *bs;
+	struct timespec start, end;
 	struct ClockIdentity best_id;
+	int fresh_best = 0, full, n = 0;
 	struct port *piter;
-	int fresh_best = 0;
+	uint64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	LIST_FOREACH(piter, &c->ports, list) {
 		fc = port_compute_best(piter);
@@ -1746,18 +2111,37 @@ static void handle_state_decision_event(struct clock *c)
 		tsproc_reset(c->tsproc, 1);
 		if (!tmv_is_zero(c->initial_delay))
 			tsproc_set_delay(c->tsproc, c->initial_delay);
+		clock_trace(c, TRACE_RESET, 1, 0.0, c->initial_delay,
+			    tmv_zero(), tmv_zero());
 		c->ingress_ts = tmv_zero();
 		c->path_delay = c->initial_delay;
 		c->nrr = 1.0;
 		fresh_best = 1;
 	}
 
+	/*
+	 * Unless Ebest or the default data set changed, only the ports
+	 * whose own state or Erbest changed can reach a new decision.
+	 */
+	full = c->bmca_full || fresh_best || best != c->best ||
+		(best && !dataset_eq(&best->dataset, &c->bmca_best_ds)) ||
+		memcmp(&c->dds, &c->bmca_dds, sizeof(c->dds));
+
 	c->best = best;
 	c->best_id = best_id;
+	if (best) {
+		c->bmca_best_ds = best->dataset;
+	}
+	c->bmca_dds = c->dds;
+	c->bmca_full = 0;
 
 	LIST_FOREACH(piter, &c->ports, list) {
 		enum port_state ps;
 		enum fsm_event event;
+		if (!full && !port_bmca_pending(piter)) {
+			continue;
+		}
+		n++;
 		ps = bmc_state_decision(c, piter, c->dscmp);
 		switch (ps) {
 		case PS_LISTENING:
@@ -1783,7 +2167,26 @@ static void handle_state_decision_event(struct clock *c)
 			break;
 		}
 		port_dispatch(piter, event, fresh_best);
+		port_bmca_done(piter);
+	}
+	clock_update_status(c);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - start.tv_sec) * NS_PER_SEC +
+		end.tv_nsec - start.tv_nsec;
+	bs = &c->bmca_stats;
+	bs->runs++;
+	if (full) {
+		bs->full_runs++;
+	}
+	bs->decisions += n;
+	bs->last_ns = ns;
+	if (ns > bs->max_ns) {
+		bs->max_ns = ns;
 	}
+	bs->total_ns += ns;
+	pr_debug("state decision %" PRIu64 ": %d of %d ports in %" PRIu64 " ns",
+		 bs->runs, n, c->nports, ns);
 }
 
 struct clock_description *clock_description(struct clock *c)
@@ -1800,6 +2203,8 @@ void clock_check_ts(struct clock *c, uint64_t ts)
 {
 	if (c->sanity_check && clockcheck_sample(c->sanity_check, ts)) {
 		servo_reset(c->servo);
+		clock_trace(c, TRACE_SERVO_RESET, 0, 0.0, tmv_zero(),
+			    tmv_zero(), tmv_zero());
 	}
 }
 
@@ -26,6 +26,7 @@
 #include "notification.h"
 #include "servo.h"
 #include "tlv.h"
+#include "tmq.h"
 #include "tmv.h"
 #include "transport.h"
 
@@ -163,12 +164,20 @@ int clock_gm_capable(struct clock *c);
  */
 struct ClockIdentity clock_identity(struct clock *c);
 
+/**
+ * Obtain the queue holding the timers of a clock's ports.
+ * @param c  The clock instance.
+ * @return   A pointer to the clock's timer queue.
+ */
+struct tmq *clock_tmq(struct clock *c);
+
 /**
  * Informs clock that a file descriptor of one of its ports changed. The
- * clock will rebuild its array of file descriptors to poll.
+ * clock will update the set of descriptors it polls for that port.
  * @param c    The clock instance.
+ * @param p    The port whose descriptors changed.
  */
-void clock_fda_changed(struct clock *c);
+void clock_fda_changed(struct clock *c, struct port *p);
 
 /**
  * Obtains the time of the latest synchronization.
@@ -224,10 +233,26 @@ struct PortIdentity clock_parent_identity(struct clock *c);
  * @param c           The clock instance.
  * @param req         The transmission time of the delay request message.
  * @param rx          The reception time of the delay request message,
- *                    as reported in the delay response message, including
- *                    correction.
+ *                    as reported in the delay response message.
+ * @param corr        The correction field of the delay response message.
+ * @return            Zero if a new path delay was estimated, non-zero
+ *                    otherwise.
+ */
+int clock_path_delay(struct clock *c, tmv_t req, tmv_t rx, tmv_t corr);
+
+/**
+ * Obtain the path delay last estimated by a clock.
+ * @param c  The clock instance.
+ * @return   The mean path delay.
  */
-void clock_path_delay(struct clock *c, tmv_t req, tmv_t rx);
+tmv_t clock_mean_path_delay(struct clock *c);
+
+/**
+ * Obtain the offset from the master last measured by a clock.
+ * @param c  The clock instance.
+ * @return   The offset from the master.
+ */
+tmv_t clock_master_offset(struct clock *c);
 
 /**
  * Provide the estimated peer delay from a slave port.
@@ -280,15 +305,20 @@ int clock_switch_phc(struct clock *c, int phc_index);
  * Provide a data point to synchronize the clock.
  * @param c            The clock instance to synchronize.
  * @param ingress      The ingress time stamp on the sync message.
- * @param origin       The reported transmission time of the sync message,
-                       including any corrections.
- * @param correction1  The correction field of the sync message.
- * @param correction2  The correction field of the follow up message.
- *                     Pass zero in the case of one step operation.
+ * @param origin       The reported transmission time of the sync message.
+ * @param corr         The sum of the correction fields of the sync and
+ *                     follow up messages.
  * @return             The state of the clock's servo.
  */
 enum servo_state clock_synchronize(struct clock *c, tmv_t ingress,
-				   tmv_t origin);
+				   tmv_t origin, tmv_t corr);
+
+/**
+ * Publish the data sets of a clock and the states of its ports in the
+ * status segment, if the clock has one.
+ * @param c  The clock instance.
+ */
+void clock_update_status(struct clock *c);
 
 /**
  * Inform a slaved clock about the master's sync interval.
@@ -29,11 +29,14 @@
 #include "ether.h"
 #include "hash.h"
 #include "print.h"
+#include "sk.h"
+#include "sysoff.h"
 #include "util.h"
 
 enum config_section {
 	GLOBAL_SECTION,
 	PORT_SECTION,
+	UNICAST_TABLE_SECTION,
 	UNKNOWN_SECTION,
 };
 
@@ -133,6 +136,7 @@ static struct config_enum clock_servo_enu[] = {
 	{ "linreg", CLOCK_SERVO_LINREG },
 	{ "ntpshm", CLOCK_SERVO_NTPSHM },
 	{ "nullf",  CLOCK_SERVO_NULLF  },
+	{ "kalman", CLOCK_SERVO_KALMAN },
 	{ NULL, 0 },
 };
 
@@ -154,6 +158,7 @@ static struct config_enum delay_filter_enu[] = {
 	{ "moving_average", FILTER_MOVING_AVERAGE },
 	{ "moving_median",  FILTER_MOVING_MEDIAN  },
 	{ "ewma",  FILTER_EWMA  },
+	{ "moving_percentile", FILTER_MOVING_PERCENTILE },
 	{ NULL, 0 },
 };
 
@@ -171,6 +176,13 @@ static struct config_enum nw_trans_enu[] = {
 	{ NULL, 0 },
 };
 
+static struct config_enum sysoff_est_enu[] = {
+	{ "min_delay", SYSOFF_EST_MIN_DELAY },
+	{ "median",    SYSOFF_EST_MEDIAN    },
+	{ "weighted",  SYSOFF_EST_WEIGHTED  },
+	{ NULL, 0 },
+};
+
 static struct config_enum timestamping_enu[] = {
 	{ "hardware", TS_HARDWARE  },
 	{ "software", TS_SOFTWARE  },
@@ -201,6 +213,7 @@ struct config_item config_tab[] = {
 	PORT_ITEM_INT("delayAsymmetry", 0, INT_MIN, INT_MAX),
 	PORT_ITEM_ENU("delay_filter", FILTER_MOVING_MEDIAN, delay_filter_enu),
 	PORT_ITEM_INT("delay_filter_length", 10, 1, INT_MAX),
+	PORT_ITEM_INT("delay_filter_percentile", 50, 0, 100),
 	PORT_ITEM_ENU("delay_mechanism", DM_E2E, delay_mech_enu),
 	GLOB_ITEM_INT("disable_hires_timestamps", 0, 0, 1),
 	GLOB_ITEM_INT("dscp_event", 0, 0, 63),
@@ -216,6 +229,7 @@ struct config_item config_tab[] = {
 	GLOB_ITEM_INT("G.8275.defaultDS.localPriority", 128, 1, UINT8_MAX),
 	PORT_ITEM_INT("G.8275.portDS.localPriority", 128, 1, UINT8_MAX),
 	GLOB_ITEM_INT("gmCapable", 1, 0, 1),
+	GLOB_ITEM_INT("histogram_summary", 0, 0, 1),
 	PORT_ITEM_INT("hybrid_e2e", 0, 0, 1),
 	PORT_ITEM_INT("ignore_transport_specific", 0, 0, 1),
 	PORT_ITEM_INT("ingressLatency", 0, INT_MIN, INT_MAX),
@@ -225,11 +239,13 @@ struct config_item config_tab[] = {
 	PORT_ITEM_INT("logMinDelayReqInterval", 0, INT8_MIN, INT8_MAX),
 	PORT_ITEM_INT("logMinPdelayReqInterval", 0, INT8_MIN, INT8_MAX),
 	PORT_ITEM_INT("logSyncInterval", 0, INT8_MIN, INT8_MAX),
+	GLOB_ITEM_INT("log_queue_size", 0, 0, 65536),
 	GLOB_ITEM_INT("logging_level", LOG_INFO, PRINT_LEVEL_MIN, PRINT_LEVEL_MAX),
 	PORT_ITEM_INT("masterOnly", 0, 0, 1),
 	GLOB_ITEM_STR("message_tag", NULL),
 	GLOB_ITEM_STR("manufacturerIdentity", "00:00:00"),
 	GLOB_ITEM_INT("max_frequency", 900000000, 0, INT_MAX),
+	GLOB_ITEM_INT("message_pool_high_water", 256, 0, INT_MAX),
 	PORT_ITEM_INT("min_neighbor_prop_delay", -20000000, INT_MIN, -1),
 	PORT_ITEM_INT("neighborPropDelayThresh", 20000000, 0, INT_MAX),
 	PORT_ITEM_INT("net_sync_monitor", 0, 0, 1),
@@ -251,21 +267,31 @@ struct config_item config_tab[] = {
 	PORT_ITEM_STR("ptp_dst_mac", "01:1B:19:00:00:00"),
 	PORT_ITEM_STR("p2p_dst_mac", "01:80:C2:00:00:0E"),
 	GLOB_ITEM_STR("revisionData", ";;"),
+	PORT_ITEM_INT("rx_batch_size", 1, 1, SK_RX_BATCH_MAX),
 	GLOB_ITEM_INT("sanity_freq_limit", 200000000, 0, INT_MAX),
 	GLOB_ITEM_INT("slaveOnly", 0, 0, 1),
 	GLOB_ITEM_DBL("step_threshold", 0.0, 0.0, DBL_MAX),
+	GLOB_ITEM_STR("status_segment", NULL),
 	GLOB_ITEM_INT("summary_interval", 0, INT_MIN, INT_MAX),
 	PORT_ITEM_INT("syncReceiptTimeout", 0, 0, UINT8_MAX),
+	GLOB_ITEM_ENU("sysoff_estimator", SYSOFF_EST_MIN_DELAY, sysoff_est_enu),
 	GLOB_ITEM_INT("tc_spanning_tree", 0, 0, 1),
 	GLOB_ITEM_INT("timeSource", INTERNAL_OSCILLATOR, 0x10, 0xfe),
 	GLOB_ITEM_ENU("time_stamping", TS_HARDWARE, timestamping_enu),
+	GLOB_ITEM_STR("trace_file", NULL),
+	GLOB_ITEM_INT("trace_records", 262144, 16, 16777216),
 	PORT_ITEM_INT("transportSpecific", 0, 0, 0x0F),
 	PORT_ITEM_ENU("tsproc_mode", TSPROC_FILTER, tsproc_enu),
 	GLOB_ITEM_INT("twoStepFlag", 1, 0, 1),
+	GLOB_ITEM_INT("tx_timestamp_deferred", 0, 0, 1),
 	GLOB_ITEM_INT("tx_timestamp_timeout", 1, 1, INT_MAX),
 	PORT_ITEM_INT("udp_ttl", 1, 1, 255),
 	PORT_ITEM_INT("udp6_scope", 0x0E, 0x00, 0x0F),
 	GLOB_ITEM_STR("uds_address", "/var/run/ptp4l"),
+	PORT_ITEM_INT("unicast_listen", 0, 0, 1),
+	PORT_ITEM_INT("unicast_master_table", 0, 0, INT_MAX),
+	PORT_ITEM_INT("unicast_req_duration", 3600, 10, INT_MAX),
+	PORT_ITEM_DBL("update_rate", 1.0, 1e-9, DBL_MAX),
 	GLOB_ITEM_INT("use_syslog", 1, 0, 1),
 	GLOB_ITEM_STR("userDescription", ""),
 	GLOB_ITEM_INT("utc_offset", CURRENT_UTC_OFFSET, 0, INT_MAX),
@@ -346,6 +372,8 @@ static enum parser_result parse_section_line(char *s, enum config_section *secti
 {
 	if (!strcasecmp(s, "[global]")) {
 		*section = GLOBAL_SECTION;
+	} else if (!strcasecmp(s, "[unicast_master_table]")) {
+		*section = UNICAST_TABLE_SECTION;
 	} else if (s[0] == '[') {
 		char c;
 		*section = PORT_SECTION;
@@ -508,6 +536,77 @@ static enum parser_result parse_setting_line(char *line,
 	return PARSED_OK;
 }
 
+static enum parser_result parse_unicast_mtab_line(struct config *cfg,
+						  struct unicast_master_table *table,
+						  const char *option,
+						  const char *value)
+{
+	struct unicast_master_address *address;
+	enum parser_result r;
+	int i;
+
+	if (!strcmp(option, "table_id")) {
+		r = get_ranged_int(value, &i, 1, INT_MAX);
+		if (r != PARSED_OK) {
+			return r;
+		}
+		if (config_unicast_master_table(cfg, i)) {
+			fprintf(stderr, "unicast master table %d is defined "
+				"more than once\n", i);
+			return BAD_VALUE;
+		}
+		table->table_index = i;
+		return PARSED_OK;
+	}
+	if (!strcmp(option, "logQueryInterval")) {
+		r = get_ranged_int(value, &i, -7, 12);
+		if (r == PARSED_OK) {
+			table->logQueryInterval = i;
+		}
+		return r;
+	}
+	for (i = 0; nw_trans_enu[i].label; i++) {
+		if (!strcmp(option, nw_trans_enu[i].label)) {
+			break;
+		}
+	}
+	if (!nw_trans_enu[i].label) {
+		return NOT_PARSED;
+	}
+	address = calloc(1, sizeof(*address));
+	if (!address) {
+		fprintf(stderr, "low memory\n");
+		return BAD_VALUE;
+	}
+	address->type = nw_trans_enu[i].value;
+	if (str2addr(address->type, value, &address->address)) {
+		free(address);
+		return MALFORMED;
+	}
+	STAILQ_INSERT_TAIL(&table->addrs, address, list);
+	table->count++;
+	return PARSED_OK;
+}
+
+static int check_unicast_master_tables(struct config *cfg)
+{
+	struct unicast_master_table *table;
+
+	STAILQ_FOREACH(table, &cfg->unicast_master_tables, list) {
+		if (!table->table_index) {
+			fprintf(stderr, "unicast master table without "
+				"table_id\n");
+			return -1;
+		}
+		if (!table->count) {
+			fprintf(stderr, "unicast master table %d is empty\n",
+				table->table_index);
+			return -1;
+		}
+	}
+	return 0;
+}
+
 static void check_deprecated_options(const char **option)
 {
 	const char *new_option = NULL;
@@ -554,6 +653,7 @@ int config_read(char *name, struct config *cfg)
 	char buf[1024], *line, *c;
 	const char *option, *value;
 	struct interface *current_port = NULL;
+	struct unicast_master_table *current_uc_mtab = NULL;
 	int line_num;
 
 	fp = 0 == strncmp(name, "-", 2) ? stdin : fopen(name, "r");
@@ -592,6 +692,15 @@ int config_read(char *name, struct config *cfg)
 				current_port = config_create_interface(port, cfg);
 				if (!current_port)
 					goto parse_error;
+			} else if (current_section == UNICAST_TABLE_SECTION) {
+				current_uc_mtab = calloc(1, sizeof(*current_uc_mtab));
+				if (!current_uc_mtab) {
+					fprintf(stderr, "low memory\n");
+					goto parse_error;
+				}
+				STAILQ_INIT(&current_uc_mtab->addrs);
+				STAILQ_INSERT_TAIL(&cfg->unicast_master_tables,
+						   current_uc_mtab, list);
 			}
 			continue;
 		}
@@ -601,6 +710,24 @@ int config_read(char *name, struct config *cfg)
 			goto parse_error;
 		}
 
+		if (current_section == UNICAST_TABLE_SECTION) {
+			if (parse_setting_line(line, &option, &value)) {
+				fprintf(stderr, "could not parse line %d in "
+					"unicast_master_table section\n",
+					line_num);
+				goto parse_error;
+			}
+			parser_res = parse_unicast_mtab_line(cfg, current_uc_mtab,
+							     option, value);
+			if (parser_res != PARSED_OK) {
+				fprintf(stderr, "bad option %s at line %d in "
+					"unicast_master_table section\n",
+					option, line_num);
+				goto parse_error;
+			}
+			continue;
+		}
+
 		if (parse_setting_line(line, &option, &value)) {
 			fprintf(stderr, "could not parse line %d in %s section\n",
 				line_num, current_section == GLOBAL_SECTION ?
@@ -638,6 +765,11 @@ int config_read(char *name, struct config *cfg)
 	}
 
 	fclose(fp);
+
+	if (check_unicast_master_tables(cfg)) {
+		fprintf(stderr, "failed to parse configuration file %s\n", name);
+		return -2;
+	}
 	return 0;
 
 parse_error:
@@ -681,6 +813,7 @@ struct config *config_create(void)
 		return NULL;
 	}
 	STAILQ_INIT(&cfg->interfaces);
+	STAILQ_INIT(&cfg->unicast_master_tables);
 
 	cfg->opts = config_alloc_longopts(cfg);
 	if (!cfg->opts) {
@@ -726,12 +859,22 @@ fail:
 
 void config_destroy(struct config *cfg)
 {
+	struct unicast_master_address *address;
+	struct unicast_master_table *table;
 	struct interface *iface;
 
 	while ((iface = STAILQ_FIRST(&cfg->interfaces))) {
 		STAILQ_REMOVE_HEAD(&cfg->interfaces, list);
 		free(iface);
 	}
+	while ((table = STAILQ_FIRST(&cfg->unicast_master_tables))) {
+		while ((address = STAILQ_FIRST(&table->addrs))) {
+			STAILQ_REMOVE_HEAD(&table->addrs, list);
+			free(address);
+		}
+		STAILQ_REMOVE_HEAD(&cfg->unicast_master_tables, list);
+		free(table);
+	}
 	hash_destroy(cfg->htab, config_item_free);
 	free(cfg->opts);
 	free(cfg);
@@ -923,3 +1066,16 @@ int config_set_string(struct config *cfg, const char *option,
 	pr_debug("locked item global.%s as '%s'", option, ci->val.s);
 	return 0;
 }
+
+struct unicast_master_table *config_unicast_master_table(struct config *cfg,
+							 int table_index)
+{
+	struct unicast_master_table *table;
+
+	STAILQ_FOREACH(table, &cfg->unicast_master_tables, list) {
+		if (table->table_index == table_index) {
+			return table;
+		}
+	}
+	return NULL;
+}
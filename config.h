@@ -44,11 +44,30 @@ struct interface {
 	struct sk_ts_info ts_info;
 };
 
+struct unicast_master_address {
+	STAILQ_ENTRY(unicast_master_address) list;
+	enum transport_type type;
+	struct address address;
+};
+
+struct unicast_master_table {
+	STAILQ_ENTRY(unicast_master_table) list;
+	STAILQ_HEAD(addrs_head, unicast_master_address) addrs;
+	int table_index;
+	int count;
+	int logQueryInterval;
+	/* the number of the port using the table, or zero */
+	int port;
+};
+
 struct config {
 	/* configured interfaces */
 	STAILQ_HEAD(interfaces_head, interface) interfaces;
 	int n_interfaces;
 
+	/* configured unicast master tables */
+	STAILQ_HEAD(ucmtab_head, unicast_master_table) unicast_master_tables;
+
 	/* for parsing command line options */
 	struct option *opts;
 
@@ -96,4 +115,7 @@ static inline int config_set_int(struct config *cfg,
 int config_set_string(struct config *cfg, const char *option,
 		      const char *val);
 
+struct unicast_master_table *config_unicast_master_table(struct config *cfg,
+							 int table_index);
+
 #endif
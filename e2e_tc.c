@@ -34,12 +34,12 @@ void e2e_dispatch(struct port *p, enum fsm_event event, int mdiff)
 		return;
 	}
 
-	port_clr_tmo(p->fda.fd[FD_ANNOUNCE_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_RX_TIMER]);
+	port_clr_tmo(port_timer(p, FD_ANNOUNCE_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_RX_TIMER));
 	/* Leave FD_DELAY_TIMER running. */
-	port_clr_tmo(p->fda.fd[FD_QUALIFICATION_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_MANNO_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_TX_TIMER]);
+	port_clr_tmo(port_timer(p, FD_QUALIFICATION_TIMER));
+	port_clr_tmo(port_timer(p, FD_MANNO_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_TX_TIMER));
 
 	/*
 	 * Handle the side effects of the state transition.
@@ -116,6 +116,8 @@ enum fsm_event e2e_event(struct port *p, int fd_index)
 
 	case FD_MANNO_TIMER:
 	case FD_SYNC_TX_TIMER:
+	case FD_UNICAST_SRV_TIMER:
+	case FD_UNICAST_REQ_TIMER:
 		pr_err("unexpected timer expiration");
 		return EV_NONE;
 
@@ -20,13 +20,16 @@
 #ifndef HAVE_FD_H
 #define HAVE_FD_H
 
-#define N_TIMER_FDS 6
+#define N_TIMER_FDS 8
 
 /*
  * The order matters here.  The DELAY timer must appear before the
  * ANNOUNCE and SYNC_RX timers in order to correctly handle the case
  * when the DELAY timer and one of the other two expire during the
  * same call to poll().
+ *
+ * The timers are not descriptors, since they all share the timer
+ * queue of the clock, but their indices still identify them.
  */
 enum {
 	FD_EVENT,
@@ -37,12 +40,17 @@ enum {
 	FD_QUALIFICATION_TIMER,
 	FD_MANNO_TIMER,
 	FD_SYNC_TX_TIMER,
+	FD_UNICAST_SRV_TIMER,
+	FD_UNICAST_REQ_TIMER,
 	FD_RTNL,
 	N_POLLFD,
 };
 
 #define FD_FIRST_TIMER FD_DELAY_TIMER
 
+/* The fault timer has no place in the fdarray, but it needs an index. */
+#define FD_FAULT_TIMER N_POLLFD
+
 struct fdarray {
 	int fd[N_POLLFD];
 };
@@ -22,15 +22,18 @@
 #include "mmedian.h"
 #include "ewma.h"
 
-struct filter *filter_create(enum filter_type type, int length)
+struct filter *filter_create(enum filter_type type, int length,
+			     int percentile)
 {
 	switch (type) {
 	case FILTER_MOVING_AVERAGE:
 		return mave_create(length);
 	case FILTER_MOVING_MEDIAN:
-		return mmedian_create(length);
+		return mmedian_create(length, 50);
 	case FILTER_EWMA:
 		return ewma_create(length);
+	case FILTER_MOVING_PERCENTILE:
+		return mmedian_create(length, percentile);
 	default:
 		return NULL;
 	}
@@ -32,15 +32,19 @@ enum filter_type {
 	FILTER_MOVING_AVERAGE,
 	FILTER_MOVING_MEDIAN,
 	FILTER_EWMA,
+	FILTER_MOVING_PERCENTILE,
 };
 
 /**
  * Create a new instance of a filter.
- * @param type    The type of the filter to create.
- * @param length  The filter's length.
+ * @param type        The type of the filter to create.
+ * @param length      The filter's length.
+ * @param percentile  The percentile returned by FILTER_MOVING_PERCENTILE,
+ *                    ignored by the other types.
  * @return A pointer to a new filter on success, NULL otherwise.
  */
-struct filter *filter_create(enum filter_type type, int length);
+struct filter *filter_create(enum filter_type type, int length,
+			     int percentile);
 
 /**
  * Destroy an instance of a filter.
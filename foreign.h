@@ -33,6 +33,21 @@ struct foreign_clock {
 	 */
 	LIST_ENTRY(foreign_clock) list;
 
+	/**
+	 * Pointer to next foreign_clock holding announce messages.
+	 */
+	LIST_ENTRY(foreign_clock) active_list;
+
+	/**
+	 * Set while the foreign_clock is on the port's active list.
+	 */
+	int active;
+
+	/**
+	 * Set when a message arrived since the data set was last updated.
+	 */
+	int dirty;
+
 	/**
 	 * A list of received announce messages.
 	 *
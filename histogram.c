@@ -0,0 +1,127 @@
+/**
+ * @file histogram.c
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "histogram.h"
+
+/*
+ * Values below 2^SUB_BITS have a bucket each. Above that, every power
+ * of two is split into HALF buckets of equal width, so the width of a
+ * bucket is at most 1/HALF of its values.
+ */
+#define SUB_BITS	6
+#define HALF		(1 << (SUB_BITS - 1))
+#define MAX_BITS	41
+#define MAX_VALUE	((1LL << MAX_BITS) - 1)
+#define N_BUCKETS	((1 << SUB_BITS) + (MAX_BITS - SUB_BITS) * HALF)
+
+struct histogram {
+	uint64_t count;
+	int64_t max;
+	uint32_t bucket[N_BUCKETS];
+};
+
+static int bucket_index(int64_t v)
+{
+	int msb, shift;
+
+	if (v < (1 << SUB_BITS))
+		return v;
+	msb = 63 - __builtin_clzll(v);
+	shift = msb - SUB_BITS + 1;
+	return (1 << SUB_BITS) + (shift - 1) * HALF + (int) (v >> shift) - HALF;
+}
+
+/* Returns the middle of a bucket. */
+static int64_t bucket_value(int i)
+{
+	int64_t low;
+	int shift;
+
+	if (i < (1 << SUB_BITS))
+		return i;
+	i -= 1 << SUB_BITS;
+	shift = i / HALF + 1;
+	low = (int64_t) (i % HALF + HALF) << shift;
+	return low + ((1LL << shift) - 1) / 2;
+}
+
+struct histogram *histogram_create(void)
+{
+	return calloc(1, sizeof(struct histogram));
+}
+
+void histogram_destroy(struct histogram *h)
+{
+	free(h);
+}
+
+void histogram_add(struct histogram *h, int64_t value)
+{
+	uint32_t *b;
+
+	if (value < 0)
+		value = -value;
+	if (value > MAX_VALUE)
+		value = MAX_VALUE;
+	if (value > h->max)
+		h->max = value;
+	b = &h->bucket[bucket_index(value)];
+	if (*b < UINT32_MAX) {
+		(*b)++;
+		h->count++;
+	}
+}
+
+uint64_t histogram_count(struct histogram *h)
+{
+	return h->count;
+}
+
+int64_t histogram_max(struct histogram *h)
+{
+	return h->max;
+}
+
+int64_t histogram_percentile(struct histogram *h, double p)
+{
+	uint64_t rank, sum = 0;
+	int64_t v;
+	int i;
+
+	if (!h->count)
+		return 0;
+	rank = ceil(p / 100.0 * h->count);
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < N_BUCKETS; i++) {
+		sum += h->bucket[i];
+		if (sum >= rank)
+			break;
+	}
+	v = bucket_value(i < N_BUCKETS ? i : N_BUCKETS - 1);
+	return v < h->max ? v : h->max;
+}
+
+void histogram_reset(struct histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+}
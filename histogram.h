@@ -0,0 +1,78 @@
+/**
+ * @file histogram.h
+ * @brief Implements a log-linear histogram for tail statistics.
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_HISTOGRAM_H
+#define HAVE_HISTOGRAM_H
+
+#include <stdint.h>
+
+/** Opaque type */
+struct histogram;
+
+/**
+ * Create a new histogram. The histogram has a fixed size. Values below
+ * 64 are counted exactly, larger values with a relative error of at
+ * most 1.6 percent, and values above about 10^12 in the last bucket.
+ * @return A pointer to a new histogram on success, NULL otherwise.
+ */
+struct histogram *histogram_create(void);
+
+/**
+ * Destroy a histogram.
+ * @param h  Pointer to a histogram obtained via @ref histogram_create().
+ */
+void histogram_destroy(struct histogram *h);
+
+/**
+ * Add a value to a histogram. Negative values are counted by their
+ * magnitude.
+ * @param h      Pointer to a histogram obtained via @ref histogram_create().
+ * @param value  The measured value.
+ */
+void histogram_add(struct histogram *h, int64_t value);
+
+/**
+ * Get the number of values added to a histogram.
+ * @param h  Pointer to a histogram obtained via @ref histogram_create().
+ * @return   The number of values.
+ */
+uint64_t histogram_count(struct histogram *h);
+
+/**
+ * Get the largest value added to a histogram.
+ * @param h  Pointer to a histogram obtained via @ref histogram_create().
+ * @return   The largest magnitude added, zero if the histogram is empty.
+ */
+int64_t histogram_max(struct histogram *h);
+
+/**
+ * Estimate a percentile of the values added to a histogram.
+ * @param h  Pointer to a histogram obtained via @ref histogram_create().
+ * @param p  The percentile, between 0 and 100.
+ * @return   The estimated value, zero if the histogram is empty.
+ */
+int64_t histogram_percentile(struct histogram *h, double p);
+
+/**
+ * Remove all values from a histogram.
+ * @param h  Pointer to a histogram obtained via @ref histogram_create().
+ */
+void histogram_reset(struct histogram *h);
+
+#endif
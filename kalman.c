@@ -0,0 +1,380 @@
+/**
+ * @file kalman.c
+ * @brief Implements a clock servo based on a Kalman filter.
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <math.h>
+#include <stdlib.h>
+
+#include "kalman.h"
+#include "print.h"
+#include "servo_private.h"
+
+/* The state is the phase (ns), frequency (ppb) and drift (ppb/s) */
+#define N_STATES 3
+
+/* Initial variance of the measured offset in ns^2 */
+#define HWTS_MEAS_VAR 100.0
+#define SWTS_MEAS_VAR 1e6
+/* Initial spectral densities of the white FM in ns^2/s and RWFM in ppb^2/s */
+#define INIT_WFM 1.0
+#define INIT_RWFM 1.0
+/* Initial variances of the frequency and drift */
+#define INIT_FREQ_VAR 1e10
+#define INIT_DRIFT_VAR 100.0
+
+/* Lower limits of the estimated noises */
+#define MIN_MEAS_VAR 1.0
+#define MIN_WFM 1e-3
+#define MIN_RWFM 1e-6
+/* Spectral density of the drift noise relative to the RWFM, in 1/s^2 */
+#define DRIFT_NOISE_RATIO 1e-4
+
+/* Part of the estimated offset corrected in one update interval */
+#define PHASE_GAIN 0.5
+
+/* Innovations larger than this many standard deviations are outliers */
+#define OUTLIER_SIGMAS 5.0
+/* Number of consecutive outliers that restart the estimation */
+#define MAX_OUTLIERS 3
+
+/* The Allan variances are measured over 1, 8 and 64 intervals */
+#define N_ADEV 3
+#define ADEV_MAX_M 64
+#define PHASE_HISTORY (2 * ADEV_MAX_M + 1)
+/* Number of initial Allan variance updates with equal weight */
+#define ADEV_INITIAL_UPDATES 1024
+/* Weight of new updates of the Allan variances */
+#define ADEV_SMOOTH (1.0 / 1024)
+/* Number of updates before the Allan variances are trusted */
+#define ADEV_MIN_UPDATES 16
+
+static const int adev_m[N_ADEV] = { 1, 8, 64 };
+
+struct kalman_servo {
+	struct servo servo;
+	/* State estimate and its covariance */
+	double x[N_STATES];
+	double p[N_STATES][N_STATES];
+	/* Variance of the measured offset */
+	double r;
+	/* Spectral densities of the white FM and the random walk FM */
+	double q1;
+	double q2;
+	/* Frequency applied to the clock since the last sample */
+	double applied;
+	/* Time stamp of the last sample */
+	uint64_t last_ts;
+	/* Nominal interval between samples in seconds */
+	double interval;
+	/* Number of samples since the start of the estimation */
+	int count;
+	int outliers;
+	/* Phase of the unadjusted clock, for the Allan variances */
+	double phase[PHASE_HISTORY];
+	int phase_index;
+	int phase_count;
+	/* Sum of the phase corrections applied to the clock */
+	double correction;
+	/* Allan variances over adev_m intervals, in ppb^2 */
+	double avar[N_ADEV];
+	int avar_updates;
+};
+
+static void kalman_destroy(struct servo *servo)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+	free(s);
+}
+
+static void kalman_init(struct kalman_servo *s, double offset,
+			double freq_var)
+{
+	int i, j;
+
+	for (i = 0; i < N_STATES; i++)
+		for (j = 0; j < N_STATES; j++)
+			s->p[i][j] = 0.0;
+
+	s->x[0] = offset;
+	s->x[1] = s->applied;
+	s->x[2] = 0.0;
+	s->p[0][0] = s->r;
+	s->p[1][1] = freq_var;
+	s->p[2][2] = INIT_DRIFT_VAR;
+	s->count = 1;
+	s->outliers = 0;
+	s->phase_count = 0;
+}
+
+/*
+ * Propagate the estimate over tau seconds, in which the clock ran with
+ * the applied frequency. The noise is the usual model of a clock driven
+ * by random walk FM and a random walk of the drift.
+ */
+static void kalman_predict(struct kalman_servo *s, double tau)
+{
+	double f[N_STATES][N_STATES] = {
+		{ 1.0, tau, tau * tau / 2.0 },
+		{ 0.0, 1.0, tau },
+		{ 0.0, 0.0, 1.0 },
+	};
+	double fp[N_STATES][N_STATES], q1, q2, q3, t2, t3;
+	int i, j, k;
+
+	s->x[0] += (s->x[1] - s->applied) * tau + s->x[2] * tau * tau / 2.0;
+	s->x[1] += s->x[2] * tau;
+
+	for (i = 0; i < N_STATES; i++) {
+		for (j = 0; j < N_STATES; j++) {
+			fp[i][j] = 0.0;
+			for (k = 0; k < N_STATES; k++)
+				fp[i][j] += f[i][k] * s->p[k][j];
+		}
+	}
+	for (i = 0; i < N_STATES; i++) {
+		for (j = 0; j < N_STATES; j++) {
+			s->p[i][j] = 0.0;
+			for (k = 0; k < N_STATES; k++)
+				s->p[i][j] += fp[i][k] * f[j][k];
+		}
+	}
+
+	q1 = s->q1;
+	q2 = s->q2;
+	q3 = s->q2 * DRIFT_NOISE_RATIO;
+	t2 = tau * tau;
+	t3 = t2 * tau;
+	s->p[0][0] += q1 * tau + q2 * t3 / 3.0 + q3 * t3 * t2 / 20.0;
+	s->p[0][1] += q2 * t2 / 2.0 + q3 * t2 * t2 / 8.0;
+	s->p[0][2] += q3 * t3 / 6.0;
+	s->p[1][1] += q2 * tau + q3 * t3 / 3.0;
+	s->p[1][2] += q3 * t2 / 2.0;
+	s->p[2][2] += q3 * tau;
+	s->p[1][0] = s->p[0][1];
+	s->p[2][0] = s->p[0][2];
+	s->p[2][1] = s->p[1][2];
+}
+
+static void kalman_correct(struct kalman_servo *s, double innovation,
+			   double var)
+{
+	double k[N_STATES], p0[N_STATES];
+	int i, j;
+
+	for (i = 0; i < N_STATES; i++) {
+		p0[i] = s->p[0][i];
+		k[i] = s->p[i][0] / var;
+	}
+	for (i = 0; i < N_STATES; i++) {
+		s->x[i] += k[i] * innovation;
+		for (j = 0; j < N_STATES; j++)
+			s->p[i][j] -= k[i] * p0[j];
+	}
+	for (i = 0; i < N_STATES; i++)
+		for (j = 0; j < i; j++)
+			s->p[i][j] = s->p[j][i] = (s->p[i][j] + s->p[j][i]) / 2.0;
+}
+
+static double phase_at(struct kalman_servo *s, int age)
+{
+	return s->phase[(s->phase_index + PHASE_HISTORY - age) % PHASE_HISTORY];
+}
+
+static void avar_update(double *avar, double sample, int updates)
+{
+	if (updates < ADEV_INITIAL_UPDATES)
+		*avar = (*avar * updates + sample) / (updates + 1);
+	else
+		*avar += ADEV_SMOOTH * (sample - *avar);
+}
+
+static double det3(double m[N_ADEV][N_ADEV])
+{
+	return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+		m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+		m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+}
+
+/*
+ * Track the Allan variance of the unadjusted clock over 1, 8 and 64
+ * sample intervals, and fit the variance of the white phase noise of the
+ * measurements and the densities of the white and random walk FM to them:
+ *
+ *   avar(tau) = 3 r / tau^2 + q1 / tau + q2 tau / 3
+ */
+static void kalman_adapt(struct kalman_servo *s, double offset)
+{
+	double a[N_ADEV][N_ADEV], m[N_ADEV][N_ADEV], d, det, tau, v[N_ADEV];
+	int i, j, k;
+
+	s->phase_index = (s->phase_index + 1) % PHASE_HISTORY;
+	s->phase[s->phase_index] = offset + s->correction;
+	if (s->phase_count < PHASE_HISTORY) {
+		s->phase_count++;
+		return;
+	}
+
+	for (i = 0; i < N_ADEV; i++) {
+		tau = adev_m[i] * s->interval;
+		d = phase_at(s, 0) - 2.0 * phase_at(s, adev_m[i]) +
+			phase_at(s, 2 * adev_m[i]);
+		avar_update(&s->avar[i], d * d / (2.0 * tau * tau),
+			    s->avar_updates);
+		a[i][0] = 3.0 / (tau * tau);
+		a[i][1] = 1.0 / tau;
+		a[i][2] = tau / 3.0;
+	}
+	s->avar_updates++;
+
+	if (s->avar_updates < ADEV_MIN_UPDATES)
+		return;
+
+	det = det3(a);
+	for (k = 0; k < N_ADEV; k++) {
+		for (i = 0; i < N_ADEV; i++)
+			for (j = 0; j < N_ADEV; j++)
+				m[i][j] = j == k ? s->avar[i] : a[i][j];
+		v[k] = det3(m) / det;
+	}
+	s->r = v[0] > MIN_MEAS_VAR ? v[0] : MIN_MEAS_VAR;
+	s->q1 = v[1] > MIN_WFM ? v[1] : MIN_WFM;
+	s->q2 = v[2] > MIN_RWFM ? v[2] : MIN_RWFM;
+}
+
+static double kalman_sample(struct servo *servo,
+			    double offset,
+			    uint64_t local_ts,
+			    double weight,
+			    enum servo_state *state)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+	double innovation, tau, var, ppb;
+
+	*state = SERVO_UNLOCKED;
+
+	if (!s->count) {
+		kalman_init(s, offset, INIT_FREQ_VAR);
+		s->last_ts = local_ts;
+		kalman_adapt(s, offset);
+		return s->applied;
+	}
+
+	tau = local_ts > s->last_ts ? (local_ts - s->last_ts) / 1e9 :
+		s->interval;
+	s->last_ts = local_ts;
+	s->correction += s->applied * tau;
+
+	kalman_predict(s, tau);
+
+	innovation = offset - s->x[0];
+	var = s->p[0][0] + (weight > 0.0 ? s->r / weight : s->r);
+
+	if (s->count > 1 && servo->step_threshold &&
+	    servo->step_threshold < fabs(offset)) {
+		/* Start over, the clock will be stepped on the next sample. */
+		kalman_init(s, offset, s->p[1][1]);
+		kalman_adapt(s, offset);
+		return s->applied;
+	}
+
+	if (s->count > 1 &&
+	    innovation * innovation > OUTLIER_SIGMAS * OUTLIER_SIGMAS * var) {
+		if (++s->outliers < MAX_OUTLIERS) {
+			pr_debug("kalman: outlier offset %.0f innovation %.0f",
+				 offset, innovation);
+			kalman_adapt(s, offset);
+			return s->applied;
+		}
+		/*
+		 * The master or the path to it changed. Keep the frequency,
+		 * but with enough uncertainty to follow a new one quickly.
+		 */
+		pr_debug("kalman: restarting on offset %.0f", offset);
+		kalman_init(s, offset,
+			    s->p[1][1] + innovation * innovation / (tau * tau));
+		kalman_adapt(s, offset);
+		return s->applied;
+	}
+	s->outliers = 0;
+
+	kalman_correct(s, innovation, var);
+	kalman_adapt(s, offset);
+
+	pr_debug("kalman: offset %.0f freq %.3f drift %.6f r %.1f q %.3f %.6f",
+		 s->x[0], s->x[1], s->x[2], s->r, s->q1, s->q2);
+
+	if (s->count++ == 1 &&
+	    ((servo->first_update &&
+	      servo->first_step_threshold &&
+	      servo->first_step_threshold < fabs(s->x[0])) ||
+	     (servo->step_threshold &&
+	      servo->step_threshold < fabs(s->x[0])))) {
+		/* The clock will be stepped by offset */
+		s->x[0] -= offset;
+		s->correction += offset;
+		*state = SERVO_JUMP;
+	} else {
+		*state = SERVO_LOCKED;
+	}
+
+	ppb = s->x[1] + s->x[2] * s->interval +
+		PHASE_GAIN * s->x[0] / s->interval;
+	if (ppb < -servo->max_frequency)
+		ppb = -servo->max_frequency;
+	else if (ppb > servo->max_frequency)
+		ppb = servo->max_frequency;
+
+	s->applied = ppb;
+	return ppb;
+}
+
+static void kalman_sync_interval(struct servo *servo, double interval)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	s->interval = interval;
+}
+
+static void kalman_reset(struct servo *servo)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	s->count = 0;
+}
+
+struct servo *kalman_servo_create(int fadj, int sw_ts)
+{
+	struct kalman_servo *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->servo.destroy = kalman_destroy;
+	s->servo.sample = kalman_sample;
+	s->servo.sync_interval = kalman_sync_interval;
+	s->servo.reset = kalman_reset;
+
+	s->applied = fadj;
+	s->interval = 1.0;
+	s->r = sw_ts ? SWTS_MEAS_VAR : HWTS_MEAS_VAR;
+	s->q1 = INIT_WFM;
+	s->q2 = INIT_RWFM;
+
+	return &s->servo;
+}
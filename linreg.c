@@ -45,6 +45,25 @@ struct point {
 	double w;
 };
 
+/* Sum with compensation for the rounding errors of the additions */
+struct ksum {
+	double sum;
+	double comp;
+};
+
+/* Weighted sums of the newest points, relative to an origin */
+struct sums {
+	/* Newest point when the sums were last computed from scratch */
+	struct point origin;
+	/* Number of points added since then */
+	unsigned int age;
+	struct ksum w;
+	struct ksum x;
+	struct ksum y;
+	struct ksum xy;
+	struct ksum x2;
+};
+
 struct result {
 	/* Slope and intercept from latest regression */
 	double slope;
@@ -61,6 +80,8 @@ struct linreg_servo {
 	struct point points[MAX_POINTS];
 	/* Current time in x, y */
 	struct point reference;
+	/* Sums of the newest points for all sizes */
+	struct sums sums[MAX_SIZE - MIN_SIZE + 1];
 	/* Number of stored points */
 	unsigned int num_points;
 	/* Index of the newest point */
@@ -123,8 +144,73 @@ static void update_reference(struct linreg_servo *s, uint64_t local_ts)
 	s->last_update = local_ts;
 }
 
+static void ksum_add(struct ksum *k, double v)
+{
+	double t = k->sum + v;
+
+	if (fabs(k->sum) >= fabs(v))
+		k->comp += (k->sum - t) + v;
+	else
+		k->comp += (v - t) + k->sum;
+	k->sum = t;
+}
+
+static double ksum_get(struct ksum *k)
+{
+	return k->sum + k->comp;
+}
+
+static void sums_add(struct sums *m, struct point *p, double sign)
+{
+	double x, y, w;
+
+	x = (int64_t)(p->x - m->origin.x);
+	y = (int64_t)(p->y - m->origin.y);
+	w = sign * p->w;
+
+	ksum_add(&m->w, w);
+	ksum_add(&m->x, x * w);
+	ksum_add(&m->y, y * w);
+	ksum_add(&m->xy, x * y * w);
+	ksum_add(&m->x2, x * x * w);
+}
+
+/*
+ * Compute the sums of a size from scratch around the newest point. Doing
+ * this once per n added points keeps the coordinates small and drops the
+ * rounding errors accumulated by removing points, at an amortized cost of
+ * one point per sample.
+ */
+static void compute_sums(struct linreg_servo *s, struct sums *m,
+			 unsigned int n)
+{
+	unsigned int i, l;
+
+	memset(m, 0, sizeof(*m));
+	m->origin = s->points[s->last_point];
+
+	for (i = 0; i < n && i < s->num_points; i++) {
+		/* Iterate points from newest to oldest */
+		l = (MAX_POINTS + s->last_point - i) % MAX_POINTS;
+		sums_add(m, &s->points[l], 1.0);
+	}
+}
+
 static void add_sample(struct linreg_servo *s, int64_t offset, double weight)
 {
+	unsigned int n, size;
+	struct sums *m;
+
+	/* Remove the oldest point from the sums of the full sizes */
+	for (size = MIN_SIZE; size <= MAX_SIZE; size++) {
+		n = 1 << size;
+		if (n > s->num_points)
+			break;
+		sums_add(&s->sums[size - MIN_SIZE],
+			 &s->points[(s->last_point + MAX_POINTS + 1 - n) %
+				    MAX_POINTS], -1.0);
+	}
+
 	s->last_point = (s->last_point + 1) % MAX_POINTS;
 
 	s->points[s->last_point].x = s->reference.x;
@@ -133,16 +219,23 @@ static void add_sample(struct linreg_servo *s, int64_t offset, double weight)
 
 	if (s->num_points < MAX_POINTS)
 		s->num_points++;
+
+	for (size = MIN_SIZE; size <= MAX_SIZE; size++) {
+		n = 1 << size;
+		m = &s->sums[size - MIN_SIZE];
+		if (s->num_points == 1 || ++m->age >= n)
+			compute_sums(s, m, n);
+		else
+			sums_add(m, &s->points[s->last_point], 1.0);
+	}
 }
 
 static void regress(struct linreg_servo *s)
 {
-	double x, y, y0, e, x_sum, y_sum, xy_sum, x2_sum, w, w_sum;
-	unsigned int i, l, n, size;
+	double ref_x, ref_y, y0, e, x_mean, y_mean, xy_mean, x2_mean, w_sum;
+	unsigned int n, size;
 	struct result *res;
-
-	x_sum = 0.0, y_sum = 0.0, xy_sum = 0.0, x2_sum = 0.0; w_sum = 0.0;
-	i = 0;
+	struct sums *m;
 
 	y0 = (int64_t)(s->points[s->last_point].y - s->reference.y);
 
@@ -167,25 +260,22 @@ static void regress(struct linreg_servo *s)
 			}
 		}
 
-		for (; i < n; i++) {
-			/* Iterate points from newest to oldest */
-			l = (MAX_POINTS + s->last_point - i) % MAX_POINTS;
+		m = &s->sums[size - MIN_SIZE];
 
-			x = (int64_t)(s->points[l].x - s->reference.x);
-			y = (int64_t)(s->points[l].y - s->reference.y);
-			w = s->points[l].w;
+		/* Position of the reference relative to the origin */
+		ref_x = (int64_t)(s->reference.x - m->origin.x);
+		ref_y = (int64_t)(s->reference.y - m->origin.y);
 
-			x_sum += x * w;
-			y_sum += y * w;
-			xy_sum += x * y * w;
-			x2_sum += x * x * w;
-			w_sum += w;
-		}
+		w_sum = ksum_get(&m->w);
+		x_mean = ksum_get(&m->x) / w_sum;
+		y_mean = ksum_get(&m->y) / w_sum;
+		xy_mean = ksum_get(&m->xy) / w_sum;
+		x2_mean = ksum_get(&m->x2) / w_sum;
 
 		/* Get new intercept and slope */
-		res->slope = (xy_sum - x_sum * y_sum / w_sum) /
-				(x2_sum - x_sum * x_sum / w_sum);
-		res->intercept = (y_sum - res->slope * x_sum) / w_sum;
+		res->slope = (xy_mean - x_mean * y_mean) /
+				(x2_mean - x_mean * x_mean);
+		res->intercept = y_mean - ref_y - res->slope * (x_mean - ref_x);
 	}
 }
 
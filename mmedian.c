@@ -22,21 +22,114 @@
 #include "mmedian.h"
 #include "filter_private.h"
 
+/*
+ * The samples are split at the requested rank into a max-heap holding
+ * the lower part and a min-heap holding the upper part, so the result
+ * is found at the tops of the heaps. Each sample remembers its heap and
+ * its position there, so the sample leaving the window is removed
+ * directly, and every sample costs O(log n).
+ */
+struct mheap {
+	/* Indices of the samples in heap order. */
+	int *order;
+	int len;
+	/* 1 for a min-heap, -1 for a max-heap. */
+	int sign;
+};
+
 struct mmedian {
 	struct filter filter;
 	int cnt;
 	int len;
 	int index;
-	/* Indices sorted by value. */
-	int *order;
+	int percentile;
+	struct mheap low;
+	struct mheap high;
+	/* Heap and position in the heap of each sample. */
+	struct mheap **heap;
+	int *pos;
 	/* Values stored in circular buffer. */
 	tmv_t *samples;
 };
 
+static int mheap_before(struct mmedian *m, struct mheap *h, int a, int b)
+{
+	return h->sign * tmv_cmp(m->samples[a], m->samples[b]) < 0;
+}
+
+static void mheap_place(struct mmedian *m, struct mheap *h, int sample, int i)
+{
+	h->order[i] = sample;
+	m->heap[sample] = h;
+	m->pos[sample] = i;
+}
+
+static void mheap_sift_up(struct mmedian *m, struct mheap *h, int i)
+{
+	int parent, sample = h->order[i];
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!mheap_before(m, h, sample, h->order[parent]))
+			break;
+		mheap_place(m, h, h->order[parent], i);
+		i = parent;
+	}
+	mheap_place(m, h, sample, i);
+}
+
+static void mheap_sift_down(struct mmedian *m, struct mheap *h, int i)
+{
+	int child, sample = h->order[i];
+
+	while ((child = 2 * i + 1) < h->len) {
+		if (child + 1 < h->len &&
+		    mheap_before(m, h, h->order[child + 1], h->order[child]))
+			child++;
+		if (!mheap_before(m, h, h->order[child], sample))
+			break;
+		mheap_place(m, h, h->order[child], i);
+		i = child;
+	}
+	mheap_place(m, h, sample, i);
+}
+
+static void mheap_push(struct mmedian *m, struct mheap *h, int sample)
+{
+	mheap_place(m, h, sample, h->len++);
+	mheap_sift_up(m, h, h->len - 1);
+}
+
+static void mheap_remove(struct mmedian *m, int sample)
+{
+	struct mheap *h = m->heap[sample];
+	int i = m->pos[sample], last;
+
+	last = h->order[--h->len];
+	if (last == sample)
+		return;
+	mheap_place(m, h, last, i);
+	if (i > 0 && mheap_before(m, h, last, h->order[(i - 1) / 2]))
+		mheap_sift_up(m, h, i);
+	else
+		mheap_sift_down(m, h, i);
+}
+
+static int mheap_pop(struct mmedian *m, struct mheap *h)
+{
+	int top = h->order[0];
+
+	mheap_remove(m, top);
+	return top;
+}
+
 static void mmedian_destroy(struct filter *filter)
 {
 	struct mmedian *m = container_of(filter, struct mmedian, filter);
-	free(m->order);
+	free(m->low.order);
+	free(m->high.order);
+	free(m->heap);
+	free(m->pos);
 	free(m->samples);
 	free(m);
 }
@@ -44,36 +137,43 @@ static void mmedian_destroy(struct filter *filter)
 static tmv_t mmedian_sample(struct filter *filter, tmv_t sample)
 {
 	struct mmedian *m = container_of(filter, struct mmedian, filter);
-	int i;
+	int rank, rem;
+	tmv_t lo, hi;
 
-	m->samples[m->index] = sample;
-	if (m->cnt < m->len) {
+	if (m->cnt < m->len)
 		m->cnt++;
-	} else {
-		/* Remove index of the replaced value from order. */
-		for (i = 0; i < m->cnt; i++)
-			if (m->order[i] == m->index)
-				break;
-		for (; i + 1 < m->cnt; i++)
-			m->order[i] = m->order[i + 1];
-	}
+	else
+		/* Remove the replaced value from its heap. */
+		mheap_remove(m, m->index);
 
-	/* Insert index of the new value to order. */
-	for (i = m->cnt - 1; i > 0; i--) {
-		if (tmv_cmp(m->samples[m->order[i - 1]],
-			    m->samples[m->index]) <= 0)
-			break;
-		m->order[i] = m->order[i - 1];
-	}
-	m->order[i] = m->index;
+	m->samples[m->index] = sample;
+	if (m->low.len && tmv_cmp(sample, m->samples[m->low.order[0]]) < 0)
+		mheap_push(m, &m->low, m->index);
+	else
+		mheap_push(m, &m->high, m->index);
 
 	m->index = (1 + m->index) % m->len;
 
-	if (m->cnt % 2)
-		return m->samples[m->order[m->cnt / 2]];
-	else
-		return tmv_div(tmv_add(m->samples[m->order[m->cnt / 2 - 1]],
-				       m->samples[m->order[m->cnt / 2]]), 2);
+	/*
+	 * The percentile lies between the samples of rank 'rank' and
+	 * 'rank + 1', counting from zero. Move samples between the heaps
+	 * until the lower one holds exactly the samples up to 'rank'.
+	 */
+	rank = m->percentile * (m->cnt - 1) / 100;
+	rem = m->percentile * (m->cnt - 1) % 100;
+
+	while (m->low.len > rank + 1)
+		mheap_push(m, &m->high, mheap_pop(m, &m->low));
+	while (m->low.len < rank + 1)
+		mheap_push(m, &m->low, mheap_pop(m, &m->high));
+
+	lo = m->samples[m->low.order[0]];
+	if (!rem)
+		return lo;
+	hi = m->samples[m->high.order[0]];
+	if (2 * rem == 100)
+		return tmv_div(tmv_add(lo, hi), 2);
+	return tmv_add(lo, dbl_tmv(tmv_dbl(tmv_sub(hi, lo)) * rem / 100));
 }
 
 static void mmedian_reset(struct filter *filter)
@@ -81,13 +181,15 @@ static void mmedian_reset(struct filter *filter)
 	struct mmedian *m = container_of(filter, struct mmedian, filter);
 	m->cnt = 0;
 	m->index = 0;
+	m->low.len = 0;
+	m->high.len = 0;
 }
 
-struct filter *mmedian_create(int length)
+struct filter *mmedian_create(int length, int percentile)
 {
 	struct mmedian *m;
 
-	if (length < 1)
+	if (length < 1 || percentile < 0 || percentile > 100)
 		return NULL;
 	m = calloc(1, sizeof(*m));
 	if (!m)
@@ -95,17 +197,19 @@ struct filter *mmedian_create(int length)
 	m->filter.destroy = mmedian_destroy;
 	m->filter.sample = mmedian_sample;
 	m->filter.reset = mmedian_reset;
-	m->order = calloc(1, length * sizeof(*m->order));
-	if (!m->order) {
-		free(m);
-		return NULL;
-	}
-	m->samples = calloc(1, length * sizeof(*m->samples));
-	if (!m->samples) {
-		free(m->order);
-		free(m);
+	m->low.order = calloc(length, sizeof(*m->low.order));
+	m->high.order = calloc(length, sizeof(*m->high.order));
+	m->heap = calloc(length, sizeof(*m->heap));
+	m->pos = calloc(length, sizeof(*m->pos));
+	m->samples = calloc(length, sizeof(*m->samples));
+	if (!m->low.order || !m->high.order || !m->heap || !m->pos ||
+	    !m->samples) {
+		mmedian_destroy(&m->filter);
 		return NULL;
 	}
+	m->low.sign = -1;
+	m->high.sign = 1;
 	m->len = length;
+	m->percentile = percentile;
 	return &m->filter;
 }
@@ -1,6 +1,6 @@
 /**
  * @file mmedian.h
- * @brief Implements a moving median.
+ * @brief Implements a moving median and a moving percentile.
  * @note Copyright (C) 2013 Miroslav Lichvar <mlichvar@redhat.com>
  *
  * This program is free software; you can redistribute it and/or modify
@@ -22,6 +22,14 @@
 
 #include "filter.h"
 
-struct filter *mmedian_create(int length);
+/**
+ * Create a filter returning a percentile of the most recent samples.
+ * @param length      The number of samples considered.
+ * @param percentile  The percentile to return, from 0 to 100. Ranks
+ *                    falling between two samples are interpolated, so
+ *                    50 gives the median.
+ * @return A pointer to a new filter on success, NULL otherwise.
+ */
+struct filter *mmedian_create(int length, int percentile);
 
 #endif
@@ -19,8 +19,11 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <malloc.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/queue.h>
 
 #include <asm/byteorder.h>
 
@@ -39,31 +42,236 @@ int assume_two_step = 0;
  */
 #define MSG_HEADROOM 24
 
+/* The number of messages allocated together. */
+#define MSG_SLAB_SIZE 32
+
+struct msg_slab;
+
 struct message_storage {
+	struct msg_slab *slab;
+	struct message_storage *next; /* on the remote free stack */
 	unsigned char reserved[MSG_HEADROOM];
 	struct ptp_message msg;
-} PACKED;
+};
+
+struct msg_slab {
+	struct message_storage storage[MSG_SLAB_SIZE];
+	LIST_ENTRY(msg_slab) list;
+	struct msg_cache *cache;
+	int nfree;
+};
+
+/*
+ * Each thread allocates from a cache of its own. A message released by
+ * another thread is pushed onto the owner's remote stack without a
+ * lock, and the owner takes the whole stack back once its free list
+ * runs dry.
+ *
+ * When its thread exits, a cache closes the remote stack with
+ * MSG_REMOTE_DEAD and lives on for as long as any of its messages are
+ * still held elsewhere. They are then returned under msg_orphan_lock,
+ * and the last one to come back releases the cache.
+ */
+struct msg_cache {
+	TAILQ_HEAD(msg_pool, ptp_message) pool;
+	LIST_HEAD(msg_slabs, msg_slab) slabs;
+	struct message_storage *remote;
+	struct msg_pool_stats stats;
+};
 
-static TAILQ_HEAD(msg_pool, ptp_message) msg_pool = TAILQ_HEAD_INITIALIZER(msg_pool);
+#define MSG_REMOTE_DEAD ((struct message_storage *) 1)
 
-static struct {
-	int total;
-	int count;
-} pool_stats;
+static __thread struct msg_cache *msg_cache;
+static pthread_key_t msg_cache_key;
+static pthread_once_t msg_cache_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t msg_orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int msg_high_water = 256;
 
 #ifdef DEBUG_POOL
-static void pool_debug(const char *str, void *addr)
+static void pool_debug(struct msg_cache *c, const char *str, void *addr)
 {
-	fprintf(stderr, "*** %p %10s total %d count %d used %d\n",
-		addr, str, pool_stats.total, pool_stats.count,
-		pool_stats.total - pool_stats.count);
+	fprintf(stderr, "*** %p %10s slabs %d free %d used %d\n",
+		addr, str, c->stats.slabs, c->stats.free, c->stats.in_use);
 }
 #else
-static void pool_debug(const char *str, void *addr)
+static void pool_debug(struct msg_cache *c, const char *str, void *addr)
 {
 }
 #endif
 
+static void msg_cache_release(void *arg);
+
+static void msg_cache_key_create(void)
+{
+	if (pthread_key_create(&msg_cache_key, msg_cache_release)) {
+		pr_err("failed to create the message cache key");
+	}
+}
+
+static struct msg_cache *msg_cache_get(void)
+{
+	struct msg_cache *c = msg_cache;
+
+	if (c) {
+		return c;
+	}
+	pthread_once(&msg_cache_once, msg_cache_key_create);
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		return NULL;
+	}
+	TAILQ_INIT(&c->pool);
+	LIST_INIT(&c->slabs);
+	pthread_setspecific(msg_cache_key, c);
+	msg_cache = c;
+	return c;
+}
+
+static int msg_slab_create(struct msg_cache *c)
+{
+	struct msg_slab *slab;
+	int i;
+
+	slab = malloc(sizeof(*slab));
+	if (!slab) {
+		return -1;
+	}
+	slab->cache = c;
+	slab->nfree = MSG_SLAB_SIZE;
+	for (i = 0; i < MSG_SLAB_SIZE; i++) {
+		slab->storage[i].slab = slab;
+		TAILQ_INSERT_TAIL(&c->pool, &slab->storage[i].msg, list);
+	}
+	LIST_INSERT_HEAD(&c->slabs, slab, list);
+	c->stats.slabs++;
+	c->stats.free += MSG_SLAB_SIZE;
+	pool_debug(c, "allocate", slab);
+	return 0;
+}
+
+static void msg_slab_destroy(struct msg_cache *c, struct msg_slab *slab)
+{
+	int i;
+
+	for (i = 0; i < MSG_SLAB_SIZE; i++) {
+		TAILQ_REMOVE(&c->pool, &slab->storage[i].msg, list);
+	}
+	LIST_REMOVE(slab, list);
+	c->stats.slabs--;
+	c->stats.free -= MSG_SLAB_SIZE;
+	pool_debug(c, "release", slab);
+	free(slab);
+}
+
+/* Messages still in use keep their slab alive. */
+static void msg_slab_trim(struct msg_cache *c)
+{
+	struct msg_slab *slab, *next;
+
+	for (slab = LIST_FIRST(&c->slabs); slab; slab = next) {
+		next = LIST_NEXT(slab, list);
+		if (slab->nfree == MSG_SLAB_SIZE) {
+			msg_slab_destroy(c, slab);
+		}
+	}
+}
+
+static void msg_recycle(struct msg_cache *c, struct ptp_message *m)
+{
+	struct message_storage *s = container_of(m, struct message_storage, msg);
+	struct tlv_extra *extra;
+
+	while ((extra = TAILQ_FIRST(&m->tlv_list)) != NULL) {
+		TAILQ_REMOVE(&m->tlv_list, extra, list);
+		tlv_extra_recycle(extra);
+	}
+	TAILQ_INSERT_HEAD(&c->pool, m, list);
+	s->slab->nfree++;
+	c->stats.free++;
+	c->stats.in_use--;
+	pool_debug(c, "recycle", m);
+
+	/* Give memory back once the cache holds more than it needs. */
+	if (s->slab->nfree == MSG_SLAB_SIZE &&
+	    c->stats.free - MSG_SLAB_SIZE >= msg_high_water) {
+		msg_slab_destroy(c, s->slab);
+		c->stats.trims++;
+	}
+}
+
+static void msg_reclaim(struct msg_cache *c)
+{
+	struct message_storage *s, *next;
+
+	s = __atomic_exchange_n(&c->remote, NULL, __ATOMIC_ACQUIRE);
+	while (s) {
+		next = s->next;
+		msg_recycle(c, &s->msg);
+		s = next;
+	}
+}
+
+/* Called with msg_orphan_lock held, once the owning thread is gone. */
+static void msg_orphan_recycle(struct msg_cache *c, struct ptp_message *m)
+{
+	struct tlv_extra *extra;
+
+	/* The TLV pool is not shared between threads, so bypass it. */
+	while ((extra = TAILQ_FIRST(&m->tlv_list)) != NULL) {
+		TAILQ_REMOVE(&m->tlv_list, extra, list);
+		free(extra);
+	}
+	msg_recycle(c, m);
+}
+
+static void msg_orphan_release(struct msg_cache *c)
+{
+	msg_slab_trim(c);
+	if (!c->stats.in_use) {
+		free(c);
+	}
+}
+
+static void msg_cache_release(void *arg)
+{
+	struct msg_cache *c = arg;
+	struct message_storage *s, *next;
+
+	msg_cache = NULL;
+
+	pthread_mutex_lock(&msg_orphan_lock);
+	s = __atomic_exchange_n(&c->remote, MSG_REMOTE_DEAD, __ATOMIC_ACQ_REL);
+	while (s) {
+		next = s->next;
+		msg_orphan_recycle(c, &s->msg);
+		s = next;
+	}
+	msg_orphan_release(c);
+	pthread_mutex_unlock(&msg_orphan_lock);
+}
+
+static struct ptp_message *msg_take(struct msg_cache *c)
+{
+	struct ptp_message *m = TAILQ_FIRST(&c->pool);
+	struct message_storage *s = container_of(m, struct message_storage, msg);
+
+	TAILQ_REMOVE(&c->pool, m, list);
+	s->slab->nfree--;
+	c->stats.free--;
+	c->stats.in_use++;
+	if (c->stats.in_use > c->stats.peak_in_use) {
+		c->stats.peak_in_use = c->stats.in_use;
+	}
+	c->stats.allocations++;
+	pool_debug(c, "dequeue", m);
+
+	memset(m, 0, sizeof(*m));
+	m->refcnt = 1;
+	TAILQ_INIT(&m->tlv_list);
+	return m;
+}
+
 static void announce_pre_send(struct announce_msg *m)
 {
 	m->currentUtcOffset = htons(m->currentUtcOffset);
@@ -257,44 +465,66 @@ static void timestamp_pre_send(struct Timestamp *ts)
 
 struct ptp_message *msg_allocate(void)
 {
-	struct message_storage *s;
-	struct ptp_message *m = TAILQ_FIRST(&msg_pool);
+	struct ptp_message *m;
 
-	if (m) {
-		TAILQ_REMOVE(&msg_pool, m, list);
-		pool_stats.count--;
-		pool_debug("dequeue", m);
-	} else {
-		s = malloc(sizeof(*s));
-		if (s) {
-			m = &s->msg;
-			pool_stats.total++;
-			pool_debug("allocate", m);
+	if (msg_allocate_bulk(&m, 1)) {
+		return NULL;
+	}
+	return m;
+}
+
+int msg_allocate_bulk(struct ptp_message **m, int n)
+{
+	struct msg_cache *c = msg_cache_get();
+	int i;
+
+	if (!c) {
+		return -1;
+	}
+	if (c->stats.free < n) {
+		msg_reclaim(c);
+	}
+	if (c->stats.free < n) {
+		c->stats.misses++;
+	}
+	while (c->stats.free < n) {
+		if (msg_slab_create(c)) {
+			return -1;
 		}
 	}
-	if (m) {
-		memset(m, 0, sizeof(*m));
-		m->refcnt = 1;
-		TAILQ_INIT(&m->tlv_list);
+	for (i = 0; i < n; i++) {
+		m[i] = msg_take(c);
 	}
-
-	return m;
+	return 0;
 }
 
 void msg_cleanup(void)
 {
-	struct message_storage *s;
-	struct ptp_message *m;
+	struct msg_cache *c = msg_cache_get();
 
+	if (c) {
+		msg_reclaim(c);
+		msg_slab_trim(c);
+	}
 	tlv_extra_cleanup();
+}
+
+void msg_pool_get_stats(struct msg_pool_stats *stats)
+{
+	struct msg_cache *c = msg_cache_get();
 
-	while ((m = TAILQ_FIRST(&msg_pool)) != NULL) {
-		TAILQ_REMOVE(&msg_pool, m, list);
-		s = container_of(m, struct message_storage, msg);
-		free(s);
+	if (c) {
+		*stats = c->stats;
+	} else {
+		memset(stats, 0, sizeof(*stats));
 	}
 }
 
+void msg_pool_set_high_water(int count)
+{
+	msg_high_water = count;
+}
+
 struct ptp_message *msg_duplicate(struct ptp_message *msg, int cnt)
 {
 	struct ptp_message *dup;
@@ -334,7 +564,7 @@ struct ptp_message *msg_duplicate(struct ptp_message *msg, int cnt)
 
 void msg_get(struct ptp_message *m)
 {
-	m->refcnt++;
+	__atomic_add_fetch(&m->refcnt, 1, __ATOMIC_RELAXED);
 }
 
 int msg_post_recv(struct ptp_message *m, int cnt)
@@ -417,6 +647,7 @@ int msg_post_recv(struct ptp_message *m, int cnt)
 		announce_post_recv(&m->announce);
 		break;
 	case SIGNALING:
+		port_id_post_recv(&m->signaling.targetPortIdentity);
 		break;
 	case MANAGEMENT:
 		port_id_post_recv(&m->management.targetPortIdentity);
@@ -467,6 +698,7 @@ int msg_pre_send(struct ptp_message *m)
 		announce_pre_send(&m->announce);
 		break;
 	case SIGNALING:
+		port_id_pre_send(&m->signaling.targetPortIdentity);
 		break;
 	case MANAGEMENT:
 		port_id_pre_send(&m->management.targetPortIdentity);
@@ -559,19 +791,32 @@ void msg_print(struct ptp_message *m, FILE *fp)
 
 void msg_put(struct ptp_message *m)
 {
-	struct tlv_extra *extra;
+	struct message_storage *s, *head;
+	struct msg_cache *owner;
 
-	m->refcnt--;
-	if (m->refcnt) {
+	if (__atomic_sub_fetch(&m->refcnt, 1, __ATOMIC_ACQ_REL)) {
 		return;
 	}
-	pool_stats.count++;
-	pool_debug("recycle", m);
-	while ((extra = TAILQ_FIRST(&m->tlv_list)) != NULL) {
-		TAILQ_REMOVE(&m->tlv_list, extra, list);
-		tlv_extra_recycle(extra);
+	s = container_of(m, struct message_storage, msg);
+	owner = s->slab->cache;
+	if (owner == msg_cache) {
+		msg_recycle(owner, m);
+		return;
 	}
-	TAILQ_INSERT_HEAD(&msg_pool, m, list);
+	/* The owner recycles the TLVs, as their pool is not shared. */
+	head = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+	do {
+		if (head == MSG_REMOTE_DEAD) {
+			pthread_mutex_lock(&msg_orphan_lock);
+			msg_orphan_recycle(owner, m);
+			msg_orphan_release(owner);
+			pthread_mutex_unlock(&msg_orphan_lock);
+			return;
+		}
+		s->next = head;
+	} while (!__atomic_compare_exchange_n(&owner->remote, &head, s, 1,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
 }
 
 int msg_sots_missing(struct ptp_message *m)
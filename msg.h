@@ -307,15 +307,53 @@ static inline int msg_type(struct ptp_message *m)
  * reference count of one. Allocated messages are freed using the
  * function @ref msg_put().
  *
+ * Each thread allocates from a cache of its own. A message may be
+ * released by another thread, as long as that thread drops the last
+ * reference.
+ *
  * @return Pointer to a message on success, NULL otherwise.
  */
 struct ptp_message *msg_allocate(void);
 
 /**
- * Release all of the memory in the message cache.
+ * Allocate a number of message instances at once.
+ * @param m  An array to receive the new messages.
+ * @param n  The number of messages to allocate.
+ * @return   Zero on success, or -1 if none were allocated.
+ */
+int msg_allocate_bulk(struct ptp_message **m, int n);
+
+/**
+ * Release all of the unused memory in the calling thread's message cache.
  */
 void msg_cleanup(void);
 
+/**
+ * Counters describing a thread's message cache.
+ */
+struct msg_pool_stats {
+	uint64_t allocations; /* messages handed out */
+	uint64_t misses;      /* allocations which needed more memory */
+	uint64_t trims;       /* slabs given back to the system */
+	int in_use;
+	int peak_in_use;
+	int free;
+	int slabs;
+};
+
+/**
+ * Obtain the counters of the calling thread's message cache.
+ * @param stats  Filled in with the current values.
+ */
+void msg_pool_get_stats(struct msg_pool_stats *stats);
+
+/**
+ * Set the number of free messages a cache may hold before it gives
+ * memory back to the system.
+ * @param count  The high water mark, applying to all threads.
+ */
+void msg_pool_set_high_water(int count);
+
 /**
  * Duplicate a message instance.
  *
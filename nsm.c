@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
@@ -29,33 +30,126 @@
 #include "config.h"
 #include "print.h"
 #include "rtnl.h"
+#include "stats.h"
 #include "util.h"
 #include "version.h"
 
 #define IFMT		"\n\t\t"
 #define NSM_NFD		3
+#define NSM_NSEQ	(1 << 16)
+
+enum nsm_format {
+	NSM_TEXT,
+	NSM_CSV,
+};
+
+struct nsm_target {
+	STAILQ_ENTRY(nsm_target) list;
+	char			*name;
+	struct address		addr;
+	struct stats		*offset;
+	unsigned int		sent;
+	unsigned int		received;
+};
+
+struct nsm_request {
+	TAILQ_ENTRY(nsm_request) list;
+	struct nsm_target	*target;
+	struct ptp_message	*delay_req;
+	struct ptp_message	*delay_resp;
+	struct ptp_message	*sync;
+	struct ptp_message	*fup;
+	int64_t			expiry;
+	UInteger16		sequence_id;
+};
 
 struct nsm {
 	struct config		*cfg;
 	struct fdarray		fda;
 	struct transport	*trp;
 	struct tsproc		*tsproc;
-	struct ptp_message	*nsm_delay_req;
-	struct ptp_message	*nsm_delay_resp;
-	struct ptp_message	*nsm_sync;
-	struct ptp_message	*nsm_fup;
+	/* outstanding requests, oldest first and indexed by sequenceId */
+	TAILQ_HEAD(nsm_pending, nsm_request) pending;
+	struct nsm_request	*index[NSM_NSEQ];
+	int			n_pending;
+	STAILQ_HEAD(nsm_targets, nsm_target) targets;
+	/* the targets from the list file, swept once per period */
+	struct nsm_target	**sweep;
+	int			n_sweep;
+	int			next_target;
+	int			sweeps_left;
+	int64_t			next_send;
+	int64_t			spacing;
+	int64_t			timeout;
+	enum nsm_format		format;
 	struct PortIdentity	port_identity;
 	UInteger16		sequence_id;
 	const char		*name;
 } the_nsm;
 
 static void nsm_help(FILE *fp);
-static int nsm_request(struct nsm *nsm, char *target);
-static void nsm_reset(struct nsm *nsm);
+static int nsm_request(struct nsm *nsm, struct nsm_target *target);
+
+static int64_t nsm_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+static struct nsm_target *nsm_target_get(struct nsm *nsm, const char *name)
+{
+	enum transport_type type = transport_type(nsm->trp);
+	struct nsm_target *target;
+
+	STAILQ_FOREACH(target, &nsm->targets, list) {
+		if (!strcmp(target->name, name)) {
+			return target;
+		}
+	}
+
+	switch (type) {
+	case TRANS_UDS:
+	case TRANS_UDP_IPV6:
+	case TRANS_DEVICENET:
+	case TRANS_CONTROLNET:
+	case TRANS_PROFINET:
+		pr_err("sorry, NSM not support with this transport");
+		return NULL;
+	case TRANS_UDP_IPV4:
+	case TRANS_IEEE_802_3:
+		break;
+	}
+
+	target = calloc(1, sizeof(*target));
+	if (!target) {
+		pr_err("low memory");
+		return NULL;
+	}
+	if (str2addr(type, name, &target->addr)) {
+		free(target);
+		return NULL;
+	}
+	target->name = strdup(name);
+	target->offset = stats_create();
+	if (!target->name || !target->offset) {
+		pr_err("low memory");
+		free(target->name);
+		if (target->offset) {
+			stats_destroy(target->offset);
+		}
+		free(target);
+		return NULL;
+	}
+	STAILQ_INSERT_TAIL(&nsm->targets, target, list);
+	return target;
+}
 
 static int nsm_command(struct nsm *nsm, const char *cmd)
 {
 	char action_str[10+1] = {0}, id_str[64+1] = {0};
+	struct nsm_target *target;
 
 	if (0 == strncasecmp(cmd, "HELP", strlen(cmd))) {
 		nsm_help(stdout);
@@ -66,21 +160,22 @@ static int nsm_command(struct nsm *nsm, const char *cmd)
 		return -1;
 	}
 	if (0 == strncasecmp(action_str, "NSM", strlen(action_str))) {
-		return nsm_request(nsm, id_str);
+		target = nsm_target_get(nsm, id_str);
+		return target ? nsm_request(nsm, target) : -1;
 	}
 	pr_err("bad command: %s", cmd);
 	return -1;
 }
 
-static int nsm_complete(struct nsm *nsm)
+static int nsm_complete(struct nsm_request *req)
 {
-	if (!nsm->nsm_sync) {
+	if (!req->sync) {
 		return 0;
 	}
-	if (one_step(nsm->nsm_sync)) {
-		return nsm->nsm_delay_resp ? 1 : 0;
+	if (one_step(req->sync)) {
+		return req->delay_resp ? 1 : 0;
 	}
-	return (nsm->nsm_delay_resp && nsm->nsm_fup) ? 1 : 0;
+	return (req->delay_resp && req->fup) ? 1 : 0;
 }
 
 static int64_t nsm_compute_offset(struct tsproc *tsp,
@@ -111,89 +206,101 @@ static int64_t nsm_compute_offset(struct tsproc *tsp,
 	return tmv_to_nanoseconds(offset);
 }
 
-static void nsm_close(struct nsm *nsm)
+static void nsm_request_free(struct nsm *nsm, struct nsm_request *req)
 {
-	nsm_reset(nsm);
-	transport_close(nsm->trp, &nsm->fda);
-	transport_destroy(nsm->trp);
-	tsproc_destroy(nsm->tsproc);
+	TAILQ_REMOVE(&nsm->pending, req, list);
+	nsm->index[req->sequence_id] = NULL;
+	nsm->n_pending--;
+	if (req->delay_req) {
+		msg_put(req->delay_req);
+	}
+	if (req->delay_resp) {
+		msg_put(req->delay_resp);
+	}
+	if (req->sync) {
+		msg_put(req->sync);
+	}
+	if (req->fup) {
+		msg_put(req->fup);
+	}
+	free(req);
 }
 
-static void nsm_handle_msg(struct nsm *nsm, struct ptp_message *msg, FILE *fp)
+static void nsm_print_time(FILE *fp)
 {
-	struct nsm_resp_tlv_head *head;
-	struct nsm_resp_tlv_foot *foot;
-	struct timePropertiesDS *tp;
-	struct PortAddress *paddr;
-	struct currentDS cds;
-	struct parentDS *pds;
-	struct Timestamp ts;
-	unsigned char *ptr;
-	int64_t offset;
+	struct timespec now;
 
-	if (!nsm->nsm_delay_req) {
-		return;
-	}
-	if (msg->header.sequenceId !=
-	    ntohs(nsm->nsm_delay_req->header.sequenceId)) {
-		return;
-	}
-	if (!msg_unicast(msg)) {
-		return;
-	}
+	clock_gettime(CLOCK_REALTIME, &now);
+	fprintf(fp, "%ld.%09ld", (long) now.tv_sec, now.tv_nsec);
+}
 
-	switch (msg_type(msg)) {
-	case SYNC:
-		if (!nsm->nsm_sync) {
-			nsm->nsm_sync = msg;
-			msg_get(msg);
-		}
-		break;
-	case FOLLOW_UP:
-		if (!nsm->nsm_fup) {
-			nsm->nsm_fup = msg;
-			msg_get(msg);
-		}
+static void nsm_timeout(struct nsm *nsm, struct nsm_request *req, FILE *fp)
+{
+	switch (nsm->format) {
+	case NSM_TEXT:
+		fprintf(fp, "NSM MEASUREMENT TIMEOUT"
+			IFMT "target                                %s\n",
+			req->target->name);
 		break;
-	case DELAY_RESP:
-		if (!nsm->nsm_delay_resp) {
-			nsm->nsm_delay_resp = msg;
-			msg_get(msg);
-		}
+	case NSM_CSV:
+		nsm_print_time(fp);
+		fprintf(fp, ",%s,%hu,timeout,,,,,,,,,,,\n",
+			req->target->name, req->sequence_id);
 		break;
-	case DELAY_REQ:
-	case PDELAY_REQ:
-	case PDELAY_RESP:
-	case PDELAY_RESP_FOLLOW_UP:
-	case ANNOUNCE:
-	case SIGNALING:
-	case MANAGEMENT:
-		return;
 	}
+	fflush(fp);
+	nsm_request_free(nsm, req);
+}
 
-	if (!nsm_complete(nsm)) {
-		return;
+static void nsm_expire(struct nsm *nsm, int64_t now, FILE *fp)
+{
+	struct nsm_request *req;
+
+	while ((req = TAILQ_FIRST(&nsm->pending)) && req->expiry <= now) {
+		nsm_timeout(nsm, req, fp);
 	}
+}
 
-	head = (struct nsm_resp_tlv_head *) nsm->nsm_delay_resp->delay_resp.suffix;
-	paddr = &head->parent_addr;
+static void nsm_close(struct nsm *nsm)
+{
+	struct nsm_request *req;
+	struct nsm_target *target;
 
-	ptr = (unsigned char *) head;
-	ptr += sizeof(*head) + paddr->addressLength;
-	foot = (struct nsm_resp_tlv_foot *) ptr;
+	while ((req = TAILQ_FIRST(&nsm->pending))) {
+		nsm_request_free(nsm, req);
+	}
+	while ((target = STAILQ_FIRST(&nsm->targets))) {
+		STAILQ_REMOVE_HEAD(&nsm->targets, list);
+		stats_destroy(target->offset);
+		free(target->name);
+		free(target);
+	}
+	free(nsm->sweep);
+	transport_close(nsm->trp, &nsm->fda);
+	transport_destroy(nsm->trp);
+	tsproc_destroy(nsm->tsproc);
+}
+
+static void nsm_print_text(FILE *fp, struct nsm_request *req, int64_t offset,
+			   struct nsm_resp_tlv_head *head,
+			   struct nsm_resp_tlv_foot *foot)
+{
+	struct timePropertiesDS *tp;
+	struct currentDS cds;
+	struct parentDS *pds;
+	struct Timestamp ts;
 
 	pds = &foot->parent;
 	memcpy(&cds, &foot->current, sizeof(cds));
 	tp = &foot->timeprop;
 	memcpy(&ts, &foot->lastsync, sizeof(ts));
 
-	offset = nsm_compute_offset(nsm->tsproc, nsm->nsm_sync, nsm->nsm_fup,
-				    nsm->nsm_delay_req, nsm->nsm_delay_resp);
-
 	fprintf(fp, "NSM MEASUREMENT COMPLETE"
+		IFMT "target                                %s"
 		IFMT "offset                                %" PRId64
 		IFMT "portState                             %s"
 		IFMT "parentPortAddress                     %hu %s\n",
+		req->target->name,
 		offset,
 		ps_str[head->port_state],
 		head->parent_addr.networkProtocol,
@@ -245,9 +352,102 @@ static void nsm_handle_msg(struct nsm *nsm, struct ptp_message *msg, FILE *fp)
 	fprintf(fp, "\tlastSyncTimestamp    %" PRId64 ".%09u\n",
 		((uint64_t)ts.seconds_lsb) | (((uint64_t)ts.seconds_msb) << 32),
 		ts.nanoseconds);
+}
+
+static void nsm_print_csv(FILE *fp, struct nsm_request *req, int64_t offset,
+			  struct nsm_resp_tlv_head *head,
+			  struct nsm_resp_tlv_foot *foot)
+{
+	struct currentDS cds;
+	struct parentDS *pds;
+	struct Timestamp ts;
+
+	pds = &foot->parent;
+	memcpy(&cds, &foot->current, sizeof(cds));
+	memcpy(&ts, &foot->lastsync, sizeof(ts));
+
+	nsm_print_time(fp);
+	fprintf(fp, ",%s,%hu,ok,%" PRId64 ",%s,%s,",
+		req->target->name, req->sequence_id, offset,
+		ps_str[head->port_state], portaddr2str(&head->parent_addr));
+	fprintf(fp, "%s,", pid2str(&pds->parentPortIdentity));
+	fprintf(fp, "%s,%hhu,%hd,%.1f,%.1f,%hd,%" PRId64 ".%09u\n",
+		cid2str(&pds->grandmasterIdentity),
+		pds->grandmasterClockQuality.clockClass,
+		cds.stepsRemoved, cds.offsetFromMaster / 65536.0,
+		cds.meanPathDelay / 65536.0,
+		foot->timeprop.currentUtcOffset,
+		((uint64_t)ts.seconds_lsb) | (((uint64_t)ts.seconds_msb) << 32),
+		ts.nanoseconds);
+}
+
+static void nsm_handle_msg(struct nsm *nsm, struct ptp_message *msg, FILE *fp)
+{
+	struct nsm_resp_tlv_head *head;
+	struct nsm_resp_tlv_foot *foot;
+	struct ptp_message **slot;
+	struct nsm_request *req;
+	struct PortAddress *paddr;
+	unsigned char *ptr;
+	int64_t offset;
+
+	if (!msg_unicast(msg)) {
+		return;
+	}
+	req = nsm->index[msg->header.sequenceId];
+	if (!req) {
+		return;
+	}
+	/* The sequenceId alone could match a stale reply of another target. */
+	if (msg->address.len && !addr_host_eq(&msg->address, &req->target->addr)) {
+		return;
+	}
+
+	switch (msg_type(msg)) {
+	case SYNC:
+		slot = &req->sync;
+		break;
+	case FOLLOW_UP:
+		slot = &req->fup;
+		break;
+	case DELAY_RESP:
+		slot = &req->delay_resp;
+		break;
+	default:
+		return;
+	}
+	if (!*slot) {
+		*slot = msg;
+		msg_get(msg);
+	}
+
+	if (!nsm_complete(req)) {
+		return;
+	}
+
+	head = (struct nsm_resp_tlv_head *) req->delay_resp->delay_resp.suffix;
+	paddr = &head->parent_addr;
+
+	ptr = (unsigned char *) head;
+	ptr += sizeof(*head) + paddr->addressLength;
+	foot = (struct nsm_resp_tlv_foot *) ptr;
+
+	offset = nsm_compute_offset(nsm->tsproc, req->sync, req->fup,
+				    req->delay_req, req->delay_resp);
 
+	req->target->received++;
+	stats_add_value(req->target->offset, offset);
+
+	switch (nsm->format) {
+	case NSM_TEXT:
+		nsm_print_text(fp, req, offset, head, foot);
+		break;
+	case NSM_CSV:
+		nsm_print_csv(fp, req, offset, head, foot);
+		break;
+	}
 	fflush(fp);
-	nsm_reset(nsm);
+	nsm_request_free(nsm, req);
 }
 
 static void nsm_help(FILE *fp)
@@ -289,7 +489,7 @@ static int nsm_open(struct nsm *nsm, struct config *cfg)
 	}
 	nsm->port_identity.portNumber = 1;
 
-	nsm->tsproc = tsproc_create(TSPROC_RAW, FILTER_MOVING_AVERAGE, 10);
+	nsm->tsproc = tsproc_create(TSPROC_RAW, FILTER_MOVING_AVERAGE, 10, 50);
 	if (!nsm->tsproc) {
 		pr_err("failed to create time stamp processor");
 		goto no_tsproc;
@@ -355,49 +555,15 @@ failed:
 	return NULL;
 }
 
-static int nsm_request(struct nsm *nsm, char *target)
+static int nsm_request(struct nsm *nsm, struct nsm_target *target)
 {
-	enum transport_type type = transport_type(nsm->trp);
 	UInteger8 transportSpecific;
-	unsigned char mac[MAC_LEN];
-	struct in_addr ipv4_addr;
+	struct nsm_request *req;
 	struct ptp_message *msg;
 	struct tlv_extra *extra;
 	Integer64 asymmetry;
-	struct address dst;
 	int cnt, err;
 
-	memset(&dst, 0, sizeof(dst));
-
-	switch (type) {
-	case TRANS_UDS:
-	case TRANS_UDP_IPV6:
-	case TRANS_DEVICENET:
-	case TRANS_CONTROLNET:
-	case TRANS_PROFINET:
-		pr_err("sorry, NSM not support with this transport");
-		return -1;
-	case TRANS_UDP_IPV4:
-		if (!inet_aton(target, &ipv4_addr)) {
-			pr_err("bad IPv4 address");
-			return -1;
-		}
-		dst.sin.sin_family = AF_INET;
-		dst.sin.sin_addr = ipv4_addr;
-		dst.len = sizeof(dst.sin);
-		break;
-	case TRANS_IEEE_802_3:
-		if (str2mac(target, mac)) {
-			pr_err("bad Layer-2 address");
-			return -1;
-		}
-		dst.sll.sll_family = AF_PACKET;
-		dst.sll.sll_halen = MAC_LEN;
-		memcpy(&dst.sll.sll_addr, mac, MAC_LEN);
-		dst.len = sizeof(dst.sll);
-		break;
-	}
-
 	msg = msg_allocate();
 	if (!msg) {
 		return -1;
@@ -421,7 +587,7 @@ static int nsm_request(struct nsm *nsm, char *target)
 	msg->header.control            = CTL_DELAY_REQ;
 	msg->header.logMessageInterval = 0x7f;
 
-	msg->address = dst;
+	msg->address = target->addr;
 	msg->header.flagField[0] |= UNICAST;
 
 	extra = msg_tlv_append(msg, sizeof(struct TLV));
@@ -432,6 +598,14 @@ static int nsm_request(struct nsm *nsm, char *target)
 	extra->tlv->type = TLV_PTPMON_REQ;
 	extra->tlv->length = 0;
 
+	req = calloc(1, sizeof(*req));
+	if (!req) {
+		msg_put(msg);
+		return -ENOMEM;
+	}
+	req->target = target;
+	req->sequence_id = msg->header.sequenceId;
+
 	err = msg_pre_send(msg);
 	if (err) {
 		pr_err("msg_pre_send failed");
@@ -448,55 +622,153 @@ static int nsm_request(struct nsm *nsm, char *target)
 		err = -1;
 		goto out;
 	}
-	nsm_reset(nsm);
-	nsm->nsm_delay_req = msg;
+	target->sent++;
+
+	/* After a wrap around, the older request has waited long enough. */
+	if (nsm->index[req->sequence_id]) {
+		nsm_timeout(nsm, nsm->index[req->sequence_id], stdout);
+	}
+	req->delay_req = msg;
+	req->expiry = nsm_now() + nsm->timeout;
+	TAILQ_INSERT_TAIL(&nsm->pending, req, list);
+	nsm->index[req->sequence_id] = req;
+	nsm->n_pending++;
 	return 0;
 out:
+	free(req);
 	msg_put(msg);
 	return err;
 }
 
-static void nsm_reset(struct nsm *nsm)
+/* Send the requests which are due, spread evenly over the period. */
+static void nsm_sweep(struct nsm *nsm, int64_t now)
 {
-	if (nsm->nsm_delay_req) {
-		msg_put(nsm->nsm_delay_req);
+	while (nsm->sweeps_left && now >= nsm->next_send) {
+		if (nsm_request(nsm, nsm->sweep[nsm->next_target])) {
+			pr_err("request to %s failed",
+			       nsm->sweep[nsm->next_target]->name);
+		}
+		nsm->next_send += nsm->spacing;
+		if (++nsm->next_target == nsm->n_sweep) {
+			nsm->next_target = 0;
+			if (nsm->sweeps_left > 0) {
+				nsm->sweeps_left--;
+			}
+		}
 	}
-	if (nsm->nsm_delay_resp) {
-		msg_put(nsm->nsm_delay_resp);
+	/* Skip the requests missed while falling behind, don't burst. */
+	if (nsm->next_send + nsm->spacing * nsm->n_sweep < now) {
+		nsm->next_send = now;
 	}
-	if (nsm->nsm_sync) {
-		msg_put(nsm->nsm_sync);
+}
+
+static int nsm_poll_timeout(struct nsm *nsm, int64_t now)
+{
+	struct nsm_request *req = TAILQ_FIRST(&nsm->pending);
+	int64_t next = -1;
+
+	if (nsm->sweeps_left) {
+		next = nsm->next_send;
+	}
+	if (req && (next < 0 || req->expiry < next)) {
+		next = req->expiry;
 	}
-	if (nsm->nsm_fup) {
-		msg_put(nsm->nsm_fup);
+	if (next < 0) {
+		return -1;
 	}
-	nsm->nsm_delay_req = NULL;
-	nsm->nsm_delay_resp = NULL;
-	nsm->nsm_sync = NULL;
-	nsm->nsm_fup = NULL;
+	if (next <= now) {
+		return 0;
+	}
+	/* Round up, so that the deadline has passed when poll returns. */
+	return (next - now + 999999) / 1000000;
+}
+
+static int nsm_read_list(struct nsm *nsm, const char *name)
+{
+	struct nsm_target *target, **sweep;
+	char line[256], addr[64+1];
+	FILE *fp;
+	int err = 0;
+
+	fp = fopen(name, "r");
+	if (!fp) {
+		pr_err("failed to open target list %s: %m", name);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (1 != sscanf(line, " %64s", addr) || addr[0] == '#') {
+			continue;
+		}
+		target = nsm_target_get(nsm, addr);
+		if (!target) {
+			err = -1;
+			break;
+		}
+		sweep = realloc(nsm->sweep, (nsm->n_sweep + 1) * sizeof(*sweep));
+		if (!sweep) {
+			pr_err("low memory");
+			err = -1;
+			break;
+		}
+		nsm->sweep = sweep;
+		nsm->sweep[nsm->n_sweep++] = target;
+	}
+	fclose(fp);
+	if (!err && !nsm->n_sweep) {
+		pr_err("no targets in %s", name);
+		err = -1;
+	}
+	return err;
+}
+
+static void nsm_summary(struct nsm *nsm, FILE *fp)
+{
+	struct stats_result result;
+	struct nsm_target *target;
+
+	STAILQ_FOREACH(target, &nsm->targets, list) {
+		fprintf(fp, "%s: sent %u received %u", target->name,
+			target->sent, target->received);
+		if (!stats_get_result(target->offset, &result)) {
+			fprintf(fp, " offset min %.0f max %.0f mean %.1f "
+				"stddev %.1f", result.min, result.max,
+				result.mean, result.stddev);
+		}
+		fprintf(fp, "\n");
+	}
+	fflush(fp);
 }
 
 static void usage(char *progname)
 {
 	fprintf(stderr,
 		"\nusage: %s [options]\n\n"
+		" -c [num]  number of sweeps over the target list, 0 for endless,\n"
+		"           default 1\n"
 		" -f [file] read configuration from 'file'\n"
 		" -h        prints this message and exits\n"
 		" -i [dev]  interface device to use\n"
+		" -l [file] read the list of targets, one address per line, from 'file'\n"
+		" -o [fmt]  output format, 'text' (default) or 'csv'\n"
+		" -p [sec]  period of a sweep over the target list, default 1.0\n"
 		" -v        prints the software version and exits\n"
+		" -w [ms]   how long to wait for the replies, default 1000\n"
 		"\n",
 		progname);
 }
 
 int main(int argc, char *argv[])
 {
-	int batch_mode = 0, c, cnt, err = 0, index, length, tmo = -1;
-	char *cmd = NULL, *config = NULL, line[1024], *progname;
+	int batch_mode = 0, c, cnt, err = 0, index, input, length, sweeps = 1;
+	char *cmd = NULL, *config = NULL, *list = NULL, line[1024], *progname;
+	int tmo, wait_ms = 1000;
 	struct pollfd pollfd[NSM_NFD];
 	struct nsm *nsm = &the_nsm;
 	struct ptp_message *msg;
 	struct option *opts;
 	struct config *cfg;
+	double period = 1.0;
+	int64_t now;
 
 	if (handle_term_signals()) {
 		return -1;
@@ -509,10 +781,15 @@ int main(int argc, char *argv[])
 	print_set_verbose(1);
 	print_set_syslog(0);
 
+	TAILQ_INIT(&nsm->pending);
+	STAILQ_INIT(&nsm->targets);
+	nsm->format = NSM_TEXT;
+
 	/* Process the command line arguments. */
 	progname = strrchr(argv[0], '/');
 	progname = progname ? 1+progname : argv[0];
-	while (EOF != (c = getopt_long(argc, argv, "f:hi:v", opts, &index))) {
+	while (EOF != (c = getopt_long(argc, argv, "c:f:hi:l:o:p:vw:",
+				       opts, &index))) {
 		switch (c) {
 		case 0:
 			if (config_parse_option(cfg, opts[index].name, optarg)) {
@@ -520,6 +797,12 @@ int main(int argc, char *argv[])
 				return -1;
 			}
 			break;
+		case 'c':
+			if (get_arg_val_i(c, optarg, &sweeps, 0, INT32_MAX)) {
+				config_destroy(cfg);
+				return -1;
+			}
+			break;
 		case 'f':
 			config = optarg;
 			break;
@@ -529,6 +812,33 @@ int main(int argc, char *argv[])
 				return -1;
 			}
 			break;
+		case 'l':
+			list = optarg;
+			break;
+		case 'o':
+			if (!strcasecmp(optarg, "text")) {
+				nsm->format = NSM_TEXT;
+			} else if (!strcasecmp(optarg, "csv")) {
+				nsm->format = NSM_CSV;
+			} else {
+				fprintf(stderr, "unknown output format %s\n",
+					optarg);
+				config_destroy(cfg);
+				return -1;
+			}
+			break;
+		case 'p':
+			if (get_arg_val_d(c, optarg, &period, 1e-3, 86400.0)) {
+				config_destroy(cfg);
+				return -1;
+			}
+			break;
+		case 'w':
+			if (get_arg_val_i(c, optarg, &wait_ms, 1, INT32_MAX)) {
+				config_destroy(cfg);
+				return -1;
+			}
+			break;
 		case 'v':
 			version_show(stdout);
 			config_destroy(cfg);
@@ -560,30 +870,52 @@ int main(int argc, char *argv[])
 	if (err) {
 		goto out;
 	}
+	nsm->timeout = (int64_t) wait_ms * 1000000;
+
+	if (list) {
+		err = nsm_read_list(nsm, list);
+		if (err) {
+			goto close;
+		}
+		nsm->sweeps_left = sweeps ? sweeps : -1;
+		nsm->spacing = period * NS_PER_SEC / nsm->n_sweep;
+		nsm->next_send = nsm_now();
+	}
+	if (nsm->format == NSM_CSV) {
+		fprintf(stdout, "time,target,sequence,status,offset,"
+			"port_state,parent_port_address,parent_port_identity,"
+			"grandmaster_identity,gm_clock_class,steps_removed,"
+			"offset_from_master,mean_path_delay,current_utc_offset,"
+			"last_sync\n");
+	}
 
 	if (optind < argc) {
 		batch_mode = 1;
 	}
+	/* All of the batch requests go out at once, and run concurrently. */
+	while (optind < argc) {
+		cmd = argv[optind++];
+		if (nsm_command(nsm, cmd)) {
+			pr_err("command failed");
+		}
+	}
+	input = !batch_mode && !list;
 
 	pollfd[0].fd = nsm->fda.fd[0];
 	pollfd[1].fd = nsm->fda.fd[1];
-	pollfd[2].fd = batch_mode ? -1 : STDIN_FILENO;
+	pollfd[2].fd = input ? STDIN_FILENO : -1;
 	pollfd[0].events = POLLIN | POLLPRI;
 	pollfd[1].events = POLLIN | POLLPRI;
-	pollfd[2].events = batch_mode ? 0 : POLLIN | POLLPRI;
+	pollfd[2].events = input ? POLLIN | POLLPRI : 0;
 
 	while (is_running()) {
-		if (batch_mode) {
-			if (optind < argc && !nsm->nsm_delay_req) {
-				cmd = argv[optind++];
-				if (nsm_command(nsm, cmd)) {
-					pr_err("command failed");
-					continue;
-				}
-			}
-			/* Wait a bit for any outstanding replies. */
-			tmo = 100;
+		now = nsm_now();
+		nsm_sweep(nsm, now);
+		nsm_expire(nsm, now, stdout);
+		if (!input && !nsm->sweeps_left && !nsm->n_pending) {
+			break;
 		}
+		tmo = nsm_poll_timeout(nsm, now);
 
 		cnt = poll(pollfd, NSM_NFD, tmo);
 		if (cnt < 0) {
@@ -594,27 +926,19 @@ int main(int argc, char *argv[])
 				err = -1;
 				break;
 			}
-		} else if (!cnt && optind < argc) {
-			/* For batch mode. No response received from target node,
-			 * continue with next command. */
-			nsm_reset(nsm);
-			continue;
-		} else if (!cnt) {
-			break;
 		}
 		if (pollfd[2].revents & POLLHUP) {
-			if (tmo == -1) {
-				/* Wait a bit longer for outstanding replies. */
-				tmo = 100;
-				pollfd[2].fd = -1;
-				pollfd[2].events = 0;
-			} else {
-				break;
-			}
+			/* Wait for the outstanding replies, then stop. */
+			input = 0;
+			pollfd[2].fd = -1;
+			pollfd[2].events = 0;
 		}
 		if (pollfd[2].revents & (POLLIN|POLLPRI)) {
 			if (!fgets(line, sizeof(line), stdin)) {
-				break;
+				input = 0;
+				pollfd[2].fd = -1;
+				pollfd[2].events = 0;
+				continue;
 			}
 			length = strlen(line);
 			if (length < 2) {
@@ -642,6 +966,10 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (list && nsm->format == NSM_TEXT) {
+		nsm_summary(nsm, stdout);
+	}
+close:
 	nsm_close(nsm);
 out:
 	msg_cleanup();
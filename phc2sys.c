@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
@@ -51,6 +52,7 @@
 #include "servo.h"
 #include "sk.h"
 #include "stats.h"
+#include "status.h"
 #include "sysoff.h"
 #include "tlv.h"
 #include "uds.h"
@@ -63,17 +65,32 @@
 
 #define PHC_PPS_OFFSET_LIMIT 10000000
 #define PMC_UPDATE_INTERVAL (60 * NS_PER_SEC)
+#define PMC_POLL_INTERVAL 1	/* seconds between retries of pmc requests */
 #define PMC_SUBSCRIBE_DURATION 180	/* 3 minutes */
 /* Note that PMC_SUBSCRIBE_DURATION has to be longer than
  * PMC_UPDATE_INTERVAL otherwise subscription will time out before it is
  * renewed.
  */
 
+/* Registered with epoll as the cookie of one descriptor. */
+struct loop_source {
+	enum {
+		LOOP_CLOCK,
+		LOOP_PMC,
+		LOOP_PMC_TIMER,
+		LOOP_PPS,
+	} type;
+	int fd;
+	struct clock *clock;
+};
+
 struct clock {
 	LIST_ENTRY(clock) list;
 	clockid_t clkid;
 	int phc_index;
-	int sysoff_supported;
+	int sysoff_method;
+	double interval;
+	struct loop_source timer;
 	int is_utc;
 	int dest_only;
 	int state;
@@ -103,7 +120,12 @@ struct node {
 	int sanity_freq_limit;
 	enum servo_type servo_type;
 	int phc_readings;
-	double phc_interval;
+	int sysoff_estimator;
+	int epfd;
+	struct loop_source pmc_fd;
+	struct loop_source pmc_timer;
+	struct loop_source pps;
+	unsigned int pps_sequence;
 	int sync_offset;
 	int forced_sync_offset;
 	int utc_offset_traceable;
@@ -112,6 +134,10 @@ struct node {
 	struct pmc *pmc;
 	int pmc_ds_requested;
 	uint64_t pmc_last_update;
+	struct status *status;
+	char *status_name;
+	int status_failed;
+	int status_stalled;
 	int state_changed;
 	int clock_identity_set;
 	struct ClockIdentity clock_identity;
@@ -126,7 +152,7 @@ static int update_pmc(struct node *node, int subscribe);
 static int clock_handle_leap(struct node *node, struct clock *clock,
 			     int64_t offset, uint64_t ts);
 static int run_pmc_get_utc_offset(struct node *node, int timeout);
-static void run_pmc_events(struct node *node);
+static void update_utc_offset(struct node *node, struct timePropertiesDS *tds);
 
 static int normalize_state(int state);
 static int run_pmc_port_properties(struct node *node, int timeout,
@@ -196,7 +222,7 @@ static struct servo *servo_add(struct node *node, struct clock *clock)
 		return NULL;
 	}
 
-	servo_sync_interval(servo, node->phc_interval);
+	servo_sync_interval(servo, clock->interval);
 
 	return servo;
 }
@@ -222,6 +248,19 @@ static struct clock *clock_add(struct node *node, char *device)
 	c->phc_index = phc_index;
 	c->servo_state = SERVO_UNLOCKED;
 	c->device = device ? strdup(device) : NULL;
+	c->timer.type = LOOP_CLOCK;
+	c->timer.clock = c;
+
+	/* A section named after the device may set its own update rate. */
+	c->interval = 1.0 / config_get_double(phc2sys_config, device,
+					      "update_rate");
+	c->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (c->timer.fd < 0) {
+		pr_err("timerfd_create failed: %m");
+		free(c->device);
+		free(c);
+		return NULL;
+	}
 
 	if (c->clkid == CLOCK_REALTIME) {
 		c->source_label = "sys";
@@ -252,10 +291,13 @@ static struct clock *clock_add(struct node *node, char *device)
 	if (clkid != CLOCK_INVALID)
 		c->servo = servo_add(node, c);
 
-	if (clkid != CLOCK_INVALID && clkid != CLOCK_REALTIME)
-		c->sysoff_supported = (SYSOFF_SUPPORTED ==
-				       sysoff_probe(CLOCKID_TO_FD(clkid),
-						    node->phc_readings));
+	c->sysoff_method = SYSOFF_RUN_TIME_MISSING;
+	if (clkid != CLOCK_INVALID && clkid != CLOCK_REALTIME) {
+		c->sysoff_method = sysoff_probe(CLOCKID_TO_FD(clkid),
+						node->phc_readings);
+		pr_info("%s: reading the clock with %s", c->device,
+			sysoff_method_name(c->sysoff_method));
+	}
 
 	LIST_INSERT_HEAD(&node->clocks, c, list);
 	return c;
@@ -284,6 +326,7 @@ static void clock_cleanup(struct node *node)
 		if (c->device) {
 			free(c->device);
 		}
+		close(c->timer.fd);
 		free(c);
 	}
 }
@@ -519,6 +562,68 @@ static int read_phc(clockid_t clkid, clockid_t sysclk, int readings,
 	return 1;
 }
 
+/* Measure the offset of a clock from the system clock, like sysoff does. */
+static int read_sysclk(struct node *node, struct clock *clock,
+		       int64_t *offset, uint64_t *ts, int64_t *delay)
+{
+	struct timespec now;
+
+	if (clock->clkid != CLOCK_REALTIME) {
+		return sysoff_measure(CLOCKID_TO_FD(clock->clkid),
+				      clock->sysoff_method, node->phc_readings,
+				      node->sysoff_estimator,
+				      offset, ts, delay) >= 0;
+	}
+	if (clock_gettime(CLOCK_REALTIME, &now)) {
+		pr_err("failed to read clock: %m");
+		return 0;
+	}
+	*offset = 0;
+	*ts = now.tv_sec * NS_PER_SEC + now.tv_nsec;
+	*delay = 0;
+	return 1;
+}
+
+static int sysoff_usable(struct clock *clock)
+{
+	return clock->clkid == CLOCK_REALTIME ||
+		clock->sysoff_method != SYSOFF_RUN_TIME_MISSING;
+}
+
+/*
+ * Compare two clocks through their offsets from the system clock. The
+ * measurement of the source clock is reused for all destination clocks
+ * in one update, so with N destination PHCs only N + 1 ioctls are made.
+ */
+static int read_sysoff(struct node *node, struct clock *src,
+		       struct clock *dst, int *src_valid, int64_t *src_offset,
+		       uint64_t *src_ts, int64_t *src_delay,
+		       int64_t *offset, uint64_t *ts, int64_t *delay)
+{
+	int64_t dst_offset, dst_delay;
+	uint64_t dst_ts;
+
+	if (!*src_valid) {
+		if (!read_sysclk(node, src, src_offset, src_ts, src_delay))
+			return 0;
+		*src_valid = 1;
+	}
+	if (dst->clkid == CLOCK_REALTIME) {
+		*offset = *src_offset;
+		*ts = *src_ts;
+		*delay = *src_delay;
+		return 1;
+	}
+	if (!read_sysclk(node, dst, &dst_offset, &dst_ts, &dst_delay))
+		return 0;
+
+	/* Both offsets are the system time minus the clock time. */
+	*offset = *src_offset - dst_offset;
+	*ts = dst_ts - dst_offset;
+	*delay = *src_delay + dst_delay;
+	return 1;
+}
+
 static int64_t get_sync_offset(struct node *node, struct clock *dst)
 {
 	int direction = node->forced_sync_offset;
@@ -627,17 +732,21 @@ static void enable_pps_output(clockid_t src)
 		pr_warning("failed to enable PPS output");
 }
 
-static int read_pps(int fd, int64_t *offset, uint64_t *ts)
+/* Returns 1 if a new pulse was fetched, without waiting for one. */
+static int read_pps(int fd, unsigned int *sequence,
+		    int64_t *offset, uint64_t *ts)
 {
 	struct pps_fdata pfd;
 
-	pfd.timeout.sec = 10;
-	pfd.timeout.nsec = 0;
+	memset(&pfd, 0, sizeof(pfd));
 	pfd.timeout.flags = ~PPS_TIME_INVALID;
 	if (ioctl(fd, PPS_FETCH, &pfd)) {
 		pr_err("failed to fetch PPS: %m");
 		return 0;
 	}
+	if (pfd.info.assert_sequence == *sequence)
+		return 0;
+	*sequence = pfd.info.assert_sequence;
 
 	*ts = pfd.info.assert_tu.sec * NS_PER_SEC;
 	*ts += pfd.info.assert_tu.nsec;
@@ -649,52 +758,37 @@ static int read_pps(int fd, int64_t *offset, uint64_t *ts)
 	return 1;
 }
 
-static int do_pps_loop(struct node *node, struct clock *clock, int fd)
+static int do_pps(struct node *node, struct clock *clock, int fd)
 {
 	int64_t pps_offset, phc_offset, phc_delay;
 	uint64_t pps_ts, phc_ts;
 	clockid_t src = node->master->clkid;
 
-	node->master->source_label = "pps";
-
-	if (src == CLOCK_INVALID) {
-		/* The sync offset can't be applied with PPS alone. */
-		node->sync_offset = 0;
-	} else {
-		enable_pps_output(node->master->clkid);
-	}
-
-	while (is_running()) {
-		if (!read_pps(fd, &pps_offset, &pps_ts)) {
-			continue;
-		}
-
-		/* If a PHC is available, use it to get the whole number
-		   of seconds in the offset and PPS for the rest. */
-		if (src != CLOCK_INVALID) {
-			if (!read_phc(src, clock->clkid, node->phc_readings,
-				      &phc_offset, &phc_ts, &phc_delay))
-				return -1;
+	if (!read_pps(fd, &node->pps_sequence, &pps_offset, &pps_ts))
+		return 0;
 
-			/* Convert the time stamp to the PHC time. */
-			phc_ts -= phc_offset;
+	/* If a PHC is available, use it to get the whole number
+	   of seconds in the offset and PPS for the rest. */
+	if (src != CLOCK_INVALID) {
+		if (!read_phc(src, clock->clkid, node->phc_readings,
+			      &phc_offset, &phc_ts, &phc_delay))
+			return -1;
 
-			/* Check if it is close to the start of the second. */
-			if (phc_ts % NS_PER_SEC > PHC_PPS_OFFSET_LIMIT) {
-				pr_warning("PPS is not in sync with PHC"
-					   " (0.%09lld)", phc_ts % NS_PER_SEC);
-				continue;
-			}
+		/* Convert the time stamp to the PHC time. */
+		phc_ts -= phc_offset;
 
-			phc_ts = phc_ts / NS_PER_SEC * NS_PER_SEC;
-			pps_offset = pps_ts - phc_ts;
+		/* Check if it is close to the start of the second. */
+		if (phc_ts % NS_PER_SEC > PHC_PPS_OFFSET_LIMIT) {
+			pr_warning("PPS is not in sync with PHC"
+				   " (0.%09lld)", phc_ts % NS_PER_SEC);
+			return 0;
 		}
 
-		if (update_pmc(node, 0) < 0)
-			continue;
-		update_clock(node, clock, pps_offset, pps_ts, -1);
+		phc_ts = phc_ts / NS_PER_SEC * NS_PER_SEC;
+		pps_offset = pps_ts - phc_ts;
 	}
-	close(fd);
+
+	update_clock(node, clock, pps_offset, pps_ts, -1);
 	return 0;
 }
 
@@ -715,65 +809,239 @@ static int update_needed(struct clock *c)
 	return 0;
 }
 
-static int do_loop(struct node *node, int subscriptions)
-{
-	struct timespec interval;
-	struct clock *clock;
+/* The measurement of the source clock shared by one batch of updates. */
+struct src_reading {
+	int valid;
+	int64_t offset;
 	uint64_t ts;
+	int64_t delay;
+};
+
+static int do_clock(struct node *node, struct clock *clock,
+		    struct src_reading *src)
+{
 	int64_t offset, delay;
+	uint64_t ts;
 
-	interval.tv_sec = node->phc_interval;
-	interval.tv_nsec = (node->phc_interval - interval.tv_sec) * 1e9;
+	if (!node->master || !update_needed(clock))
+		return 0;
 
-	while (is_running()) {
-		clock_nanosleep(CLOCK_MONOTONIC, 0, &interval, NULL);
-		if (update_pmc(node, subscriptions) < 0)
-			continue;
+	/* don't try to synchronize the clock to itself */
+	if (clock->clkid == node->master->clkid ||
+	    (clock->phc_index >= 0 &&
+	     clock->phc_index == node->master->phc_index) ||
+	    !strcmp(clock->device, node->master->device))
+		return 0;
 
-		if (subscriptions) {
-			run_pmc_events(node);
-			if (node->state_changed) {
-				/* force getting offset, as it may have
-				 * changed after the port state change */
-				if (run_pmc_get_utc_offset(node, 1000) <= 0) {
-					pr_err("failed to get UTC offset");
-					continue;
-				}
-				reconfigure(node);
-			}
-		}
-		if (!node->master)
+	if (sysoff_usable(clock) && sysoff_usable(node->master)) {
+		/* use sysoff */
+		if (!read_sysoff(node, node->master, clock, &src->valid,
+				 &src->offset, &src->ts, &src->delay,
+				 &offset, &ts, &delay))
+			return -1;
+	} else {
+		/* use phc */
+		if (!read_phc(node->master->clkid, clock->clkid,
+			      node->phc_readings, &offset, &ts, &delay))
+			return 0;
+	}
+	update_clock(node, clock, offset, ts, delay);
+
+	/*
+	 * The shared reading is relative to the system clock, which may
+	 * have just been stepped or slewed. Measure the source again for
+	 * the remaining clocks of the batch.
+	 */
+	if (clock->clkid == CLOCK_REALTIME)
+		src->valid = 0;
+	return 0;
+}
+
+static int loop_add(struct node *node, struct loop_source *s,
+		    uint32_t events)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = s;
+	if (epoll_ctl(node->epfd, EPOLL_CTL_ADD, s->fd, &ev)) {
+		pr_err("epoll_ctl failed: %m");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Arm a periodic timer. All timers start at the same time, so the
+ * clocks updated at the same rate wake up the loop together and share
+ * the reading of the source clock.
+ */
+static int timer_start(int fd, struct timespec *start, double interval)
+{
+	struct itimerspec tmo;
+
+	tmo.it_interval.tv_sec = interval;
+	tmo.it_interval.tv_nsec = (interval - tmo.it_interval.tv_sec) * 1e9;
+	if (!tmo.it_interval.tv_sec && !tmo.it_interval.tv_nsec)
+		tmo.it_interval.tv_nsec = 1;
+	tmo.it_value.tv_sec = start->tv_sec + tmo.it_interval.tv_sec;
+	tmo.it_value.tv_nsec = start->tv_nsec + tmo.it_interval.tv_nsec;
+	if (tmo.it_value.tv_nsec >= NS_PER_SEC) {
+		tmo.it_value.tv_sec++;
+		tmo.it_value.tv_nsec -= NS_PER_SEC;
+	}
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &tmo, NULL)) {
+		pr_err("timerfd_settime failed: %m");
+		return -1;
+	}
+	return 0;
+}
+
+static int timer_expired(int fd)
+{
+	uint64_t expirations;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0) {
+		if (errno != EAGAIN)
+			pr_err("timerfd read failed: %m");
+		return 0;
+	}
+	return 1;
+}
+
+static int loop_init(struct node *node, struct clock *pps_clock, int pps_fd)
+{
+	struct timespec start;
+	struct clock *clock;
+	int64_t pps_offset;
+	uint64_t pps_ts;
+
+	node->epfd = epoll_create1(0);
+	if (node->epfd < 0) {
+		pr_err("epoll_create1 failed: %m");
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	LIST_FOREACH(clock, &node->clocks, list) {
+		/* The clock synchronized to a PPS is updated on the pulses. */
+		if (clock == pps_clock)
 			continue;
+		if (timer_start(clock->timer.fd, &start, clock->interval) ||
+		    loop_add(node, &clock->timer, EPOLLIN))
+			return -1;
+	}
+	if (node->pmc) {
+		node->pmc_fd.type = LOOP_PMC;
+		node->pmc_fd.fd = pmc_get_transport_fd(node->pmc);
+		if (loop_add(node, &node->pmc_fd, EPOLLIN | EPOLLPRI))
+			return -1;
+	}
+	if (node->pmc || node->status_name) {
+		node->pmc_timer.type = LOOP_PMC_TIMER;
+		node->pmc_timer.fd = timerfd_create(CLOCK_MONOTONIC,
+						    TFD_NONBLOCK);
+		if (node->pmc_timer.fd < 0) {
+			pr_err("timerfd_create failed: %m");
+			return -1;
+		}
+		if (timer_start(node->pmc_timer.fd, &start, PMC_POLL_INTERVAL) ||
+		    loop_add(node, &node->pmc_timer, EPOLLIN))
+			return -1;
+	}
+	if (pps_fd >= 0) {
+		node->pps.type = LOOP_PPS;
+		node->pps.fd = pps_fd;
+		node->pps.clock = pps_clock;
+		/*
+		 * Some kernels report a PPS device as always readable, but
+		 * they wake up the waiters on each pulse. Edge triggering
+		 * works with both kinds. Skip the pulse fetched last.
+		 */
+		read_pps(pps_fd, &node->pps_sequence, &pps_offset, &pps_ts);
+		if (loop_add(node, &node->pps, EPOLLIN | EPOLLET))
+			return -1;
+	}
+	return 0;
+}
 
-		LIST_FOREACH(clock, &node->clocks, list) {
-			if (!update_needed(clock))
-				continue;
+static void loop_cleanup(struct node *node)
+{
+	if (node->pmc_timer.fd >= 0)
+		close(node->pmc_timer.fd);
+	if (node->epfd >= 0)
+		close(node->epfd);
+}
+
+static void recv_pmc(struct node *node);
 
-			/* don't try to synchronize the clock to itself */
-			if (clock->clkid == node->master->clkid ||
-			    (clock->phc_index >= 0 &&
-			     clock->phc_index == node->master->phc_index) ||
-			    !strcmp(clock->device, node->master->device))
+#define LOOP_MAX_EVENTS 16
+
+/*
+ * Wait for the timers of the clocks, the messages from ptp4l and the
+ * pulses, and handle them as they come. A change of a port state is
+ * acted upon as soon as it is received.
+ */
+static int do_loop(struct node *node, int subscriptions,
+		   struct clock *pps_clock, int pps_fd)
+{
+	struct epoll_event ev[LOOP_MAX_EVENTS];
+	struct loop_source *s;
+	struct src_reading src;
+	int cnt, i, r = -1;
+
+	node->epfd = -1;
+	node->pmc_timer.fd = -1;
+	if (loop_init(node, pps_clock, pps_fd))
+		goto out;
+
+	while (is_running()) {
+		cnt = epoll_wait(node->epfd, ev, LOOP_MAX_EVENTS, -1);
+		if (cnt < 0) {
+			if (errno == EINTR)
 				continue;
+			pr_err("epoll_wait failed: %m");
+			goto out;
+		}
+		src.valid = 0;
+
+		for (i = 0; i < cnt; i++) {
+			s = ev[i].data.ptr;
+			switch (s->type) {
+			case LOOP_CLOCK:
+				if (!timer_expired(s->fd))
+					break;
+				if (do_clock(node, s->clock, &src))
+					goto out;
+				break;
+			case LOOP_PMC:
+				recv_pmc(node);
+				break;
+			case LOOP_PMC_TIMER:
+				if (timer_expired(s->fd))
+					update_pmc(node, subscriptions);
+				break;
+			case LOOP_PPS:
+				if (do_pps(node, s->clock, s->fd))
+					goto out;
+				break;
+			}
+		}
 
-			if (clock->clkid == CLOCK_REALTIME &&
-			    node->master->sysoff_supported) {
-				/* use sysoff */
-				if (sysoff_measure(CLOCKID_TO_FD(node->master->clkid),
-						   node->phc_readings,
-						   &offset, &ts, &delay))
-					return -1;
-			} else {
-				/* use phc */
-				if (!read_phc(node->master->clkid, clock->clkid,
-					      node->phc_readings,
-					      &offset, &ts, &delay))
-					continue;
+		if (subscriptions && node->state_changed) {
+			/* force getting offset, as it may have
+			 * changed after the port state change */
+			if (run_pmc_get_utc_offset(node, 1000) <= 0) {
+				pr_err("failed to get UTC offset");
+				continue;
 			}
-			update_clock(node, clock, offset, ts, delay);
+			reconfigure(node);
 		}
 	}
-	return 0;
+	r = 0;
+out:
+	loop_cleanup(node);
+	return r;
 }
 
 static int check_clock_identity(struct node *node, struct ptp_message *msg)
@@ -1015,6 +1283,62 @@ static int run_pmc_wait_sync(struct node *node, int timeout)
 	}
 }
 
+/* Reads the port states from the status segment of ptp4l instead. */
+/* Opens the status segment as needed, and drops it when it got stuck. */
+static int run_status_read(struct node *node, struct status_data *data)
+{
+	if (!node->status) {
+		/* ptp4l may not be up yet, only report the first failure. */
+		node->status = status_open(node->status_name,
+					   node->status_failed ?
+					   LOG_DEBUG : LOG_ERR);
+		node->status_failed = !node->status;
+		if (!node->status) {
+			return -1;
+		}
+	}
+	if (status_read(node->status, data)) {
+		print(node->status_stalled ? LOG_DEBUG : LOG_ERR,
+		      "status segment %s is stuck in an update, reopening it",
+		      node->status_name);
+		node->status_stalled = 1;
+		status_destroy(node->status);
+		node->status = NULL;
+		return -1;
+	}
+	node->status_stalled = 0;
+	return 0;
+}
+
+static int run_status_wait_sync(struct node *node)
+{
+	struct status_data data;
+	unsigned int i;
+
+	if (!run_status_read(node, &data)) {
+		for (i = 0; i < data.num_ports; i++) {
+			switch (data.port[i].portState) {
+			case PS_MASTER:
+			case PS_SLAVE:
+				return 1;
+			}
+		}
+	}
+	sleep(1);
+	return 0;
+}
+
+static int run_status_get_utc_offset(struct node *node)
+{
+	struct status_data data;
+
+	if (run_status_read(node, &data)) {
+		return -1;
+	}
+	update_utc_offset(node, &data.tds);
+	return 0;
+}
+
 static int run_pmc_get_utc_offset(struct node *node, int timeout)
 {
 	struct ptp_message *msg;
@@ -1026,6 +1350,13 @@ static int run_pmc_get_utc_offset(struct node *node, int timeout)
 		return res;
 
 	tds = (struct timePropertiesDS *)get_mgt_data(msg);
+	update_utc_offset(node, tds);
+	msg_put(msg);
+	return 1;
+}
+
+static void update_utc_offset(struct node *node, struct timePropertiesDS *tds)
+{
 	if (tds->flags & PTP_TIMESCALE) {
 		node->sync_offset = tds->currentUtcOffset;
 		if (tds->flags & LEAP_61)
@@ -1041,8 +1372,6 @@ static int run_pmc_get_utc_offset(struct node *node, int timeout)
 		node->leap = 0;
 		node->utc_offset_traceable = 0;
 	}
-	msg_put(msg);
-	return 1;
 }
 
 static int run_pmc_get_number_ports(struct node *node, int timeout)
@@ -1073,11 +1402,24 @@ static int run_pmc_subscribe(struct node *node, int timeout)
 	return 1;
 }
 
-static void run_pmc_events(struct node *node)
+/* Handle a message from ptp4l received outside of run_pmc(). */
+static void recv_pmc(struct node *node)
 {
 	struct ptp_message *msg;
+	struct timespec tp;
 
-	run_pmc(node, 0, -1, &msg);
+	msg = pmc_recv(node->pmc);
+	if (!msg)
+		return;
+
+	if (check_clock_identity(node, msg) && is_msg_mgt(msg) > 0 &&
+	    !recv_subscribed(node, msg, -1) &&
+	    get_mgt_id(msg) == TLV_TIME_PROPERTIES_DATA_SET &&
+	    !clock_gettime(CLOCK_MONOTONIC, &tp)) {
+		update_utc_offset(node, get_mgt_data(msg));
+		node->pmc_last_update = tp.tv_sec * NS_PER_SEC + tp.tv_nsec;
+	}
+	msg_put(msg);
 }
 
 static int run_pmc_port_properties(struct node *node, int timeout,
@@ -1231,13 +1573,20 @@ static int update_pmc(struct node *node, int subscribe)
 	}
 	ts = tp.tv_sec * NS_PER_SEC + tp.tv_nsec;
 
+	/* Reading the status segment costs no more than a copy. */
+	if (node->status_name) {
+		run_status_get_utc_offset(node);
+		return 0;
+	}
+
+	/* The responses are handled by recv_pmc(), which updates
+	   pmc_last_update. Until then, ask again on each call. */
 	if (node->pmc &&
 	    !(ts > node->pmc_last_update &&
 	      ts - node->pmc_last_update < PMC_UPDATE_INTERVAL)) {
 		if (subscribe)
-			run_pmc_subscribe(node, 0);
-		if (run_pmc_get_utc_offset(node, 0) > 0)
-			node->pmc_last_update = ts;
+			send_subscription(node);
+		pmc_send_get_action(node->pmc, TLV_TIME_PROPERTIES_DATA_SET);
 	}
 
 	return 0;
@@ -1318,7 +1667,7 @@ static void usage(char *progname)
 		" -w             wait for ptp4l\n"
 		" common options:\n"
 		" -f [file]      configuration file\n"
-		" -E [pi|linreg] clock servo (pi)\n"
+		" -E [pi|linreg|kalman] clock servo (pi)\n"
 		" -P [kp]        proportional constant (0.7)\n"
 		" -I [ki]        integration constant (0.3)\n"
 		" -S [step]      step threshold (disabled)\n"
@@ -1352,7 +1701,6 @@ int main(int argc, char *argv[])
 	double phc_rate, tmp;
 	struct node node = {
 		.phc_readings = 5,
-		.phc_interval = 1.0,
 	};
 
 	handle_term_signals();
@@ -1412,6 +1760,9 @@ int main(int argc, char *argv[])
 			} else if (!strcasecmp(optarg, "linreg")) {
 				config_set_int(cfg, "clock_servo",
 					       CLOCK_SERVO_LINREG);
+			} else if (!strcasecmp(optarg, "kalman")) {
+				config_set_int(cfg, "clock_servo",
+					       CLOCK_SERVO_KALMAN);
 			} else if (!strcasecmp(optarg, "ntpshm")) {
 				config_set_int(cfg, "clock_servo",
 					       CLOCK_SERVO_NTPSHM);
@@ -1442,9 +1793,9 @@ int main(int argc, char *argv[])
 				goto end;
 			break;
 		case 'R':
-			if (get_arg_val_d(c, optarg, &phc_rate, 1e-9, DBL_MAX))
+			if (get_arg_val_d(c, optarg, &phc_rate, 1e-9, DBL_MAX) ||
+			    config_set_double(cfg, "update_rate", phc_rate))
 				goto end;
-			node.phc_interval = 1.0 / phc_rate;
 			break;
 		case 'N':
 			if (get_arg_val_i(c, optarg, &node.phc_readings, 1, INT_MAX))
@@ -1569,6 +1920,7 @@ int main(int argc, char *argv[])
 		config_set_int(cfg, "sanity_freq_limit", 0);
 	}
 	node.kernel_leap = config_get_int(cfg, NULL, "kernel_leap");
+	node.sysoff_estimator = config_get_int(cfg, NULL, "sysoff_estimator");
 	node.sanity_freq_limit = config_get_int(cfg, NULL, "sanity_freq_limit");
 
 	if (autocfg) {
@@ -1576,7 +1928,7 @@ int main(int argc, char *argv[])
 			goto end;
 		if (auto_init_ports(&node, rt) < 0)
 			goto end;
-		r = do_loop(&node, 1);
+		r = do_loop(&node, 1, NULL, -1);
 		goto end;
 	}
 
@@ -1608,11 +1960,16 @@ int main(int argc, char *argv[])
 	r = -1;
 
 	if (wait_sync) {
-		if (init_pmc(cfg, &node))
+		node.status_name = config_get_string(cfg, NULL,
+						     "status_segment");
+		if (!node.status_name && init_pmc(cfg, &node))
 			goto end;
 
 		while (is_running()) {
-			r = run_pmc_wait_sync(&node, 1000);
+			if (node.status_name)
+				r = run_status_wait_sync(&node);
+			else
+				r = run_pmc_wait_sync(&node, 1000);
 			if (r < 0)
 				goto end;
 			if (r > 0)
@@ -1621,7 +1978,12 @@ int main(int argc, char *argv[])
 				pr_notice("Waiting for ptp4l...");
 		}
 
-		if (!node.forced_sync_offset) {
+		if (node.status_name && !node.forced_sync_offset) {
+			if (run_status_get_utc_offset(&node)) {
+				pr_err("failed to get UTC offset");
+				goto end;
+			}
+		} else if (!node.forced_sync_offset) {
 			r = run_pmc_get_utc_offset(&node, 1000);
 			if (r <= 0) {
 				pr_err("failed to get UTC offset");
@@ -1631,22 +1993,39 @@ int main(int argc, char *argv[])
 
 		if (node.forced_sync_offset ||
 		    (src->clkid != CLOCK_REALTIME && dst->clkid != CLOCK_REALTIME) ||
-		    src->clkid == CLOCK_INVALID)
-			close_pmc(&node);
+		    src->clkid == CLOCK_INVALID) {
+			if (node.pmc)
+				close_pmc(&node);
+			if (node.status) {
+				status_destroy(node.status);
+				node.status = NULL;
+			}
+			node.status_name = NULL;
+		}
 	}
 
 	if (pps_fd >= 0) {
 		/* only one destination clock allowed with PPS until we
 		 * implement a mean to specify PTP port to PPS mapping */
 		servo_sync_interval(dst->servo, 1.0);
-		r = do_pps_loop(&node, dst, pps_fd);
+		src->source_label = "pps";
+		if (src->clkid == CLOCK_INVALID) {
+			/* The sync offset can't be applied with PPS alone. */
+			node.sync_offset = 0;
+		} else {
+			enable_pps_output(src->clkid);
+		}
+		r = do_loop(&node, 0, dst, pps_fd);
+		close(pps_fd);
 	} else {
-		r = do_loop(&node, 0);
+		r = do_loop(&node, 0, NULL, -1);
 	}
 
 end:
 	if (node.pmc)
 		close_pmc(&node);
+	if (node.status)
+		status_destroy(node.status);
 	clock_cleanup(&node);
 	port_cleanup(&node);
 	config_destroy(cfg);
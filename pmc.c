@@ -40,8 +40,24 @@
 #define AMBIGUOUS_ID -2
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 #define P41 ((double)(1ULL << 41))
+#define MAX_SERVERS 128
+/*
+ * A UNIX datagram socket queues only 10 messages by default. With more
+ * requests in flight, pmc could block sending a request while ptp4l
+ * blocks sending a reply to pmc.
+ */
+#define MAX_IN_FLIGHT 8
+
+struct server {
+	struct pmc *pmc;
+	char *address;
+	char local[MAX_IFNAME_SIZE + 1];
+};
 
 static struct pmc *pmc;
+static struct server servers[MAX_SERVERS];
+static int n_servers;
+static int json_output;
 
 static void do_get_action(int action, int index, char *str);
 static void do_set_action(int action, int index, char *str);
@@ -88,6 +104,8 @@ struct management_id idtab[] = {
 	{ "PRIMARY_DOMAIN", TLV_PRIMARY_DOMAIN, not_supported },
 	{ "TIME_STATUS_NP", TLV_TIME_STATUS_NP, do_get_action },
 	{ "GRANDMASTER_SETTINGS_NP", TLV_GRANDMASTER_SETTINGS_NP, do_set_action },
+	{ "MSG_POOL_NP", TLV_MSG_POOL_NP, do_get_action },
+	{ "BMCA_STATS_NP", TLV_BMCA_STATS_NP, do_get_action },
 /* Port management ID values */
 	{ "NULL_MANAGEMENT", TLV_NULL_MANAGEMENT, null_management },
 	{ "CLOCK_DESCRIPTION", TLV_CLOCK_DESCRIPTION, do_get_action },
@@ -107,6 +125,7 @@ struct management_id idtab[] = {
 	{ "DELAY_MECHANISM", TLV_DELAY_MECHANISM, do_get_action },
 	{ "LOG_MIN_PDELAY_REQ_INTERVAL", TLV_LOG_MIN_PDELAY_REQ_INTERVAL, do_get_action },
 	{ "PORT_DATA_SET_NP", TLV_PORT_DATA_SET_NP, do_set_action },
+	{ "PORT_HISTOGRAM_NP", TLV_PORT_HISTOGRAM_NP, do_get_action },
 };
 
 static const char *action_string[] = {
@@ -118,6 +137,107 @@ static const char *action_string[] = {
 };
 
 #define IFMT "\n\t\t"
+/* The largest TLV, GRANDMASTER_SETTINGS_NP, has 11 fields. */
+#define MAX_FIELDS 16
+#define FIELD_LEN (MAX_PTP_OCTETS + 1)
+
+enum field_type {
+	FIELD_INT,
+	FIELD_UINT,
+	FIELD_HEX,
+	FIELD_FLOAT,
+	FIELD_RATE,
+	FIELD_BOOL,
+	FIELD_STR,
+	FIELD_HISTOGRAM,
+};
+
+struct field {
+	const char *name;
+	enum field_type type;
+	int digits;
+	union {
+		int64_t i;
+		uint64_t u;
+		double f;
+		struct histogram_np h;
+	} val;
+	char str[FIELD_LEN];
+};
+
+/*
+ * The fields of one management TLV. They are extracted once, and then
+ * printed either as text or as JSON.
+ */
+struct fields {
+	int n;
+	struct field f[MAX_FIELDS];
+};
+
+static struct field *field_add(struct fields *fs, const char *name,
+			       enum field_type type)
+{
+	struct field *f = &fs->f[fs->n++];
+
+	f->name = name;
+	f->type = type;
+	f->digits = 0;
+	return f;
+}
+
+static void field_int(struct fields *fs, const char *name, int64_t val)
+{
+	field_add(fs, name, FIELD_INT)->val.i = val;
+}
+
+static void field_uint(struct fields *fs, const char *name, uint64_t val)
+{
+	field_add(fs, name, FIELD_UINT)->val.u = val;
+}
+
+static void field_hex(struct fields *fs, const char *name, uint64_t val,
+		      int digits)
+{
+	struct field *f = field_add(fs, name, FIELD_HEX);
+
+	f->val.u = val;
+	f->digits = digits;
+}
+
+static void field_float(struct fields *fs, const char *name, double val,
+			int digits)
+{
+	struct field *f = field_add(fs, name, FIELD_FLOAT);
+
+	f->val.f = val;
+	f->digits = digits;
+}
+
+static void field_rate(struct fields *fs, const char *name, double val)
+{
+	struct field *f = field_add(fs, name, FIELD_RATE);
+
+	f->val.f = val;
+	f->digits = 9;
+}
+
+static void field_bool(struct fields *fs, const char *name, int val)
+{
+	field_add(fs, name, FIELD_BOOL)->val.i = val ? 1 : 0;
+}
+
+static void field_str(struct fields *fs, const char *name, const char *str)
+{
+	struct field *f = field_add(fs, name, FIELD_STR);
+
+	snprintf(f->str, sizeof(f->str), "%s", str);
+}
+
+static void field_histogram(struct fields *fs, const char *name,
+			    struct histogram_np h)
+{
+	field_add(fs, name, FIELD_HISTOGRAM)->val.h = h;
+}
 
 static char *text2str(struct PTPText *text)
 {
@@ -133,311 +253,510 @@ static char *bin2str(Octet *data, int len)
 	return bin2str_impl(data, len, buf, sizeof(buf));
 }
 
-static void pmc_show(struct ptp_message *msg, FILE *fp)
+static const char *id_name(int code)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(idtab); i++) {
+		if (idtab[i].code == code)
+			return idtab[i].name;
+	}
+	return "unknown";
+}
+
+/* Returns -1 if the fields of the management ID are not known. */
+static int extract_fields(struct management_tlv *mgt,
+			  struct tlv_extra *extra, struct fields *fs)
 {
-	int action;
-	struct TLV *tlv;
-	struct management_tlv *mgt;
 	struct management_tlv_datum *mtd;
+	struct grandmaster_settings_np *gsn;
+	struct port_histogram_np *phn;
+	struct mgmt_clock_description *cd;
+	struct timePropertiesDS *tp;
+	struct time_status_np *tsn;
+	struct port_ds_np *pnp;
+	struct msg_pool_np *mpn;
+	struct bmca_stats_np *bsn;
 	struct defaultDS *dds;
 	struct currentDS *cds;
 	struct parentDS *pds;
-	struct timePropertiesDS *tp;
-	struct time_status_np *tsn;
-	struct grandmaster_settings_np *gsn;
-	struct mgmt_clock_description *cd;
-	struct tlv_extra *extra;
+	struct field *f;
 	struct portDS *p;
-	struct port_ds_np *pnp;
 
-	if (msg_type(msg) != MANAGEMENT) {
-		return;
-	}
-	action = management_action(msg);
-	if (action < GET || action > ACKNOWLEDGE) {
-		return;
-	}
-	fprintf(fp, "\t%s seq %hu %s ",
-		pid2str(&msg->header.sourcePortIdentity),
-		msg->header.sequenceId, action_string[action]);
-	if (msg->tlv_count != 1) {
-		goto out;
-	}
-	extra = TAILQ_FIRST(&msg->tlv_list);
-	tlv = (struct TLV *) msg->management.suffix;
-	if (tlv->type == TLV_MANAGEMENT) {
-		fprintf(fp, "MANAGEMENT ");
-	} else if (tlv->type == TLV_MANAGEMENT_ERROR_STATUS) {
-		fprintf(fp, "MANAGEMENT_ERROR_STATUS ");
-		goto out;
-	} else {
-		fprintf(fp, "unknown-tlv ");
-		goto out;
-	}
-	mgt = (struct management_tlv *) msg->management.suffix;
-	if (mgt->length == 2 && mgt->id != TLV_NULL_MANAGEMENT) {
-		fprintf(fp, "empty-tlv ");
-		goto out;
-	}
+	fs->n = 0;
+	mtd = (struct management_tlv_datum *) mgt->data;
+
 	switch (mgt->id) {
 	case TLV_CLOCK_DESCRIPTION:
 		cd = &extra->cd;
-		fprintf(fp, "CLOCK_DESCRIPTION "
-			IFMT "clockType             0x%hx"
-			IFMT "physicalLayerProtocol %s"
-			IFMT "physicalAddress       %s"
-			IFMT "protocolAddress       %hu %s",
-			align16(cd->clockType),
-			text2str(cd->physicalLayerProtocol),
-			bin2str(cd->physicalAddress->address,
-				align16(&cd->physicalAddress->length)),
-			align16(&cd->protocolAddress->networkProtocol),
-			portaddr2str(cd->protocolAddress));
-		fprintf(fp, IFMT "manufacturerId        %s"
-			IFMT "productDescription    %s",
-			bin2str(cd->manufacturerIdentity, OUI_LEN),
-			text2str(cd->productDescription));
-		fprintf(fp, IFMT "revisionData          %s",
-			text2str(cd->revisionData));
-		fprintf(fp, IFMT "userDescription       %s"
-			IFMT "profileId             %s",
-			text2str(cd->userDescription),
-			bin2str(cd->profileIdentity, PROFILE_ID_LEN));
+		field_hex(fs, "clockType", align16(cd->clockType), 0);
+		field_str(fs, "physicalLayerProtocol",
+			  text2str(cd->physicalLayerProtocol));
+		field_str(fs, "physicalAddress",
+			  bin2str(cd->physicalAddress->address,
+				  cd->physicalAddress->length));
+		f = field_add(fs, "protocolAddress", FIELD_STR);
+		snprintf(f->str, sizeof(f->str), "%hu %s",
+			 cd->protocolAddress->networkProtocol,
+			 portaddr2str(cd->protocolAddress));
+		field_str(fs, "manufacturerId",
+			  bin2str(cd->manufacturerIdentity, OUI_LEN));
+		field_str(fs, "productDescription",
+			  text2str(cd->productDescription));
+		field_str(fs, "revisionData", text2str(cd->revisionData));
+		field_str(fs, "userDescription", text2str(cd->userDescription));
+		field_str(fs, "profileId",
+			  bin2str(cd->profileIdentity, PROFILE_ID_LEN));
 		break;
 	case TLV_USER_DESCRIPTION:
-		fprintf(fp, "USER_DESCRIPTION "
-			IFMT "userDescription  %s",
-			text2str(extra->cd.userDescription));
+		field_str(fs, "userDescription",
+			  text2str(extra->cd.userDescription));
 		break;
 	case TLV_DEFAULT_DATA_SET:
 		dds = (struct defaultDS *) mgt->data;
-		fprintf(fp, "DEFAULT_DATA_SET "
-			IFMT "twoStepFlag             %d"
-			IFMT "slaveOnly               %d"
-			IFMT "numberPorts             %hu"
-			IFMT "priority1               %hhu"
-			IFMT "clockClass              %hhu"
-			IFMT "clockAccuracy           0x%02hhx"
-			IFMT "offsetScaledLogVariance 0x%04hx"
-			IFMT "priority2               %hhu"
-			IFMT "clockIdentity           %s"
-			IFMT "domainNumber            %hhu",
-			dds->flags & DDS_TWO_STEP_FLAG ? 1 : 0,
-			dds->flags & DDS_SLAVE_ONLY ? 1 : 0,
-			dds->numberPorts,
-			dds->priority1,
-			dds->clockQuality.clockClass,
-			dds->clockQuality.clockAccuracy,
-			dds->clockQuality.offsetScaledLogVariance,
-			dds->priority2,
-			cid2str(&dds->clockIdentity),
-			dds->domainNumber);
+		field_int(fs, "twoStepFlag",
+			  dds->flags & DDS_TWO_STEP_FLAG ? 1 : 0);
+		field_int(fs, "slaveOnly", dds->flags & DDS_SLAVE_ONLY ? 1 : 0);
+		field_uint(fs, "numberPorts", dds->numberPorts);
+		field_uint(fs, "priority1", dds->priority1);
+		field_uint(fs, "clockClass", dds->clockQuality.clockClass);
+		field_hex(fs, "clockAccuracy",
+			  dds->clockQuality.clockAccuracy, 2);
+		field_hex(fs, "offsetScaledLogVariance",
+			  dds->clockQuality.offsetScaledLogVariance, 4);
+		field_uint(fs, "priority2", dds->priority2);
+		field_str(fs, "clockIdentity", cid2str(&dds->clockIdentity));
+		field_uint(fs, "domainNumber", dds->domainNumber);
 		break;
 	case TLV_CURRENT_DATA_SET:
 		cds = (struct currentDS *) mgt->data;
-		fprintf(fp, "CURRENT_DATA_SET "
-			IFMT "stepsRemoved     %hd"
-			IFMT "offsetFromMaster %.1f"
-			IFMT "meanPathDelay    %.1f",
-			cds->stepsRemoved, cds->offsetFromMaster / 65536.0,
-			cds->meanPathDelay / 65536.0);
+		field_int(fs, "stepsRemoved", (Integer16) cds->stepsRemoved);
+		field_float(fs, "offsetFromMaster",
+			    cds->offsetFromMaster / 65536.0, 1);
+		field_float(fs, "meanPathDelay",
+			    cds->meanPathDelay / 65536.0, 1);
 		break;
 	case TLV_PARENT_DATA_SET:
 		pds = (struct parentDS *) mgt->data;
-		fprintf(fp, "PARENT_DATA_SET "
-			IFMT "parentPortIdentity                    %s"
-			IFMT "parentStats                           %hhu"
-			IFMT "observedParentOffsetScaledLogVariance 0x%04hx"
-			IFMT "observedParentClockPhaseChangeRate    0x%08x"
-			IFMT "grandmasterPriority1                  %hhu"
-			IFMT "gm.ClockClass                         %hhu"
-			IFMT "gm.ClockAccuracy                      0x%02hhx"
-			IFMT "gm.OffsetScaledLogVariance            0x%04hx"
-			IFMT "grandmasterPriority2                  %hhu"
-			IFMT "grandmasterIdentity                   %s",
-			pid2str(&pds->parentPortIdentity),
-			pds->parentStats,
-			pds->observedParentOffsetScaledLogVariance,
-			pds->observedParentClockPhaseChangeRate,
-			pds->grandmasterPriority1,
-			pds->grandmasterClockQuality.clockClass,
-			pds->grandmasterClockQuality.clockAccuracy,
-			pds->grandmasterClockQuality.offsetScaledLogVariance,
-			pds->grandmasterPriority2,
-			cid2str(&pds->grandmasterIdentity));
+		field_str(fs, "parentPortIdentity",
+			  pid2str(&pds->parentPortIdentity));
+		field_uint(fs, "parentStats", pds->parentStats);
+		field_hex(fs, "observedParentOffsetScaledLogVariance",
+			  pds->observedParentOffsetScaledLogVariance, 4);
+		field_hex(fs, "observedParentClockPhaseChangeRate",
+			  (uint32_t) pds->observedParentClockPhaseChangeRate, 8);
+		field_uint(fs, "grandmasterPriority1",
+			   pds->grandmasterPriority1);
+		field_uint(fs, "gm.ClockClass",
+			   pds->grandmasterClockQuality.clockClass);
+		field_hex(fs, "gm.ClockAccuracy",
+			  pds->grandmasterClockQuality.clockAccuracy, 2);
+		field_hex(fs, "gm.OffsetScaledLogVariance",
+			  pds->grandmasterClockQuality.offsetScaledLogVariance,
+			  4);
+		field_uint(fs, "grandmasterPriority2",
+			   pds->grandmasterPriority2);
+		field_str(fs, "grandmasterIdentity",
+			  cid2str(&pds->grandmasterIdentity));
 		break;
 	case TLV_TIME_PROPERTIES_DATA_SET:
 		tp = (struct timePropertiesDS *) mgt->data;
-		fprintf(fp, "TIME_PROPERTIES_DATA_SET "
-			IFMT "currentUtcOffset      %hd"
-			IFMT "leap61                %d"
-			IFMT "leap59                %d"
-			IFMT "currentUtcOffsetValid %d"
-			IFMT "ptpTimescale          %d"
-			IFMT "timeTraceable         %d"
-			IFMT "frequencyTraceable    %d"
-			IFMT "timeSource            0x%02hhx",
-			tp->currentUtcOffset,
-			tp->flags & LEAP_61 ? 1 : 0,
-			tp->flags & LEAP_59 ? 1 : 0,
-			tp->flags & UTC_OFF_VALID ? 1 : 0,
-			tp->flags & PTP_TIMESCALE ? 1 : 0,
-			tp->flags & TIME_TRACEABLE ? 1 : 0,
-			tp->flags & FREQ_TRACEABLE ? 1 : 0,
-			tp->timeSource);
+		field_int(fs, "currentUtcOffset", tp->currentUtcOffset);
+		field_int(fs, "leap61", tp->flags & LEAP_61 ? 1 : 0);
+		field_int(fs, "leap59", tp->flags & LEAP_59 ? 1 : 0);
+		field_int(fs, "currentUtcOffsetValid",
+			  tp->flags & UTC_OFF_VALID ? 1 : 0);
+		field_int(fs, "ptpTimescale", tp->flags & PTP_TIMESCALE ? 1 : 0);
+		field_int(fs, "timeTraceable",
+			  tp->flags & TIME_TRACEABLE ? 1 : 0);
+		field_int(fs, "frequencyTraceable",
+			  tp->flags & FREQ_TRACEABLE ? 1 : 0);
+		field_hex(fs, "timeSource", tp->timeSource, 2);
 		break;
 	case TLV_PRIORITY1:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "PRIORITY1 "
-			IFMT "priority1 %hhu", mtd->val);
+		field_uint(fs, "priority1", mtd->val);
 		break;
 	case TLV_PRIORITY2:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "PRIORITY2 "
-			IFMT "priority2 %hhu", mtd->val);
+		field_uint(fs, "priority2", mtd->val);
 		break;
 	case TLV_DOMAIN:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "DOMAIN "
-			IFMT "domainNumber %hhu", mtd->val);
+		field_uint(fs, "domainNumber", mtd->val);
 		break;
 	case TLV_SLAVE_ONLY:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "SLAVE_ONLY "
-			IFMT "slaveOnly %d", mtd->val & DDS_SLAVE_ONLY ? 1 : 0);
+		field_int(fs, "slaveOnly", mtd->val & DDS_SLAVE_ONLY ? 1 : 0);
 		break;
 	case TLV_CLOCK_ACCURACY:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "CLOCK_ACCURACY "
-			IFMT "clockAccuracy 0x%02hhx", mtd->val);
+		field_hex(fs, "clockAccuracy", mtd->val, 2);
 		break;
 	case TLV_TRACEABILITY_PROPERTIES:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "TRACEABILITY_PROPERTIES "
-			IFMT "timeTraceable      %d"
-			IFMT "frequencyTraceable %d",
-			mtd->val & TIME_TRACEABLE ? 1 : 0,
-			mtd->val & FREQ_TRACEABLE ? 1 : 0);
+		field_int(fs, "timeTraceable",
+			  mtd->val & TIME_TRACEABLE ? 1 : 0);
+		field_int(fs, "frequencyTraceable",
+			  mtd->val & FREQ_TRACEABLE ? 1 : 0);
 		break;
 	case TLV_TIMESCALE_PROPERTIES:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "TIMESCALE_PROPERTIES "
-			IFMT "ptpTimescale %d", mtd->val & PTP_TIMESCALE ? 1 : 0);
+		field_int(fs, "ptpTimescale", mtd->val & PTP_TIMESCALE ? 1 : 0);
 		break;
 	case TLV_TIME_STATUS_NP:
 		tsn = (struct time_status_np *) mgt->data;
-		fprintf(fp, "TIME_STATUS_NP "
-			IFMT "master_offset              %" PRId64
-			IFMT "ingress_time               %" PRId64
-			IFMT "cumulativeScaledRateOffset %+.9f"
-			IFMT "scaledLastGmPhaseChange    %d"
-			IFMT "gmTimeBaseIndicator        %hu"
-			IFMT "lastGmPhaseChange          0x%04hx'%016" PRIx64 ".%04hx"
-			IFMT "gmPresent                  %s"
-			IFMT "gmIdentity                 %s",
-			tsn->master_offset,
-			tsn->ingress_time,
-			(tsn->cumulativeScaledRateOffset + 0.0) / P41,
-			tsn->scaledLastGmPhaseChange,
-			tsn->gmTimeBaseIndicator,
-			tsn->lastGmPhaseChange.nanoseconds_msb,
-			tsn->lastGmPhaseChange.nanoseconds_lsb,
-			tsn->lastGmPhaseChange.fractional_nanoseconds,
-			tsn->gmPresent ? "true" : "false",
-			cid2str(&tsn->gmIdentity));
+		field_int(fs, "master_offset", tsn->master_offset);
+		field_int(fs, "ingress_time", tsn->ingress_time);
+		field_rate(fs, "cumulativeScaledRateOffset",
+			   (tsn->cumulativeScaledRateOffset + 0.0) / P41);
+		field_int(fs, "scaledLastGmPhaseChange",
+			  tsn->scaledLastGmPhaseChange);
+		field_uint(fs, "gmTimeBaseIndicator", tsn->gmTimeBaseIndicator);
+		f = field_add(fs, "lastGmPhaseChange", FIELD_STR);
+		snprintf(f->str, sizeof(f->str), "0x%04hx'%016" PRIx64 ".%04hx",
+			 tsn->lastGmPhaseChange.nanoseconds_msb,
+			 tsn->lastGmPhaseChange.nanoseconds_lsb,
+			 tsn->lastGmPhaseChange.fractional_nanoseconds);
+		field_bool(fs, "gmPresent", tsn->gmPresent);
+		field_str(fs, "gmIdentity", cid2str(&tsn->gmIdentity));
 		break;
 	case TLV_GRANDMASTER_SETTINGS_NP:
 		gsn = (struct grandmaster_settings_np *) mgt->data;
-		fprintf(fp, "GRANDMASTER_SETTINGS_NP "
-			IFMT "clockClass              %hhu"
-			IFMT "clockAccuracy           0x%02hhx"
-			IFMT "offsetScaledLogVariance 0x%04hx"
-			IFMT "currentUtcOffset        %hd"
-			IFMT "leap61                  %d"
-			IFMT "leap59                  %d"
-			IFMT "currentUtcOffsetValid   %d"
-			IFMT "ptpTimescale            %d"
-			IFMT "timeTraceable           %d"
-			IFMT "frequencyTraceable      %d"
-			IFMT "timeSource              0x%02hhx",
-			gsn->clockQuality.clockClass,
-			gsn->clockQuality.clockAccuracy,
-			gsn->clockQuality.offsetScaledLogVariance,
-			gsn->utc_offset,
-			gsn->time_flags & LEAP_61 ? 1 : 0,
-			gsn->time_flags & LEAP_59 ? 1 : 0,
-			gsn->time_flags & UTC_OFF_VALID ? 1 : 0,
-			gsn->time_flags & PTP_TIMESCALE ? 1 : 0,
-			gsn->time_flags & TIME_TRACEABLE ? 1 : 0,
-			gsn->time_flags & FREQ_TRACEABLE ? 1 : 0,
-			gsn->time_source);
+		field_uint(fs, "clockClass", gsn->clockQuality.clockClass);
+		field_hex(fs, "clockAccuracy",
+			  gsn->clockQuality.clockAccuracy, 2);
+		field_hex(fs, "offsetScaledLogVariance",
+			  gsn->clockQuality.offsetScaledLogVariance, 4);
+		field_int(fs, "currentUtcOffset", gsn->utc_offset);
+		field_int(fs, "leap61", gsn->time_flags & LEAP_61 ? 1 : 0);
+		field_int(fs, "leap59", gsn->time_flags & LEAP_59 ? 1 : 0);
+		field_int(fs, "currentUtcOffsetValid",
+			  gsn->time_flags & UTC_OFF_VALID ? 1 : 0);
+		field_int(fs, "ptpTimescale",
+			  gsn->time_flags & PTP_TIMESCALE ? 1 : 0);
+		field_int(fs, "timeTraceable",
+			  gsn->time_flags & TIME_TRACEABLE ? 1 : 0);
+		field_int(fs, "frequencyTraceable",
+			  gsn->time_flags & FREQ_TRACEABLE ? 1 : 0);
+		field_hex(fs, "timeSource", gsn->time_source, 2);
+		break;
+	case TLV_MSG_POOL_NP:
+		mpn = (struct msg_pool_np *) mgt->data;
+		field_uint(fs, "allocations", mpn->allocations);
+		field_uint(fs, "misses", mpn->misses);
+		field_uint(fs, "trims", mpn->trims);
+		field_uint(fs, "in_use", mpn->in_use);
+		field_uint(fs, "peak_in_use", mpn->peak_in_use);
+		field_uint(fs, "free", mpn->free);
+		field_uint(fs, "slabs", mpn->slabs);
+		break;
+	case TLV_BMCA_STATS_NP:
+		bsn = (struct bmca_stats_np *) mgt->data;
+		field_uint(fs, "runs", bsn->runs);
+		field_uint(fs, "full_runs", bsn->full_runs);
+		field_uint(fs, "decisions", bsn->decisions);
+		field_uint(fs, "last_ns", bsn->last_ns);
+		field_uint(fs, "max_ns", bsn->max_ns);
+		field_uint(fs, "total_ns", bsn->total_ns);
 		break;
 	case TLV_PORT_DATA_SET:
 		p = (struct portDS *) mgt->data;
 		if (p->portState > PS_SLAVE) {
 			p->portState = 0;
 		}
-		fprintf(fp, "PORT_DATA_SET "
-			IFMT "portIdentity            %s"
-			IFMT "portState               %s"
-			IFMT "logMinDelayReqInterval  %hhd"
-			IFMT "peerMeanPathDelay       %" PRId64
-			IFMT "logAnnounceInterval     %hhd"
-			IFMT "announceReceiptTimeout  %hhu"
-			IFMT "logSyncInterval         %hhd"
-			IFMT "delayMechanism          %hhu"
-			IFMT "logMinPdelayReqInterval %hhd"
-			IFMT "versionNumber           %hhu",
-			pid2str(&p->portIdentity), ps_str[p->portState],
-			p->logMinDelayReqInterval, p->peerMeanPathDelay >> 16,
-			p->logAnnounceInterval, p->announceReceiptTimeout,
-			p->logSyncInterval, p->delayMechanism,
-			p->logMinPdelayReqInterval, p->versionNumber);
+		field_str(fs, "portIdentity", pid2str(&p->portIdentity));
+		field_str(fs, "portState", ps_str[p->portState]);
+		field_int(fs, "logMinDelayReqInterval",
+			  p->logMinDelayReqInterval);
+		field_int(fs, "peerMeanPathDelay", p->peerMeanPathDelay >> 16);
+		field_int(fs, "logAnnounceInterval", p->logAnnounceInterval);
+		field_uint(fs, "announceReceiptTimeout",
+			   p->announceReceiptTimeout);
+		field_int(fs, "logSyncInterval", p->logSyncInterval);
+		field_uint(fs, "delayMechanism", p->delayMechanism);
+		field_int(fs, "logMinPdelayReqInterval",
+			  p->logMinPdelayReqInterval);
+		field_uint(fs, "versionNumber", p->versionNumber);
 		break;
 	case TLV_PORT_DATA_SET_NP:
 		pnp = (struct port_ds_np *) mgt->data;
-		fprintf(fp, "PORT_DATA_SET_NP "
-			IFMT "neighborPropDelayThresh %u"
-			IFMT "asCapable               %d",
-			pnp->neighborPropDelayThresh,
-			pnp->asCapable ? 1 : 0);
+		field_uint(fs, "neighborPropDelayThresh",
+			   pnp->neighborPropDelayThresh);
+		field_int(fs, "asCapable", pnp->asCapable ? 1 : 0);
+		break;
+	case TLV_PORT_HISTOGRAM_NP:
+		phn = (struct port_histogram_np *) mgt->data;
+		field_str(fs, "portIdentity", pid2str(&phn->portIdentity));
+		field_histogram(fs, "offset", phn->offset);
+		field_histogram(fs, "delay", phn->delay);
+		field_histogram(fs, "residence", phn->residence);
 		break;
 	case TLV_LOG_ANNOUNCE_INTERVAL:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "LOG_ANNOUNCE_INTERVAL "
-			IFMT "logAnnounceInterval %hhd", mtd->val);
+		field_int(fs, "logAnnounceInterval", (Integer8) mtd->val);
 		break;
 	case TLV_ANNOUNCE_RECEIPT_TIMEOUT:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "ANNOUNCE_RECEIPT_TIMEOUT "
-			IFMT "announceReceiptTimeout %hhu", mtd->val);
+		field_uint(fs, "announceReceiptTimeout", mtd->val);
 		break;
 	case TLV_LOG_SYNC_INTERVAL:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "LOG_SYNC_INTERVAL "
-			IFMT "logSyncInterval %hhd", mtd->val);
+		field_int(fs, "logSyncInterval", (Integer8) mtd->val);
 		break;
 	case TLV_VERSION_NUMBER:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "VERSION_NUMBER "
-			IFMT "versionNumber %hhu", mtd->val);
+		field_uint(fs, "versionNumber", mtd->val);
 		break;
 	case TLV_DELAY_MECHANISM:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "DELAY_MECHANISM "
-			IFMT "delayMechanism %hhu", mtd->val);
+		field_uint(fs, "delayMechanism", mtd->val);
 		break;
 	case TLV_LOG_MIN_PDELAY_REQ_INTERVAL:
-		mtd = (struct management_tlv_datum *) mgt->data;
-		fprintf(fp, "LOG_MIN_PDELAY_REQ_INTERVAL "
-			IFMT "logMinPdelayReqInterval %hhd", mtd->val);
+		field_int(fs, "logMinPdelayReqInterval", (Integer8) mtd->val);
 		break;
+	default:
+		return -1;
 	}
-out:
-	fprintf(fp, "\n");
+	return 0;
+}
+
+static void print_fields(struct fields *fs, FILE *fp)
+{
+	int i, len, width = 0;
+	struct field *f;
+
+	for (i = 0; i < fs->n; i++) {
+		len = strlen(fs->f[i].name);
+		if (len > width) {
+			width = len;
+		}
+	}
+	for (i = 0; i < fs->n; i++) {
+		f = &fs->f[i];
+		fprintf(fp, IFMT "%-*s ", width, f->name);
+		switch (f->type) {
+		case FIELD_INT:
+			fprintf(fp, "%" PRId64, f->val.i);
+			break;
+		case FIELD_UINT:
+			fprintf(fp, "%" PRIu64, f->val.u);
+			break;
+		case FIELD_HEX:
+			fprintf(fp, "0x%0*" PRIx64, f->digits, f->val.u);
+			break;
+		case FIELD_FLOAT:
+			fprintf(fp, "%.*f", f->digits, f->val.f);
+			break;
+		case FIELD_RATE:
+			fprintf(fp, "%+.*f", f->digits, f->val.f);
+			break;
+		case FIELD_BOOL:
+			fprintf(fp, "%s", f->val.i ? "true" : "false");
+			break;
+		case FIELD_STR:
+			fprintf(fp, "%s", f->str);
+			break;
+		case FIELD_HISTOGRAM:
+			fprintf(fp, "count %" PRIu64 " p50 %" PRId64
+				" p99 %" PRId64 " p99.9 %" PRId64
+				" max %" PRId64,
+				f->val.h.count, f->val.h.p50, f->val.h.p99,
+				f->val.h.p999, f->val.h.max);
+			break;
+		}
+	}
+}
+
+static void pmc_show_tlv(struct tlv_extra *extra, FILE *fp)
+{
+	struct management_tlv *mgt;
+	struct fields fs;
+	struct TLV *tlv;
+
+	tlv = extra->tlv;
+	if (tlv->type == TLV_MANAGEMENT) {
+		fprintf(fp, "MANAGEMENT ");
+	} else if (tlv->type == TLV_MANAGEMENT_ERROR_STATUS) {
+		fprintf(fp, "MANAGEMENT_ERROR_STATUS ");
+		return;
+	} else {
+		fprintf(fp, "unknown-tlv ");
+		return;
+	}
+	mgt = (struct management_tlv *) tlv;
+	if (mgt->length == 2 && mgt->id != TLV_NULL_MANAGEMENT) {
+		fprintf(fp, "empty-tlv ");
+		return;
+	}
+	if (extract_fields(mgt, extra, &fs)) {
+		return;
+	}
+	fprintf(fp, "%s ", id_name(mgt->id));
+	print_fields(&fs, fp);
+}
+
+static void pmc_show(struct ptp_message *msg, FILE *fp, const char *server)
+{
+	struct tlv_extra *extra;
+	int action;
+
+	if (msg_type(msg) != MANAGEMENT) {
+		return;
+	}
+	action = management_action(msg);
+	if (action < GET || action > ACKNOWLEDGE) {
+		return;
+	}
+	/* Each TLV of the message is shown on its own. */
+	extra = TAILQ_FIRST(&msg->tlv_list);
+	do {
+		if (server) {
+			fprintf(fp, "\t%s", server);
+		}
+		fprintf(fp, "\t%s seq %hu %s ",
+			pid2str(&msg->header.sourcePortIdentity),
+			msg->header.sequenceId, action_string[action]);
+		if (extra) {
+			pmc_show_tlv(extra, fp);
+			extra = TAILQ_NEXT(extra, list);
+		}
+		fprintf(fp, "\n");
+	} while (extra);
 	fflush(fp);
 }
 
+static const char *error_name(int error)
+{
+	switch (error) {
+	case TLV_RESPONSE_TOO_BIG:
+		return "RESPONSE_TOO_BIG";
+	case TLV_NO_SUCH_ID:
+		return "NO_SUCH_ID";
+	case TLV_WRONG_LENGTH:
+		return "WRONG_LENGTH";
+	case TLV_WRONG_VALUE:
+		return "WRONG_VALUE";
+	case TLV_NOT_SETABLE:
+		return "NOT_SETABLE";
+	case TLV_NOT_SUPPORTED:
+		return "NOT_SUPPORTED";
+	case TLV_GENERAL_ERROR:
+		return "GENERAL_ERROR";
+	}
+	return "unknown";
+}
+
+static void json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			fprintf(fp, "\\u%04x", (unsigned char) *s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+static void json_fields(struct fields *fs, FILE *fp)
+{
+	struct field *f;
+	int i;
+
+	fputc('{', fp);
+	for (i = 0; i < fs->n; i++) {
+		f = &fs->f[i];
+		if (i) {
+			fputc(',', fp);
+		}
+		json_string(fp, f->name);
+		fputc(':', fp);
+		switch (f->type) {
+		case FIELD_INT:
+			fprintf(fp, "%" PRId64, f->val.i);
+			break;
+		case FIELD_UINT:
+		case FIELD_HEX:
+			fprintf(fp, "%" PRIu64, f->val.u);
+			break;
+		case FIELD_FLOAT:
+		case FIELD_RATE:
+			fprintf(fp, "%.*f", f->digits, f->val.f);
+			break;
+		case FIELD_BOOL:
+			fprintf(fp, "%s", f->val.i ? "true" : "false");
+			break;
+		case FIELD_STR:
+			json_string(fp, f->str);
+			break;
+		case FIELD_HISTOGRAM:
+			fprintf(fp, "{\"count\":%" PRIu64 ",\"p50\":%" PRId64
+				",\"p99\":%" PRId64 ",\"p99.9\":%" PRId64
+				",\"max\":%" PRId64 "}",
+				f->val.h.count, f->val.h.p50, f->val.h.p99,
+				f->val.h.p999, f->val.h.max);
+			break;
+		}
+	}
+	fputc('}', fp);
+}
+
+/* Prints one JSON object per line for each TLV of a management message. */
+static void pmc_show_json(struct ptp_message *msg, FILE *fp,
+			  const char *server)
+{
+	struct management_error_status *mes;
+	struct management_tlv *mgt;
+	struct tlv_extra *extra;
+	struct fields fs;
+	int action;
+
+	if (msg_type(msg) != MANAGEMENT) {
+		return;
+	}
+	action = management_action(msg);
+	if (action < GET || action > ACKNOWLEDGE) {
+		return;
+	}
+	TAILQ_FOREACH(extra, &msg->tlv_list, list) {
+		fprintf(fp, "{\"server\":");
+		json_string(fp, server);
+		fprintf(fp, ",\"sequence_id\":%hu,\"source\":\"%s\","
+			"\"action\":\"%s\"",
+			msg->header.sequenceId,
+			pid2str(&msg->header.sourcePortIdentity),
+			action_string[action]);
+		switch (extra->tlv->type) {
+		case TLV_MANAGEMENT:
+			mgt = (struct management_tlv *) extra->tlv;
+			fprintf(fp, ",\"id\":\"%s\",\"data\":",
+				id_name(mgt->id));
+			if (mgt->length == 2 && mgt->id != TLV_NULL_MANAGEMENT) {
+				fprintf(fp, "null");
+			} else if (extract_fields(mgt, extra, &fs)) {
+				fprintf(fp, "null");
+			} else {
+				json_fields(&fs, fp);
+			}
+			break;
+		case TLV_MANAGEMENT_ERROR_STATUS:
+			mes = (struct management_error_status *) extra->tlv;
+			fprintf(fp, ",\"id\":\"%s\",\"error\":\"%s\"",
+				id_name(mes->id), error_name(mes->error));
+			break;
+		default:
+			fprintf(fp, ",\"tlv_type\":%hu", extra->tlv->type);
+			break;
+		}
+		fprintf(fp, "}\n");
+	}
+	fflush(fp);
+}
+
+static void pmc_show_timeout(void *ctx, UInteger16 sequence_id, int id)
+{
+	struct server *server = ctx;
+
+	if (!json_output) {
+		return;
+	}
+	fprintf(stdout, "{\"server\":");
+	json_string(stdout, server->address);
+	fprintf(stdout, ",\"sequence_id\":%hu,\"id\":\"%s\","
+		"\"error\":\"TIMEOUT\"}\n", sequence_id, id_name(id));
+}
+
 static void do_get_action(int action, int index, char *str)
 {
 	if (action == GET)
@@ -591,6 +910,7 @@ static int parse_id(char *s)
 static int parse_target(const char *str)
 {
 	struct PortIdentity pid;
+	int i;
 
 	if (str[0] == '*') {
 		memset(&pid, 0xff, sizeof(pid));
@@ -598,7 +918,62 @@ static int parse_target(const char *str)
 		return -1;
 	}
 
-	return pmc_target(pmc, &pid);
+	for (i = 0; i < n_servers; i++) {
+		pmc_target(servers[i].pmc, &pid);
+	}
+	return 0;
+}
+
+static int do_get_all(char *str, int *index, int count)
+{
+	int codes[PMC_MAX_GET_IDS], i;
+
+	for (i = 0; i < count; i++) {
+		if (idtab[index[i]].func == not_supported) {
+			not_supported(GET, index[i], str);
+			return 0;
+		}
+		codes[i] = idtab[index[i]].code;
+	}
+	if (!json_output) {
+		fprintf(stdout, "sending: GET");
+		for (i = 0; i < count; i++) {
+			fprintf(stdout, " %s", idtab[index[i]].name);
+		}
+		fprintf(stdout, "\n");
+	}
+	for (i = 0; i < n_servers; i++) {
+		pmc_send_get_actions(servers[i].pmc, codes, count);
+	}
+	return 0;
+}
+
+/* Collects the IDs of a GET, which may ask for several of them at once. */
+static int parse_ids(char *str, int *index, int max)
+{
+	char id_str[64+1];
+	int i, n = 0, offset = 0;
+
+	/* Skip the action. */
+	sscanf(str, " %*s%n", &offset);
+	str += offset;
+
+	while (1 == sscanf(str, " %64s%n", id_str, &offset)) {
+		str += offset;
+		if (n == max) {
+			fprintf(stdout, "at most %d IDs per GET\n", max);
+			return AMBIGUOUS_ID;
+		}
+		i = parse_id(id_str);
+		if (i == AMBIGUOUS_ID) {
+			fprintf(stdout, "id %s is too ambiguous\n", id_str);
+		}
+		if (i < 0) {
+			return i;
+		}
+		index[n++] = i;
+	}
+	return n;
 }
 
 static void print_help(FILE *fp)
@@ -612,6 +987,7 @@ static void print_help(FILE *fp)
 	fprintf(fp, "\n");
 	fprintf(fp, "\tThe [action] can be GET, SET, CMD, or COMMAND\n");
 	fprintf(fp, "\tCommands are case insensitive and may be abbreviated.\n");
+	fprintf(fp, "\tA GET may list several IDs to get them in one message.\n");
 	fprintf(fp, "\n");
 	fprintf(fp, "\tTARGET [portIdentity]\n");
 	fprintf(fp, "\tTARGET *\n");
@@ -620,7 +996,7 @@ static void print_help(FILE *fp)
 
 static int do_command(char *str)
 {
-	int action, id;
+	int action, count, i, id, index[PMC_MAX_GET_IDS];
 	char action_str[10+1] = {0}, id_str[64+1] = {0};
 
 	if (0 == strncasecmp(str, "HELP", strlen(str))) {
@@ -645,14 +1021,57 @@ static int do_command(char *str)
 		return 0;
 	}
 
-	fprintf(stdout, "sending: %s %s\n",
-		action_string[action], idtab[id].name);
+	if (action == GET) {
+		count = parse_ids(str, index, PMC_MAX_GET_IDS);
+		if (count == BAD_ID)
+			return -1;
+		if (count == AMBIGUOUS_ID)
+			return 0;
+		if (count > 1)
+			return do_get_all(str, index, count);
+	}
+
+	if (idtab[id].func == not_supported) {
+		not_supported(action, id, str);
+		return 0;
+	}
+	if (!json_output) {
+		fprintf(stdout, "sending: %s %s\n",
+			action_string[action], idtab[id].name);
+	}
 
-	idtab[id].func(action, id, str);
+	/* The request goes to every server without waiting for replies. */
+	for (i = 0; i < n_servers; i++) {
+		pmc = servers[i].pmc;
+		idtab[id].func(action, id, str);
+	}
 
 	return 0;
 }
 
+static int pending_replies(void)
+{
+	int i, n = 0;
+
+	for (i = 0; i < n_servers; i++) {
+		n += pmc_pending(servers[i].pmc);
+	}
+	return n;
+}
+
+static int most_pending(void)
+{
+	int i, n, max = 0;
+
+	for (i = 0; i < n_servers; i++) {
+		n = pmc_pending(servers[i].pmc);
+		if (n > max) {
+			max = n;
+		}
+	}
+	return max;
+}
+
 static void usage(char *progname)
 {
 	fprintf(stderr,
@@ -669,7 +1088,9 @@ static void usage(char *progname)
 		" -h        prints this message and exits\n"
 		" -i [dev]  interface device to use, default 'eth0'\n"
 		"           for network and '/var/run/pmc.$pid' for UDS.\n"
+		" -j        print the replies as JSON lines\n"
 		" -s [path] server address for UDS, default '/var/run/ptp4l'.\n"
+		"           May be given several times to query many servers.\n"
 		" -t [hex]  transport specific field, default 0x0\n"
 		" -v        prints the software version and exits\n"
 		" -z        send zero length TLV values with the GET actions\n"
@@ -681,15 +1102,15 @@ int main(int argc, char *argv[])
 {
 	const char *iface_name = NULL;
 	char *config = NULL, *progname;
-	int c, cnt, index, length, tmo = -1, batch_mode = 0, zero_datalen = 0;
+	int c, cnt, i, index, length, tmo = -1, batch_mode = 0, zero_datalen = 0;
 	int ret = 0;
-	char line[1024], *command = NULL, uds_local[MAX_IFNAME_SIZE + 1];
+	char line[1024], *command = NULL;
 	enum transport_type transport_type = TRANS_UDP_IPV4;
 	UInteger8 boundary_hops = 1, domain_number = 0, transport_specific = 0;
 	struct ptp_message *msg;
 	struct option *opts;
 	struct config *cfg;
-#define N_FD 2
+#define N_FD (1 + MAX_SERVERS)
 	struct pollfd pollfd[N_FD];
 
 	handle_term_signals();
@@ -704,7 +1125,7 @@ int main(int argc, char *argv[])
 	/* Process the command line arguments. */
 	progname = strrchr(argv[0], '/');
 	progname = progname ? 1+progname : argv[0];
-	while (EOF != (c = getopt_long(argc, argv, "246u""b:d:f:hi:s:t:vz",
+	while (EOF != (c = getopt_long(argc, argv, "246u""b:d:f:hi:js:t:vz",
 				       opts, &index))) {
 		switch (c) {
 		case 0:
@@ -752,6 +1173,9 @@ int main(int argc, char *argv[])
 		case 'i':
 			iface_name = optarg;
 			break;
+		case 'j':
+			json_output = 1;
+			break;
 		case 's':
 			if (strlen(optarg) > MAX_IFNAME_SIZE) {
 				fprintf(stderr, "path %s too long, max is %d\n",
@@ -759,10 +1183,13 @@ int main(int argc, char *argv[])
 				config_destroy(cfg);
 				return -1;
 			}
-			if (config_set_string(cfg, "uds_address", optarg)) {
+			if (n_servers == MAX_SERVERS) {
+				fprintf(stderr, "too many servers, max is %d\n",
+					MAX_SERVERS);
 				config_destroy(cfg);
 				return -1;
 			}
+			servers[n_servers++].address = optarg;
 			break;
 		case 't':
 			if (1 == sscanf(optarg, "%x", &c)) {
@@ -800,14 +1227,13 @@ int main(int argc, char *argv[])
 	transport_specific = config_get_int(cfg, NULL, "transportSpecific") << 4;
 	domain_number = config_get_int(cfg, NULL, "domainNumber");
 
-	if (!iface_name) {
-		if (transport_type == TRANS_UDS) {
-			snprintf(uds_local, sizeof(uds_local),
-				 "/var/run/pmc.%d", getpid());
-			iface_name = uds_local;
-		} else {
-			iface_name = "eth0";
-		}
+	if (!n_servers) {
+		servers[n_servers++].address =
+			config_get_string(cfg, NULL, "uds_address");
+	} else if (n_servers > 1 && transport_type != TRANS_UDS) {
+		fprintf(stderr, "several servers need the UDS transport\n");
+		config_destroy(cfg);
+		return -1;
 	}
 	if (optind < argc) {
 		batch_mode = 1;
@@ -817,37 +1243,65 @@ int main(int argc, char *argv[])
 	print_set_syslog(1);
 	print_set_verbose(1);
 
-	pmc = pmc_create(cfg, transport_type, iface_name, boundary_hops,
-			 domain_number, transport_specific, zero_datalen);
-	if (!pmc) {
-		fprintf(stderr, "failed to create pmc\n");
-		config_destroy(cfg);
-		return -1;
+	for (i = 0; i < n_servers; i++) {
+		if (iface_name && transport_type != TRANS_UDS) {
+			snprintf(servers[i].local, sizeof(servers[i].local),
+				 "%s", iface_name);
+		} else if (iface_name) {
+			snprintf(servers[i].local, sizeof(servers[i].local),
+				 i ? "%s.%d" : "%s", iface_name, i);
+		} else if (transport_type == TRANS_UDS) {
+			snprintf(servers[i].local, sizeof(servers[i].local),
+				 i ? "/var/run/pmc.%d.%d" : "/var/run/pmc.%d",
+				 getpid(), i);
+		} else {
+			snprintf(servers[i].local, sizeof(servers[i].local),
+				 "eth0");
+		}
+		if (transport_type == TRANS_UDS &&
+		    config_set_string(cfg, "uds_address", servers[i].address)) {
+			ret = -1;
+			goto destroy;
+		}
+		servers[i].pmc = pmc_create(cfg, transport_type,
+					    servers[i].local, boundary_hops,
+					    domain_number, transport_specific,
+					    zero_datalen);
+		if (!servers[i].pmc) {
+			fprintf(stderr, "failed to create pmc\n");
+			ret = -1;
+			goto destroy;
+		}
+		if (transport_type != TRANS_UDS) {
+			servers[i].address = servers[i].local;
+		}
+		pollfd[1 + i].fd = pmc_get_transport_fd(servers[i].pmc);
+		pollfd[1 + i].events = POLLIN | POLLPRI;
 	}
+	pmc = servers[0].pmc;
 
 	pollfd[0].fd = batch_mode ? -1 : STDIN_FILENO;
-	pollfd[1].fd = pmc_get_transport_fd(pmc);
+	pollfd[0].events = batch_mode ? 0 : POLLIN | POLLPRI;
 
 	while (is_running()) {
-		if (batch_mode && !command) {
-			if (optind < argc) {
-				command = argv[optind++];
-			} else {
-				/* No more commands, wait a bit for
-				   any outstanding replies and exit. */
-				tmo = 100;
+		/* Keep a few batch commands in flight to each server. */
+		while (optind < argc && most_pending() < MAX_IN_FLIGHT) {
+			command = argv[optind++];
+			if (do_command(command)) {
+				fprintf(stderr, "bad command: %s\n", command);
 			}
 		}
+		if (batch_mode) {
+			/*
+			 * Wait a bit for any outstanding replies and exit.
+			 * Once each request has been answered, only linger
+			 * for the replies of the other ports.
+			 */
+			tmo = pending_replies() || transport_type != TRANS_UDS ?
+				100 : 10;
+		}
 
-		pollfd[0].events = 0;
-		pollfd[1].events = POLLIN | POLLPRI;
-
-		if (!batch_mode && !command)
-			pollfd[0].events |= POLLIN | POLLPRI;
-		if (command)
-			pollfd[1].events |= POLLOUT;
-
-		cnt = poll(pollfd, N_FD, tmo);
+		cnt = poll(pollfd, 1 + n_servers, tmo);
 		if (cnt < 0) {
 			if (EINTR == errno) {
 				continue;
@@ -856,6 +1310,13 @@ int main(int argc, char *argv[])
 				ret = -1;
 				break;
 			}
+		} else if (!cnt && optind < argc) {
+			/* Give up on the silent requests and send the rest. */
+			for (i = 0; i < n_servers; i++) {
+				pmc_expire(servers[i].pmc, pmc_show_timeout,
+					   &servers[i]);
+			}
+			continue;
 		} else if (!cnt) {
 			break;
 		}
@@ -879,23 +1340,40 @@ int main(int argc, char *argv[])
 			}
 			line[length - 1] = 0;
 			command = line;
-		}
-		if (pollfd[1].revents & POLLOUT) {
 			if (do_command(command)) {
 				fprintf(stderr, "bad command: %s\n", command);
 			}
-			command = NULL;
 		}
-		if (pollfd[1].revents & (POLLIN|POLLPRI)) {
-			msg = pmc_recv(pmc);
-			if (msg) {
-				pmc_show(msg, stdout);
-				msg_put(msg);
+		for (i = 0; i < n_servers; i++) {
+			if (!(pollfd[1 + i].revents & (POLLIN|POLLPRI))) {
+				continue;
+			}
+			msg = pmc_recv(servers[i].pmc);
+			if (!msg) {
+				continue;
+			}
+			if (pmc_correlate(servers[i].pmc, msg) < 0) {
+				pr_debug("ignoring unexpected reply seq %hu",
+					 msg->header.sequenceId);
+			} else if (json_output) {
+				pmc_show_json(msg, stdout, servers[i].address);
+			} else {
+				pmc_show(msg, stdout, n_servers > 1 ?
+					 servers[i].address : NULL);
 			}
+			msg_put(msg);
 		}
 	}
 
-	pmc_destroy(pmc);
+	for (i = 0; i < n_servers; i++) {
+		pmc_expire(servers[i].pmc, pmc_show_timeout, &servers[i]);
+	}
+destroy:
+	for (i = 0; i < n_servers; i++) {
+		if (servers[i].pmc) {
+			pmc_destroy(servers[i].pmc);
+		}
+	}
 	msg_cleanup();
 
 out:
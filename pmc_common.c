@@ -48,6 +48,27 @@
 /* Includes one extra byte to make length even. */
 #define EMPTY_PTP_TEXT 2
 
+/*
+ * Outstanding requests are remembered in a window of this many sequenceIds,
+ * a few times the handful pmc keeps in flight to each server, so that the
+ * late replies of the other ports can still be matched.
+ */
+#define PMC_MAX_PENDING 64
+
+enum pmc_request_state {
+	PMC_REQ_FREE,
+	PMC_REQ_PENDING,
+	PMC_REQ_ANSWERED,
+};
+
+struct pmc_request {
+	UInteger16 sequence_id;
+	UInteger8 state;
+	UInteger8 count;
+	uint32_t answered; /* one bit for each of the ids */
+	UInteger16 ids[PMC_MAX_GET_IDS];
+};
+
 struct pmc {
 	UInteger16 sequence_id;
 	UInteger8 boundary_hops;
@@ -59,6 +80,9 @@ struct pmc {
 	struct transport *transport;
 	struct fdarray fdarray;
 	int zero_length_gets;
+
+	struct pmc_request requests[PMC_MAX_PENDING];
+	int n_pending;
 };
 
 struct pmc *pmc_create(struct config *cfg, enum transport_type transport_type,
@@ -151,17 +175,38 @@ static struct ptp_message *pmc_message(struct pmc *pmc, uint8_t action)
 	return msg;
 }
 
-static int pmc_send(struct pmc *pmc, struct ptp_message *msg)
+static int pmc_send(struct pmc *pmc, struct ptp_message *msg,
+		    int *ids, int count)
 {
-	int err;
+	UInteger16 sequence_id = msg->header.sequenceId;
+	struct pmc_request *req;
+	int err, i;
 
 	err = msg_pre_send(msg);
 	if (err) {
 		pr_err("msg_pre_send failed");
 		return -1;
 	}
-	return transport_send(pmc->transport, &pmc->fdarray,
-			      TRANS_GENERAL, msg);
+	req = &pmc->requests[sequence_id % PMC_MAX_PENDING];
+	if (req->state != PMC_REQ_PENDING) {
+		pmc->n_pending++;
+	}
+	req->sequence_id = sequence_id;
+	for (i = 0; i < count; i++) {
+		req->ids[i] = ids[i];
+	}
+	req->count = count;
+	req->answered = 0;
+	req->state = PMC_REQ_PENDING;
+
+	err = transport_send(pmc->transport, &pmc->fdarray,
+			     TRANS_GENERAL, msg);
+	if (err <= 0) {
+		req->state = PMC_REQ_FREE;
+		pmc->n_pending--;
+		return -1;
+	}
+	return 0;
 }
 
 static int pmc_tlv_datalen(struct pmc *pmc, int id)
@@ -202,6 +247,12 @@ static int pmc_tlv_datalen(struct pmc *pmc, int id)
 	case TLV_GRANDMASTER_SETTINGS_NP:
 		len += sizeof(struct grandmaster_settings_np);
 		break;
+	case TLV_MSG_POOL_NP:
+		len += sizeof(struct msg_pool_np);
+		break;
+	case TLV_BMCA_STATS_NP:
+		len += sizeof(struct bmca_stats_np);
+		break;
 	case TLV_NULL_MANAGEMENT:
 		break;
 	case TLV_CLOCK_DESCRIPTION:
@@ -213,6 +264,9 @@ static int pmc_tlv_datalen(struct pmc *pmc, int id)
 	case TLV_PORT_DATA_SET_NP:
 		len += sizeof(struct port_ds_np);
 		break;
+	case TLV_PORT_HISTOGRAM_NP:
+		len += sizeof(struct port_histogram_np);
+		break;
 	case TLV_LOG_ANNOUNCE_INTERVAL:
 	case TLV_ANNOUNCE_RECEIPT_TIMEOUT:
 	case TLV_LOG_SYNC_INTERVAL:
@@ -230,32 +284,21 @@ int pmc_get_transport_fd(struct pmc *pmc)
 	return pmc->fdarray.fd[FD_GENERAL];
 }
 
-int pmc_send_get_action(struct pmc *pmc, int id)
+static int pmc_append_get(struct pmc *pmc, struct ptp_message *msg, int id)
 {
-	int datalen, pdulen;
-	struct ptp_message *msg;
 	struct management_tlv *mgt;
 	struct tlv_extra *extra;
+	int datalen;
 
-	msg = pmc_message(pmc, GET);
-	if (!msg) {
+	datalen = pmc_tlv_datalen(pmc, id);
+	extra = msg_tlv_append(msg, sizeof(*mgt) + datalen);
+	if (!extra) {
 		return -1;
 	}
-	mgt = (struct management_tlv *) msg->management.suffix;
+	mgt = (struct management_tlv *) extra->tlv;
 	mgt->type = TLV_MANAGEMENT;
-	datalen = pmc_tlv_datalen(pmc, id);
 	mgt->length = 2 + datalen;
 	mgt->id = id;
-	pdulen = msg->header.messageLength + sizeof(*mgt) + datalen;
-	msg->header.messageLength = pdulen;
-
-	extra = tlv_extra_alloc();
-	if (!extra) {
-		pr_err("failed to allocate TLV descriptor");
-		return -ENOMEM;
-	}
-	extra->tlv = (struct TLV *) msg->management.suffix;
-	msg_tlv_attach(msg, extra);
 
 	if (id == TLV_CLOCK_DESCRIPTION && !pmc->zero_length_gets) {
 		/*
@@ -272,11 +315,38 @@ int pmc_send_get_action(struct pmc *pmc, int id)
 		buf += sizeof(struct PhysicalAddress) + 0;
 		cd->protocolAddress = (struct PortAddress *) buf;
 	}
+	return 0;
+}
 
-	pmc_send(pmc, msg);
+int pmc_send_get_action(struct pmc *pmc, int id)
+{
+	return pmc_send_get_actions(pmc, &id, 1);
+}
+
+int pmc_send_get_actions(struct pmc *pmc, int *ids, int count)
+{
+	struct ptp_message *msg;
+	int err, i;
+
+	if (count > PMC_MAX_GET_IDS) {
+		pr_err("too many management IDs in one message");
+		return -1;
+	}
+	msg = pmc_message(pmc, GET);
+	if (!msg) {
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		if (pmc_append_get(pmc, msg, ids[i])) {
+			pr_err("too many management IDs in one message");
+			msg_put(msg);
+			return -1;
+		}
+	}
+	err = pmc_send(pmc, msg, ids, count);
 	msg_put(msg);
 
-	return 0;
+	return err;
 }
 
 int pmc_send_set_action(struct pmc *pmc, int id, void *data, int datasize)
@@ -284,6 +354,7 @@ int pmc_send_set_action(struct pmc *pmc, int id, void *data, int datasize)
 	struct management_tlv *mgt;
 	struct ptp_message *msg;
 	struct tlv_extra *extra;
+	int err;
 
 	msg = pmc_message(pmc, SET);
 	if (!msg) {
@@ -298,10 +369,10 @@ int pmc_send_set_action(struct pmc *pmc, int id, void *data, int datasize)
 	mgt->length = 2 + datasize;
 	mgt->id = id;
 	memcpy(mgt->data, data, datasize);
-	pmc_send(pmc, msg);
+	err = pmc_send(pmc, msg, &id, 1);
 	msg_put(msg);
 
-	return 0;
+	return err;
 }
 
 struct ptp_message *pmc_recv(struct pmc *pmc)
@@ -344,6 +415,98 @@ failed:
 	return NULL;
 }
 
+static void pmc_mark_answered(struct pmc_request *req, int id)
+{
+	int i;
+
+	for (i = 0; i < req->count; i++) {
+		if (req->ids[i] == id) {
+			req->answered |= 1U << i;
+		}
+	}
+}
+
+int pmc_correlate(struct pmc *pmc, struct ptp_message *msg)
+{
+	struct management_error_status *mes;
+	struct management_tlv *mgt;
+	struct pmc_request *req;
+	struct tlv_extra *extra;
+	uint32_t all;
+
+	if (msg_type(msg) != MANAGEMENT) {
+		return -1;
+	}
+	switch (management_action(msg)) {
+	case RESPONSE:
+	case ACKNOWLEDGE:
+		break;
+	default:
+		return -1;
+	}
+	req = &pmc->requests[msg->header.sequenceId % PMC_MAX_PENDING];
+	if (req->state == PMC_REQ_FREE ||
+	    req->sequence_id != msg->header.sequenceId) {
+		return -1;
+	}
+	if (req->state != PMC_REQ_PENDING) {
+		/* Requests to all ports are answered once by each port. */
+		return req->ids[0];
+	}
+	/* The clock and each of the ports may answer separately. */
+	TAILQ_FOREACH(extra, &msg->tlv_list, list) {
+		switch (extra->tlv->type) {
+		case TLV_MANAGEMENT:
+			mgt = (struct management_tlv *) extra->tlv;
+			pmc_mark_answered(req, mgt->id);
+			break;
+		case TLV_MANAGEMENT_ERROR_STATUS:
+			mes = (struct management_error_status *) extra->tlv;
+			pmc_mark_answered(req, mes->id);
+			break;
+		}
+	}
+	all = req->count < PMC_MAX_GET_IDS ? (1U << req->count) - 1 : ~0U;
+	if (!req->answered) {
+		/* A reply naming none of the IDs settles the whole request. */
+		req->answered = all;
+	}
+	if (req->answered == all) {
+		req->state = PMC_REQ_ANSWERED;
+		pmc->n_pending--;
+	}
+	return req->ids[0];
+}
+
+int pmc_pending(struct pmc *pmc)
+{
+	return pmc->n_pending;
+}
+
+int pmc_expire(struct pmc *pmc,
+	       void (*callback)(void *ctx, UInteger16 sequence_id, int id),
+	       void *ctx)
+{
+	struct pmc_request *req;
+	int i, j, n = 0;
+
+	for (i = 0; i < PMC_MAX_PENDING && pmc->n_pending; i++) {
+		req = &pmc->requests[i];
+		if (req->state != PMC_REQ_PENDING) {
+			continue;
+		}
+		for (j = 0; callback && j < req->count; j++) {
+			if (!(req->answered & (1U << j))) {
+				callback(ctx, req->sequence_id, req->ids[j]);
+			}
+		}
+		req->state = PMC_REQ_FREE;
+		pmc->n_pending--;
+		n++;
+	}
+	return n;
+}
+
 int pmc_target(struct pmc *pmc, struct PortIdentity *pid)
 {
 	pmc->target = *pid;
@@ -25,6 +25,9 @@
 #include "msg.h"
 #include "transport.h"
 
+/* The most management IDs a single GET may carry. */
+#define PMC_MAX_GET_IDS 32
+
 struct pmc;
 
 struct pmc *pmc_create(struct config *cfg, enum transport_type transport_type,
@@ -38,10 +41,47 @@ int pmc_get_transport_fd(struct pmc *pmc);
 
 int pmc_send_get_action(struct pmc *pmc, int id);
 
+/**
+ * Send a single GET carrying one management TLV for each of the IDs.
+ * @param pmc    The management client in question.
+ * @param ids    The management IDs to get.
+ * @param count  The number of IDs, at most PMC_MAX_GET_IDS.
+ * @return       Zero on success, non-zero otherwise.
+ */
+int pmc_send_get_actions(struct pmc *pmc, int *ids, int count);
+
 int pmc_send_set_action(struct pmc *pmc, int id, void *data, int datasize);
 
 struct ptp_message *pmc_recv(struct pmc *pmc);
 
+/**
+ * Match a reply with the request it answers, using the sequenceId.
+ * @param pmc  The management client which sent the request.
+ * @param msg  A message received from the server.
+ * @return     The management ID of the request, or of its first TLV,
+ *             or -1 if the message does not answer any outstanding request.
+ */
+int pmc_correlate(struct pmc *pmc, struct ptp_message *msg);
+
+/**
+ * Count the requests which still wait for the reply to any of their IDs.
+ * @param pmc  The management client in question.
+ * @return     The number of unanswered requests.
+ */
+int pmc_pending(struct pmc *pmc);
+
+/**
+ * Give up on all of the unanswered requests.
+ * @param pmc       The management client in question.
+ * @param callback  Called with the sequenceId and each of the unanswered
+ *                  management IDs of each request, may be NULL.
+ * @param ctx       Passed through to the callback.
+ * @return          The number of requests given up.
+ */
+int pmc_expire(struct pmc *pmc,
+	       void (*callback)(void *ctx, UInteger16 sequence_id, int id),
+	       void *ctx);
+
 int pmc_target(struct pmc *pmc, struct PortIdentity *pid);
 void pmc_target_port(struct pmc *pmc, UInteger16 portNumber);
 void pmc_target_all(struct pmc *pmc);
@@ -18,6 +18,7 @@
  */
 #include <arpa/inet.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <malloc.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +29,7 @@
 #include "bmc.h"
 #include "clock.h"
 #include "filter.h"
+#include "hash.h"
 #include "missing.h"
 #include "msg.h"
 #include "phc.h"
@@ -36,10 +38,13 @@
 #include "print.h"
 #include "rtnl.h"
 #include "sk.h"
+#include "stats.h"
 #include "tc.h"
 #include "tlv.h"
 #include "tmv.h"
 #include "tsproc.h"
+#include "unicast_client.h"
+#include "unicast_service.h"
 #include "util.h"
 
 #define ALLOWED_LOST_RESPONSES 3
@@ -55,6 +60,7 @@ enum syfu_event {
 static int port_capable(struct port *p);
 static int port_is_ieee8021as(struct port *p);
 static void port_nrate_initialize(struct port *p);
+static int port_txts_collect(struct port *p, struct ptp_message *want);
 
 static int announce_compare(struct ptp_message *m1, struct ptp_message *m2)
 {
@@ -170,21 +176,13 @@ void fault_interval(struct port *port, enum fault_type ft,
 	i->val = port->flt_interval_pertype[ft].val;
 }
 
-int port_fault_fd(struct port *port)
-{
-	return port->fault_fd;
-}
-
 struct fdarray *port_fda(struct port *port)
 {
 	return &port->fda;
 }
 
-int set_tmo_log(int fd, unsigned int scale, int log_seconds)
+int set_tmo_log(struct tmq_timer *t, unsigned int scale, int log_seconds)
 {
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
 	uint64_t ns;
 	int i;
 
@@ -194,35 +192,21 @@ int set_tmo_log(int fd, unsigned int scale, int log_seconds)
 		for (i = 1, ns = scale * 500000000ULL; i < log_seconds; i++) {
 			ns >>= 1;
 		}
-		tmo.it_value.tv_nsec = ns;
-
-		while (tmo.it_value.tv_nsec >= NS_PER_SEC) {
-			tmo.it_value.tv_nsec -= NS_PER_SEC;
-			tmo.it_value.tv_sec++;
-		}
 
 	} else
-		tmo.it_value.tv_sec = scale * (1 << log_seconds);
+		ns = scale * (1ULL << log_seconds) * NS_PER_SEC;
 
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	return tmq_timer_set(t, ns);
 }
 
-int set_tmo_lin(int fd, int seconds)
+int set_tmo_lin(struct tmq_timer *t, int seconds)
 {
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
-
-	tmo.it_value.tv_sec = seconds;
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	return tmq_timer_set(t, seconds * NS_PER_SEC);
 }
 
-int set_tmo_random(int fd, int min, int span, int log_seconds)
+int set_tmo_random(struct tmq_timer *t, int min, int span, int log_seconds)
 {
 	uint64_t value_ns, min_ns, span_ns;
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
 
 	if (log_seconds >= 0) {
 		min_ns = min * NS_PER_SEC << log_seconds;
@@ -234,21 +218,18 @@ int set_tmo_random(int fd, int min, int span, int log_seconds)
 
 	value_ns = min_ns + (span_ns * (random() % (1 << 15) + 1) >> 15);
 
-	tmo.it_value.tv_sec = value_ns / NS_PER_SEC;
-	tmo.it_value.tv_nsec = value_ns % NS_PER_SEC;
-
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	return tmq_timer_set(t, value_ns);
 }
 
 int port_set_fault_timer_log(struct port *port,
 			     unsigned int scale, int log_seconds)
 {
-	return set_tmo_log(port->fault_fd, scale, log_seconds);
+	return set_tmo_log(&port->fault_timer, scale, log_seconds);
 }
 
 int port_set_fault_timer_lin(struct port *port, int seconds)
 {
-	return set_tmo_lin(port->fault_fd, seconds);
+	return set_tmo_lin(&port->fault_timer, seconds);
 }
 
 void fc_clear(struct foreign_clock *fc)
@@ -321,6 +302,19 @@ void ts_add(tmv_t *ts, Integer64 correction)
 	*ts = tmv_add(*ts, correction_to_tmv(correction));
 }
 
+static void fc_add_message(struct port *p, struct foreign_clock *fc,
+			   struct ptp_message *m)
+{
+	msg_get(m);
+	fc->n_messages++;
+	TAILQ_INSERT_HEAD(&fc->messages, m, list);
+	fc->dirty = 1;
+	if (!fc->active) {
+		LIST_INSERT_HEAD(&p->active_masters, fc, active_list);
+		fc->active = 1;
+	}
+}
+
 /*
  * Returns non-zero if the announce message is different than last.
  */
@@ -329,15 +323,19 @@ static int add_foreign_master(struct port *p, struct ptp_message *m)
 	struct foreign_clock *fc;
 	struct ptp_message *tmp;
 	int broke_threshold = 0, diff = 0;
+	char *key;
 
-	LIST_FOREACH(fc, &p->foreign_masters, list) {
-		if (msg_source_equal(m, fc)) {
-			break;
+	if (!p->foreign_index) {
+		p->foreign_index = hash_create();
+		if (!p->foreign_index) {
+			pr_err("low memory, failed to add foreign master");
+			return 0;
 		}
 	}
+	key = pid2str(&m->header.sourcePortIdentity);
+	fc = hash_lookup(p->foreign_index, key);
 	if (!fc) {
-		pr_notice("port %hu: new foreign master %s", portnum(p),
-			pid2str(&m->header.sourcePortIdentity));
+		pr_notice("port %hu: new foreign master %s", portnum(p), key);
 
 		fc = malloc(sizeof(*fc));
 		if (!fc) {
@@ -345,6 +343,11 @@ static int add_foreign_master(struct port *p, struct ptp_message *m)
 			return 0;
 		}
 		memset(fc, 0, sizeof(*fc));
+		if (hash_insert(p->foreign_index, key, fc)) {
+			pr_err("low memory, failed to add foreign master");
+			free(fc);
+			return 0;
+		}
 		TAILQ_INIT(&fc->messages);
 		LIST_INSERT_HEAD(&p->foreign_masters, fc, list);
 		fc->port = p;
@@ -364,9 +367,7 @@ static int add_foreign_master(struct port *p, struct ptp_message *m)
 	/*
 	 * Okay, go ahead and add this announcement.
 	 */
-	msg_get(m);
-	fc->n_messages++;
-	TAILQ_INSERT_HEAD(&fc->messages, m, list);
+	fc_add_message(p, fc, m);
 
 	/*
 	 * Test if this announcement contains changed information.
@@ -486,6 +487,12 @@ static void free_foreign_masters(struct port *p)
 		fc_clear(fc);
 		free(fc);
 	}
+	LIST_INIT(&p->active_masters);
+	p->last_best = NULL;
+	if (p->foreign_index) {
+		hash_destroy(p->foreign_index, NULL);
+		p->foreign_index = NULL;
+	}
 }
 
 static int fup_sync_ok(struct ptp_message *fup, struct ptp_message *sync)
@@ -569,7 +576,12 @@ static int path_trace_ignore(struct port *p, struct ptp_message *m)
 static int peer_prepare_and_send(struct port *p, struct ptp_message *msg,
 				 int event)
 {
-	int cnt;
+	int cnt, wait = 0;
+
+	if (event == TRANS_EVENT && p->txts_deferred) {
+		event = TRANS_DEFER_EVENT;
+		wait = 1;
+	}
 	if (msg_pre_send(msg)) {
 		return -1;
 	}
@@ -577,6 +589,9 @@ static int peer_prepare_and_send(struct port *p, struct ptp_message *msg,
 	if (cnt <= 0) {
 		return -1;
 	}
+	if (wait && port_txts_collect(p, msg)) {
+		return -1;
+	}
 	if (msg_sots_valid(msg)) {
 		ts_add(&msg->hwts.ts, p->tx_timestamp_offset);
 	}
@@ -649,12 +664,10 @@ not_capable:
 	return 0;
 }
 
-int port_clr_tmo(int fd)
+int port_clr_tmo(struct tmq_timer *t)
 {
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	tmq_timer_clear(t);
+	return 0;
 }
 
 static int port_ignore(struct port *p, struct ptp_message *m)
@@ -748,29 +761,100 @@ static void port_management_send_error(struct port *p, struct port *ingress,
 static const Octet profile_id_drr[] = {0x00, 0x1B, 0x19, 0x00, 0x01, 0x00};
 static const Octet profile_id_p2p[] = {0x00, 0x1B, 0x19, 0x00, 0x02, 0x00};
 
+static void port_hist_fill(struct histogram *h, struct histogram_np *hnp)
+{
+	hnp->count = histogram_count(h);
+	hnp->p50 = histogram_percentile(h, 50.0);
+	hnp->p99 = histogram_percentile(h, 99.0);
+	hnp->p999 = histogram_percentile(h, 99.9);
+	hnp->max = histogram_max(h);
+}
+
+/* Lays out a CLOCK_DESCRIPTION at buf, returning the length of its data. */
+static int port_clock_description_fill(struct port *target,
+				       struct mgmt_clock_description *cd,
+				       uint8_t *buf)
+{
+	struct clock_description *desc;
+	uint8_t *start = buf;
+	uint16_t u16;
+
+	cd->clockType = (UInteger16 *) buf;
+	buf += sizeof(*cd->clockType);
+	*cd->clockType = clock_type(target->clock);
+	cd->physicalLayerProtocol = (struct PTPText *) buf;
+	switch(transport_type(target->trp)) {
+	case TRANS_UDP_IPV4:
+	case TRANS_UDP_IPV6:
+	case TRANS_IEEE_802_3:
+		ptp_text_set(cd->physicalLayerProtocol, "IEEE 802.3");
+		break;
+	default:
+		ptp_text_set(cd->physicalLayerProtocol, NULL);
+		break;
+	}
+	buf += sizeof(struct PTPText) + cd->physicalLayerProtocol->length;
+
+	cd->physicalAddress = (struct PhysicalAddress *) buf;
+	u16 = transport_physical_addr(target->trp,
+				      cd->physicalAddress->address);
+	memcpy(&cd->physicalAddress->length, &u16, 2);
+	buf += sizeof(struct PhysicalAddress) + u16;
+
+	cd->protocolAddress = (struct PortAddress *) buf;
+	u16 = transport_type(target->trp);
+	memcpy(&cd->protocolAddress->networkProtocol, &u16, 2);
+	u16 = transport_protocol_addr(target->trp,
+				      cd->protocolAddress->address);
+	memcpy(&cd->protocolAddress->addressLength, &u16, 2);
+	buf += sizeof(struct PortAddress) + u16;
+
+	desc = clock_description(target->clock);
+	cd->manufacturerIdentity = buf;
+	memcpy(cd->manufacturerIdentity, desc->manufacturerIdentity, OUI_LEN);
+	buf += OUI_LEN;
+	*(buf++) = 0; /* reserved */
+
+	cd->productDescription = (struct PTPText *) buf;
+	ptp_text_copy(cd->productDescription, &desc->productDescription);
+	buf += sizeof(struct PTPText) + cd->productDescription->length;
+
+	cd->revisionData = (struct PTPText *) buf;
+	ptp_text_copy(cd->revisionData, &desc->revisionData);
+	buf += sizeof(struct PTPText) + cd->revisionData->length;
+
+	cd->userDescription = (struct PTPText *) buf;
+	ptp_text_copy(cd->userDescription, &desc->userDescription);
+	buf += sizeof(struct PTPText) + cd->userDescription->length;
+
+	if (target->delayMechanism == DM_P2P) {
+		memcpy(buf, profile_id_p2p, PROFILE_ID_LEN);
+	} else {
+		memcpy(buf, profile_id_drr, PROFILE_ID_LEN);
+	}
+	buf += PROFILE_ID_LEN;
+	return buf - start;
+}
+
 static int port_management_fill_response(struct port *target,
 					 struct ptp_message *rsp, int id)
 {
-	struct mgmt_clock_description *cd;
+	struct mgmt_clock_description clock_desc;
 	struct management_tlv_datum *mtd;
-	struct clock_description *desc;
 	struct port_properties_np *ppn;
+	struct port_histogram_np *phn;
 	struct management_tlv *tlv;
 	struct port_ds_np *pdsnp;
 	struct tlv_extra *extra;
 	struct portDS *pds;
-	uint16_t u16;
-	uint8_t *buf;
+	uint8_t data[sizeof(*tlv) + MANAGEMENT_MAX_DATALEN];
 	int datalen;
 
-	extra = tlv_extra_alloc();
-	if (!extra) {
-		pr_err("failed to allocate TLV descriptor");
-		return 0;
-	}
-	extra->tlv = (struct TLV *) rsp->management.suffix;
-
-	tlv = (struct management_tlv *) rsp->management.suffix;
+	/*
+	 * The answer is filled in aside, and then goes after any answers
+	 * already in the response if its actual length fits.
+	 */
+	tlv = (struct management_tlv *) data;
 	tlv->type = TLV_MANAGEMENT;
 	tlv->id = id;
 
@@ -779,64 +863,8 @@ static int port_management_fill_response(struct port *target,
 		datalen = 0;
 		break;
 	case TLV_CLOCK_DESCRIPTION:
-		cd = &extra->cd;
-		buf = tlv->data;
-		cd->clockType = (UInteger16 *) buf;
-		buf += sizeof(*cd->clockType);
-		*cd->clockType = clock_type(target->clock);
-		cd->physicalLayerProtocol = (struct PTPText *) buf;
-		switch(transport_type(target->trp)) {
-		case TRANS_UDP_IPV4:
-		case TRANS_UDP_IPV6:
-		case TRANS_IEEE_802_3:
-			ptp_text_set(cd->physicalLayerProtocol, "IEEE 802.3");
-			break;
-		default:
-			ptp_text_set(cd->physicalLayerProtocol, NULL);
-			break;
-		}
-		buf += sizeof(struct PTPText) + cd->physicalLayerProtocol->length;
-
-		cd->physicalAddress = (struct PhysicalAddress *) buf;
-		u16 = transport_physical_addr(target->trp,
-                                              cd->physicalAddress->address);
-		memcpy(&cd->physicalAddress->length, &u16, 2);
-		buf += sizeof(struct PhysicalAddress) + u16;
-
-		cd->protocolAddress = (struct PortAddress *) buf;
-		u16 = transport_type(target->trp);
-		memcpy(&cd->protocolAddress->networkProtocol, &u16, 2);
-		u16 = transport_protocol_addr(target->trp,
-                                              cd->protocolAddress->address);
-		memcpy(&cd->protocolAddress->addressLength, &u16, 2);
-		buf += sizeof(struct PortAddress) + u16;
-
-		desc = clock_description(target->clock);
-		cd->manufacturerIdentity = buf;
-		memcpy(cd->manufacturerIdentity,
-                       desc->manufacturerIdentity, OUI_LEN);
-		buf += OUI_LEN;
-		*(buf++) = 0; /* reserved */
-
-		cd->productDescription = (struct PTPText *) buf;
-		ptp_text_copy(cd->productDescription, &desc->productDescription);
-		buf += sizeof(struct PTPText) + cd->productDescription->length;
-
-		cd->revisionData = (struct PTPText *) buf;
-		ptp_text_copy(cd->revisionData, &desc->revisionData);
-		buf += sizeof(struct PTPText) + cd->revisionData->length;
-
-		cd->userDescription = (struct PTPText *) buf;
-		ptp_text_copy(cd->userDescription, &desc->userDescription);
-		buf += sizeof(struct PTPText) + cd->userDescription->length;
-
-		if (target->delayMechanism == DM_P2P) {
-			memcpy(buf, profile_id_p2p, PROFILE_ID_LEN);
-		} else {
-			memcpy(buf, profile_id_drr, PROFILE_ID_LEN);
-		}
-		buf += PROFILE_ID_LEN;
-		datalen = buf - tlv->data;
+		datalen = port_clock_description_fill(target, &clock_desc,
+						      tlv->data);
 		break;
 	case TLV_PORT_DATA_SET:
 		pds = (struct portDS *) tlv->data;
@@ -910,6 +938,17 @@ static int port_management_fill_response(struct port *target,
 		ptp_text_set(&ppn->interface, target->iface->ts_label);
 		datalen = sizeof(*ppn) + ppn->interface.length;
 		break;
+	case TLV_PORT_HISTOGRAM_NP:
+		phn = (struct port_histogram_np *)tlv->data;
+		phn->portIdentity = target->portIdentity;
+		port_hist_fill(target->hist_total[PORT_HIST_OFFSET],
+			       &phn->offset);
+		port_hist_fill(target->hist_total[PORT_HIST_DELAY],
+			       &phn->delay);
+		port_hist_fill(target->hist_total[PORT_HIST_RESIDENCE],
+			       &phn->residence);
+		datalen = sizeof(*phn);
+		break;
 	default:
 		/* The caller should *not* respond to this message. */
 		return 0;
@@ -920,8 +959,17 @@ static int port_management_fill_response(struct port *target,
 		datalen++;
 	}
 	tlv->length = sizeof(tlv->id) + datalen;
-	rsp->header.messageLength += sizeof(*tlv) + datalen;
-	msg_tlv_attach(rsp, extra);
+	extra = msg_tlv_append(rsp, sizeof(*tlv) + datalen);
+	if (!extra) {
+		return !port_management_append_error(rsp, id,
+						     TLV_RESPONSE_TOO_BIG);
+	}
+	memcpy(extra->tlv, tlv, sizeof(*tlv) + datalen);
+	if (id == TLV_CLOCK_DESCRIPTION) {
+		/* Lay it out again in place, so the descriptor points there. */
+		tlv = (struct management_tlv *) extra->tlv;
+		port_clock_description_fill(target, &extra->cd, tlv->data);
+	}
 
 	/* The caller can respond to this message. */
 	return 1;
@@ -1027,7 +1075,7 @@ static void port_nrate_initialize(struct port *p)
 
 int port_set_announce_tmo(struct port *p)
 {
-	return set_tmo_random(p->fda.fd[FD_ANNOUNCE_TIMER],
+	return set_tmo_random(port_timer(p, FD_ANNOUNCE_TIMER),
 			      p->announceReceiptTimeout,
 			      p->announce_span, p->logAnnounceInterval);
 }
@@ -1035,34 +1083,34 @@ int port_set_announce_tmo(struct port *p)
 int port_set_delay_tmo(struct port *p)
 {
 	if (p->delayMechanism == DM_P2P) {
-		return set_tmo_log(p->fda.fd[FD_DELAY_TIMER], 1,
+		return set_tmo_log(port_timer(p, FD_DELAY_TIMER), 1,
 			       p->logMinPdelayReqInterval);
 	} else {
-		return set_tmo_random(p->fda.fd[FD_DELAY_TIMER], 0, 2,
+		return set_tmo_random(port_timer(p, FD_DELAY_TIMER), 0, 2,
 				p->logMinDelayReqInterval);
 	}
 }
 
 static int port_set_manno_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, p->logAnnounceInterval);
+	return set_tmo_log(port_timer(p, FD_MANNO_TIMER), 1, p->logAnnounceInterval);
 }
 
 int port_set_qualification_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_QUALIFICATION_TIMER],
+	return set_tmo_log(port_timer(p, FD_QUALIFICATION_TIMER),
 		       1+clock_steps_removed(p->clock), p->logAnnounceInterval);
 }
 
 static int port_set_sync_rx_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_SYNC_RX_TIMER],
+	return set_tmo_log(port_timer(p, FD_SYNC_RX_TIMER),
 			   p->syncReceiptTimeout, p->logSyncInterval);
 }
 
 static int port_set_sync_tx_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_SYNC_TX_TIMER], 1, p->logSyncInterval);
+	return set_tmo_log(port_timer(p, FD_SYNC_TX_TIMER), 1, p->logSyncInterval);
 }
 
 void port_show_transition(struct port *p, enum port_state next,
@@ -1091,7 +1139,7 @@ static void port_synchronize(struct port *p,
 			     Integer64 correction1, Integer64 correction2)
 {
 	enum servo_state state;
-	tmv_t t1, t1c, t2, c1, c2;
+	tmv_t t1, t2, c1, c2;
 
 	port_set_sync_rx_tmo(p);
 
@@ -1099,9 +1147,12 @@ static void port_synchronize(struct port *p,
 	t2 = ingress_ts;
 	c1 = correction_to_tmv(correction1);
 	c2 = correction_to_tmv(correction2);
-	t1c = tmv_add(t1, tmv_add(c1, c2));
 
-	state = clock_synchronize(p->clock, t2, t1c);
+	state = clock_synchronize(p->clock, t2, t1, tmv_add(c1, c2));
+	if (state == SERVO_LOCKED) {
+		port_hist_add(p, PORT_HIST_OFFSET,
+			      clock_master_offset(p->clock));
+	}
 	switch (state) {
 	case SERVO_UNLOCKED:
 		port_dispatch(p, EV_SYNCHRONIZATION_FAULT, 0);
@@ -1292,7 +1343,7 @@ int port_delay_request(struct port *p)
 	msg->header.control            = CTL_DELAY_REQ;
 	msg->header.logMessageInterval = 0x7f;
 
-	if (p->hybrid_e2e) {
+	if (p->hybrid_e2e || unicast_client_enabled(p)) {
 		struct ptp_message *dst = TAILQ_FIRST(&p->best->messages);
 		msg->address = dst->address;
 		msg->header.flagField[0] |= UNICAST;
@@ -1315,19 +1366,17 @@ out:
 	return -1;
 }
 
-static int port_tx_announce(struct port *p)
+static struct ptp_message *port_announce_msg(struct port *p,
+					     struct address *dst,
+					     UInteger16 seqnum)
 {
 	struct timePropertiesDS *tp = clock_time_properties(p->clock);
 	struct parent_ds *dad = clock_parent_ds(p->clock);
 	struct ptp_message *msg;
-	int err;
 
-	if (!port_capable(p)) {
-		return 0;
-	}
 	msg = msg_allocate();
 	if (!msg) {
-		return -1;
+		return NULL;
 	}
 
 	msg->hwts.type = p->timestamping;
@@ -1337,7 +1386,7 @@ static int port_tx_announce(struct port *p)
 	msg->header.messageLength      = sizeof(struct announce_msg);
 	msg->header.domainNumber       = clock_domain_number(p->clock);
 	msg->header.sourcePortIdentity = p->portIdentity;
-	msg->header.sequenceId         = p->seqnum.announce++;
+	msg->header.sequenceId         = seqnum;
 	msg->header.control            = CTL_OTHER;
 	msg->header.logMessageInterval = p->logAnnounceInterval;
 
@@ -1354,7 +1403,26 @@ static int port_tx_announce(struct port *p)
 	if (p->path_trace_enabled && path_trace_append(p, msg, dad)) {
 		pr_err("port %hu: append path trace failed", portnum(p));
 	}
+	if (dst) {
+		msg->address = *dst;
+		msg->header.flagField[0] |= UNICAST;
+		msg->header.logMessageInterval = 0x7f;
+	}
+	return msg;
+}
+
+int port_tx_announce(struct port *p, struct address *dst)
+{
+	struct ptp_message *msg;
+	int err;
 
+	if (!port_capable(p)) {
+		return 0;
+	}
+	msg = port_announce_msg(p, dst, p->seqnum.announce++);
+	if (!msg) {
+		return -1;
+	}
 	err = port_prepare_and_send(p, msg, TRANS_GENERAL);
 	if (err) {
 		pr_err("port %hu: send announce failed", portnum(p));
@@ -1363,16 +1431,96 @@ static int port_tx_announce(struct port *p)
 	return err;
 }
 
-static int port_tx_sync(struct port *p, struct address *dst)
+/*
+ * Sends an Announce message to each of the n unicast addresses in dst
+ * with as few system calls as possible, at most SK_TX_BATCH_MAX. The
+ * message for dst[i] carries the sequenceId seqnum[i]. Returns the
+ * number of messages sent, or -1 if none were. Failures are left to the
+ * caller to report, once for all of its clients.
+ */
+int port_tx_announce_batch(struct port *p, struct address **dst,
+			   UInteger16 *seqnum, int n)
+{
+	struct ptp_message *msg[SK_TX_BATCH_MAX];
+	int i, cnt, sent = -1;
+
+	if (!port_capable(p)) {
+		return n;
+	}
+	if (n > SK_TX_BATCH_MAX) {
+		n = SK_TX_BATCH_MAX;
+	}
+	for (cnt = 0; cnt < n; cnt++) {
+		msg[cnt] = port_announce_msg(p, dst[cnt], seqnum[cnt]);
+		if (!msg[cnt]) {
+			goto out;
+		}
+		if (msg_pre_send(msg[cnt])) {
+			msg_put(msg[cnt]);
+			goto out;
+		}
+	}
+	sent = transport_send_batch(p->trp, &p->fda, msg, n);
+out:
+	for (i = 0; i < cnt; i++) {
+		msg_put(msg[i]);
+	}
+	return sent;
+}
+
+static int port_tx_follow_up(struct port *p, struct ptp_message *sync)
+{
+	struct ptp_message *fup;
+	int err;
+
+	fup = msg_allocate();
+	if (!fup) {
+		return -1;
+	}
+
+	fup->hwts.type = p->timestamping;
+
+	fup->header.tsmt               = FOLLOW_UP | p->transportSpecific;
+	fup->header.ver                = PTP_VERSION;
+	fup->header.messageLength      = sizeof(struct follow_up_msg);
+	fup->header.domainNumber       = clock_domain_number(p->clock);
+	fup->header.sourcePortIdentity = p->portIdentity;
+	fup->header.sequenceId         = ntohs(sync->header.sequenceId);
+	fup->header.control            = CTL_FOLLOW_UP;
+	fup->header.logMessageInterval = p->logSyncInterval;
+
+	fup->follow_up.preciseOriginTimestamp = tmv_to_Timestamp(sync->hwts.ts);
+	fup->header.correction = tmv_frac_to_correction(sync->hwts.ts);
+
+	if (msg_unicast(sync)) {
+		fup->address = sync->address;
+		fup->header.flagField[0] |= UNICAST;
+	}
+	if (p->follow_up_info && follow_up_info_append(p, fup)) {
+		pr_err("port %hu: append fup info failed", portnum(p));
+		err = -1;
+		goto out;
+	}
+
+	err = port_prepare_and_send(p, fup, TRANS_GENERAL);
+	if (err) {
+		pr_err("port %hu: send follow up failed", portnum(p));
+	}
+out:
+	msg_put(fup);
+	return err;
+}
+
+int port_tx_sync(struct port *p, struct address *dst)
 {
-	struct ptp_message *msg, *fup;
+	struct ptp_message *msg;
 	int err, event;
 
 	switch (p->timestamping) {
 	case TS_SOFTWARE:
 	case TS_LEGACY_HW:
 	case TS_HARDWARE:
-		event = TRANS_EVENT;
+		event = p->txts_deferred ? TRANS_DEFER_EVENT : TRANS_EVENT;
 		break;
 	case TS_ONESTEP:
 		event = TRANS_ONESTEP;
@@ -1394,11 +1542,6 @@ static int port_tx_sync(struct port *p, struct address *dst)
 	if (!msg) {
 		return -1;
 	}
-	fup = msg_allocate();
-	if (!fup) {
-		msg_put(msg);
-		return -1;
-	}
 
 	msg->hwts.type = p->timestamping;
 
@@ -1420,13 +1563,17 @@ static int port_tx_sync(struct port *p, struct address *dst)
 		msg->header.flagField[0] |= UNICAST;
 		msg->header.logMessageInterval = 0x7f;
 	}
+	/* Failures are reported by the caller, see unicast_service_sync(). */
 	err = port_prepare_and_send(p, msg, event);
 	if (err) {
-		pr_err("port %hu: send sync failed", portnum(p));
 		goto out;
 	}
 	if (p->timestamping == TS_ONESTEP || p->timestamping == TS_P2P1STEP) {
 		goto out;
+	} else if (event == TRANS_DEFER_EVENT) {
+		/* The follow up goes out once the time stamp arrives. */
+		err = port_txts_defer(p, msg, NULL, tmv_zero());
+		goto out;
 	} else if (msg_sots_missing(msg)) {
 		pr_err("missing timestamp on transmitted sync");
 		err = -1;
@@ -1436,40 +1583,166 @@ static int port_tx_sync(struct port *p, struct address *dst)
 	/*
 	 * Send the follow up message right away.
 	 */
-	fup->hwts.type = p->timestamping;
+	err = port_tx_follow_up(p, msg);
+out:
+	msg_put(msg);
+	return err;
+}
 
-	fup->header.tsmt               = FOLLOW_UP | p->transportSpecific;
-	fup->header.ver                = PTP_VERSION;
-	fup->header.messageLength      = sizeof(struct follow_up_msg);
-	fup->header.domainNumber       = clock_domain_number(p->clock);
-	fup->header.sourcePortIdentity = p->portIdentity;
-	fup->header.sequenceId         = p->seqnum.sync - 1;
-	fup->header.control            = CTL_FOLLOW_UP;
-	fup->header.logMessageInterval = p->logSyncInterval;
+/*
+ * deferred transmit time stamps
+ */
+static int txts_match(unsigned char *pkt, int cnt, struct ptp_message *m)
+{
+	int i, len = sizeof(m->header);
+
+	/* The looped back packet still carries the lower layer headers. */
+	for (i = 0; i + len <= cnt; i++) {
+		if (!memcmp(pkt + i, &m->header, len)) {
+			return 1;
+		}
+	}
+	return 0;
+}
 
-	fup->follow_up.preciseOriginTimestamp = tmv_to_Timestamp(msg->hwts.ts);
-	fup->header.correction = tmv_frac_to_correction(msg->hwts.ts);
+static void port_txts_release(struct txts_pending *txp)
+{
+	msg_put(txp->msg);
+	free(txp);
+}
 
-	if (dst) {
-		fup->address = *dst;
-		fup->header.flagField[0] |= UNICAST;
+static int port_txts_complete(struct port *p, struct txts_pending *txp,
+			      struct hw_timestamp *hwts)
+{
+	struct ptp_message *msg = txp->msg;
+
+	msg->hwts.ts = hwts->ts;
+	if (!msg_sots_valid(msg)) {
+		pr_err("port %hu: missing timestamp on transmitted %s",
+		       portnum(p), msg_type_string(msg_type(msg)));
+		return -1;
 	}
-	if (p->follow_up_info && follow_up_info_append(p, fup)) {
-		pr_err("port %hu: append fup info failed", portnum(p));
-		err = -1;
-		goto out;
+	ts_add(&msg->hwts.ts, p->tx_timestamp_offset);
+
+	if (txp->ingress) {
+		tc_fwd_txts(txp->ingress, p, msg, txp->ingress_ts);
+		return 0;
+	}
+	switch (msg_type(msg)) {
+	case SYNC:
+		return port_tx_follow_up(p, msg);
+	default:
+		return 0;
 	}
+}
 
-	err = port_prepare_and_send(p, fup, TRANS_GENERAL);
-	if (err) {
-		pr_err("port %hu: send follow up failed", portnum(p));
+static void port_txts_flush(struct port *p)
+{
+	struct txts_pending *txp;
+
+	while ((txp = TAILQ_FIRST(&p->txts_pending)) != NULL) {
+		TAILQ_REMOVE(&p->txts_pending, txp, list);
+		port_txts_release(txp);
 	}
-out:
-	msg_put(msg);
-	msg_put(fup);
+}
+
+static void port_txts_prune(struct port *p)
+{
+	struct txts_pending *txp;
+	struct timespec now;
+	int64_t age;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	while ((txp = TAILQ_FIRST(&p->txts_pending)) != NULL) {
+		age = (now.tv_sec - txp->sent.tv_sec) * NSEC2SEC +
+			now.tv_nsec - txp->sent.tv_nsec;
+		if (age < sk_tx_timeout * 1000000LL) {
+			break;
+		}
+		pr_err("port %hu: timed out waiting for tx timestamp on %s",
+		       portnum(p), msg_type_string(msg_type(txp->msg)));
+		TAILQ_REMOVE(&p->txts_pending, txp, list);
+		port_txts_release(txp);
+	}
+}
+
+/*
+ * Reads the queued transmit time stamps and completes the pending
+ * messages they belong to. If 'want' is given, this blocks until the
+ * time stamp of that message arrives, or until tx_timestamp_timeout.
+ */
+static int port_txts_collect(struct port *p, struct ptp_message *want)
+{
+	struct txts_pending *txp;
+	struct hw_timestamp hwts;
+	unsigned char pkt[1600];
+	int cnt, err = 0;
+
+	while (1) {
+		memset(&hwts, 0, sizeof(hwts));
+		hwts.type = p->timestamping;
+		cnt = transport_txts_recv(p->trp, &p->fda, pkt, sizeof(pkt),
+					  &hwts, want != NULL);
+		if (cnt <= 0) {
+			if (cnt < 0 || want) {
+				err = -1;
+			}
+			break;
+		}
+		if (want && txts_match(pkt, cnt, want)) {
+			want->hwts.ts = hwts.ts;
+			break;
+		}
+		TAILQ_FOREACH(txp, &p->txts_pending, list) {
+			if (txts_match(pkt, cnt, txp->msg)) {
+				break;
+			}
+		}
+		if (!txp) {
+			pr_debug("port %hu: dropping unmatched tx timestamp",
+				 portnum(p));
+			continue;
+		}
+		TAILQ_REMOVE(&p->txts_pending, txp, list);
+		if (port_txts_complete(p, txp, &hwts)) {
+			err = -1;
+		}
+		port_txts_release(txp);
+	}
+	port_txts_prune(p);
 	return err;
 }
 
+int port_txts_defer(struct port *p, struct ptp_message *msg,
+		    struct port *ingress, tmv_t ingress_ts)
+{
+	struct txts_pending *txp;
+
+	txp = calloc(1, sizeof(*txp));
+	if (!txp) {
+		return -1;
+	}
+	msg_get(msg);
+	txp->msg = msg;
+	txp->ingress = ingress;
+	txp->ingress_ts = ingress_ts;
+	clock_gettime(CLOCK_MONOTONIC, &txp->sent);
+	TAILQ_INSERT_TAIL(&p->txts_pending, txp, list);
+
+	return port_txts_collect(p, NULL);
+}
+
+int port_txts_deferred(struct port *p)
+{
+	return p->txts_deferred;
+}
+
+enum fsm_event port_txts_event(struct port *p)
+{
+	return port_txts_collect(p, NULL) ? EV_FAULT_DETECTED : EV_NONE;
+}
+
 /*
  * port initialize and disable
  */
@@ -1538,27 +1811,28 @@ void port_disable(struct port *p)
 	int i;
 
 	tc_flush(p);
+	port_txts_flush(p);
 	flush_last_sync(p);
 	flush_delay_req(p);
 	flush_peer_delay(p);
 
 	p->best = NULL;
 	free_foreign_masters(p);
+	unicast_service_clear(p);
 	transport_close(p->trp, &p->fda);
 
 	for (i = 0; i < N_TIMER_FDS; i++) {
-		close(p->fda.fd[FD_FIRST_TIMER + i]);
+		tmq_timer_clear(&p->timer[i]);
 	}
 
 	/* Keep rtnl socket to get link status info. */
 	port_clear_fda(p, FD_RTNL);
-	clock_fda_changed(p->clock);
+	clock_fda_changed(p->clock, p);
 }
 
 int port_initialize(struct port *p)
 {
 	struct config *cfg = clock_config(p->clock);
-	int fd[N_TIMER_FDS], i;
 
 	p->multiple_seq_pdr_count  = 0;
 	p->multiple_pdr_detected   = 0;
@@ -1578,23 +1852,9 @@ int port_initialize(struct port *p)
 	p->neighborPropDelayThresh = config_get_int(cfg, p->name, "neighborPropDelayThresh");
 	p->min_neighbor_prop_delay = config_get_int(cfg, p->name, "min_neighbor_prop_delay");
 
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		fd[i] = -1;
-	}
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		fd[i] = timerfd_create(CLOCK_MONOTONIC, 0);
-		if (fd[i] < 0) {
-			pr_err("timerfd_create: %s", strerror(errno));
-			goto no_timers;
-		}
-	}
 	if (transport_open(p->trp, p->iface, &p->fda, p->timestamping))
 		goto no_tropen;
 
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		p->fda.fd[FD_FIRST_TIMER + i] = fd[i];
-	}
-
 	if (port_set_announce_tmo(p))
 		goto no_tmo;
 
@@ -1608,17 +1868,12 @@ int port_initialize(struct port *p)
 
 	port_nrate_initialize(p);
 
-	clock_fda_changed(p->clock);
+	clock_fda_changed(p->clock, p);
 	return 0;
 
 no_tmo:
 	transport_close(p->trp, &p->fda);
 no_tropen:
-no_timers:
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		if (fd[i] >= 0)
-			close(fd[i]);
-	}
 	return -1;
 }
 
@@ -1634,7 +1889,7 @@ static int port_renew_transport(struct port *p)
 	res = transport_open(p->trp, p->iface, &p->fda, p->timestamping);
 	/* Need to call clock_fda_changed even if transport_open failed in
 	 * order to update clock to the now closed descriptors. */
-	clock_fda_changed(p->clock);
+	clock_fda_changed(p->clock, p);
 	return res;
 }
 
@@ -1666,9 +1921,7 @@ static int update_current_master(struct port *p, struct ptp_message *m)
 	}
 	port_set_announce_tmo(p);
 	fc_prune(fc);
-	msg_get(m);
-	fc->n_messages++;
-	TAILQ_INSERT_HEAD(&fc->messages, m, list);
+	fc_add_message(p, fc, m);
 	if (fc->n_messages > 1) {
 		tmp = TAILQ_NEXT(m, list);
 		return announce_compare(m, tmp);
@@ -1733,6 +1986,12 @@ static int process_delay_req(struct port *p, struct ptp_message *m)
 		return 0;
 	}
 
+	/* Without hybrid mode, only the negotiated clients get an answer. */
+	if (!nsm && !p->hybrid_e2e && p->unicast_service && msg_unicast(m) &&
+	    !unicast_service_granted(p, m, DELAY_RESP)) {
+		return 0;
+	}
+
 	msg = msg_allocate();
 	if (!msg) {
 		return -1;
@@ -1755,7 +2014,7 @@ static int process_delay_req(struct port *p, struct ptp_message *m)
 
 	msg->delay_resp.requestingPortIdentity = m->header.sourcePortIdentity;
 
-	if (p->hybrid_e2e && msg_unicast(m)) {
+	if ((p->hybrid_e2e || p->unicast_service) && msg_unicast(m)) {
 		msg->address = m->address;
 		msg->header.flagField[0] |= UNICAST;
 		msg->header.logMessageInterval = 0x7f;
@@ -1765,6 +2024,15 @@ static int process_delay_req(struct port *p, struct ptp_message *m)
 		err = -1;
 		goto out;
 	}
+	if (p->rx_batch > 1 && !nsm) {
+		/* Sent by port_flush_delay_resp() at the end of the batch. */
+		err = msg_pre_send(msg);
+		if (err) {
+			goto out;
+		}
+		TAILQ_INSERT_TAIL(&p->delay_resp, msg, list);
+		return 0;
+	}
 	err = port_prepare_and_send(p, msg, TRANS_GENERAL);
 	if (err) {
 		pr_err("port %hu: send delay response failed", portnum(p));
@@ -1775,6 +2043,9 @@ static int process_delay_req(struct port *p, struct ptp_message *m)
 		p->seqnum.sync = m->header.sequenceId;
 		err = port_tx_sync(p, &m->address);
 		p->seqnum.sync = saved_seqnum_sync;
+		if (err) {
+			pr_err("port %hu: send sync failed", portnum(p));
+		}
 	}
 out:
 	msg_put(msg);
@@ -1786,7 +2057,7 @@ void process_delay_resp(struct port *p, struct ptp_message *m)
 	struct delay_resp_msg *rsp = &m->delay_resp;
 	struct PortIdentity master;
 	struct ptp_message *req;
-	tmv_t c3, t3, t4, t4c;
+	tmv_t c3, t3, t4;
 
 	master = clock_parent_identity(p->clock);
 
@@ -1811,9 +2082,11 @@ void process_delay_resp(struct port *p, struct ptp_message *m)
 	c3 = correction_to_tmv(m->header.correction);
 	t3 = req->hwts.ts;
 	t4 = timestamp_to_tmv(m->ts.pdu);
-	t4c = tmv_sub(t4, c3);
 
-	clock_path_delay(p->clock, t3, t4c);
+	if (!clock_path_delay(p->clock, t3, t4, c3)) {
+		port_hist_add(p, PORT_HIST_DELAY,
+			      clock_mean_path_delay(p->clock));
+	}
 
 	TAILQ_REMOVE(&p->delay_req, req, list);
 	msg_put(req);
@@ -2060,6 +2333,7 @@ calc:
 		return;
 
 	p->peerMeanPathDelay = tmv_to_TimeInterval(p->peer_delay);
+	port_hist_add(p, PORT_HIST_DELAY, p->peer_delay);
 
 	if (p->state == PS_UNCALIBRATED || p->state == PS_SLAVE) {
 		clock_peer_delay(p->clock, p->peer_delay, t1, t2,
@@ -2179,8 +2453,71 @@ void process_sync(struct port *p, struct ptp_message *m)
 
 /* public methods */
 
+static void port_hist_destroy(struct port *p)
+{
+	int i;
+
+	for (i = 0; i < N_PORT_HIST; i++) {
+		if (p->hist[i]) {
+			histogram_destroy(p->hist[i]);
+		}
+		if (p->hist_total[i]) {
+			histogram_destroy(p->hist_total[i]);
+		}
+	}
+}
+
+static void port_hist_summary(struct port *p)
+{
+	static const char *name[N_PORT_HIST] = {
+		[PORT_HIST_OFFSET] = "offset",
+		[PORT_HIST_DELAY] = "delay",
+		[PORT_HIST_RESIDENCE] = "residence",
+	};
+	struct histogram_np hnp;
+	char buf[256];
+	int i, len = 0;
+
+	for (i = 0; i < N_PORT_HIST; i++) {
+		if (!histogram_count(p->hist[i])) {
+			continue;
+		}
+		port_hist_fill(p->hist[i], &hnp);
+		len += snprintf(buf + len, sizeof(buf) - len,
+				" %s p50 %" PRId64 " p99 %" PRId64
+				" p99.9 %" PRId64 " max %" PRId64,
+				name[i], hnp.p50, hnp.p99, hnp.p999, hnp.max);
+		histogram_reset(p->hist[i]);
+	}
+	if (len) {
+		pr_info("port %hu:%s", portnum(p), buf);
+	}
+}
+
+void port_hist_add(struct port *p, enum port_hist type, tmv_t value)
+{
+	int64_t ns = tmv_to_nanoseconds(value);
+	struct timespec now;
+
+	histogram_add(p->hist_total[type], ns);
+	if (!p->hist_interval) {
+		return;
+	}
+	histogram_add(p->hist[type], ns);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if ((now.tv_sec - p->hist_stamp.tv_sec) * NS_PER_SEC +
+	    now.tv_nsec - p->hist_stamp.tv_nsec < p->hist_interval) {
+		return;
+	}
+	port_hist_summary(p);
+	p->hist_stamp = now;
+}
+
 void port_close(struct port *p)
 {
+	int i;
+
 	if (port_is_enabled(p)) {
 		port_disable(p);
 	}
@@ -2191,16 +2528,23 @@ void port_close(struct port *p)
 
 	transport_destroy(p->trp);
 	tsproc_destroy(p->tsproc);
-	if (p->fault_fd >= 0) {
-		close(p->fault_fd);
+	if (p->rx_batch_stats) {
+		stats_destroy(p->rx_batch_stats);
 	}
+	port_hist_destroy(p);
+	unicast_client_cleanup(p);
+	unicast_service_cleanup(p);
+	for (i = 0; i < N_TIMER_FDS; i++) {
+		tmq_timer_clear(&p->timer[i]);
+	}
+	tmq_timer_clear(&p->fault_timer);
 	free(p);
 }
 
 struct foreign_clock *port_compute_best(struct port *p)
 {
 	int (*dscmp)(struct dataset *a, struct dataset *b);
-	struct foreign_clock *fc;
+	struct foreign_clock *fc, *next;
 	struct ptp_message *tmp;
 
 	dscmp = clock_dscmp(p->clock);
@@ -2209,12 +2553,23 @@ struct foreign_clock *port_compute_best(struct port *p)
 	if (p->master_only)
 		return p->best;
 
-	LIST_FOREACH(fc, &p->foreign_masters, list) {
+	/*
+	 * Only the foreign masters holding messages can qualify. The
+	 * others leave the active list until their next announcement.
+	 */
+	for (fc = LIST_FIRST(&p->active_masters); fc; fc = next) {
+		next = LIST_NEXT(fc, active_list);
 		tmp = TAILQ_FIRST(&fc->messages);
-		if (!tmp)
+		if (!tmp) {
+			LIST_REMOVE(fc, active_list);
+			fc->active = 0;
 			continue;
+		}
 
-		announce_to_dataset(tmp, p, &fc->dataset);
+		if (fc->dirty) {
+			announce_to_dataset(tmp, p, &fc->dataset);
+			fc->dirty = 0;
+		}
 
 		fc_prune(fc);
 
@@ -2229,17 +2584,35 @@ struct foreign_clock *port_compute_best(struct port *p)
 			fc_clear(fc);
 	}
 
+	if (p->best != p->last_best ||
+	    (p->best && !dataset_eq(&p->best->dataset, &p->last_best_ds))) {
+		p->last_best = p->best;
+		if (p->best) {
+			p->last_best_ds = p->best->dataset;
+		}
+		p->bmca_pending = 1;
+	}
 	return p->best;
 }
 
+int port_bmca_pending(struct port *p)
+{
+	return p->bmca_pending;
+}
+
+void port_bmca_done(struct port *p)
+{
+	p->bmca_pending = 0;
+}
+
 static void port_e2e_transition(struct port *p, enum port_state next)
 {
-	port_clr_tmo(p->fda.fd[FD_ANNOUNCE_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_RX_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_DELAY_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_QUALIFICATION_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_MANNO_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_TX_TIMER]);
+	port_clr_tmo(port_timer(p, FD_ANNOUNCE_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_RX_TIMER));
+	port_clr_tmo(port_timer(p, FD_DELAY_TIMER));
+	port_clr_tmo(port_timer(p, FD_QUALIFICATION_TIMER));
+	port_clr_tmo(port_timer(p, FD_MANNO_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_TX_TIMER));
 
 	switch (next) {
 	case PS_INITIALIZING:
@@ -2256,7 +2629,7 @@ static void port_e2e_transition(struct port *p, enum port_state next)
 		break;
 	case PS_MASTER:
 	case PS_GRAND_MASTER:
-		set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, -10); /*~1ms*/
+		set_tmo_log(port_timer(p, FD_MANNO_TIMER), 1, -10); /*~1ms*/
 		port_set_sync_tx_tmo(p);
 		break;
 	case PS_PASSIVE:
@@ -2275,12 +2648,12 @@ static void port_e2e_transition(struct port *p, enum port_state next)
 
 static void port_p2p_transition(struct port *p, enum port_state next)
 {
-	port_clr_tmo(p->fda.fd[FD_ANNOUNCE_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_RX_TIMER]);
+	port_clr_tmo(port_timer(p, FD_ANNOUNCE_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_RX_TIMER));
 	/* Leave FD_DELAY_TIMER running. */
-	port_clr_tmo(p->fda.fd[FD_QUALIFICATION_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_MANNO_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_TX_TIMER]);
+	port_clr_tmo(port_timer(p, FD_QUALIFICATION_TIMER));
+	port_clr_tmo(port_timer(p, FD_MANNO_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_TX_TIMER));
 
 	switch (next) {
 	case PS_INITIALIZING:
@@ -2298,7 +2671,7 @@ static void port_p2p_transition(struct port *p, enum port_state next)
 		break;
 	case PS_MASTER:
 	case PS_GRAND_MASTER:
-		set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, -10); /*~1ms*/
+		set_tmo_log(port_timer(p, FD_MANNO_TIMER), 1, -10); /*~1ms*/
 		port_set_sync_tx_tmo(p);
 		break;
 	case PS_PASSIVE:
@@ -2328,6 +2701,10 @@ static void bc_dispatch(struct port *p, enum fsm_event event, int mdiff)
 	}
 
 	if (!port_state_update(p, event, mdiff)) {
+		/* The parent may change without a change of state. */
+		if (mdiff) {
+			unicast_client_state_changed(p);
+		}
 		return;
 	}
 
@@ -2336,6 +2713,7 @@ static void bc_dispatch(struct port *p, enum fsm_event event, int mdiff)
 	} else {
 		port_e2e_transition(p, p->state);
 	}
+	unicast_client_state_changed(p);
 
 	if (p->jbod && p->state == PS_UNCALIBRATED) {
 		if (clock_switch_phc(p->clock, p->phc_index)) {
@@ -2403,76 +2781,82 @@ void port_link_status(void *ctx, int linkup, int ts_index)
 		clock_set_sde(p->clock, 1);
 }
 
-enum fsm_event port_event(struct port *p, int fd_index)
+static int port_flush_delay_resp(struct port *p)
 {
-	return p->event(p, fd_index);
-}
+	struct ptp_message *msg[SK_TX_BATCH_MAX];
+	int i, n, err = 0;
 
-static enum fsm_event bc_event(struct port *p, int fd_index)
-{
-	enum fsm_event event = EV_NONE;
-	struct ptp_message *msg;
-	int cnt, fd = p->fda.fd[fd_index], err;
-
-	switch (fd_index) {
-	case FD_ANNOUNCE_TIMER:
-	case FD_SYNC_RX_TIMER:
-		pr_debug("port %hu: %s timeout", portnum(p),
-			 fd_index == FD_SYNC_RX_TIMER ? "rx sync" : "announce");
-		if (p->best)
-			fc_clear(p->best);
-		port_set_announce_tmo(p);
-		delay_req_prune(p);
-		if (clock_slave_only(p->clock) && p->delayMechanism != DM_P2P &&
-		    port_renew_transport(p)) {
-			return EV_FAULT_DETECTED;
+	while (!TAILQ_EMPTY(&p->delay_resp)) {
+		for (n = 0; n < SK_TX_BATCH_MAX; n++) {
+			msg[n] = TAILQ_FIRST(&p->delay_resp);
+			if (!msg[n]) {
+				break;
+			}
+			TAILQ_REMOVE(&p->delay_resp, msg[n], list);
 		}
-		return EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES;
-
-	case FD_DELAY_TIMER:
-		pr_debug("port %hu: delay timeout", portnum(p));
-		port_set_delay_tmo(p);
-		delay_req_prune(p);
-		return port_delay_request(p) ? EV_FAULT_DETECTED : EV_NONE;
-
-	case FD_QUALIFICATION_TIMER:
-		pr_debug("port %hu: qualification timeout", portnum(p));
-		return EV_QUALIFICATION_TIMEOUT_EXPIRES;
+		if (transport_send_batch(p->trp, &p->fda, msg, n) != n) {
+			pr_err("port %hu: send delay response failed",
+			       portnum(p));
+			err = -1;
+		}
+		for (i = 0; i < n; i++) {
+			msg_put(msg[i]);
+		}
+	}
+	return err;
+}
 
-	case FD_MANNO_TIMER:
-		pr_debug("port %hu: master tx announce timeout", portnum(p));
-		port_set_manno_tmo(p);
-		return port_tx_announce(p) ? EV_FAULT_DETECTED : EV_NONE;
+static void port_rx_batch_stats(struct port *p, int n)
+{
+	struct stats_result res;
+	struct timespec now;
+	int64_t interval;
 
-	case FD_SYNC_TX_TIMER:
-		pr_debug("port %hu: master sync timeout", portnum(p));
-		port_set_sync_tx_tmo(p);
-		return port_tx_sync(p, NULL) ? EV_FAULT_DETECTED : EV_NONE;
+	if (!p->rx_batch_stats) {
+		return;
+	}
+	stats_add_value(p->rx_batch_stats, n);
 
-	case FD_RTNL:
-		pr_debug("port %hu: received link status notification", portnum(p));
-		rtnl_link_status(fd, p->name, port_link_status, p);
-		if (p->link_status == (LINK_UP | LINK_STATE_CHANGED))
-			return EV_FAULT_CLEARED;
-		else if ((p->link_status == (LINK_DOWN | LINK_STATE_CHANGED)) ||
-			 (p->link_status & TS_LABEL_CHANGED))
-			return EV_FAULT_DETECTED;
-		else
-			return EV_NONE;
+	interval = 1;
+	if (p->rx_batch_interval > 0) {
+		interval <<= p->rx_batch_interval < 31 ? p->rx_batch_interval : 31;
 	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec - p->rx_batch_stamp.tv_sec < interval) {
+		return;
+	}
+	if (!stats_get_result(p->rx_batch_stats, &res)) {
+		pr_info("port %hu: rx batch %5.2f +/- %5.2f max %2.0f "
+			"messages per wake up", portnum(p),
+			res.mean, res.stddev, res.max);
+	}
+	stats_reset(p->rx_batch_stats);
+	p->rx_batch_stamp = now;
+}
 
-	msg = msg_allocate();
-	if (!msg)
-		return EV_FAULT_DETECTED;
+/*
+ * Combines the events of a receive batch. A fault outranks a state
+ * decision event, which in turn outranks anything else, so that no
+ * message of the batch can hide the decision asked for by an earlier one.
+ */
+static enum fsm_event port_event_merge(enum fsm_event event,
+				       enum fsm_event ev)
+{
+	if (event == EV_FAULT_DETECTED || ev == EV_NONE) {
+		return event;
+	}
+	if (event == EV_STATE_DECISION_EVENT && ev != EV_FAULT_DETECTED) {
+		return event;
+	}
+	return ev;
+}
 
-	msg->hwts.type = p->timestamping;
+static enum fsm_event bc_process(struct port *p, struct ptp_message *msg,
+				 int cnt)
+{
+	enum fsm_event event = EV_NONE;
+	int err;
 
-	cnt = transport_recv(p->trp, fd, msg);
-	if (cnt <= 0) {
-		pr_err("port %hu: recv message failed", portnum(p));
-		msg_put(msg);
-		return EV_FAULT_DETECTED;
-	}
 	err = msg_post_recv(msg, cnt);
 	if (err) {
 		switch (err) {
@@ -2483,18 +2867,15 @@ static enum fsm_event bc_event(struct port *p, int fd_index)
 			pr_debug("port %hu: ignoring message", portnum(p));
 			break;
 		}
-		msg_put(msg);
 		return EV_NONE;
 	}
 	if (port_ignore(p, msg)) {
-		msg_put(msg);
 		return EV_NONE;
 	}
 	if (msg_sots_missing(msg) &&
 	    !(p->timestamping == TS_P2P1STEP && msg_type(msg) == PDELAY_REQ)) {
 		pr_err("port %hu: received %s without timestamp",
 		       portnum(p), msg_type_string(msg_type(msg)));
-		msg_put(msg);
 		return EV_NONE;
 	}
 	if (msg_sots_valid(msg)) {
@@ -2532,6 +2913,8 @@ static enum fsm_event bc_event(struct port *p, int fd_index)
 			event = EV_STATE_DECISION_EVENT;
 		break;
 	case SIGNALING:
+		if (process_signaling(p, msg))
+			event = EV_FAULT_DETECTED;
 		break;
 	case MANAGEMENT:
 		if (clock_manage(p->clock, p, msg))
@@ -2539,10 +2922,116 @@ static enum fsm_event bc_event(struct port *p, int fd_index)
 		break;
 	}
 
-	msg_put(msg);
 	return event;
 }
 
+static enum fsm_event bc_event(struct port *p, int fd_index)
+{
+	enum fsm_event event = EV_NONE;
+	struct ptp_message *msg[SK_RX_BATCH_MAX];
+	int cnt[SK_RX_BATCH_MAX], fd = p->fda.fd[fd_index], i, n, res;
+
+	switch (fd_index) {
+	case FD_ANNOUNCE_TIMER:
+	case FD_SYNC_RX_TIMER:
+		pr_debug("port %hu: %s timeout", portnum(p),
+			 fd_index == FD_SYNC_RX_TIMER ? "rx sync" : "announce");
+		if (p->best)
+			fc_clear(p->best);
+		port_set_announce_tmo(p);
+		delay_req_prune(p);
+		if (clock_slave_only(p->clock) && p->delayMechanism != DM_P2P &&
+		    port_renew_transport(p)) {
+			return EV_FAULT_DETECTED;
+		}
+		return EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES;
+
+	case FD_DELAY_TIMER:
+		pr_debug("port %hu: delay timeout", portnum(p));
+		port_set_delay_tmo(p);
+		delay_req_prune(p);
+		return port_delay_request(p) ? EV_FAULT_DETECTED : EV_NONE;
+
+	case FD_QUALIFICATION_TIMER:
+		pr_debug("port %hu: qualification timeout", portnum(p));
+		return EV_QUALIFICATION_TIMEOUT_EXPIRES;
+
+	case FD_MANNO_TIMER:
+		pr_debug("port %hu: master tx announce timeout", portnum(p));
+		port_set_manno_tmo(p);
+		return port_tx_announce(p, NULL) ? EV_FAULT_DETECTED : EV_NONE;
+
+	case FD_SYNC_TX_TIMER:
+		pr_debug("port %hu: master sync timeout", portnum(p));
+		port_set_sync_tx_tmo(p);
+		if (port_tx_sync(p, NULL)) {
+			pr_err("port %hu: send sync failed", portnum(p));
+			return EV_FAULT_DETECTED;
+		}
+		return EV_NONE;
+
+	case FD_UNICAST_SRV_TIMER:
+		pr_debug("port %hu: unicast service timeout", portnum(p));
+		return unicast_service_timer(p) ? EV_FAULT_DETECTED : EV_NONE;
+
+	case FD_UNICAST_REQ_TIMER:
+		pr_debug("port %hu: unicast request timeout", portnum(p));
+		return unicast_client_timer(p) ? EV_FAULT_DETECTED : EV_NONE;
+
+	case FD_RTNL:
+		pr_debug("port %hu: received link status notification", portnum(p));
+		rtnl_link_status(fd, p->name, port_link_status, p);
+		if (p->link_status == (LINK_UP | LINK_STATE_CHANGED))
+			return EV_FAULT_CLEARED;
+		else if ((p->link_status == (LINK_DOWN | LINK_STATE_CHANGED)) ||
+			 (p->link_status & TS_LABEL_CHANGED))
+			return EV_FAULT_DETECTED;
+		else
+			return EV_NONE;
+	}
+
+	n = p->rx_batch;
+	if (msg_allocate_bulk(msg, n)) {
+		return EV_FAULT_DETECTED;
+	}
+	for (i = 0; i < n; i++) {
+		msg[i]->hwts.type = p->timestamping;
+	}
+
+	res = transport_recv_batch(p->trp, fd, msg, cnt, p->rx_batch);
+	if (res < 0) {
+		pr_err("port %hu: recv message failed", portnum(p));
+		event = EV_FAULT_DETECTED;
+		goto out;
+	}
+	port_rx_batch_stats(p, res);
+
+	for (i = 0; i < res; i++) {
+		if (cnt[i] <= 0) {
+			pr_err("port %hu: recv message failed", portnum(p));
+			event = EV_FAULT_DETECTED;
+			break;
+		}
+		event = port_event_merge(event, bc_process(p, msg[i], cnt[i]));
+		if (event == EV_FAULT_DETECTED) {
+			break;
+		}
+	}
+	if (port_flush_delay_resp(p)) {
+		event = EV_FAULT_DETECTED;
+	}
+out:
+	for (i = 0; i < n; i++) {
+		msg_put(msg[i]);
+	}
+	return event;
+}
+
+enum fsm_event port_event(struct port *p, int fd_index)
+{
+	return p->event(p, fd_index);
+}
+
 int port_forward(struct port *p, struct ptp_message *msg)
 {
 	int cnt;
@@ -2560,8 +3049,12 @@ int port_forward_to(struct port *p, struct ptp_message *msg)
 int port_prepare_and_send(struct port *p, struct ptp_message *msg,
 			  enum transport_event event)
 {
-	int cnt;
+	int cnt, wait = 0;
 
+	if (event == TRANS_EVENT && p->txts_deferred) {
+		event = TRANS_DEFER_EVENT;
+		wait = 1;
+	}
 	if (msg_pre_send(msg)) {
 		return -1;
 	}
@@ -2573,6 +3066,9 @@ int port_prepare_and_send(struct port *p, struct ptp_message *msg,
 	if (cnt <= 0) {
 		return -1;
 	}
+	if (wait && port_txts_collect(p, msg)) {
+		return -1;
+	}
 	if (msg_sots_valid(msg)) {
 		ts_add(&msg->hwts.ts, p->tx_timestamp_offset);
 	}
@@ -2594,6 +3090,83 @@ int port_link_status_get(struct port *p)
 	return !!(p->link_status & LINK_UP);
 }
 
+int port_management_id(int id)
+{
+	switch (id) {
+	case TLV_NULL_MANAGEMENT:
+	case TLV_CLOCK_DESCRIPTION:
+	case TLV_PORT_DATA_SET:
+	case TLV_LOG_ANNOUNCE_INTERVAL:
+	case TLV_ANNOUNCE_RECEIPT_TIMEOUT:
+	case TLV_LOG_SYNC_INTERVAL:
+	case TLV_VERSION_NUMBER:
+	case TLV_ENABLE_PORT:
+	case TLV_DISABLE_PORT:
+	case TLV_UNICAST_NEGOTIATION_ENABLE:
+	case TLV_UNICAST_MASTER_TABLE:
+	case TLV_UNICAST_MASTER_MAX_TABLE_SIZE:
+	case TLV_ACCEPTABLE_MASTER_TABLE_ENABLED:
+	case TLV_ALTERNATE_MASTER:
+	case TLV_TRANSPARENT_CLOCK_PORT_DATA_SET:
+	case TLV_DELAY_MECHANISM:
+	case TLV_LOG_MIN_PDELAY_REQ_INTERVAL:
+	case TLV_PORT_DATA_SET_NP:
+	case TLV_PORT_PROPERTIES_NP:
+	case TLV_PORT_HISTOGRAM_NP:
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Answer all of the port management IDs of a GET in a single response.
+ * The clock answers the clock management IDs on its own.
+ */
+static int port_manage_get_all(struct port *p, struct port *ingress,
+			       struct ptp_message *req)
+{
+	struct PortIdentity pid = port_identity(p);
+	struct management_tlv *mgt;
+	struct ptp_message *rsp;
+	struct tlv_extra *extra;
+	int err;
+
+	rsp = port_management_reply(pid, ingress, req);
+	if (!rsp) {
+		return -1;
+	}
+	TAILQ_FOREACH(extra, &req->tlv_list, list) {
+		if (extra->tlv->type != TLV_MANAGEMENT) {
+			continue;
+		}
+		mgt = (struct management_tlv *) extra->tlv;
+		if (!port_management_id(mgt->id)) {
+			continue;
+		}
+		if (mgt->id == TLV_PORT_PROPERTIES_NP &&
+		    transport_type(ingress->trp) != TRANS_UDS) {
+			/* Only the UDS port allowed. */
+			err = port_management_append_error(rsp, mgt->id,
+							   TLV_NOT_SUPPORTED);
+		} else if (port_management_fill_response(p, rsp, mgt->id)) {
+			err = 0;
+		} else {
+			err = port_management_append_error(rsp, mgt->id,
+							   TLV_NOT_SUPPORTED);
+		}
+		if (err) {
+			break;
+		}
+	}
+	if (!rsp->tlv_count) {
+		msg_put(rsp);
+		return 0;
+	}
+	err = port_prepare_and_send(ingress, rsp, TRANS_GENERAL);
+	msg_put(rsp);
+	return err ? -1 : 1;
+}
+
 int port_manage(struct port *p, struct port *ingress, struct ptp_message *msg)
 {
 	struct management_tlv *mgt;
@@ -2602,6 +3175,9 @@ int port_manage(struct port *p, struct port *ingress, struct ptp_message *msg)
 	if (target != portnum(p) && target != 0xffff) {
 		return 0;
 	}
+	if (msg->tlv_count > 1) {
+		return port_manage_get_all(p, ingress, msg);
+	}
 	mgt = (struct management_tlv *) msg->management.suffix;
 
 	switch (management_action(msg)) {
@@ -2646,13 +3222,29 @@ int port_manage(struct port *p, struct port *ingress, struct ptp_message *msg)
 	return 1;
 }
 
+int port_management_append_error(struct ptp_message *rsp, Enumeration16 id,
+				 Enumeration16 error_id)
+{
+	struct management_error_status *mes;
+	struct tlv_extra *extra;
+
+	extra = msg_tlv_append(rsp, sizeof(*mes));
+	if (!extra) {
+		return -1;
+	}
+	mes = (struct management_error_status *) extra->tlv;
+	mes->type = TLV_MANAGEMENT_ERROR_STATUS;
+	mes->length = 8;
+	mes->error = error_id;
+	mes->id = id;
+	return 0;
+}
+
 int port_management_error(struct PortIdentity pid, struct port *ingress,
 			  struct ptp_message *req, Enumeration16 error_id)
 {
-	struct management_error_status *mes;
 	struct management_tlv *mgt;
 	struct ptp_message *msg;
-	struct tlv_extra *extra;
 	int err = 0;
 
 	mgt = (struct management_tlv *) req->management.suffix;
@@ -2661,16 +3253,10 @@ int port_management_error(struct PortIdentity pid, struct port *ingress,
 		return -1;
 	}
 
-	extra = msg_tlv_append(msg, sizeof(*mes));
-	if (!extra) {
+	if (port_management_append_error(msg, mgt->id, error_id)) {
 		msg_put(msg);
 		return -ENOMEM;
 	}
-	mes = (struct management_error_status *) extra->tlv;
-	mes->type = TLV_MANAGEMENT_ERROR_STATUS;
-	mes->length = 8;
-	mes->error = error_id;
-	mes->id = mgt->id;
 
 	err = port_prepare_and_send(ingress, msg, TRANS_GENERAL);
 	msg_put(msg);
@@ -2784,6 +3370,14 @@ struct port *port_open(int phc_index,
 
 	memset(p, 0, sizeof(*p));
 	TAILQ_INIT(&p->tc_transmitted);
+	TAILQ_INIT(&p->txts_pending);
+	TAILQ_INIT(&p->delay_resp);
+	/* Before anything on the error path may clear them. */
+	for (i = 0; i < N_TIMER_FDS; i++) {
+		tmq_timer_init(clock_tmq(clock), &p->timer[i], p,
+			       FD_FIRST_TIMER + i);
+	}
+	tmq_timer_init(clock_tmq(clock), &p->fault_timer, p, FD_FAULT_TIMER);
 
 	switch (type) {
 	case CLOCK_TYPE_ORDINARY:
@@ -2835,6 +3429,10 @@ struct port *port_open(int phc_index,
 	p->net_sync_monitor = config_get_int(cfg, p->name, "net_sync_monitor");
 	p->path_trace_enabled = config_get_int(cfg, p->name, "path_trace_enabled");
 	p->tc_spanning_tree = config_get_int(cfg, p->name, "tc_spanning_tree");
+	p->txts_deferred = transport == TRANS_UDS ? 0 :
+		config_get_int(cfg, NULL, "tx_timestamp_deferred");
+	p->rx_batch = transport == TRANS_UDS ? 1 :
+		config_get_int(cfg, p->name, "rx_batch_size");
 	p->rx_timestamp_offset = config_get_int(cfg, p->name, "ingressLatency");
 	p->rx_timestamp_offset <<= 16;
 	p->tx_timestamp_offset = config_get_int(cfg, p->name, "egressLatency");
@@ -2849,6 +3447,7 @@ struct port *port_open(int phc_index,
 	p->portIdentity.clockIdentity = clock_identity(clock);
 	p->portIdentity.portNumber = number;
 	p->state = PS_INITIALIZING;
+	p->bmca_pending = 1;
 	p->delayMechanism = config_get_int(cfg, p->name, "delay_mechanism");
 	p->versionNumber = PTP_VERSION;
 
@@ -2881,25 +3480,60 @@ struct port *port_open(int phc_index,
 
 	p->tsproc = tsproc_create(config_get_int(cfg, p->name, "tsproc_mode"),
 				  config_get_int(cfg, p->name, "delay_filter"),
-				  config_get_int(cfg, p->name, "delay_filter_length"));
+				  config_get_int(cfg, p->name, "delay_filter_length"),
+				  config_get_int(cfg, p->name, "delay_filter_percentile"));
 	if (!p->tsproc) {
 		pr_err("Failed to create time stamp processor");
 		goto err_transport;
 	}
 	p->nrate.ratio = 1.0;
 
-	port_clear_fda(p, N_POLLFD);
-	p->fault_fd = -1;
-	if (number) {
-		p->fault_fd = timerfd_create(CLOCK_MONOTONIC, 0);
-		if (p->fault_fd < 0) {
-			pr_err("timerfd_create failed: %m");
-			goto err_tsproc;
+	for (i = 0; i < N_PORT_HIST; i++) {
+		p->hist[i] = histogram_create();
+		p->hist_total[i] = histogram_create();
+		if (!p->hist[i] || !p->hist_total[i]) {
+			pr_err("failed to create histograms");
+			goto err_hist;
 		}
 	}
+	if (config_get_int(cfg, NULL, "histogram_summary")) {
+		i = config_get_int(cfg, NULL, "summary_interval");
+		p->hist_interval = i < 0 ? NS_PER_SEC >> (i < -30 ? 30 : -i) :
+			NS_PER_SEC << (i > 30 ? 30 : i);
+		clock_gettime(CLOCK_MONOTONIC, &p->hist_stamp);
+	}
+
+	if (transport != TRANS_UDS &&
+	    (type == CLOCK_TYPE_ORDINARY || type == CLOCK_TYPE_BOUNDARY) &&
+	    unicast_service_initialize(p)) {
+		pr_err("failed to create unicast service");
+		goto err_hist;
+	}
+	if (transport != TRANS_UDS &&
+	    (type == CLOCK_TYPE_ORDINARY || type == CLOCK_TYPE_BOUNDARY) &&
+	    unicast_client_initialize(p)) {
+		pr_err("failed to create unicast client");
+		goto err_hist;
+	}
+
+	if (p->rx_batch > 1) {
+		p->rx_batch_stats = stats_create();
+		if (!p->rx_batch_stats) {
+			pr_err("failed to create rx batch statistics");
+			goto err_hist;
+		}
+		p->rx_batch_interval =
+			config_get_int(cfg, NULL, "summary_interval");
+		clock_gettime(CLOCK_MONOTONIC, &p->rx_batch_stamp);
+	}
+
+	port_clear_fda(p, N_POLLFD);
 	return p;
 
-err_tsproc:
+err_hist:
+	unicast_client_cleanup(p);
+	unicast_service_cleanup(p);
+	port_hist_destroy(p);
 	tsproc_destroy(p->tsproc);
 err_transport:
 	transport_destroy(p->trp);
@@ -2946,7 +3580,9 @@ int port_state_update(struct port *p, enum fsm_event event, int mdiff)
 	if (next != p->state) {
 		port_show_transition(p, next, event);
 		p->state = next;
+		p->bmca_pending = 1;
 		port_notify_event(p, NOTIFY_PORT_STATE);
+		clock_update_status(p->clock);
 		return 1;
 	}
 
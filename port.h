@@ -24,6 +24,7 @@
 #include "foreign.h"
 #include "fsm.h"
 #include "notification.h"
+#include "tmq.h"
 #include "transport.h"
 
 /* forward declarations */
@@ -62,6 +63,23 @@ void port_close(struct port *port);
  */
 struct foreign_clock *port_compute_best(struct port *port);
 
+/**
+ * Tell whether the inputs to a port's state decision changed since the
+ * last decision. These are the port's state and the data set of its
+ * best foreign master, as found by @ref port_compute_best().
+ *
+ * @param port A pointer previously obtained via port_open().
+ * @return     One if the port needs a new state decision, zero otherwise.
+ */
+int port_bmca_pending(struct port *port);
+
+/**
+ * Mark the state decision of a port as done.
+ *
+ * @param port A pointer previously obtained via port_open().
+ */
+void port_bmca_done(struct port *port);
+
 /**
  * Dispatch a port event. This may cause a state transition on the
  * port, with the associated side effect.
@@ -82,6 +100,25 @@ void port_dispatch(struct port *p, enum fsm_event event, int mdiff);
  */
 enum fsm_event port_event(struct port *port, int fd_index);
 
+/**
+ * Collects the transmit time stamps queued on a port's event socket and
+ * completes the messages waiting for them. Only used when the port has
+ * deferred transmit time stamps enabled.
+ *
+ * @param port A pointer previously obtained via port_open().
+ * @return One of the @a fsm_event codes.
+ */
+enum fsm_event port_txts_event(struct port *port);
+
+/**
+ * Find out whether a port collects its transmit time stamps from the
+ * event loop instead of waiting for them after each transmission.
+ *
+ * @param port A pointer previously obtained via port_open().
+ * @return Non-zero if deferred time stamps are enabled, zero otherwise.
+ */
+int port_txts_deferred(struct port *port);
+
 /**
  * Forward a message on a given port.
  * @param port    A pointer previously obtained via port_open().
@@ -137,10 +174,29 @@ int port_link_status_get(struct port *p);
  * @param ingress  The port on which 'msg' was received.
  * @param msg      A management message.
  * @return         1 if the message was responded to, 0 if it did not apply
- *                 to the port, -1 if it was invalid.
+ *                 to the port, -1 if it was invalid.  A GET carrying
+ *                 several management TLVs is answered with one response
+ *                 holding the answers to all of the port management IDs.
  */
 int port_manage(struct port *p, struct port *ingress, struct ptp_message *msg);
 
+/**
+ * Test whether a management ID refers to a port data set.
+ * @param id  The management ID in question.
+ * @return    One if the ID is a port management ID, zero otherwise.
+ */
+int port_management_id(int id);
+
+/**
+ * Append a management error status TLV to a response.
+ * @param rsp       The response message.
+ * @param id        The management ID which caused the error.
+ * @param error_id  One of the management error ID values.
+ * @return          Zero on success, non-zero otherwise.
+ */
+int port_management_append_error(struct ptp_message *rsp, Enumeration16 id,
+				 Enumeration16 error_id);
+
 /**
  * Send a management error status message.
  * @param pid       The id of the responding port.
@@ -222,8 +278,8 @@ enum port_state port_state(struct port *port);
 int port_state_update(struct port *p, enum fsm_event event, int mdiff);
 
 /**
- * Return array of file descriptors for this port. The fault fd is not
- * included.
+ * Return array of file descriptors for this port. The timers are not
+ * descriptors, so their entries are always -1.
  * @param port	A port instance
  * @return	Array of file descriptors. Unused descriptors are guranteed
  *		to be set to -1.
@@ -231,55 +287,48 @@ int port_state_update(struct port *p, enum fsm_event event, int mdiff);
 struct fdarray *port_fda(struct port *port);
 
 /**
- * Return file descriptor of the port.
- * @param port	A port instance.
- * @return	File descriptor or -1 if not applicable.
- */
-int port_fault_fd(struct port *port);
-
-/**
- * Utility function for setting or resetting a file descriptor timer.
+ * Utility function for setting or resetting a port timer.
  *
- * This function sets the timer 'fd' to the value M(2^N), where M is
+ * This function sets the timer 't' to the value M(2^N), where M is
  * the value of the 'scale' parameter and N in the value of the
  * 'log_seconds' parameter.
  *
  * Passing both 'scale' and 'log_seconds' as zero disables the timer.
  *
- * @param fd A file descriptor previously opened with timerfd_create(2).
+ * @param t A timer previously prepared with tmq_timer_init().
  * @param scale The multiplicative factor for the timer.
  * @param log_seconds The exponential factor for the timer.
  * @return Zero on success, non-zero otherwise.
  */
-int set_tmo_log(int fd, unsigned int scale, int log_seconds);
+int set_tmo_log(struct tmq_timer *t, unsigned int scale, int log_seconds);
 
 /**
- * Utility function for setting a file descriptor timer.
+ * Utility function for setting a port timer.
  *
- * This function sets the timer 'fd' to a random value between M * 2^N and
+ * This function sets the timer 't' to a random value between M * 2^N and
  * (M + S) * 2^N, where M is the value of the 'min' parameter, S is the value
  * of the 'span' parameter, and N in the value of the 'log_seconds' parameter.
  *
- * @param fd A file descriptor previously opened with timerfd_create(2).
+ * @param t A timer previously prepared with tmq_timer_init().
  * @param min The minimum value for the timer.
  * @param span The span value for the timer. Must be a positive value.
  * @param log_seconds The exponential factor for the timer.
  * @return Zero on success, non-zero otherwise.
  */
-int set_tmo_random(int fd, int min, int span, int log_seconds);
+int set_tmo_random(struct tmq_timer *t, int min, int span, int log_seconds);
 
 /**
- * Utility function for setting or resetting a file descriptor timer.
+ * Utility function for setting or resetting a port timer.
  *
- * This function sets the timer 'fd' to the value of the 'seconds' parameter.
+ * This function sets the timer 't' to the value of the 'seconds' parameter.
  *
  * Passing 'seconds' as zero disables the timer.
  *
- * @param fd A file descriptor previously opened with timerfd_create(2).
+ * @param t A timer previously prepared with tmq_timer_init().
  * @param seconds The timeout value for the timer.
  * @return Zero on success, non-zero otherwise.
  */
-int set_tmo_lin(int fd, int seconds);
+int set_tmo_lin(struct tmq_timer *t, int seconds);
 
 /**
  * Sets port's fault file descriptor timer.
@@ -23,7 +23,10 @@
 
 #include "clock.h"
 #include "fsm.h"
+#include "histogram.h"
 #include "msg.h"
+#include "stats.h"
+#include "tmq.h"
 #include "tmv.h"
 
 #define NSEC2SEC 1000000000LL
@@ -50,13 +53,33 @@ struct nrate_estimator {
 	int ratio_valid;
 };
 
+/* The number of hash buckets holding a port's transmitted messages. */
+#define TC_HASH_SIZE 64
+
 struct tc_txd {
 	TAILQ_ENTRY(tc_txd) list;
+	LIST_ENTRY(tc_txd) hash;
 	struct ptp_message *msg;
 	tmv_t residence;
+	int64_t expiry; /* CLOCK_MONOTONIC nanoseconds */
 	int ingress_port;
 };
 
+struct txts_pending {
+	TAILQ_ENTRY(txts_pending) list;
+	struct ptp_message *msg;
+	struct port *ingress;
+	tmv_t ingress_ts;
+	struct timespec sent;
+};
+
+enum port_hist {
+	PORT_HIST_OFFSET,
+	PORT_HIST_DELAY,
+	PORT_HIST_RESIDENCE,
+	N_PORT_HIST,
+};
+
 struct port {
 	LIST_ENTRY(port) list;
 	char *name;
@@ -65,7 +88,8 @@ struct port {
 	struct transport *trp;
 	enum timestamp_type timestamping;
 	struct fdarray fda;
-	int fault_fd;
+	struct tmq_timer timer[N_TIMER_FDS];
+	struct tmq_timer fault_timer;
 	int phc_index;
 
 	void (*dispatch)(struct port *p, enum fsm_event event, int mdiff);
@@ -73,9 +97,14 @@ struct port {
 
 	int jbod;
 	struct foreign_clock *best;
+	/* Erbest as of the last state decision */
+	struct foreign_clock *last_best;
+	struct dataset last_best_ds;
+	int bmca_pending;
 	enum syfu_state syfu;
 	struct ptp_message *last_syncfup;
 	TAILQ_HEAD(delay_req, ptp_message) delay_req;
+	TAILQ_HEAD(delay_resp, ptp_message) delay_resp;
 	struct ptp_message *peer_delay_req;
 	struct ptp_message *peer_delay_resp;
 	struct ptp_message *peer_delay_fup;
@@ -84,6 +113,7 @@ struct port {
 	struct {
 		UInteger16 announce;
 		UInteger16 delayreq;
+		UInteger16 signaling;
 		UInteger16 sync;
 	} seqnum;
 	tmv_t peer_delay;
@@ -121,6 +151,8 @@ struct port {
 	int                 net_sync_monitor;
 	int                 path_trace_enabled;
 	int                 tc_spanning_tree;
+	int                 txts_deferred;
+	int                 rx_batch;
 	Integer64           rx_timestamp_offset;
 	Integer64           tx_timestamp_offset;
 	enum link_state     link_status;
@@ -129,11 +161,32 @@ struct port {
 	unsigned int        versionNumber; /*UInteger4*/
 	/* foreignMasterDS */
 	LIST_HEAD(fm, foreign_clock) foreign_masters;
-	/* TC book keeping */
+	/* the foreign masters indexed by sourcePortIdentity */
+	struct hash *foreign_index;
+	/* the foreign masters which are holding announce messages */
+	LIST_HEAD(fma, foreign_clock) active_masters;
+	/* TC book keeping, in order of expiry and indexed by tc_hash() */
 	TAILQ_HEAD(tct, tc_txd) tc_transmitted;
+	LIST_HEAD(tch, tc_txd) tc_index[TC_HASH_SIZE];
+	/* event messages waiting for their transmit time stamps */
+	TAILQ_HEAD(txp, txts_pending) txts_pending;
+	/* messages read per wake up, when reading in batches */
+	struct stats *rx_batch_stats;
+	struct timespec rx_batch_stamp;
+	int rx_batch_interval;
+	/* tail statistics since the last summary and since the start */
+	struct histogram *hist[N_PORT_HIST];
+	struct histogram *hist_total[N_PORT_HIST];
+	struct timespec hist_stamp;
+	int64_t hist_interval; /* nanoseconds, zero without summaries */
+	/* grants unicast transmission, when unicast_listen is enabled */
+	struct unicast_service *unicast_service;
+	/* requests unicast transmission, with a unicast_master_table */
+	struct unicast_client *unicast_client;
 };
 
 #define portnum(p) (p->portIdentity.portNumber)
+#define port_timer(p, index) (&(p)->timer[(index) - FD_FIRST_TIMER])
 
 void e2e_dispatch(struct port *p, enum fsm_event event, int mdiff);
 enum fsm_event e2e_event(struct port *p, int fd_index);
@@ -146,15 +199,25 @@ void delay_req_prune(struct port *p);
 void fc_clear(struct foreign_clock *fc);
 void flush_delay_req(struct port *p);
 void flush_last_sync(struct port *p);
-int port_clr_tmo(int fd);
+int port_clr_tmo(struct tmq_timer *t);
 int port_delay_request(struct port *p);
 void port_disable(struct port *p);
+void port_hist_add(struct port *p, enum port_hist type, tmv_t value);
 int port_initialize(struct port *p);
 int port_is_enabled(struct port *p);
 void port_link_status(void *ctx, int index, int linkup);
 int port_set_announce_tmo(struct port *p);
 int port_set_delay_tmo(struct port *p);
 int port_set_qualification_tmo(struct port *p);
+struct ptp_message *port_signaling_construct(struct port *p,
+					     struct address *address,
+					     struct PortIdentity *tpid);
+int port_tx_announce(struct port *p, struct address *dst);
+int port_tx_announce_batch(struct port *p, struct address **dst,
+			   UInteger16 *seqnum, int n);
+int port_tx_sync(struct port *p, struct address *dst);
+int port_txts_defer(struct port *p, struct ptp_message *msg,
+		    struct port *ingress, tmv_t ingress_ts);
 void port_show_transition(struct port *p, enum port_state next,
 			  enum fsm_event event);
 int process_announce(struct port *p, struct ptp_message *m);
@@ -163,6 +226,7 @@ void process_follow_up(struct port *p, struct ptp_message *m);
 int process_pdelay_req(struct port *p, struct ptp_message *m);
 int process_pdelay_resp(struct port *p, struct ptp_message *m);
 void process_pdelay_resp_fup(struct port *p, struct ptp_message *m);
+int process_signaling(struct port *p, struct ptp_message *m);
 void process_sync(struct port *p, struct ptp_message *m);
 int pid_eq(struct PortIdentity *a, struct PortIdentity *b);
 int source_pid_eq(struct ptp_message *m1, struct ptp_message *m2);
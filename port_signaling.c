@@ -0,0 +1,182 @@
+/**
+ * @file port_signaling.c
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <string.h>
+
+#include "port.h"
+#include "port_private.h"
+#include "print.h"
+#include "unicast_client.h"
+#include "unicast_service.h"
+
+static int port_signaling_target(struct port *p, struct ptp_message *m)
+{
+	struct ClockIdentity wildcard = {
+		{0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}
+	};
+	struct PortIdentity *tpid = &m->signaling.targetPortIdentity;
+
+	if (memcmp(&tpid->clockIdentity, &wildcard, sizeof(wildcard)) &&
+	    memcmp(&tpid->clockIdentity, &p->portIdentity.clockIdentity,
+		   sizeof(wildcard))) {
+		return 0;
+	}
+	return tpid->portNumber == 0xffff || tpid->portNumber == portnum(p);
+}
+
+struct ptp_message *port_signaling_construct(struct port *p,
+					     struct address *address,
+					     struct PortIdentity *tpid)
+{
+	struct ptp_message *msg;
+
+	msg = msg_allocate();
+	if (!msg) {
+		return NULL;
+	}
+	msg->hwts.type                 = p->timestamping;
+	msg->header.tsmt               = SIGNALING | p->transportSpecific;
+	msg->header.ver                = PTP_VERSION;
+	msg->header.messageLength      = sizeof(struct signaling_msg);
+	msg->header.domainNumber       = clock_domain_number(p->clock);
+	msg->header.sourcePortIdentity = p->portIdentity;
+	msg->header.sequenceId         = p->seqnum.signaling++;
+	msg->header.control            = CTL_OTHER;
+	msg->header.logMessageInterval = 0x7F;
+	msg->header.flagField[0]      |= UNICAST;
+
+	msg->signaling.targetPortIdentity = *tpid;
+	msg->address = *address;
+
+	return msg;
+}
+
+static int process_request(struct port *p, struct ptp_message *m,
+			   struct tlv_extra *extra, struct ptp_message *rsp)
+{
+	struct request_unicast_xmit_tlv *req;
+	struct grant_unicast_xmit_tlv *g;
+	struct tlv_extra *rsp_extra;
+
+	req = (struct request_unicast_xmit_tlv *) extra->tlv;
+
+	rsp_extra = msg_tlv_append(rsp, sizeof(*g));
+	if (!rsp_extra) {
+		return -1;
+	}
+	g = (struct grant_unicast_xmit_tlv *) rsp_extra->tlv;
+	g->type = TLV_GRANT_UNICAST_TRANSMISSION;
+	g->length = sizeof(*g) - sizeof(g->type) - sizeof(g->length);
+	g->message_type = req->message_type;
+	g->logInterMessagePeriod = req->logInterMessagePeriod;
+
+	if (unicast_service_add(p, m, extra) == SERVICE_GRANTED) {
+		g->durationField = req->durationField;
+		g->flags = GRANT_UNICAST_RENEWAL_INVITED;
+	} else {
+		/* A zero duration denies the request. */
+		g->durationField = 0;
+	}
+	return 0;
+}
+
+static int process_cancel(struct port *p, struct ptp_message *m,
+			  struct tlv_extra *extra, struct ptp_message *rsp)
+{
+	struct cancel_unicast_xmit_tlv *cancel, *ack;
+	struct tlv_extra *rsp_extra;
+
+	cancel = (struct cancel_unicast_xmit_tlv *) extra->tlv;
+	unicast_service_remove(p, m, extra);
+	unicast_client_cancel(p, m, extra);
+
+	rsp_extra = msg_tlv_append(rsp, sizeof(*ack));
+	if (!rsp_extra) {
+		return -1;
+	}
+	ack = (struct cancel_unicast_xmit_tlv *) rsp_extra->tlv;
+	ack->type = TLV_ACKNOWLEDGE_CANCEL_UNICAST_TRANSMISSION;
+	ack->length = sizeof(*ack) - sizeof(ack->type) - sizeof(ack->length);
+	ack->message_type_flags = cancel->message_type_flags;
+	return 0;
+}
+
+int process_signaling(struct port *p, struct ptp_message *m)
+{
+	struct ptp_message *rsp = NULL;
+	struct tlv_extra *extra;
+	int err = 0;
+
+	switch (p->state) {
+	case PS_INITIALIZING:
+	case PS_FAULTY:
+	case PS_DISABLED:
+		return 0;
+	default:
+		break;
+	}
+	if ((!p->unicast_service && !p->unicast_client) || !msg_unicast(m) ||
+	    !port_signaling_target(p, m)) {
+		return 0;
+	}
+
+	/* All of the answers go back together in one message. */
+	TAILQ_FOREACH(extra, &m->tlv_list, list) {
+		switch (extra->tlv->type) {
+		case TLV_REQUEST_UNICAST_TRANSMISSION:
+			if (!p->unicast_service) {
+				continue;
+			}
+			break;
+		case TLV_GRANT_UNICAST_TRANSMISSION:
+			unicast_client_grant(p, m, extra);
+			continue;
+		case TLV_CANCEL_UNICAST_TRANSMISSION:
+			break;
+		default:
+			continue;
+		}
+		if (!rsp) {
+			rsp = port_signaling_construct(p, &m->address,
+					&m->header.sourcePortIdentity);
+			if (!rsp) {
+				return -1;
+			}
+		}
+		if (extra->tlv->type == TLV_REQUEST_UNICAST_TRANSMISSION) {
+			err = process_request(p, m, extra, rsp);
+		} else {
+			err = process_cancel(p, m, extra, rsp);
+		}
+		if (err) {
+			/* Answer what fits, the client will ask again. */
+			pr_debug("port %hu: signaling response too long",
+				 portnum(p));
+			break;
+		}
+	}
+	if (!rsp) {
+		return 0;
+	}
+	/* An unreachable client must not fault the port, it will ask again. */
+	if (port_prepare_and_send(p, rsp, TRANS_GENERAL)) {
+		pr_err("port %hu: send signaling failed", portnum(p));
+	}
+	msg_put(rsp);
+	return 0;
+}
@@ -16,19 +16,54 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "print.h"
 
+#define PRINT_BUF_SIZE 1024
+
+struct print_record {
+	unsigned int seq;
+	int level;
+	struct timespec ts;
+	char buf[PRINT_BUF_SIZE];
+};
+
+/*
+ * A bounded queue with many producers and one consumer. A producer
+ * claims a slot by advancing the head, fills it, and then publishes it
+ * by setting the slot's sequence number to its position plus one. The
+ * consumer frees the slot for the next lap by moving the sequence
+ * number on by the size of the ring. When the ring is full, messages
+ * are counted and dropped instead of blocking the caller.
+ */
+struct print_queue {
+	struct print_record *rec;
+	unsigned int mask;
+	unsigned int head;
+	unsigned int tail;
+	unsigned int dropped;
+	int stop;
+	sem_t sem;
+	pthread_t thread;
+};
+
 static int verbose = 0;
 static int print_level = LOG_INFO;
 static int use_syslog = 1;
 static const char *progname;
 static const char *message_tag;
+static struct print_queue *queue;
 
 void print_set_progname(const char *name)
 {
@@ -55,35 +90,183 @@ void print_set_verbose(int value)
 	verbose = value ? 1 : 0;
 }
 
-void print(int level, char const *format, ...)
+static void print_out(int level, struct timespec *ts, const char *buf)
 {
-	struct timespec ts;
-	va_list ap;
-	char buf[1024];
 	FILE *f;
 
-	if (level > print_level)
-		return;
-
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-
-	va_start(ap, format);
-	vsnprintf(buf, sizeof(buf), format, ap);
-	va_end(ap);
-
 	if (verbose) {
 		f = level >= LOG_NOTICE ? stdout : stderr;
 		fprintf(f, "%s[%ld.%03ld]: %s%s%s\n",
 			progname ? progname : "",
-			ts.tv_sec, ts.tv_nsec / 1000000,
+			ts->tv_sec, ts->tv_nsec / 1000000,
 			message_tag ? message_tag : "", message_tag ? " " : "",
 			buf);
 		fflush(f);
 	}
 	if (use_syslog) {
 		syslog(level, "[%ld.%03ld] %s%s%s",
-		       ts.tv_sec, ts.tv_nsec / 1000000,
+		       ts->tv_sec, ts->tv_nsec / 1000000,
 		       message_tag ? message_tag : "", message_tag ? " " : "",
 		       buf);
 	}
 }
+
+static struct print_record *queue_claim(struct print_queue *q)
+{
+	unsigned int pos, seq;
+	struct print_record *r;
+
+	pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	while (1) {
+		r = &q->rec[pos & q->mask];
+		seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1,
+							1, __ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				return r;
+		} else if ((int) (seq - pos) < 0) {
+			__atomic_fetch_add(&q->dropped, 1, __ATOMIC_RELAXED);
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static void queue_publish(struct print_queue *q, struct print_record *r)
+{
+	__atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELEASE);
+	sem_post(&q->sem);
+}
+
+static void queue_drain(struct print_queue *q)
+{
+	struct print_record *r;
+	struct timespec ts;
+	unsigned int n;
+	char buf[64];
+
+	while (1) {
+		r = &q->rec[q->tail & q->mask];
+		if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != q->tail + 1)
+			break;
+		print_out(r->level, &r->ts, r->buf);
+		__atomic_store_n(&r->seq, q->tail + q->mask + 1,
+				 __ATOMIC_RELEASE);
+		q->tail++;
+	}
+	n = __atomic_exchange_n(&q->dropped, 0, __ATOMIC_RELAXED);
+	if (n) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		snprintf(buf, sizeof(buf), "dropped %u log messages", n);
+		print_out(LOG_WARNING, &ts, buf);
+	}
+}
+
+static void *queue_run(void *arg)
+{
+	struct print_queue *q = arg;
+
+	while (!__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE)) {
+		if (sem_wait(&q->sem) && errno != EINTR)
+			break;
+		queue_drain(q);
+	}
+	return NULL;
+}
+
+int print_start_async(unsigned int size)
+{
+	struct print_queue *q;
+	sigset_t all, old;
+	unsigned int i;
+	int err;
+
+	if (!size || queue)
+		return 0;
+
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return -1;
+	for (q->mask = 1; q->mask < size; q->mask <<= 1)
+		;
+	q->rec = calloc(q->mask, sizeof(*q->rec));
+	if (!q->rec) {
+		free(q);
+		return -1;
+	}
+	for (i = 0; i < q->mask; i++)
+		q->rec[i].seq = i;
+	q->mask--;
+	sem_init(&q->sem, 0, 0);
+
+	/* Leave the signals to the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&q->thread, NULL, queue_run, q);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		pr_err("failed to start the logging thread: %s", strerror(err));
+		sem_destroy(&q->sem);
+		free(q->rec);
+		free(q);
+		return -1;
+	}
+	queue = q;
+	return 0;
+}
+
+void print_stop_async(void)
+{
+	struct print_queue *q = queue;
+
+	if (!q)
+		return;
+
+	queue = NULL;
+	__atomic_store_n(&q->stop, 1, __ATOMIC_RELEASE);
+	sem_post(&q->sem);
+	pthread_join(q->thread, NULL);
+	queue_drain(q);
+	sem_destroy(&q->sem);
+	free(q->rec);
+	free(q);
+}
+
+void print(int level, char const *format, ...)
+{
+	struct print_record *r;
+	struct timespec ts;
+	va_list ap;
+	char buf[PRINT_BUF_SIZE];
+
+	if (level > print_level)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	/*
+	 * The message is formatted right away, because the arguments may
+	 * point to buffers that are reused by the caller, and %m needs
+	 * the current errno. Only the output is deferred.
+	 */
+	if (queue) {
+		r = queue_claim(queue);
+		if (!r)
+			return;
+		r->level = level;
+		r->ts = ts;
+		va_start(ap, format);
+		vsnprintf(r->buf, sizeof(r->buf), format, ap);
+		va_end(ap);
+		queue_publish(queue, r);
+		return;
+	}
+
+	va_start(ap, format);
+	vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+
+	print_out(level, &ts, buf);
+}
@@ -38,6 +38,22 @@ void print_set_syslog(int value);
 void print_set_level(int level);
 void print_set_verbose(int value);
 
+/**
+ * Hand the output of the messages over to a separate thread, so that
+ * callers never block on the standard output or the system log. When
+ * the queue is full, messages are dropped and counted.
+ * @param size  The number of messages the queue can hold, rounded up to
+ *              a power of two. Zero keeps the output synchronous.
+ * @return      Zero on success, non-zero otherwise.
+ */
+int print_start_async(unsigned int size);
+
+/**
+ * Write out the queued messages, stop the output thread and return to
+ * synchronous output.
+ */
+void print_stop_async(void);
+
 #define pr_emerg(x...)   print(LOG_EMERG, x)
 #define pr_alert(x...)   print(LOG_ALERT, x)
 #define pr_crit(x...)    print(LOG_CRIT, x)
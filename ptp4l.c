@@ -192,6 +192,10 @@ int main(int argc, char *argv[])
 	print_set_verbose(config_get_int(cfg, NULL, "verbose"));
 	print_set_syslog(config_get_int(cfg, NULL, "use_syslog"));
 	print_set_level(config_get_int(cfg, NULL, "logging_level"));
+	if (print_start_async(config_get_int(cfg, NULL, "log_queue_size"))) {
+		fprintf(stderr, "failed to start the logging thread\n");
+		goto out;
+	}
 
 	assume_two_step = config_get_int(cfg, NULL, "assume_two_step");
 	sk_check_fupsync = config_get_int(cfg, NULL, "check_fup_sync");
@@ -261,6 +265,7 @@ int main(int argc, char *argv[])
 out:
 	if (clock)
 		clock_destroy(clock);
+	print_stop_async();
 	config_destroy(cfg);
 	return err;
 }
@@ -0,0 +1,350 @@
+/**
+ * @file ptp_replay.c
+ * @brief Feeds a recorded trace through the time stamp processor and servo.
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "print.h"
+#include "servo.h"
+#include "stats.h"
+#include "trace.h"
+#include "tsproc.h"
+#include "util.h"
+#include "version.h"
+
+#define NS_PER_SEC 1000000000LL
+
+/*
+ * The recorded time stamps were taken while the original servo steered
+ * the local clock. The replay keeps track of how far the clock steered
+ * by the replayed servo would have drifted from the original one, and
+ * moves the local time stamps by that amount. With the original servo
+ * and configuration the replay reproduces the recorded run.
+ */
+struct replay {
+	struct servo *servo;
+	struct tsproc *tsp;
+	enum servo_state state;
+	tmv_t offset;
+	tmv_t delay;
+	/* Local time of the replayed clock minus the recorded one. */
+	double shift;
+	/* Recorded local time when shift was last updated. */
+	int64_t shift_ts;
+	/* Frequencies applied by the original and the replayed servo. */
+	double freq_orig;
+	double freq;
+	int quiet;
+	struct stats *offset_stats;
+	struct stats *freq_stats;
+	struct stats *time_stats;
+	int64_t max_time;
+	unsigned long samples;
+};
+
+static double shift_at(struct replay *r, int64_t ts)
+{
+	return r->shift + (r->freq_orig - r->freq) * 1e-9 * (ts - r->shift_ts);
+}
+
+static tmv_t local_ts(struct replay *r, tmv_t ts)
+{
+	return tmv_add(ts, dbl_tmv(shift_at(r, tmv_to_nanoseconds(ts))));
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/* Does what clock_synchronize() does, except for leap seconds. */
+static void replay_sync(struct replay *r, tmv_t ingress, tmv_t origin)
+{
+	enum servo_state state = SERVO_UNLOCKED;
+	int64_t start, elapsed, ts;
+	double adj, weight;
+
+	ts = tmv_to_nanoseconds(ingress);
+	r->shift = shift_at(r, ts);
+	r->shift_ts = ts;
+	ingress = local_ts(r, ingress);
+
+	start = now_ns();
+
+	tsproc_down_ts(r->tsp, origin, ingress);
+	if (tsproc_update_offset(r->tsp, &r->offset, &weight)) {
+		return;
+	}
+	adj = servo_sample(r->servo, tmv_dbl(r->offset),
+			   tmv_to_nanoseconds(ingress), weight, &state);
+	r->state = state;
+	tsproc_set_clock_rate_ratio(r->tsp, servo_rate_ratio(r->servo));
+
+	switch (state) {
+	case SERVO_UNLOCKED:
+		break;
+	case SERVO_JUMP:
+		r->freq = adj;
+		r->shift -= tmv_dbl(r->offset);
+		tsproc_reset(r->tsp, 0);
+		break;
+	case SERVO_LOCKED:
+		r->freq = adj;
+		break;
+	}
+
+	elapsed = now_ns() - start;
+	if (elapsed > r->max_time) {
+		r->max_time = elapsed;
+	}
+	stats_add_value(r->time_stats, elapsed);
+	stats_add_value(r->offset_stats, tmv_dbl(r->offset));
+	stats_add_value(r->freq_stats, adj);
+	r->samples++;
+
+	if (!r->quiet) {
+		printf("%" PRId64 " %.3f %d %+.3f %.3f %" PRId64 "\n",
+		       tmv_to_nanoseconds(ingress), tmv_dbl(r->offset), state,
+		       adj, tmv_dbl(r->delay), elapsed);
+	}
+}
+
+static void replay_servo(struct replay *r, struct trace_record *rec)
+{
+	switch (rec->arg) {
+	case SERVO_UNLOCKED:
+		break;
+	case SERVO_JUMP:
+		r->freq_orig = rec->value;
+		r->shift += tmv_dbl(trace_tmv(&rec->t[0]));
+		break;
+	case SERVO_LOCKED:
+		r->freq_orig = rec->value;
+		break;
+	}
+}
+
+static int replay_record(struct replay *r, struct trace_record *rec)
+{
+	int n;
+
+	switch (rec->type) {
+	case TRACE_SYNC:
+		replay_sync(r, trace_tmv(&rec->t[0]),
+			    tmv_add(trace_tmv(&rec->t[1]),
+				    trace_tmv(&rec->t[2])));
+		break;
+	case TRACE_SERVO:
+		replay_servo(r, rec);
+		break;
+	case TRACE_DELAY:
+		tsproc_up_ts(r->tsp, local_ts(r, trace_tmv(&rec->t[0])),
+			     tmv_sub(trace_tmv(&rec->t[1]),
+				     trace_tmv(&rec->t[2])));
+		tsproc_update_delay(r->tsp, &r->delay);
+		break;
+	case TRACE_PEER_DELAY:
+		r->delay = trace_tmv(&rec->t[0]);
+		tsproc_set_delay(r->tsp, r->delay);
+		tsproc_up_ts(r->tsp, local_ts(r, trace_tmv(&rec->t[1])),
+			     trace_tmv(&rec->t[2]));
+		break;
+	case TRACE_RESET:
+		tsproc_reset(r->tsp, rec->arg);
+		if (!tmv_is_zero(trace_tmv(&rec->t[0]))) {
+			tsproc_set_delay(r->tsp, trace_tmv(&rec->t[0]));
+		}
+		break;
+	case TRACE_INTERVAL:
+		n = rec->arg;
+		servo_sync_interval(r->servo,
+				    n < 0 ? 1.0 / (1 << -n) : 1 << n);
+		break;
+	case TRACE_SERVO_RESET:
+		servo_reset(r->servo);
+		break;
+	default:
+		pr_err("unknown trace record type %hu", rec->type);
+		return -1;
+	}
+	return 0;
+}
+
+static void replay_summary(struct replay *r)
+{
+	struct stats_result offset, freq, time;
+
+	if (stats_get_result(r->offset_stats, &offset) ||
+	    stats_get_result(r->freq_stats, &freq) ||
+	    stats_get_result(r->time_stats, &time)) {
+		fprintf(stderr, "no servo samples\n");
+		return;
+	}
+	fprintf(stderr,
+		"samples %lu rms %.3f max %.3f freq %+.3f +/- %.3f "
+		"time %.0f +/- %.0f max %" PRId64 " ns\n",
+		r->samples, offset.rms, offset.max_abs, freq.mean, freq.stddev,
+		time.mean, time.stddev, r->max_time);
+}
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options] trace-file\n\n"
+		" -f [file]      read configuration from 'file'\n"
+		" -E [pi|linreg|kalman] clock servo, overriding the configuration\n"
+		" -q             only print the summary\n"
+		" -v             prints the software version and exits\n"
+		" -h             prints this message and exits\n"
+		"\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	char *config = NULL, *progname;
+	struct trace_header hdr;
+	struct trace_record rec;
+	struct replay r;
+	struct config *cfg;
+	struct trace *t;
+	int c, err = -1, res;
+
+	memset(&r, 0, sizeof(r));
+
+	cfg = config_create();
+	if (!cfg) {
+		return -1;
+	}
+
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1 + progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "f:E:qvh"))) {
+		switch (c) {
+		case 'f':
+			config = optarg;
+			break;
+		case 'E':
+			if (!strcasecmp(optarg, "pi")) {
+				config_set_int(cfg, "clock_servo",
+					       CLOCK_SERVO_PI);
+			} else if (!strcasecmp(optarg, "linreg")) {
+				config_set_int(cfg, "clock_servo",
+					       CLOCK_SERVO_LINREG);
+			} else if (!strcasecmp(optarg, "kalman")) {
+				config_set_int(cfg, "clock_servo",
+					       CLOCK_SERVO_KALMAN);
+			} else {
+				fprintf(stderr,
+					"invalid servo name %s\n", optarg);
+				goto out;
+			}
+			break;
+		case 'q':
+			r.quiet = 1;
+			break;
+		case 'v':
+			version_show(stdout);
+			err = 0;
+			goto out;
+		case 'h':
+			usage(progname);
+			err = 0;
+			goto out;
+		default:
+			usage(progname);
+			goto out;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(progname);
+		goto out;
+	}
+	if (config && config_read(config, cfg)) {
+		fprintf(stderr, "failed to read configuration file\n");
+		goto out;
+	}
+
+	print_set_progname(progname);
+	print_set_verbose(1);
+	print_set_syslog(0);
+	print_set_level(config_get_int(cfg, NULL, "logging_level"));
+
+	t = trace_open(argv[optind], &hdr);
+	if (!t) {
+		goto out;
+	}
+
+	r.freq = r.freq_orig = hdr.fadj;
+	r.servo = servo_create(cfg, config_get_int(cfg, NULL, "clock_servo"),
+			       hdr.fadj, hdr.max_adj, hdr.sw_ts);
+	r.tsp = tsproc_create(config_get_int(cfg, NULL, "tsproc_mode"),
+			      config_get_int(cfg, NULL, "delay_filter"),
+			      config_get_int(cfg, NULL, "delay_filter_length"),
+			      config_get_int(cfg, NULL,
+					     "delay_filter_percentile"));
+	r.offset_stats = stats_create();
+	r.freq_stats = stats_create();
+	r.time_stats = stats_create();
+	if (!r.servo || !r.tsp || !r.offset_stats || !r.freq_stats ||
+	    !r.time_stats) {
+		fprintf(stderr, "failed to create the servo\n");
+		goto no_replay;
+	}
+	r.delay = dbl_tmv(config_get_int(cfg, NULL, "initial_delay"));
+	if (!tmv_is_zero(r.delay)) {
+		tsproc_set_delay(r.tsp, r.delay);
+	}
+	servo_sync_interval(r.servo, 1.0);
+
+	while ((res = trace_read(t, &rec)) > 0) {
+		if (replay_record(&r, &rec)) {
+			break;
+		}
+	}
+	if (!res) {
+		replay_summary(&r);
+		err = 0;
+	}
+
+no_replay:
+	if (r.servo)
+		servo_destroy(r.servo);
+	if (r.tsp)
+		tsproc_destroy(r.tsp);
+	if (r.offset_stats)
+		stats_destroy(r.offset_stats);
+	if (r.freq_stats)
+		stats_destroy(r.freq_stats);
+	if (r.time_stats)
+		stats_destroy(r.time_stats);
+	trace_close(t);
+out:
+	config_destroy(cfg);
+	return err;
+}
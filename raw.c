@@ -252,42 +252,100 @@ no_mac:
 	return -1;
 }
 
+/* Only reports the changes of the VLAN mode. */
+static void raw_check_vlan(struct raw *raw, struct eth_hdr *hdr)
+{
+	int vlan = ETH_P_8021Q == ntohs(hdr->type);
+
+	if (raw->vlan == vlan) {
+		return;
+	}
+	raw->vlan = vlan;
+	if (vlan) {
+		pr_notice("raw: switching to VLAN mode");
+	} else {
+		pr_notice("raw: disabling VLAN mode");
+	}
+}
+
+/*
+ * Frames may arrive with or without a VLAN tag, and so each one is
+ * received as if it were tagged, sizeof(struct vlan_hdr) bytes before
+ * the message buffer. The payload of an untagged frame then starts
+ * VLAN_HLEN bytes early and is moved into place.
+ */
+static int raw_strip_hdr(struct raw *raw, void *buf, int cnt)
+{
+	struct eth_hdr *hdr;
+
+	if (cnt < 0) {
+		return cnt;
+	}
+	hdr = (struct eth_hdr *) ((unsigned char *) buf -
+				  sizeof(struct vlan_hdr));
+	raw_check_vlan(raw, hdr);
+
+	if (ETH_P_8021Q == ntohs(hdr->type)) {
+		return cnt - sizeof(struct vlan_hdr);
+	}
+	cnt -= sizeof(struct eth_hdr);
+	if (cnt > 0) {
+		memmove(buf, (unsigned char *) buf - VLAN_HLEN, cnt);
+	}
+	return cnt;
+}
+
 static int raw_recv(struct transport *t, int fd, void *buf, int buflen,
 		    struct address *addr, struct hw_timestamp *hwts)
 {
-	int cnt, hlen;
 	unsigned char *ptr = buf;
-	struct eth_hdr *hdr;
 	struct raw *raw = container_of(t, struct raw, t);
+	int cnt;
 
-	if (raw->vlan) {
-		hlen = sizeof(struct vlan_hdr);
-	} else {
-		hlen = sizeof(struct eth_hdr);
+	ptr -= sizeof(struct vlan_hdr);
+	cnt = sk_receive(fd, ptr, buflen + sizeof(struct eth_hdr), addr, hwts, 0);
+
+	return raw_strip_hdr(raw, buf, cnt);
+}
+
+static int raw_recv_batch(struct transport *t, int fd, void **buf, int buflen,
+			  struct address **addr, struct hw_timestamp **hwts,
+			  int *cnt, int n)
+{
+	void *ptr[SK_RX_BATCH_MAX];
+	int i, res;
+	struct raw *raw = container_of(t, struct raw, t);
+
+	for (i = 0; i < n; i++) {
+		ptr[i] = (unsigned char *) buf[i] - sizeof(struct vlan_hdr);
 	}
-	ptr    -= hlen;
-	buflen += hlen;
-	hdr = (struct eth_hdr *) ptr;
 
-	cnt = sk_receive(fd, ptr, buflen, addr, hwts, 0);
+	res = sk_receive_batch(fd, ptr, buflen + sizeof(struct eth_hdr),
+			       addr, hwts, cnt, n);
 
-	if (cnt >= 0)
-		cnt -= hlen;
-	if (cnt < 0)
-		return cnt;
+	for (i = 0; i < res; i++) {
+		cnt[i] = raw_strip_hdr(raw, buf[i], cnt[i]);
+	}
+	return res;
+}
 
-	if (raw->vlan) {
-		if (ETH_P_1588 == ntohs(hdr->type)) {
-			pr_notice("raw: disabling VLAN mode");
-			raw->vlan = 0;
-		}
-	} else {
-		if (ETH_P_8021Q == ntohs(hdr->type)) {
-			pr_notice("raw: switching to VLAN mode");
-			raw->vlan = 1;
-		}
+static int raw_send_batch(struct transport *t, struct fdarray *fda,
+			  void **buf, int *len, struct address **addr, int n)
+{
+	struct raw *raw = container_of(t, struct raw, t);
+	void *ptr[SK_TX_BATCH_MAX];
+	struct eth_hdr *hdr;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		ptr[i] = (unsigned char *) buf[i] - sizeof(*hdr);
+		len[i] += sizeof(*hdr);
+		hdr = ptr[i];
+		addr_to_mac(&hdr->dst, addr[i] ? addr[i] : &raw->ptp_addr);
+		addr_to_mac(&hdr->src, &raw->src_addr);
+		hdr->type = htons(ETH_P_1588);
 	}
-	return cnt;
+	return sk_send_batch(fda->fd[FD_GENERAL], ptr, len, NULL, 0, n);
 }
 
 static int raw_send(struct transport *t, struct fdarray *fda,
@@ -364,6 +422,8 @@ struct transport *raw_transport_create(void)
 	raw->t.close   = raw_close;
 	raw->t.open    = raw_open;
 	raw->t.recv    = raw_recv;
+	raw->t.recv_batch = raw_recv_batch;
+	raw->t.send_batch = raw_send_batch;
 	raw->t.send    = raw_send;
 	raw->t.release = raw_release;
 	raw->t.physical_addr = raw_physical_addr;
@@ -19,6 +19,7 @@
 #include <string.h>
 
 #include "config.h"
+#include "kalman.h"
 #include "linreg.h"
 #include "ntpshm.h"
 #include "nullf.h"
@@ -48,6 +49,9 @@ struct servo *servo_create(struct config *cfg, enum servo_type type,
 	case CLOCK_SERVO_NULLF:
 		servo = nullf_servo_create();
 		break;
+	case CLOCK_SERVO_KALMAN:
+		servo = kalman_servo_create(fadj, sw_ts);
+		break;
 	default:
 		return NULL;
 	}
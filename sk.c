@@ -290,49 +290,14 @@ int sk_interface_addr(const char *name, int family, struct address *addr)
 static short sk_events = POLLPRI;
 static short sk_revents = POLLPRI;
 
-int sk_receive(int fd, void *buf, int buflen,
-	       struct address *addr, struct hw_timestamp *hwts, int flags)
+static int sk_timestamps(struct msghdr *msg, struct hw_timestamp *hwts)
 {
-	char control[256];
-	int cnt = 0, res = 0, level, type;
+	int level, type;
 	struct cmsghdr *cm;
-	struct iovec iov = { buf, buflen };
-	struct msghdr msg;
 	struct timespec *sw, *ts = NULL;
 	struct timehires *hr = NULL;
 
-	memset(control, 0, sizeof(control));
-	memset(&msg, 0, sizeof(msg));
-	if (addr) {
-		msg.msg_name = &addr->ss;
-		msg.msg_namelen = sizeof(addr->ss);
-	}
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	msg.msg_control = control;
-	msg.msg_controllen = sizeof(control);
-
-	if (flags == MSG_ERRQUEUE) {
-		struct pollfd pfd = { fd, sk_events, 0 };
-		res = poll(&pfd, 1, sk_tx_timeout);
-		if (res < 1) {
-			pr_err(res ? "poll for tx timestamp failed: %m" :
-			             "timed out while polling for tx timestamp");
-			pr_err("increasing tx_timestamp_timeout may correct "
-			       "this issue, but it is likely caused by a driver bug");
-			return res;
-		} else if (!(pfd.revents & sk_revents)) {
-			pr_err("poll for tx timestamp woke up on non ERR event");
-			return -1;
-		}
-	}
-
-	cnt = recvmsg(fd, &msg, flags);
-	if (cnt < 1)
-		pr_err("recvmsg%sfailed: %m",
-		       flags == MSG_ERRQUEUE ? " tx timestamp " : " ");
-
-	for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+	for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
 		level = cm->cmsg_level;
 		type  = cm->cmsg_type;
 		if (SOL_SOCKET == level && SO_TIMESTAMPING == type) {
@@ -356,12 +321,9 @@ int sk_receive(int fd, void *buf, int buflen,
 		}
 	}
 
-	if (addr)
-		addr->len = msg.msg_namelen;
-
 	if (!ts) {
 		memset(&hwts->ts, 0, sizeof(hwts->ts));
-		return cnt;
+		return 0;
 	}
 
 	switch (hwts->type) {
@@ -381,9 +343,142 @@ int sk_receive(int fd, void *buf, int buflen,
 		hwts->ts = timespec_to_tmv(ts[1]);
 		break;
 	}
+	return 0;
+}
+
+int sk_receive(int fd, void *buf, int buflen,
+	       struct address *addr, struct hw_timestamp *hwts, int flags)
+{
+	char control[256];
+	int cnt = 0, res = 0;
+	struct iovec iov = { buf, buflen };
+	struct msghdr msg;
+
+	memset(control, 0, sizeof(control));
+	memset(&msg, 0, sizeof(msg));
+	if (addr) {
+		msg.msg_name = &addr->ss;
+		msg.msg_namelen = sizeof(addr->ss);
+	}
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (flags == MSG_ERRQUEUE) {
+		struct pollfd pfd = { fd, sk_events, 0 };
+		res = poll(&pfd, 1, sk_tx_timeout);
+		if (res < 1) {
+			pr_err(res ? "poll for tx timestamp failed: %m" :
+			             "timed out while polling for tx timestamp");
+			pr_err("increasing tx_timestamp_timeout may correct "
+			       "this issue, but it is likely caused by a driver bug");
+			return res;
+		} else if (!(pfd.revents & sk_revents)) {
+			pr_err("poll for tx timestamp woke up on non ERR event");
+			return -1;
+		}
+	}
+
+	cnt = recvmsg(fd, &msg, flags);
+	if (cnt < 0 && (flags & MSG_DONTWAIT) && errno == EAGAIN)
+		return 0;
+	if (cnt < 1)
+		pr_err("recvmsg%sfailed: %m",
+		       flags & MSG_ERRQUEUE ? " tx timestamp " : " ");
+
+	if (sk_timestamps(&msg, hwts))
+		return -1;
+
+	if (addr)
+		addr->len = msg.msg_namelen;
+
 	return cnt;
 }
 
+int sk_receive_batch(int fd, void **buf, int buflen, struct address **addr,
+		     struct hw_timestamp **hwts, int *cnt, int n)
+{
+	char control[SK_RX_BATCH_MAX][256];
+	struct mmsghdr mmsg[SK_RX_BATCH_MAX];
+	struct iovec iov[SK_RX_BATCH_MAX];
+	struct msghdr *msg;
+	int i, res;
+
+	if (n > SK_RX_BATCH_MAX)
+		n = SK_RX_BATCH_MAX;
+
+	memset(mmsg, 0, n * sizeof(mmsg[0]));
+	for (i = 0; i < n; i++) {
+		msg = &mmsg[i].msg_hdr;
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = buflen;
+		if (addr) {
+			msg->msg_name = &addr[i]->ss;
+			msg->msg_namelen = sizeof(addr[i]->ss);
+		}
+		msg->msg_iov = &iov[i];
+		msg->msg_iovlen = 1;
+		msg->msg_control = control[i];
+		msg->msg_controllen = sizeof(control[i]);
+	}
+
+	/* The caller saw the socket become readable, so never block here. */
+	res = recvmmsg(fd, mmsg, n, MSG_DONTWAIT, NULL);
+	if (res < 0) {
+		if (errno == EAGAIN)
+			return 0;
+		pr_err("recvmmsg failed: %m");
+		return res;
+	}
+
+	for (i = 0; i < res; i++) {
+		msg = &mmsg[i].msg_hdr;
+		cnt[i] = mmsg[i].msg_len;
+		if (sk_timestamps(msg, hwts[i]))
+			cnt[i] = -1;
+		if (addr)
+			addr[i]->len = msg->msg_namelen;
+	}
+	return res;
+}
+
+int sk_send_batch(int fd, void **buf, int *len, struct address **addr,
+		  socklen_t addrlen, int n)
+{
+	struct mmsghdr mmsg[SK_TX_BATCH_MAX];
+	struct iovec iov[SK_TX_BATCH_MAX];
+	struct msghdr *msg;
+	int i, res, sent = 0;
+
+	if (n > SK_TX_BATCH_MAX)
+		n = SK_TX_BATCH_MAX;
+
+	memset(mmsg, 0, n * sizeof(mmsg[0]));
+	for (i = 0; i < n; i++) {
+		msg = &mmsg[i].msg_hdr;
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = len[i];
+		if (addr && addr[i]) {
+			msg->msg_name = &addr[i]->sa;
+			msg->msg_namelen = addrlen;
+		}
+		msg->msg_iov = &iov[i];
+		msg->msg_iovlen = 1;
+	}
+
+	/* The kernel may stop early, so keep going until all are sent. */
+	while (sent < n) {
+		res = sendmmsg(fd, mmsg + sent, n - sent, 0);
+		if (res < 1) {
+			pr_err("sendmmsg failed: %m");
+			return sent ? sent : -1;
+		}
+		sent += res;
+	}
+	return sent;
+}
+
 int sk_set_priority(int fd, uint8_t dscp)
 {
 	int tos;
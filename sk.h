@@ -23,6 +23,12 @@
 #include "address.h"
 #include "transport.h"
 
+/** The largest number of messages read by sk_receive_batch(). */
+#define SK_RX_BATCH_MAX 64
+
+/** The largest number of messages sent by sk_send_batch(). */
+#define SK_TX_BATCH_MAX 64
+
 /**
  * Contains timestamping information returned by the GET_TS_INFO ioctl.
  * @valid:            set to non-zero when the info struct contains valid data.
@@ -93,12 +99,49 @@ int sk_interface_addr(const char *name, int family, struct address *addr);
  * @param addr    Pointer to a buffer to receive the message's source
  *                address. May be NULL.
  * @param hwts    Pointer to a buffer to receive the message's time stamp.
- * @param flags   Flags to pass to RECV(2).
- * @return
+ * @param flags   Flags to pass to RECV(2).  When MSG_ERRQUEUE is given
+ *                alone, this call waits up to sk_tx_timeout for the time
+ *                stamp.  Adding MSG_DONTWAIT makes it return immediately.
+ * @return        The number of bytes received, zero if MSG_DONTWAIT was
+ *                given and nothing was queued, or negative on error.
  */
 int sk_receive(int fd, void *buf, int buflen,
 	       struct address *addr, struct hw_timestamp *hwts, int flags);
 
+/**
+ * Read a batch of messages from a socket with a single system call.
+ * This call does not block when the socket has nothing to read.
+ * @param fd      An open socket.
+ * @param buf     Array of 'n' buffers to receive the messages.
+ * @param buflen  Size of each buffer in bytes.
+ * @param addr    Array of 'n' pointers to buffers for the messages'
+ *                source addresses. May be NULL.
+ * @param hwts    Array of 'n' pointers to buffers for the time stamps.
+ * @param cnt     Array of 'n' integers to receive the length of each
+ *                message, or -1 for a message with a malformed time stamp.
+ * @param n       Maximum number of messages to read, at most
+ *                SK_RX_BATCH_MAX.
+ * @return        The number of messages received, or negative on error.
+ */
+int sk_receive_batch(int fd, void **buf, int buflen, struct address **addr,
+		     struct hw_timestamp **hwts, int *cnt, int n);
+
+/**
+ * Send a batch of messages on a socket with as few system calls as
+ * possible. No transmit time stamps are collected.
+ * @param fd      An open socket.
+ * @param buf     Array of 'n' buffers holding the messages.
+ * @param len     Array of 'n' message lengths in bytes.
+ * @param addr    Array of 'n' pointers to destination addresses. Either
+ *                the array or any of its entries may be NULL for a
+ *                connected or bound socket.
+ * @param addrlen The length of each destination address.
+ * @param n       Number of messages to send, at most SK_TX_BATCH_MAX.
+ * @return        The number of messages sent, or -1 if none were sent.
+ */
+int sk_send_batch(int fd, void **buf, int *len, struct address **addr,
+		  socklen_t addrlen, int n);
+
 /**
  * Set DSCP value for socket.
  * @param fd    An open socket.
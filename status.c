@@ -0,0 +1,163 @@
+/**
+ * @file status.c
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "print.h"
+#include "status.h"
+
+/*
+ * A writer never takes this long, about 100 ms, unless it died in the
+ * middle of an update.
+ */
+#define STATUS_READ_TRIES 1000
+#define STATUS_READ_WAIT  100 /* microseconds */
+
+struct status {
+	struct status_segment *seg;
+	char *name;
+};
+
+static struct status *status_map(const char *name, int flags, int prot,
+				 int level)
+{
+	struct status *s;
+	int fd;
+
+	s = calloc(1, sizeof(*s));
+	if (!s) {
+		return NULL;
+	}
+	fd = shm_open(name, flags, 0644);
+	if (fd < 0) {
+		print(level, "failed to open status segment %s: %m", name);
+		goto no_fd;
+	}
+	if ((flags & O_CREAT) && ftruncate(fd, sizeof(*s->seg))) {
+		print(level, "failed to resize status segment %s: %m", name);
+		goto no_map;
+	}
+	s->seg = mmap(NULL, sizeof(*s->seg), prot, MAP_SHARED, fd, 0);
+	if (s->seg == MAP_FAILED) {
+		print(level, "failed to map status segment %s: %m", name);
+		goto no_map;
+	}
+	close(fd);
+	return s;
+no_map:
+	close(fd);
+	if (flags & O_CREAT) {
+		shm_unlink(name);
+	}
+no_fd:
+	free(s);
+	return NULL;
+}
+
+struct status *status_create(const char *name)
+{
+	struct status *s;
+
+	/* Start over, readers of an old segment keep their copy. */
+	shm_unlink(name);
+
+	s = status_map(name, O_RDWR | O_CREAT | O_EXCL, PROT_READ | PROT_WRITE,
+		       LOG_ERR);
+	if (!s) {
+		return NULL;
+	}
+	s->name = strdup(name);
+	if (!s->name) {
+		status_destroy(s);
+		return NULL;
+	}
+	memset(s->seg, 0, sizeof(*s->seg));
+	s->seg->magic = STATUS_MAGIC;
+	s->seg->version = STATUS_VERSION;
+	s->seg->size = sizeof(*s->seg);
+	return s;
+}
+
+struct status *status_open(const char *name, int level)
+{
+	struct status *s;
+
+	s = status_map(name, O_RDONLY, PROT_READ, level);
+	if (!s) {
+		return NULL;
+	}
+	if (s->seg->magic != STATUS_MAGIC ||
+	    s->seg->version != STATUS_VERSION ||
+	    s->seg->size != sizeof(*s->seg)) {
+		print(level, "unsupported status segment %s", name);
+		status_destroy(s);
+		return NULL;
+	}
+	return s;
+}
+
+void status_destroy(struct status *s)
+{
+	munmap(s->seg, sizeof(*s->seg));
+	if (s->name) {
+		shm_unlink(s->name);
+		free(s->name);
+	}
+	free(s);
+}
+
+struct status_data *status_begin(struct status *s)
+{
+	uint32_t seq = s->seg->seq;
+
+	__atomic_store_n(&s->seg->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return &s->seg->data;
+}
+
+void status_end(struct status *s)
+{
+	uint32_t seq = s->seg->seq;
+
+	__atomic_store_n(&s->seg->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+int status_read(struct status *s, struct status_data *data)
+{
+	uint32_t seq;
+	int i;
+
+	for (i = 0; i < STATUS_READ_TRIES; i++) {
+		seq = __atomic_load_n(&s->seg->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			usleep(STATUS_READ_WAIT);
+			continue;
+		}
+		memcpy(data, &s->seg->data, sizeof(*data));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq == __atomic_load_n(&s->seg->seq, __ATOMIC_RELAXED)) {
+			return 0;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file status.h
+ * @brief Publishes the state of the clock in a shared memory segment.
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_STATUS_H
+#define HAVE_STATUS_H
+
+#include <stdint.h>
+
+#include "ds.h"
+#include "tlv.h"
+
+#define STATUS_MAGIC     0x53545450 /* "PTTS" in little endian */
+#define STATUS_VERSION   1
+#define STATUS_MAX_PORTS 64
+
+struct status_port {
+	struct PortIdentity portIdentity;
+	Enumeration8 portState;
+} PACKED;
+
+/**
+ * The published state of the clock. All fields are in host byte order,
+ * and the data sets have the layout of the management TLVs.
+ */
+struct status_data {
+	/** CLOCK_MONOTONIC time of the last update in nanoseconds. */
+	int64_t update_time;
+	/** Number of updates so far. */
+	uint64_t updates;
+	/** One of the servo_state values. */
+	int32_t servo_state;
+	/** Number of valid entries in @a port. */
+	uint32_t num_ports;
+	struct currentDS cds;
+	struct parentDS pds;
+	struct timePropertiesDS tds;
+	struct time_status_np tsn;
+	struct status_port port[STATUS_MAX_PORTS];
+};
+
+/**
+ * The layout of the shared memory segment. The sequence number is odd
+ * while the writer updates the data.
+ */
+struct status_segment {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;
+	uint32_t seq;
+	uint32_t reserved;
+	struct status_data data;
+};
+
+/** Opaque type */
+struct status;
+
+/**
+ * Create a shared memory segment and publish an empty state in it.
+ * @param name  The name of the POSIX shared memory object, like "/ptp4l".
+ * @return      A pointer to a new status instance on success, NULL otherwise.
+ */
+struct status *status_create(const char *name);
+
+/**
+ * Open an existing shared memory segment for reading.
+ * @param name   The name of the POSIX shared memory object.
+ * @param level  The log level of the messages reporting a failure.
+ * @return       A pointer to a status instance on success, NULL otherwise.
+ */
+struct status *status_open(const char *name, int level);
+
+/**
+ * Unmap a shared memory segment, removing it if it was created by
+ * @ref status_create().
+ * @param s  A pointer obtained via @ref status_create() or @ref status_open().
+ */
+void status_destroy(struct status *s);
+
+/**
+ * Start updating the published state. Readers will retry until the
+ * update is finished with @ref status_end().
+ * @param s  A pointer obtained via @ref status_create().
+ * @return   A pointer to the published data, to be filled in by the caller.
+ */
+struct status_data *status_begin(struct status *s);
+
+/**
+ * Finish updating the published state.
+ * @param s  A pointer obtained via @ref status_create().
+ */
+void status_end(struct status *s);
+
+/**
+ * Take a consistent copy of the published state, without a system call
+ * unless the writer is in the middle of an update.
+ * @param s     A pointer obtained via @ref status_open().
+ * @param data  Set to the published state.
+ * @return      Zero on success, or -1 if the writer appears to be stuck
+ *              in an update, for example because it died.
+ */
+int status_read(struct status *s, struct status_data *data);
+
+#endif
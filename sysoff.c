@@ -17,7 +17,10 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <linux/ptp_clock.h>
 
@@ -25,6 +28,26 @@
 
 #define NS_PER_SEC 1000000000LL
 
+struct sysoff_sample {
+	int64_t delay;
+	int64_t offset;
+	uint64_t ts;
+};
+
+static const char *method_names[SYSOFF_LAST] = {
+	[SYSOFF_PRECISE]  = "PTP_SYS_OFFSET_PRECISE",
+	[SYSOFF_EXTENDED] = "PTP_SYS_OFFSET_EXTENDED",
+	[SYSOFF_BASIC]    = "PTP_SYS_OFFSET",
+};
+
+const char *sysoff_method_name(int method)
+{
+	if (method < 0 || method >= SYSOFF_LAST) {
+		return "clock_gettime";
+	}
+	return method_names[method];
+}
+
 #ifdef PTP_SYS_OFFSET
 
 static int64_t pctns(struct ptp_clock_time *t)
@@ -32,63 +55,186 @@ static int64_t pctns(struct ptp_clock_time *t)
 	return t->sec * NS_PER_SEC + t->nsec;
 }
 
-static struct {
-	int64_t interval;
-	int64_t offset;
-	uint64_t timestamp;
-} samples[PTP_MAX_SAMPLES];
-
-static void insertion_sort(int length, int64_t interval, int64_t offset, uint64_t ts)
+static void insertion_sort(struct sysoff_sample *samples, int length,
+			   int64_t delay, int64_t offset, uint64_t ts)
 {
 	int i = length - 1;
 	while (i >= 0) {
-		if (samples[i].interval < interval)
+		if (samples[i].delay < delay)
 			break;
 		samples[i+1] = samples[i];
 		i--;
 	}
-	samples[i+1].interval = interval;
+	samples[i+1].delay = delay;
 	samples[i+1].offset = offset;
-	samples[i+1].timestamp = ts;
+	samples[i+1].ts = ts;
 }
 
-static int64_t sysoff_estimate(struct ptp_clock_time *pct, int n_samples,
-			       uint64_t *ts, int64_t *delay)
+static int cmp_offset(const void *a, const void *b)
 {
-	int64_t t1, t2, tp;
-	int64_t interval, offset;
+	const struct sysoff_sample *x = a, *y = b;
+
+	return x->offset < y->offset ? -1 : x->offset > y->offset ? 1 : 0;
+}
+
+/*
+ * The samples are sorted by their delay. All estimators report the
+ * shortest delay, as it bounds the error of the readings they trust most.
+ */
+static int64_t sysoff_estimate(struct sysoff_sample *samples, int n,
+			       int estimator, uint64_t *ts, int64_t *delay)
+{
+	double w, sum_w = 0.0, sum_off = 0.0, sum_ts = 0.0;
+	int64_t dmin = samples[0].delay;
+	uint64_t ts0 = samples[0].ts;
 	int i;
 
-	for (i = 0; i < n_samples; i++) {
-		t1 = pctns(&pct[2*i]);
-		tp = pctns(&pct[2*i+1]);
-		t2 = pctns(&pct[2*i+2]);
-		interval = t2 - t1;
-		offset = (t2 + t1) / 2 - tp;
-		insertion_sort(i, interval, offset, (t2 + t1) / 2);
+	*delay = dmin;
+
+	switch (estimator) {
+	case SYSOFF_EST_MEDIAN:
+		qsort(samples, n, sizeof(*samples), cmp_offset);
+		*ts = samples[n / 2].ts;
+		return samples[n / 2].offset;
+	case SYSOFF_EST_WEIGHTED:
+		for (i = 0; i < n; i++) {
+			w = samples[i].delay > 0 ?
+				(double) dmin / samples[i].delay : 1.0;
+			w *= w;
+			sum_w += w;
+			sum_off += w * (samples[i].offset - samples[0].offset);
+			sum_ts += w * (int64_t) (samples[i].ts - ts0);
+		}
+		*ts = ts0 + (int64_t) (sum_ts / sum_w);
+		return samples[0].offset + (int64_t) (sum_off / sum_w);
+	case SYSOFF_EST_MIN_DELAY:
+	default:
+		*ts = ts0;
+		return samples[0].offset;
 	}
-	*ts = samples[0].timestamp;
-	*delay = samples[0].interval;
-	return samples[0].offset;
 }
 
-int sysoff_measure(int fd, int n_samples,
-		   int64_t *result, uint64_t *ts, int64_t *delay)
+static int sysoff_basic(int fd, int n_samples, struct sysoff_sample *samples)
 {
 	struct ptp_sys_offset pso;
+	int64_t t1, t2, tp;
+	int i;
+
+	memset(&pso, 0, sizeof(pso));
 	pso.n_samples = n_samples;
 	if (ioctl(fd, PTP_SYS_OFFSET, &pso)) {
-		perror("ioctl PTP_SYS_OFFSET");
+		return -1;
+	}
+	for (i = 0; i < n_samples; i++) {
+		t1 = pctns(&pso.ts[2*i]);
+		tp = pctns(&pso.ts[2*i+1]);
+		t2 = pctns(&pso.ts[2*i+2]);
+		insertion_sort(samples, i, t2 - t1, (t2 + t1) / 2 - tp,
+			       (t2 + t1) / 2);
+	}
+	return 0;
+}
+
+#ifdef PTP_SYS_OFFSET_EXTENDED
+static int sysoff_extended(int fd, int n_samples,
+			   struct sysoff_sample *samples)
+{
+	struct ptp_sys_offset_extended pso;
+	int64_t t1, t2, tp;
+	int i;
+
+	memset(&pso, 0, sizeof(pso));
+	pso.n_samples = n_samples;
+	if (ioctl(fd, PTP_SYS_OFFSET_EXTENDED, &pso)) {
+		return -1;
+	}
+	/* Each sample is a system time stamp taken right before and
+	   right after the device time stamp, closer than the basic
+	   method takes them. */
+	for (i = 0; i < n_samples; i++) {
+		t1 = pctns(&pso.ts[i][0]);
+		tp = pctns(&pso.ts[i][1]);
+		t2 = pctns(&pso.ts[i][2]);
+		insertion_sort(samples, i, t2 - t1, (t2 + t1) / 2 - tp,
+			       (t2 + t1) / 2);
+	}
+	return 0;
+}
+#else
+static int sysoff_extended(int fd, int n_samples,
+			   struct sysoff_sample *samples)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+#endif
+
+#ifdef PTP_SYS_OFFSET_PRECISE
+static int sysoff_precise(int fd, struct sysoff_sample *samples)
+{
+	struct ptp_sys_offset_precise pso;
+	int64_t tp, ts;
+
+	memset(&pso, 0, sizeof(pso));
+	if (ioctl(fd, PTP_SYS_OFFSET_PRECISE, &pso)) {
+		return -1;
+	}
+	/* The device latches both clocks at the same instant. */
+	tp = pctns(&pso.device);
+	ts = pctns(&pso.sys_realtime);
+	samples[0].delay = 0;
+	samples[0].offset = ts - tp;
+	samples[0].ts = ts;
+	return 0;
+}
+#else
+static int sysoff_precise(int fd, struct sysoff_sample *samples)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+#endif
+
+static int sysoff_sample(int fd, int method, int n_samples,
+			 struct sysoff_sample *samples)
+{
+	switch (method) {
+	case SYSOFF_PRECISE:
+		return sysoff_precise(fd, samples);
+	case SYSOFF_EXTENDED:
+		return sysoff_extended(fd, n_samples, samples);
+	case SYSOFF_BASIC:
+		return sysoff_basic(fd, n_samples, samples);
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+int sysoff_measure(int fd, int method, int n_samples, int estimator,
+		   int64_t *result, uint64_t *ts, int64_t *delay)
+{
+	struct sysoff_sample samples[PTP_MAX_SAMPLES];
+
+	if (method == SYSOFF_PRECISE) {
+		n_samples = 1;
+	}
+	if (n_samples < 1 || n_samples > PTP_MAX_SAMPLES) {
+		fprintf(stderr, "invalid number of readings %d\n", n_samples);
 		return SYSOFF_RUN_TIME_MISSING;
 	}
-	*result = sysoff_estimate(pso.ts, n_samples, ts, delay);
-	return SYSOFF_SUPPORTED;
+	if (sysoff_sample(fd, method, n_samples, samples)) {
+		fprintf(stderr, "ioctl %s: %s\n", sysoff_method_name(method),
+			strerror(errno));
+		return SYSOFF_RUN_TIME_MISSING;
+	}
+	*result = sysoff_estimate(samples, n_samples, estimator, ts, delay);
+	return method;
 }
 
 int sysoff_probe(int fd, int n_samples)
 {
-	int64_t junk, delay;
-	uint64_t ts;
+	struct sysoff_sample samples[PTP_MAX_SAMPLES];
+	int method;
 
 	if (n_samples > PTP_MAX_SAMPLES) {
 		fprintf(stderr, "warning: %d exceeds kernel max readings %d\n",
@@ -97,20 +243,25 @@ int sysoff_probe(int fd, int n_samples)
 		return SYSOFF_RUN_TIME_MISSING;
 	}
 
-	return sysoff_measure(fd, n_samples, &junk, &ts, &delay);
+	for (method = SYSOFF_PRECISE; method < SYSOFF_LAST; method++) {
+		if (!sysoff_sample(fd, method, n_samples, samples)) {
+			return method;
+		}
+	}
+	return SYSOFF_RUN_TIME_MISSING;
 }
 
 #else /* !PTP_SYS_OFFSET */
 
-int sysoff_measure(int fd, int n_samples,
+int sysoff_measure(int fd, int method, int n_samples, int estimator,
 		   int64_t *result, uint64_t *ts, int64_t *delay)
 {
-	return SYSOFF_COMPILE_TIME_MISSING;
+	return SYSOFF_RUN_TIME_MISSING;
 }
 
 int sysoff_probe(int fd, int n_samples)
 {
-	return SYSOFF_COMPILE_TIME_MISSING;
+	return SYSOFF_RUN_TIME_MISSING;
 }
 
 #endif /* PTP_SYS_OFFSET */
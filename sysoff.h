@@ -21,26 +21,57 @@
 #include <stdint.h>
 
 enum {
-	SYSOFF_SUPPORTED,
-	SYSOFF_COMPILE_TIME_MISSING,
-	SYSOFF_RUN_TIME_MISSING,
+	SYSOFF_RUN_TIME_MISSING = -1,
+	SYSOFF_PRECISE,
+	SYSOFF_EXTENDED,
+	SYSOFF_BASIC,
+	SYSOFF_LAST,
 };
 
 /**
- * Check to see if the PTP_SYS_OFFSET ioctl is supported.
- * @param fd  An open file descriptor to a PHC device.
- * @return  One of the SYSOFF_ enumeration values.
+ * Defines how an offset is estimated from several readings.
+ */
+enum sysoff_estimator {
+	/** Use the reading with the shortest delay. */
+	SYSOFF_EST_MIN_DELAY,
+	/** Use the median offset of all readings. */
+	SYSOFF_EST_MEDIAN,
+	/** Weigh the readings by the square of the shortest delay over
+	    their own delay. */
+	SYSOFF_EST_WEIGHTED,
+};
+
+/**
+ * Find the most precise method of measuring the offset between a PHC
+ * and the system time that is supported by the device. The methods are
+ * tried in the order PTP_SYS_OFFSET_PRECISE, PTP_SYS_OFFSET_EXTENDED and
+ * PTP_SYS_OFFSET.
+ * @param fd         An open file descriptor to a PHC device.
+ * @param n_samples  The number of consecutive readings to make.
+ * @return  One of the SYSOFF_ enumeration values, SYSOFF_RUN_TIME_MISSING
+ *          if no method is supported.
  */
 int sysoff_probe(int fd, int n_samples);
 
 /**
  * Measure the offset between a PHC and the system time.
  * @param fd         An open file descriptor to a PHC device.
- * @param n_samples  The number of consecutive readings to make.
- * @param result     The estimated offset in nanoseconds.
+ * @param method     The method returned by @ref sysoff_probe().
+ * @param n_samples  The number of consecutive readings to make. The
+ *                   precise method always makes a single reading.
+ * @param estimator  One of the @ref sysoff_estimator values.
+ * @param result     The estimated offset in nanoseconds, the system time
+ *                   minus the PHC time.
  * @param ts         The system time corresponding to the 'result'.
  * @param delay      The delay in reading of the clock in nanoseconds.
- * @return  One of the SYSOFF_ enumeration values.
+ * @return  The method on success, SYSOFF_RUN_TIME_MISSING otherwise.
  */
-int sysoff_measure(int fd, int n_samples,
+int sysoff_measure(int fd, int method, int n_samples, int estimator,
 		   int64_t *result, uint64_t *ts, int64_t *delay);
+
+/**
+ * Get the name of a method.
+ * @param method  One of the SYSOFF_ enumeration values.
+ * @return        The name of the ioctl used by the method.
+ */
+const char *sysoff_method_name(int method);
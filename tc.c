@@ -38,6 +38,50 @@ static int tc_match_syfup(int ingress_port, struct ptp_message *msg,
 			  struct tc_txd *txd);
 static void tc_recycle(struct tc_txd *txd);
 
+/*
+ * Transmitted messages are found again by the ingress port, source port
+ * identity and sequence ID of the message which completes them. Event
+ * and general messages of one exchange share a bucket.
+ */
+static unsigned int tc_hash(int ingress_port, struct PortIdentity *pid,
+			    UInteger16 seqid, int delay)
+{
+	unsigned char *b = (unsigned char *) pid;
+	unsigned int i, h = 2166136261u;
+
+	for (i = 0; i < sizeof(*pid); i++) {
+		h = (h ^ b[i]) * 16777619u;
+	}
+	h = (h ^ seqid) * 16777619u;
+	h = (h ^ ingress_port) * 16777619u;
+	h = (h ^ delay) * 16777619u;
+	return h % TC_HASH_SIZE;
+}
+
+/*
+ * Every entry lives for the same time, and so the list in order of
+ * arrival is also in order of expiry.
+ */
+static void tc_insert(struct port *p, struct tc_txd *txd,
+		      struct PortIdentity *pid, int delay)
+{
+	struct ptp_message *m = txd->msg;
+	unsigned int h;
+
+	txd->expiry = (m->ts.host.tv_sec + 1) * NSEC2SEC + m->ts.host.tv_nsec;
+	h = tc_hash(txd->ingress_port, pid, m->header.sequenceId, delay);
+	TAILQ_INSERT_TAIL(&p->tc_transmitted, txd, list);
+	LIST_INSERT_HEAD(&p->tc_index[h], txd, hash);
+}
+
+static void tc_drop(struct port *p, struct tc_txd *txd)
+{
+	TAILQ_REMOVE(&p->tc_transmitted, txd, list);
+	LIST_REMOVE(txd, hash);
+	msg_put(txd->msg);
+	tc_recycle(txd);
+}
+
 static struct tc_txd *tc_allocate(void)
 {
 	struct tc_txd *txd = TAILQ_FIRST(&tc_pool);
@@ -134,7 +178,7 @@ static void tc_complete_request(struct port *q, struct port *p,
 	txd->msg = req;
 	txd->residence = residence;
 	txd->ingress_port = portnum(q);
-	TAILQ_INSERT_TAIL(&p->tc_transmitted, txd, list);
+	tc_insert(p, txd, &req->header.sourcePortIdentity, 1);
 }
 
 static void tc_complete_response(struct port *q, struct port *p,
@@ -143,13 +187,16 @@ static void tc_complete_response(struct port *q, struct port *p,
 	enum tc_match type = TC_MISMATCH;
 	struct tc_txd *txd;
 	Integer64 c1, c2;
+	unsigned int h;
 	int cnt;
 
 #ifdef DEBUG
 	pr_err("complete delay response from port %hd to %hd seqid %hu",
 	       portnum(q), portnum(p), ntohs(resp->header.sequenceId));
 #endif
-	TAILQ_FOREACH(txd, &q->tc_transmitted, list) {
+	h = tc_hash(portnum(p), &resp->delay_resp.requestingPortIdentity,
+		    resp->header.sequenceId, 1);
+	LIST_FOREACH(txd, &q->tc_index[h], hash) {
 		type = tc_match_delay(portnum(p), resp, txd);
 		if (type == TC_DELAY_REQRESP) {
 			residence = txd->residence;
@@ -169,9 +216,7 @@ static void tc_complete_response(struct port *q, struct port *p,
 	}
 	/* Restore original correction value for next egress port. */
 	resp->header.correction = host2net64(c1);
-	TAILQ_REMOVE(&q->tc_transmitted, txd, list);
-	msg_put(txd->msg);
-	tc_recycle(txd);
+	tc_drop(q, txd);
 }
 
 static void tc_complete_syfup(struct port *q, struct port *p,
@@ -181,9 +226,12 @@ static void tc_complete_syfup(struct port *q, struct port *p,
 	struct ptp_message *fup;
 	struct tc_txd *txd;
 	Integer64 c1, c2;
+	unsigned int h;
 	int cnt;
 
-	TAILQ_FOREACH(txd, &p->tc_transmitted, list) {
+	h = tc_hash(portnum(q), &msg->header.sourcePortIdentity,
+		    msg->header.sequenceId, 0);
+	LIST_FOREACH(txd, &p->tc_index[h], hash) {
 		type = tc_match_syfup(portnum(q), msg, txd);
 		switch (type) {
 		case TC_MISMATCH:
@@ -214,7 +262,7 @@ static void tc_complete_syfup(struct port *q, struct port *p,
 		txd->msg = msg;
 		txd->residence = residence;
 		txd->ingress_port = portnum(q);
-		TAILQ_INSERT_TAIL(&p->tc_transmitted, txd, list);
+		tc_insert(p, txd, &msg->header.sourcePortIdentity, 0);
 		return;
 	}
 
@@ -230,9 +278,7 @@ static void tc_complete_syfup(struct port *q, struct port *p,
 	}
 	/* Restore original correction value for next egress port. */
 	fup->header.correction = host2net64(c1);
-	TAILQ_REMOVE(&p->tc_transmitted, txd, list);
-	msg_put(txd->msg);
-	tc_recycle(txd);
+	tc_drop(p, txd);
 }
 
 static void tc_complete(struct port *q, struct port *p,
@@ -252,23 +298,26 @@ static void tc_complete(struct port *q, struct port *p,
 	}
 }
 
-static int tc_current(struct ptp_message *m, struct timespec now)
+static void tc_complete_event(struct port *q, struct port *p,
+			      struct ptp_message *msg, tmv_t ingress)
 {
-	int64_t t1, t2, tmo;
-
-	tmo = 1LL * NSEC2SEC;
-	t1 = m->ts.host.tv_sec * NSEC2SEC + m->ts.host.tv_nsec;
-	t2 = now.tv_sec * NSEC2SEC + now.tv_nsec;
+	tmv_t residence;
+	double rr;
 
-	return t2 - t1 < tmo;
+	residence = tmv_sub(msg->hwts.ts, ingress);
+	rr = clock_rate_ratio(q->clock);
+	if (rr != 1.0) {
+		residence = dbl_tmv(tmv_dbl(residence) * rr);
+	}
+	port_hist_add(p, PORT_HIST_RESIDENCE, residence);
+	tc_complete(q, p, msg, residence);
 }
 
 static int tc_fwd_event(struct port *q, struct ptp_message *msg)
 {
-	tmv_t egress, ingress = msg->hwts.ts, residence;
+	tmv_t ingress = msg->hwts.ts;
 	struct port *p;
 	int cnt, err;
-	double rr;
 
 	clock_gettime(CLOCK_MONOTONIC, &msg->ts.host);
 
@@ -282,12 +331,15 @@ static int tc_fwd_event(struct port *q, struct ptp_message *msg)
 			pr_err("failed to forward event from port %hd to %hd",
 				portnum(q), portnum(p));
 			port_dispatch(p, EV_FAULT_DETECTED, 0);
+		} else if (p->txts_deferred &&
+			   port_txts_defer(p, msg, q, ingress)) {
+			port_dispatch(p, EV_FAULT_DETECTED, 0);
 		}
 	}
 
 	/* Go back and gather the transmit time stamps. */
 	for (p = clock_first_port(q->clock); p; p = LIST_NEXT(p, list)) {
-		if (tc_blocked(q, p, msg)) {
+		if (tc_blocked(q, p, msg) || p->txts_deferred) {
 			continue;
 		}
 		err = transport_txts(p->trp, &p->fda, msg);
@@ -298,13 +350,7 @@ static int tc_fwd_event(struct port *q, struct ptp_message *msg)
 			continue;
 		}
 		ts_add(&msg->hwts.ts, p->tx_timestamp_offset);
-		egress = msg->hwts.ts;
-		residence = tmv_sub(egress, ingress);
-		rr = clock_rate_ratio(q->clock);
-		if (rr != 1.0) {
-			residence = dbl_tmv(tmv_dbl(residence) * rr);
-		}
-		tc_complete(q, p, msg, residence);
+		tc_complete_event(q, p, msg, ingress);
 	}
 
 	return 0;
@@ -374,9 +420,7 @@ void tc_flush(struct port *q)
 	struct tc_txd *txd;
 
 	while ((txd = TAILQ_FIRST(&q->tc_transmitted)) != NULL) {
-		TAILQ_REMOVE(&q->tc_transmitted, txd, list);
-		msg_put(txd->msg);
-		tc_recycle(txd);
+		tc_drop(q, txd);
 	}
 }
 
@@ -440,6 +484,12 @@ int tc_fwd_response(struct port *q, struct ptp_message *msg)
 	return 0;
 }
 
+void tc_fwd_txts(struct port *q, struct port *p, struct ptp_message *msg,
+		 tmv_t ingress)
+{
+	tc_complete_event(q, p, msg, ingress);
+}
+
 int tc_fwd_sync(struct port *q, struct ptp_message *msg)
 {
 	struct ptp_message *fup = NULL;
@@ -500,15 +550,15 @@ void tc_prune(struct port *q)
 {
 	struct timespec now;
 	struct tc_txd *txd;
+	int64_t t;
 
 	clock_gettime(CLOCK_MONOTONIC, &now);
+	t = now.tv_sec * NSEC2SEC + now.tv_nsec;
 
 	while ((txd = TAILQ_FIRST(&q->tc_transmitted)) != NULL) {
-		if (tc_current(txd->msg, now)) {
+		if (t < txd->expiry) {
 			break;
 		}
-		TAILQ_REMOVE(&q->tc_transmitted, txd, list);
-		msg_put(txd->msg);
-		tc_recycle(txd);
+		tc_drop(q, txd);
 	}
 }
@@ -85,6 +85,20 @@ int tc_fwd_response(struct port *q, struct ptp_message *msg);
  */
 int tc_fwd_sync(struct port *q, struct ptp_message *msg);
 
+/**
+ * Completes the forwarding of an event message whose transmit time
+ * stamp was collected after the fact.
+ *
+ * The egress time stamp is expected in msg->hwts.ts.
+ *
+ * @param q        The ingress port
+ * @param p        The egress port
+ * @param msg      The forwarded event message
+ * @param ingress  The ingress time stamp of the message
+ */
+void tc_fwd_txts(struct port *q, struct port *p, struct ptp_message *msg,
+		 tmv_t ingress);
+
 /**
  * Determines whether the local clock should ignore a given message.
  *
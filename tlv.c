@@ -52,6 +52,24 @@ static void scaled_ns_h2n(ScaledNs *sns)
 	sns->fractional_nanoseconds = htons(sns->fractional_nanoseconds);
 }
 
+static void histogram_np_n2h(struct histogram_np *h)
+{
+	h->count = net2host64(h->count);
+	h->p50 = net2host64(h->p50);
+	h->p99 = net2host64(h->p99);
+	h->p999 = net2host64(h->p999);
+	h->max = net2host64(h->max);
+}
+
+static void histogram_np_h2n(struct histogram_np *h)
+{
+	h->count = host2net64(h->count);
+	h->p50 = host2net64(h->p50);
+	h->p99 = host2net64(h->p99);
+	h->p999 = host2net64(h->p999);
+	h->max = host2net64(h->max);
+}
+
 static uint16_t flip16(uint16_t *p)
 {
 	uint16_t v;
@@ -92,6 +110,9 @@ static int mgt_post_recv(struct management_tlv *m, uint16_t data_len,
 	struct grandmaster_settings_np *gsn;
 	struct subscribe_events_np *sen;
 	struct port_properties_np *ppn;
+	struct port_histogram_np *phn;
+	struct msg_pool_np *mpn;
+	struct bmca_stats_np *bsn;
 	struct mgmt_clock_description *cd;
 	int extra_len = 0, len;
 	uint8_t *buf;
@@ -265,6 +286,29 @@ static int mgt_post_recv(struct management_tlv *m, uint16_t data_len,
 			ntohs(gsn->clockQuality.offsetScaledLogVariance);
 		gsn->utc_offset = ntohs(gsn->utc_offset);
 		break;
+	case TLV_MSG_POOL_NP:
+		if (data_len != sizeof(struct msg_pool_np))
+			goto bad_length;
+		mpn = (struct msg_pool_np *) m->data;
+		mpn->allocations = net2host64(mpn->allocations);
+		mpn->misses = net2host64(mpn->misses);
+		mpn->trims = net2host64(mpn->trims);
+		mpn->in_use = ntohl(mpn->in_use);
+		mpn->peak_in_use = ntohl(mpn->peak_in_use);
+		mpn->free = ntohl(mpn->free);
+		mpn->slabs = ntohl(mpn->slabs);
+		break;
+	case TLV_BMCA_STATS_NP:
+		if (data_len != sizeof(struct bmca_stats_np))
+			goto bad_length;
+		bsn = (struct bmca_stats_np *) m->data;
+		bsn->runs = net2host64(bsn->runs);
+		bsn->full_runs = net2host64(bsn->full_runs);
+		bsn->decisions = net2host64(bsn->decisions);
+		bsn->last_ns = net2host64(bsn->last_ns);
+		bsn->max_ns = net2host64(bsn->max_ns);
+		bsn->total_ns = net2host64(bsn->total_ns);
+		break;
 	case TLV_PORT_DATA_SET_NP:
 		if (data_len != sizeof(struct port_ds_np))
 			goto bad_length;
@@ -286,6 +330,16 @@ static int mgt_post_recv(struct management_tlv *m, uint16_t data_len,
 		extra_len = sizeof(struct port_properties_np);
 		extra_len += ppn->interface.length;
 		break;
+	case TLV_PORT_HISTOGRAM_NP:
+		if (data_len != sizeof(struct port_histogram_np))
+			goto bad_length;
+		phn = (struct port_histogram_np *) m->data;
+		phn->portIdentity.portNumber =
+			ntohs(phn->portIdentity.portNumber);
+		histogram_np_n2h(&phn->offset);
+		histogram_np_n2h(&phn->delay);
+		histogram_np_n2h(&phn->residence);
+		break;
 	case TLV_SAVE_IN_NON_VOLATILE_STORAGE:
 	case TLV_RESET_NON_VOLATILE_STORAGE:
 	case TLV_INITIALIZE:
@@ -319,6 +373,9 @@ static void mgt_pre_send(struct management_tlv *m, struct tlv_extra *extra)
 	struct grandmaster_settings_np *gsn;
 	struct subscribe_events_np *sen;
 	struct port_properties_np *ppn;
+	struct port_histogram_np *phn;
+	struct msg_pool_np *mpn;
+	struct bmca_stats_np *bsn;
 	struct mgmt_clock_description *cd;
 	switch (m->id) {
 	case TLV_CLOCK_DESCRIPTION:
@@ -378,6 +435,25 @@ static void mgt_pre_send(struct management_tlv *m, struct tlv_extra *extra)
 			htons(gsn->clockQuality.offsetScaledLogVariance);
 		gsn->utc_offset = htons(gsn->utc_offset);
 		break;
+	case TLV_MSG_POOL_NP:
+		mpn = (struct msg_pool_np *) m->data;
+		mpn->allocations = host2net64(mpn->allocations);
+		mpn->misses = host2net64(mpn->misses);
+		mpn->trims = host2net64(mpn->trims);
+		mpn->in_use = htonl(mpn->in_use);
+		mpn->peak_in_use = htonl(mpn->peak_in_use);
+		mpn->free = htonl(mpn->free);
+		mpn->slabs = htonl(mpn->slabs);
+		break;
+	case TLV_BMCA_STATS_NP:
+		bsn = (struct bmca_stats_np *) m->data;
+		bsn->runs = host2net64(bsn->runs);
+		bsn->full_runs = host2net64(bsn->full_runs);
+		bsn->decisions = host2net64(bsn->decisions);
+		bsn->last_ns = host2net64(bsn->last_ns);
+		bsn->max_ns = host2net64(bsn->max_ns);
+		bsn->total_ns = host2net64(bsn->total_ns);
+		break;
 	case TLV_PORT_DATA_SET_NP:
 		pdsnp = (struct port_ds_np *) m->data;
 		pdsnp->neighborPropDelayThresh = htonl(pdsnp->neighborPropDelayThresh);
@@ -391,6 +467,14 @@ static void mgt_pre_send(struct management_tlv *m, struct tlv_extra *extra)
 		ppn = (struct port_properties_np *)m->data;
 		ppn->portIdentity.portNumber = htons(ppn->portIdentity.portNumber);
 		break;
+	case TLV_PORT_HISTOGRAM_NP:
+		phn = (struct port_histogram_np *) m->data;
+		phn->portIdentity.portNumber =
+			htons(phn->portIdentity.portNumber);
+		histogram_np_h2n(&phn->offset);
+		histogram_np_h2n(&phn->delay);
+		histogram_np_h2n(&phn->residence);
+		break;
 	}
 }
 
@@ -575,6 +659,8 @@ void tlv_extra_recycle(struct tlv_extra *extra)
 int tlv_post_recv(struct tlv_extra *extra)
 {
 	int result = 0;
+	struct request_unicast_xmit_tlv *request;
+	struct grant_unicast_xmit_tlv *grant;
 	struct management_tlv *mgt;
 	struct management_error_status *mes;
 	struct TLV *tlv = extra->tlv;
@@ -602,9 +688,21 @@ int tlv_post_recv(struct tlv_extra *extra)
 		result = org_post_recv((struct organization_tlv *) tlv);
 		break;
 	case TLV_REQUEST_UNICAST_TRANSMISSION:
+		if (TLV_LENGTH_INVALID(tlv, request_unicast_xmit_tlv))
+			goto bad_length;
+		request = (struct request_unicast_xmit_tlv *) tlv;
+		request->durationField = ntohl(request->durationField);
+		break;
 	case TLV_GRANT_UNICAST_TRANSMISSION:
+		if (TLV_LENGTH_INVALID(tlv, grant_unicast_xmit_tlv))
+			goto bad_length;
+		grant = (struct grant_unicast_xmit_tlv *) tlv;
+		grant->durationField = ntohl(grant->durationField);
+		break;
 	case TLV_CANCEL_UNICAST_TRANSMISSION:
 	case TLV_ACKNOWLEDGE_CANCEL_UNICAST_TRANSMISSION:
+		if (TLV_LENGTH_INVALID(tlv, cancel_unicast_xmit_tlv))
+			goto bad_length;
 		break;
 	case TLV_PATH_TRACE:
 		ptt = (struct path_trace_tlv *) tlv;
@@ -632,6 +730,8 @@ bad_length:
 
 void tlv_pre_send(struct TLV *tlv, struct tlv_extra *extra)
 {
+	struct request_unicast_xmit_tlv *request;
+	struct grant_unicast_xmit_tlv *grant;
 	struct management_tlv *mgt;
 	struct management_error_status *mes;
 
@@ -651,7 +751,13 @@ void tlv_pre_send(struct TLV *tlv, struct tlv_extra *extra)
 		org_pre_send((struct organization_tlv *) tlv);
 		break;
 	case TLV_REQUEST_UNICAST_TRANSMISSION:
+		request = (struct request_unicast_xmit_tlv *) tlv;
+		request->durationField = htonl(request->durationField);
+		break;
 	case TLV_GRANT_UNICAST_TRANSMISSION:
+		grant = (struct grant_unicast_xmit_tlv *) tlv;
+		grant->durationField = htonl(grant->durationField);
+		break;
 	case TLV_CANCEL_UNICAST_TRANSMISSION:
 	case TLV_ACKNOWLEDGE_CANCEL_UNICAST_TRANSMISSION:
 	case TLV_PATH_TRACE:
@@ -84,6 +84,8 @@ enum management_action {
 #define TLV_TIME_STATUS_NP				0xC000
 #define TLV_GRANDMASTER_SETTINGS_NP			0xC001
 #define TLV_SUBSCRIBE_EVENTS_NP				0xC003
+#define TLV_MSG_POOL_NP					0xC005
+#define TLV_BMCA_STATS_NP				0xC007
 
 /* Port management ID values */
 #define TLV_NULL_MANAGEMENT				0x0000
@@ -105,6 +107,7 @@ enum management_action {
 #define TLV_LOG_MIN_PDELAY_REQ_INTERVAL			0x6001
 #define TLV_PORT_DATA_SET_NP				0xC002
 #define TLV_PORT_PROPERTIES_NP				0xC004
+#define TLV_PORT_HISTOGRAM_NP				0xC006
 
 /* Management error ID values */
 #define TLV_RESPONSE_TOO_BIG				0x0001
@@ -122,6 +125,13 @@ struct management_tlv {
 	Octet         data[0];
 } PACKED;
 
+/*
+ * Room reserved for the data of one management TLV in a response. This
+ * covers the largest data set, the CLOCK_DESCRIPTION with its three
+ * PTPText fields at their full length.
+ */
+#define MANAGEMENT_MAX_DATALEN 1024
+
 struct management_tlv_datum {
 	uint8_t val;
 	uint8_t reserved;
@@ -151,6 +161,33 @@ struct nsm_resp_tlv_foot {
 	struct Timestamp        lastsync;
 } PACKED;
 
+struct request_unicast_xmit_tlv {
+	Enumeration16   type;
+	UInteger16      length;
+	uint8_t         message_type; /* upper nibble */
+	Integer8        logInterMessagePeriod;
+	UInteger32      durationField;
+} PACKED;
+
+#define GRANT_UNICAST_RENEWAL_INVITED 0x1
+
+struct grant_unicast_xmit_tlv {
+	Enumeration16   type;
+	UInteger16      length;
+	uint8_t         message_type; /* upper nibble */
+	Integer8        logInterMessagePeriod;
+	UInteger32      durationField;
+	uint8_t         reserved;
+	uint8_t         flags;
+} PACKED;
+
+struct cancel_unicast_xmit_tlv {
+	Enumeration16   type;
+	UInteger16      length;
+	uint8_t         message_type_flags; /* upper nibble */
+	uint8_t         reserved;
+} PACKED;
+
 /* Organizationally Unique Identifiers */
 #define IEEE_802_1_COMMITTEE 0x00, 0x80, 0xC2
 extern uint8_t ieee8021_id[3];
@@ -232,6 +269,40 @@ struct port_properties_np {
 	struct PTPText interface;
 } PACKED;
 
+struct histogram_np {
+	uint64_t      count;
+	int64_t       p50;  /*nanoseconds*/
+	int64_t       p99;  /*nanoseconds*/
+	int64_t       p999; /*nanoseconds*/
+	int64_t       max;  /*nanoseconds*/
+} PACKED;
+
+struct port_histogram_np {
+	struct PortIdentity portIdentity;
+	struct histogram_np offset;
+	struct histogram_np delay;
+	struct histogram_np residence;
+} PACKED;
+
+struct msg_pool_np {
+	uint64_t      allocations;
+	uint64_t      misses;
+	uint64_t      trims;
+	UInteger32    in_use;
+	UInteger32    peak_in_use;
+	UInteger32    free;
+	UInteger32    slabs;
+} PACKED;
+
+struct bmca_stats_np {
+	uint64_t      runs;       /* state decisions made */
+	uint64_t      full_runs;  /* those which evaluated every port */
+	uint64_t      decisions;  /* port state decisions evaluated */
+	uint64_t      last_ns;    /* duration of the latest run */
+	uint64_t      max_ns;     /* longest run */
+	uint64_t      total_ns;   /* sum of all runs */
+} PACKED;
+
 #define PROFILE_ID_LEN 6
 
 struct mgmt_clock_description {
@@ -0,0 +1,265 @@
+/**
+ * @file tmq.c
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "missing.h"
+#include "print.h"
+#include "tmq.h"
+
+#ifndef TFD_TIMER_ABSTIME
+#define TFD_TIMER_ABSTIME 1
+#endif
+#ifndef TFD_NONBLOCK
+#define TFD_NONBLOCK 04000
+#endif
+
+#define NS_PER_SEC 1000000000LL
+
+/*
+ * The timers live in a binary min-heap ordered by expiry time. The
+ * timerfd is programmed for the earliest expiry. When a timer is moved
+ * to a later time, the timerfd is left alone and may wake us up early,
+ * which costs less than reprogramming it on every restart.
+ */
+struct tmq {
+	int fd;
+	int running;
+	int64_t deadline; /* when the timerfd will fire, or zero */
+	struct tmq_timer **heap;
+	int len;
+	int size;
+};
+
+static int64_t tmq_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void tmq_heap_place(struct tmq *q, struct tmq_timer *t, int i)
+{
+	q->heap[i] = t;
+	t->heap_index = i;
+}
+
+static void tmq_sift_up(struct tmq *q, int i)
+{
+	struct tmq_timer *t = q->heap[i];
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (q->heap[parent]->expiry <= t->expiry) {
+			break;
+		}
+		tmq_heap_place(q, q->heap[parent], i);
+		i = parent;
+	}
+	tmq_heap_place(q, t, i);
+}
+
+static void tmq_sift_down(struct tmq *q, int i)
+{
+	struct tmq_timer *t = q->heap[i];
+	int child;
+
+	while ((child = 2 * i + 1) < q->len) {
+		if (child + 1 < q->len &&
+		    q->heap[child + 1]->expiry < q->heap[child]->expiry) {
+			child++;
+		}
+		if (t->expiry <= q->heap[child]->expiry) {
+			break;
+		}
+		tmq_heap_place(q, q->heap[child], i);
+		i = child;
+	}
+	tmq_heap_place(q, t, i);
+}
+
+static int tmq_heap_insert(struct tmq *q, struct tmq_timer *t)
+{
+	struct tmq_timer **heap;
+	int size;
+
+	if (q->len == q->size) {
+		size = q->size ? 2 * q->size : 16;
+		heap = realloc(q->heap, size * sizeof(*heap));
+		if (!heap) {
+			return -1;
+		}
+		q->heap = heap;
+		q->size = size;
+	}
+	tmq_heap_place(q, t, q->len++);
+	tmq_sift_up(q, t->heap_index);
+	return 0;
+}
+
+static void tmq_heap_remove(struct tmq *q, struct tmq_timer *t)
+{
+	int i = t->heap_index;
+	struct tmq_timer *last;
+
+	t->heap_index = -1;
+	last = q->heap[--q->len];
+	if (last == t) {
+		return;
+	}
+	tmq_heap_place(q, last, i);
+	if (i > 0 && q->heap[(i - 1) / 2]->expiry > last->expiry) {
+		tmq_sift_up(q, i);
+	} else {
+		tmq_sift_down(q, i);
+	}
+}
+
+static int tmq_program(struct tmq *q)
+{
+	struct itimerspec tmo = {
+		{0, 0}, {0, 0}
+	};
+
+	if (!q->len) {
+		return 0;
+	}
+	q->deadline = q->heap[0]->expiry;
+	tmo.it_value.tv_sec = q->deadline / NS_PER_SEC;
+	tmo.it_value.tv_nsec = q->deadline % NS_PER_SEC;
+	if (timerfd_settime(q->fd, TFD_TIMER_ABSTIME, &tmo, NULL)) {
+		pr_err("timerfd_settime failed: %m");
+		q->deadline = 0;
+		return -1;
+	}
+	return 0;
+}
+
+struct tmq *tmq_create(void)
+{
+	struct tmq *q;
+
+	q = calloc(1, sizeof(*q));
+	if (!q) {
+		return NULL;
+	}
+	q->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (q->fd < 0) {
+		pr_err("timerfd_create failed: %m");
+		free(q);
+		return NULL;
+	}
+	return q;
+}
+
+void tmq_destroy(struct tmq *q)
+{
+	close(q->fd);
+	free(q->heap);
+	free(q);
+}
+
+int tmq_fd(struct tmq *q)
+{
+	return q->fd;
+}
+
+void tmq_timer_init(struct tmq *q, struct tmq_timer *t, void *owner, int id)
+{
+	memset(t, 0, sizeof(*t));
+	t->q = q;
+	t->heap_index = -1;
+	t->owner = owner;
+	t->id = id;
+}
+
+int tmq_timer_set(struct tmq_timer *t, int64_t ns)
+{
+	struct tmq *q = t->q;
+
+	tmq_timer_clear(t);
+	if (!ns) {
+		return 0;
+	}
+	t->expiry = tmq_now() + ns;
+	if (tmq_heap_insert(q, t)) {
+		return -1;
+	}
+	if (q->running || (q->deadline && q->deadline <= t->expiry)) {
+		return 0;
+	}
+	return tmq_program(q);
+}
+
+void tmq_timer_clear(struct tmq_timer *t)
+{
+	t->fired = 0;
+	if (t->heap_index >= 0) {
+		tmq_heap_remove(t->q, t);
+	}
+}
+
+int tmq_run(struct tmq *q, void (*func)(void *ctx, void *owner, int id),
+	    void *ctx)
+{
+	struct tmq_timer *t, **pos, *fired = NULL;
+	uint64_t expirations;
+	int64_t now;
+
+	if (read(q->fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN) {
+		pr_err("timerfd read failed: %m");
+		return -1;
+	}
+	q->deadline = 0;
+
+	now = tmq_now();
+	while (q->len && q->heap[0]->expiry <= now) {
+		t = q->heap[0];
+		tmq_heap_remove(q, t);
+		t->fired = 1;
+		/* Keep the list in order of id, then of expiry. */
+		for (pos = &fired; *pos && (*pos)->id <= t->id;
+		     pos = &(*pos)->next) {
+			;
+		}
+		t->next = *pos;
+		*pos = t;
+	}
+
+	q->running = 1;
+	while (fired) {
+		t = fired;
+		fired = t->next;
+		t->next = NULL;
+		if (!t->fired) {
+			continue;
+		}
+		t->fired = 0;
+		func(ctx, t->owner, t->id);
+	}
+	q->running = 0;
+
+	return tmq_program(q);
+}
@@ -0,0 +1,96 @@
+/**
+ * @file tmq.h
+ * @brief Implements a queue of software timers driven by one timerfd.
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_TMQ_H
+#define HAVE_TMQ_H
+
+#include <stdint.h>
+
+/** Opaque type */
+struct tmq;
+
+/**
+ * A one shot timer. The fields are private to the timer queue, and
+ * users embed the structure in their own objects.
+ */
+struct tmq_timer {
+	struct tmq *q;
+	struct tmq_timer *next;
+	int64_t expiry;
+	int heap_index;
+	int fired;
+	void *owner;
+	int id;
+};
+
+/**
+ * Create a new timer queue.
+ * @return A pointer to a new timer queue on success, NULL otherwise.
+ */
+struct tmq *tmq_create(void);
+
+/**
+ * Destroy a timer queue. All of the timers must have been stopped.
+ * @param q Pointer to a timer queue obtained via @ref tmq_create().
+ */
+void tmq_destroy(struct tmq *q);
+
+/**
+ * Obtain the descriptor which becomes readable when a timer expires.
+ * @param q Pointer to a timer queue obtained via @ref tmq_create().
+ * @return  A file descriptor.
+ */
+int tmq_fd(struct tmq *q);
+
+/**
+ * Prepare a timer for use with a queue. The timer starts out stopped.
+ * @param q     Pointer to a timer queue obtained via @ref tmq_create().
+ * @param t     The timer to initialize.
+ * @param owner Passed back to the caller of @ref tmq_run() on expiry.
+ * @param id    Passed back to the caller of @ref tmq_run() on expiry.
+ */
+void tmq_timer_init(struct tmq *q, struct tmq_timer *t, void *owner, int id);
+
+/**
+ * Start or restart a timer.
+ * @param t  A timer prepared with @ref tmq_timer_init().
+ * @param ns The time until expiry in nanoseconds. Zero stops the timer.
+ * @return   Zero on success, non-zero otherwise.
+ */
+int tmq_timer_set(struct tmq_timer *t, int64_t ns);
+
+/**
+ * Stop a timer. Stopping a timer which is not running has no effect.
+ * @param t A timer prepared with @ref tmq_timer_init().
+ */
+void tmq_timer_clear(struct tmq_timer *t);
+
+/**
+ * Handle the expired timers after the queue's descriptor became
+ * readable. Timers expiring together are handed out in order of their
+ * id. A timer stopped or restarted by an earlier callback is skipped.
+ * @param q    Pointer to a timer queue obtained via @ref tmq_create().
+ * @param func Called for each expired timer.
+ * @param ctx  Passed to 'func' as its first argument.
+ * @return     Zero on success, non-zero otherwise.
+ */
+int tmq_run(struct tmq *q, void (*func)(void *ctx, void *owner, int id),
+	    void *ctx);
+
+#endif
@@ -0,0 +1,203 @@
+/**
+ * @file trace.c
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "print.h"
+#include "trace.h"
+
+struct trace {
+	struct trace_header *hdr;
+	struct trace_record *ring;
+	size_t size;
+	/* Reading only. */
+	uint64_t next;
+	uint64_t end;
+};
+
+static size_t trace_size(unsigned int capacity)
+{
+	return sizeof(struct trace_header) +
+		(size_t) capacity * sizeof(struct trace_record);
+}
+
+static struct trace *trace_map(int fd, size_t size, int prot)
+{
+	struct trace *t;
+	void *p;
+
+	t = calloc(1, sizeof(*t));
+	if (!t) {
+		return NULL;
+	}
+	p = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		pr_err("failed to map trace file: %m");
+		free(t);
+		return NULL;
+	}
+	t->hdr = p;
+	t->ring = (struct trace_record *) (t->hdr + 1);
+	t->size = size;
+	return t;
+}
+
+struct trace *trace_create(const char *path, unsigned int capacity,
+			   int fadj, int max_adj, int sw_ts)
+{
+	struct trace *t;
+	size_t size;
+	int err, fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		pr_err("failed to open trace file %s: %m", path);
+		return NULL;
+	}
+	/*
+	 * Allocate the whole file now, so the writes to the mapping
+	 * cannot fail later for lack of space.
+	 */
+	size = trace_size(capacity);
+	err = posix_fallocate(fd, 0, size);
+	if (err) {
+		errno = err;
+		pr_err("failed to allocate trace file %s: %m", path);
+		close(fd);
+		return NULL;
+	}
+	t = trace_map(fd, size, PROT_READ | PROT_WRITE);
+	close(fd);
+	if (!t) {
+		return NULL;
+	}
+	memset(t->hdr, 0, sizeof(*t->hdr));
+	t->hdr->magic = TRACE_MAGIC;
+	t->hdr->version = TRACE_VERSION;
+	t->hdr->record_size = sizeof(struct trace_record);
+	t->hdr->fadj = fadj;
+	t->hdr->max_adj = max_adj;
+	t->hdr->sw_ts = sw_ts;
+	t->hdr->capacity = capacity;
+	return t;
+}
+
+struct trace *trace_open(const char *path, struct trace_header *hdr)
+{
+	struct trace *t;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		pr_err("failed to open trace file %s: %m", path);
+		return NULL;
+	}
+	if (fstat(fd, &st)) {
+		pr_err("failed to read trace file %s: %m", path);
+		goto no_map;
+	}
+	if (st.st_size < (off_t) sizeof(*hdr) ||
+	    pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+	    hdr->magic != TRACE_MAGIC) {
+		pr_err("%s is not a trace file", path);
+		goto no_map;
+	}
+	if (hdr->version != TRACE_VERSION ||
+	    hdr->record_size != sizeof(struct trace_record)) {
+		pr_err("unsupported trace version %hu", hdr->version);
+		goto no_map;
+	}
+	if (!hdr->capacity || st.st_size < (off_t) trace_size(hdr->capacity)) {
+		pr_err("trace file %s is truncated", path);
+		goto no_map;
+	}
+	t = trace_map(fd, trace_size(hdr->capacity), PROT_READ);
+	close(fd);
+	if (!t) {
+		return NULL;
+	}
+	t->end = hdr->count;
+	/* The oldest slot of a full ring is the next one a writer fills. */
+	t->next = t->end >= hdr->capacity ? t->end - hdr->capacity + 1 : 0;
+	return t;
+no_map:
+	close(fd);
+	return NULL;
+}
+
+void trace_close(struct trace *t)
+{
+	munmap(t->hdr, t->size);
+	free(t);
+}
+
+static void trace_set_tmv(struct trace_tmv *tt, tmv_t x)
+{
+	tt->ns = x.ns;
+	tt->frac = x.frac;
+	tt->reserved = 0;
+}
+
+void trace_write(struct trace *t, int type, int arg, double value,
+		 tmv_t t0, tmv_t t1, tmv_t t2)
+{
+	uint64_t count = t->hdr->count;
+	struct trace_record *rec = &t->ring[count % t->hdr->capacity];
+
+	rec->type = type;
+	rec->reserved = 0;
+	rec->arg = arg;
+	rec->value = value;
+	trace_set_tmv(&rec->t[0], t0);
+	trace_set_tmv(&rec->t[1], t1);
+	trace_set_tmv(&rec->t[2], t2);
+	/* Let a reader of the live file see the record before the count. */
+	__atomic_store_n(&t->hdr->count, count + 1, __ATOMIC_RELEASE);
+}
+
+int trace_read(struct trace *t, struct trace_record *rec)
+{
+	uint32_t capacity = t->hdr->capacity;
+	uint64_t count;
+
+	if (t->next == t->end) {
+		return 0;
+	}
+	*rec = t->ring[t->next % capacity];
+	/*
+	 * The writer of a live file may have lapped the reader, and be
+	 * writing record count into the slot while it was being copied.
+	 */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	count = __atomic_load_n(&t->hdr->count, __ATOMIC_RELAXED);
+	if (count >= t->next + capacity) {
+		pr_err("trace record %" PRIu64 " was overwritten while reading",
+		       t->next);
+		return -1;
+	}
+	t->next++;
+	return 1;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file trace.h
+ * @brief Records the time stamps fed to the clock servo in a binary file.
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_TRACE_H
+#define HAVE_TRACE_H
+
+#include <stdint.h>
+
+#include "tmv.h"
+
+#define TRACE_MAGIC   0x52545450 /* "PTTR" in little endian */
+#define TRACE_VERSION 2
+
+/**
+ * Defines the kinds of trace records. The fields of the record used by
+ * each kind are listed with it.
+ */
+enum trace_type {
+	/** Sync time stamps, t[0] ingress, t[1] origin, t[2] correction. */
+	TRACE_SYNC = 1,
+	/** Servo output, t[0] offset, value frequency, arg servo state. */
+	TRACE_SERVO,
+	/** Delay time stamps, t[0] request, t[1] receipt, t[2] correction. */
+	TRACE_DELAY,
+	/** Peer delay, t[0] delay, t[1] request, t[2] receipt, value nrr. */
+	TRACE_PEER_DELAY,
+	/** Time stamp processor reset, arg full, t[0] initial delay. */
+	TRACE_RESET,
+	/** Sync interval change, arg log2 of the interval. */
+	TRACE_INTERVAL,
+	/** Servo reset. */
+	TRACE_SERVO_RESET,
+};
+
+/**
+ * Starts a trace file. All fields are in host byte order. The header is
+ * followed by a ring of @a capacity records. Record number n is stored in
+ * slot n modulo @a capacity, and the last @a capacity records of the
+ * @a count written are available.
+ */
+struct trace_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	/** Frequency adjustment of the clock when the servo was created. */
+	int32_t fadj;
+	/** Largest frequency adjustment of the clock in ppb. */
+	int32_t max_adj;
+	/** Non-zero when software time stamping was used. */
+	int32_t sw_ts;
+	/** Number of records in the ring. */
+	uint32_t capacity;
+	/** Number of records written so far. */
+	uint64_t count;
+	uint32_t reserved[8];
+};
+
+struct trace_tmv {
+	int64_t ns;
+	int32_t frac;
+	int32_t reserved;
+};
+
+/**
+ * One fixed size record of a trace file.
+ */
+struct trace_record {
+	uint16_t type;
+	uint16_t reserved;
+	int32_t arg;
+	double value;
+	struct trace_tmv t[3];
+};
+
+/** Opaque type */
+struct trace;
+
+/**
+ * Create a new trace file, replacing any existing one. The records are
+ * written to a memory mapped ring, overwriting the oldest ones when the
+ * ring is full.
+ * @param path     The name of the file.
+ * @param capacity The number of records in the ring.
+ * @param fadj     The frequency adjustment passed to the servo.
+ * @param max_adj  The largest frequency adjustment of the clock.
+ * @param sw_ts    Non-zero when software time stamping is used.
+ * @return         A pointer to a new trace on success, NULL otherwise.
+ */
+struct trace *trace_create(const char *path, unsigned int capacity,
+			   int fadj, int max_adj, int sw_ts);
+
+/**
+ * Open an existing trace file for reading.
+ * @param path  The name of the file.
+ * @param hdr   Set to the header of the file.
+ * @return      A pointer to a trace on success, NULL otherwise.
+ */
+struct trace *trace_open(const char *path, struct trace_header *hdr);
+
+/**
+ * Close a trace file.
+ * @param t  A pointer obtained via @ref trace_create() or @ref trace_open().
+ */
+void trace_close(struct trace *t);
+
+/**
+ * Append a record to a trace file.
+ * @param t      A pointer obtained via @ref trace_create().
+ * @param type   One of the @ref trace_type values.
+ * @param arg    Integer argument of the record.
+ * @param value  Floating point argument of the record.
+ * @param t0     First time value of the record.
+ * @param t1     Second time value of the record.
+ * @param t2     Third time value of the record.
+ */
+void trace_write(struct trace *t, int type, int arg, double value,
+		 tmv_t t0, tmv_t t1, tmv_t t2);
+
+/**
+ * Read the next record of a trace file, starting with the oldest record
+ * still in the ring, except for the slot a live writer would fill next.
+ * @param t    A pointer obtained via @ref trace_open().
+ * @param rec  Set to the next record.
+ * @return     One if a record was read, zero after the last record,
+ *             and -1 if the writer of a live file overwrote the record
+ *             before it could be read.
+ */
+int trace_read(struct trace *t, struct trace_record *rec);
+
+/**
+ * Convert a time value of a record.
+ * @param tt  A time value of a trace record.
+ * @return    The time value.
+ */
+static inline tmv_t trace_tmv(struct trace_tmv *tt)
+{
+	tmv_t x;
+
+	x.ns = tt->ns;
+	x.frac = tt->frac;
+	return x;
+}
+
+#endif
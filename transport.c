@@ -22,6 +22,7 @@
 #include "transport.h"
 #include "transport_private.h"
 #include "raw.h"
+#include "sk.h"
 #include "udp.h"
 #include "udp6.h"
 #include "uds.h"
@@ -42,6 +43,30 @@ int transport_recv(struct transport *t, int fd, struct ptp_message *msg)
 	return t->recv(t, fd, msg, sizeof(msg->data), &msg->address, &msg->hwts);
 }
 
+int transport_recv_batch(struct transport *t, int fd, struct ptp_message **msg,
+			 int *cnt, int n)
+{
+	struct hw_timestamp *hwts[SK_RX_BATCH_MAX];
+	struct address *addr[SK_RX_BATCH_MAX];
+	void *buf[SK_RX_BATCH_MAX];
+	int i;
+
+	if (n == 1 || !t->recv_batch) {
+		cnt[0] = transport_recv(t, fd, msg[0]);
+		return cnt[0] < 0 ? cnt[0] : 1;
+	}
+	if (n > SK_RX_BATCH_MAX) {
+		n = SK_RX_BATCH_MAX;
+	}
+	for (i = 0; i < n; i++) {
+		buf[i] = msg[i];
+		addr[i] = &msg[i]->address;
+		hwts[i] = &msg[i]->hwts;
+	}
+	return t->recv_batch(t, fd, buf, sizeof(msg[0]->data), addr, hwts,
+			     cnt, n);
+}
+
 int transport_send(struct transport *t, struct fdarray *fda,
 		   enum transport_event event, struct ptp_message *msg)
 {
@@ -66,6 +91,39 @@ int transport_sendto(struct transport *t, struct fdarray *fda,
 	return t->send(t, fda, event, 0, msg, len, &msg->address, &msg->hwts);
 }
 
+int transport_send_batch(struct transport *t, struct fdarray *fda,
+			 struct ptp_message **msg, int n)
+{
+	struct address *addr[SK_TX_BATCH_MAX];
+	void *buf[SK_TX_BATCH_MAX];
+	int i, len[SK_TX_BATCH_MAX];
+
+	if (n > SK_TX_BATCH_MAX) {
+		n = SK_TX_BATCH_MAX;
+	}
+	if (!t->send_batch) {
+		for (i = 0; i < n; i++) {
+			if (msg_unicast(msg[i])) {
+				len[i] = transport_sendto(t, fda, TRANS_GENERAL,
+							  msg[i]);
+			} else {
+				len[i] = transport_send(t, fda, TRANS_GENERAL,
+							msg[i]);
+			}
+			if (len[i] <= 0) {
+				return i ? i : -1;
+			}
+		}
+		return n;
+	}
+	for (i = 0; i < n; i++) {
+		buf[i] = msg[i];
+		len[i] = ntohs(msg[i]->header.messageLength);
+		addr[i] = msg_unicast(msg[i]) ? &msg[i]->address : NULL;
+	}
+	return t->send_batch(t, fda, buf, len, addr, n);
+}
+
 int transport_txts(struct transport *t, struct fdarray *fda,
 		   struct ptp_message *msg)
 {
@@ -77,6 +135,15 @@ int transport_txts(struct transport *t, struct fdarray *fda,
 	return cnt > 0 ? 0 : cnt;
 }
 
+int transport_txts_recv(struct transport *t, struct fdarray *fda,
+			void *buf, int buflen, struct hw_timestamp *hwts,
+			int block)
+{
+	int flags = block ? MSG_ERRQUEUE : MSG_ERRQUEUE | MSG_DONTWAIT;
+
+	return sk_receive(fda->fd[FD_EVENT], buf, buflen, NULL, hwts, flags);
+}
+
 int transport_physical_addr(struct transport *t, uint8_t *addr)
 {
 	if (t->physical_addr) {
@@ -62,6 +62,24 @@ int transport_open(struct transport *t, struct interface *iface,
 
 int transport_recv(struct transport *t, int fd, struct ptp_message *msg);
 
+/**
+ * Receives up to 'n' PTP messages from a readable descriptor using as
+ * few system calls as the transport allows. Transports without batch
+ * support read a single message.
+ * @param t	The transport.
+ * @param fd	The descriptor to read, which must be readable.
+ * @param msg	Array of 'n' messages to fill in.
+ * @param cnt	Array of 'n' integers to receive the length of each
+ *		message. A negative length marks a message that must be
+ *		discarded.
+ * @param n	Maximum number of messages to read, at most
+ *		SK_RX_BATCH_MAX.
+ * @return	The number of messages received, or negative value in case
+ *		of an error.
+ */
+int transport_recv_batch(struct transport *t, int fd, struct ptp_message **msg,
+			 int *cnt, int n);
+
 /**
  * Sends the PTP message using the given transport. The message is sent to
  * the default (usually multicast) address, any address field in the
@@ -101,6 +119,20 @@ int transport_peer(struct transport *t, struct fdarray *fda,
 int transport_sendto(struct transport *t, struct fdarray *fda,
 		     enum transport_event event, struct ptp_message *msg);
 
+/**
+ * Sends a batch of general PTP messages using the given transport.
+ * Unicast messages go to the address stored in the message, and the
+ * others go to the default address.
+ * @param t	The transport.
+ * @param fda	The array of descriptors filled in by transport_open.
+ * @param msg	Array of 'n' messages to send, in network byte order.
+ * @param n	Number of messages to send, at most SK_TX_BATCH_MAX.
+ * @return	The number of messages sent, or negative value if none
+ *		could be sent.
+ */
+int transport_send_batch(struct transport *t, struct fdarray *fda,
+			 struct ptp_message **msg, int n);
+
 /**
  * Fetches the transmit time stamp for a PTP message that was sent
  * with the TRANS_DEFER_EVENT flag.
@@ -114,6 +146,25 @@ int transport_sendto(struct transport *t, struct fdarray *fda,
 int transport_txts(struct transport *t, struct fdarray *fda,
 		   struct ptp_message *msg);
 
+/**
+ * Fetches the next transmit time stamp queued on the event socket,
+ * whichever message it belongs to. The caller identifies the message
+ * using the looped back packet.
+ *
+ * @param t	 The transport.
+ * @param fda	 The array of descriptors filled in by transport_open.
+ * @param buf	 Buffer to receive the looped back packet.
+ * @param buflen Size of 'buf' in bytes.
+ * @param hwts	 Pointer to a buffer to receive the time stamp.
+ * @param block	 Non-zero to wait up to tx_timestamp_timeout for a
+ *               time stamp, zero to return immediately.
+ * @return	 The length of the looped back packet, zero if no time
+ *               stamp is available, or negative value in case of an error.
+ */
+int transport_txts_recv(struct transport *t, struct fdarray *fda,
+			void *buf, int buflen, struct hw_timestamp *hwts,
+			int block);
+
 /**
  * Returns the transport's type.
  */
@@ -38,10 +38,17 @@ struct transport {
 	int (*recv)(struct transport *t, int fd, void *buf, int buflen,
 		    struct address *addr, struct hw_timestamp *hwts);
 
+	int (*recv_batch)(struct transport *t, int fd, void **buf, int buflen,
+			  struct address **addr, struct hw_timestamp **hwts,
+			  int *cnt, int n);
+
 	int (*send)(struct transport *t, struct fdarray *fda,
 		    enum transport_event event, int peer, void *buf, int buflen,
 		    struct address *addr, struct hw_timestamp *hwts);
 
+	int (*send_batch)(struct transport *t, struct fdarray *fda,
+			  void **buf, int *len, struct address **addr, int n);
+
 	void (*release)(struct transport *t);
 
 	int (*physical_addr)(struct transport *t, uint8_t *addr);
@@ -61,7 +61,8 @@ static int weighting(struct tsproc *tsp)
 }
 
 struct tsproc *tsproc_create(enum tsproc_mode mode,
-			     enum filter_type delay_filter, int filter_length)
+			     enum filter_type delay_filter, int filter_length,
+			     int percentile)
 {
 	struct tsproc *tsp;
 
@@ -81,7 +82,8 @@ struct tsproc *tsproc_create(enum tsproc_mode mode,
 		return NULL;
 	}
 
-	tsp->delay_filter = filter_create(delay_filter, filter_length);
+	tsp->delay_filter = filter_create(delay_filter, filter_length,
+					  percentile);
 	if (!tsp->delay_filter) {
 		free(tsp);
 		return NULL;
@@ -40,10 +40,12 @@ enum tsproc_mode {
  * @param mode           Time stamp processing mode.
  * @param delay_filter   Type of the filter that will be applied to delay.
  * @param filter_length  Length of the filter.
+ * @param percentile     Percentile of the moving percentile filter.
  * @return               A pointer to a new tsproc on success, NULL otherwise.
  */
 struct tsproc *tsproc_create(enum tsproc_mode mode,
-			     enum filter_type delay_filter, int filter_length);
+			     enum filter_type delay_filter, int filter_length,
+			     int percentile);
 
 /**
  * Destroy a time stamp processor.
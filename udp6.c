@@ -225,6 +225,39 @@ static int udp6_recv(struct transport *t, int fd, void *buf, int buflen,
 	return sk_receive(fd, buf, buflen, addr, hwts, 0);
 }
 
+static int udp6_recv_batch(struct transport *t, int fd, void **buf,
+			   int buflen, struct address **addr,
+			   struct hw_timestamp **hwts, int *cnt, int n)
+{
+	return sk_receive_batch(fd, buf, buflen, addr, hwts, cnt, n);
+}
+
+static int udp6_send_batch(struct transport *t, struct fdarray *fda,
+			   void **buf, int *len, struct address **addr, int n)
+{
+	struct udp6 *udp6 = container_of(t, struct udp6, t);
+	struct address addr_buf;
+	int i;
+
+	memset(&addr_buf, 0, sizeof(addr_buf));
+	addr_buf.sin6.sin6_family = AF_INET6;
+	addr_buf.sin6.sin6_addr = mc6_addr[MC_PRIMARY];
+	if (is_link_local(&addr_buf.sin6.sin6_addr))
+		addr_buf.sin6.sin6_scope_id = udp6->index;
+	addr_buf.sin6.sin6_port = htons(GENERAL_PORT);
+	addr_buf.len = sizeof(addr_buf.sin6);
+
+	for (i = 0; i < n; i++) {
+		if (!addr[i]) {
+			addr[i] = &addr_buf;
+		}
+		addr[i]->sin6.sin6_port = htons(GENERAL_PORT);
+		len[i] += 2; /* For UDP checksum corrections, as in udp6_send. */
+	}
+	return sk_send_batch(fda->fd[FD_GENERAL], buf, len, addr,
+			     sizeof(addr_buf.sin6), n);
+}
+
 static int udp6_send(struct transport *t, struct fdarray *fda,
 		     enum transport_event event, int peer, void *buf, int len,
 		     struct address *addr, struct hw_timestamp *hwts)
@@ -313,6 +346,8 @@ struct transport *udp6_transport_create(void)
 	udp6->t.close   = udp6_close;
 	udp6->t.open    = udp6_open;
 	udp6->t.recv    = udp6_recv;
+	udp6->t.recv_batch = udp6_recv_batch;
+	udp6->t.send_batch = udp6_send_batch;
 	udp6->t.send    = udp6_send;
 	udp6->t.release = udp6_release;
 	udp6->t.physical_addr = udp6_physical_addr;
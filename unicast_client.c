@@ -0,0 +1,458 @@
+/**
+ * @file unicast_client.c
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "port.h"
+#include "print.h"
+#include "tmv.h"
+#include "unicast_client.h"
+#include "util.h"
+
+enum {
+	UC_ANNOUNCE,
+	UC_SYNC,
+	UC_DELAY_RESP,
+	N_UC_TYPES,
+};
+
+#define UC_BIT(type) (1 << (type))
+#define UC_SYDY (UC_BIT(UC_SYNC) | UC_BIT(UC_DELAY_RESP))
+
+static const int uc_message_type[N_UC_TYPES] = {
+	ANNOUNCE, SYNC, DELAY_RESP,
+};
+
+struct unicast_master {
+	struct address address;
+	int granted;                    /* UC_BIT() mask */
+	int64_t renew[N_UC_TYPES];      /* when to ask again */
+	int64_t expiry[N_UC_TYPES];     /* when the grant lapses */
+};
+
+struct unicast_client {
+	struct unicast_master_table *table;
+	struct unicast_master *master;
+	int count;
+	/* the master chosen by the BMCA, if any */
+	struct unicast_master *selected;
+	int64_t period;
+	UInteger32 duration;
+	int running;
+	int locked;
+	int64_t start;
+	int64_t selected_at;
+};
+
+static int64_t uc_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+static int uc_type(int message_type)
+{
+	int i;
+
+	for (i = 0; i < N_UC_TYPES; i++) {
+		if (uc_message_type[i] == message_type) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static Integer8 uc_log_period(struct port *p, int type)
+{
+	switch (type) {
+	case UC_ANNOUNCE:
+		return p->logAnnounceInterval;
+	case UC_SYNC:
+		return p->logSyncInterval;
+	case UC_DELAY_RESP:
+		return p->logMinDelayReqInterval;
+	}
+	return 0;
+}
+
+static struct unicast_master *uc_find(struct unicast_client *uc,
+				      struct address *addr)
+{
+	int i;
+
+	for (i = 0; i < uc->count; i++) {
+		if (addr_host_eq(&uc->master[i].address, addr)) {
+			return &uc->master[i];
+		}
+	}
+	return NULL;
+}
+
+/* Announce comes from every master, the rest only from the chosen one. */
+static int uc_wanted(struct port *p, struct unicast_master *m)
+{
+	int want = UC_BIT(UC_ANNOUNCE);
+
+	if (m == p->unicast_client->selected) {
+		want |= UC_BIT(UC_SYNC);
+		if (p->delayMechanism != DM_P2P) {
+			want |= UC_BIT(UC_DELAY_RESP);
+		}
+	}
+	return want;
+}
+
+static int uc_tx(struct port *p, struct unicast_master *m, int tlv_type,
+		 int mask)
+{
+	struct request_unicast_xmit_tlv *req;
+	struct cancel_unicast_xmit_tlv *cancel;
+	struct PortIdentity wildcard;
+	struct tlv_extra *extra;
+	struct ptp_message *msg;
+	int err, i;
+
+	memset(&wildcard, 0xff, sizeof(wildcard));
+	msg = port_signaling_construct(p, &m->address, &wildcard);
+	if (!msg) {
+		return -1;
+	}
+	for (i = 0; i < N_UC_TYPES; i++) {
+		if (!(mask & UC_BIT(i))) {
+			continue;
+		}
+		if (tlv_type == TLV_CANCEL_UNICAST_TRANSMISSION) {
+			extra = msg_tlv_append(msg, sizeof(*cancel));
+			if (!extra) {
+				err = -1;
+				goto out;
+			}
+			cancel = (struct cancel_unicast_xmit_tlv *) extra->tlv;
+			cancel->type = tlv_type;
+			cancel->length = sizeof(*cancel) -
+				sizeof(cancel->type) - sizeof(cancel->length);
+			cancel->message_type_flags = uc_message_type[i] << 4;
+			continue;
+		}
+		extra = msg_tlv_append(msg, sizeof(*req));
+		if (!extra) {
+			err = -1;
+			goto out;
+		}
+		req = (struct request_unicast_xmit_tlv *) extra->tlv;
+		req->type = tlv_type;
+		req->length = sizeof(*req) - sizeof(req->type) -
+			sizeof(req->length);
+		req->message_type = uc_message_type[i] << 4;
+		req->logInterMessagePeriod = uc_log_period(p, i);
+		req->durationField = p->unicast_client->duration;
+	}
+	err = port_prepare_and_send(p, msg, TRANS_GENERAL);
+	if (err) {
+		pr_debug("port %hu: send unicast %s to %s failed", portnum(p),
+			 tlv_type == TLV_CANCEL_UNICAST_TRANSMISSION ?
+			 "cancel" : "request", addr2str(&m->address));
+	}
+out:
+	msg_put(msg);
+	return err;
+}
+
+static int uc_tx_request(struct port *p, struct unicast_master *m, int mask)
+{
+	return uc_tx(p, m, TLV_REQUEST_UNICAST_TRANSMISSION, mask);
+}
+
+static int uc_tx_cancel(struct port *p, struct unicast_master *m, int mask)
+{
+	m->granted &= ~mask;
+	return uc_tx(p, m, TLV_CANCEL_UNICAST_TRANSMISSION, mask);
+}
+
+static void uc_reset(struct unicast_client *uc)
+{
+	int i;
+
+	for (i = 0; i < uc->count; i++) {
+		uc->master[i].granted = 0;
+	}
+	uc->selected = NULL;
+	uc->running = 0;
+	uc->locked = 0;
+}
+
+/* public methods */
+
+int unicast_client_initialize(struct port *p)
+{
+	struct config *cfg = clock_config(p->clock);
+	struct unicast_master_address *address;
+	struct unicast_master_table *table;
+	struct unicast_client *uc;
+	int i, table_id;
+
+	table_id = config_get_int(cfg, p->name, "unicast_master_table");
+	if (!table_id) {
+		return 0;
+	}
+	table = config_unicast_master_table(cfg, table_id);
+	if (!table) {
+		pr_err("port %hu: no unicast master table %d",
+		       portnum(p), table_id);
+		return -1;
+	}
+	if (table->port) {
+		pr_err("port %hu: unicast master table %d already used by "
+		       "port %d", portnum(p), table_id, table->port);
+		return -1;
+	}
+	STAILQ_FOREACH(address, &table->addrs, list) {
+		if (address->type != transport_type(p->trp)) {
+			pr_err("port %hu: unicast master table %d has another "
+			       "transport", portnum(p), table_id);
+			return -1;
+		}
+	}
+
+	uc = calloc(1, sizeof(*uc));
+	if (!uc) {
+		return -1;
+	}
+	uc->master = calloc(table->count, sizeof(*uc->master));
+	if (!uc->master) {
+		free(uc);
+		return -1;
+	}
+	i = 0;
+	STAILQ_FOREACH(address, &table->addrs, list) {
+		uc->master[i++].address = address->address;
+	}
+	uc->count = table->count;
+	uc->table = table;
+	uc->period = table->logQueryInterval < 0 ?
+		NS_PER_SEC >> -table->logQueryInterval :
+		NS_PER_SEC << table->logQueryInterval;
+	uc->duration = config_get_int(cfg, p->name, "unicast_req_duration");
+
+	table->port = portnum(p);
+	p->unicast_client = uc;
+	return 0;
+}
+
+void unicast_client_cleanup(struct port *p)
+{
+	struct unicast_client *uc = p->unicast_client;
+
+	if (!uc) {
+		return;
+	}
+	uc->table->port = 0;
+	free(uc->master);
+	free(uc);
+	p->unicast_client = NULL;
+}
+
+int unicast_client_enabled(struct port *p)
+{
+	return p->unicast_client ? 1 : 0;
+}
+
+void unicast_client_grant(struct port *p, struct ptp_message *m,
+			  struct tlv_extra *extra)
+{
+	struct unicast_client *uc = p->unicast_client;
+	struct grant_unicast_xmit_tlv *g;
+	struct unicast_master *master;
+	int64_t duration, now;
+	int type;
+
+	if (!uc) {
+		return;
+	}
+	g = (struct grant_unicast_xmit_tlv *) extra->tlv;
+	master = uc_find(uc, &m->address);
+	type = uc_type(g->message_type >> 4);
+	if (!master || type < 0) {
+		return;
+	}
+	if (!g->durationField) {
+		pr_debug("port %hu: unicast master %s denied %s", portnum(p),
+			 addr2str(&master->address),
+			 msg_type_string(uc_message_type[type]));
+		master->granted &= ~UC_BIT(type);
+		return;
+	}
+	if (!(master->granted & UC_BIT(type))) {
+		pr_info("port %hu: unicast master %s granted %s at 2^%d s "
+			"for %u s", portnum(p), addr2str(&master->address),
+			msg_type_string(uc_message_type[type]),
+			g->logInterMessagePeriod, g->durationField);
+	}
+	/* Renew half way through, leaving room for lost requests. */
+	now = uc_now();
+	duration = (int64_t) g->durationField * NS_PER_SEC;
+	master->granted |= UC_BIT(type);
+	master->renew[type] = now + duration / 2;
+	master->expiry[type] = now + duration;
+}
+
+void unicast_client_cancel(struct port *p, struct ptp_message *m,
+			   struct tlv_extra *extra)
+{
+	struct unicast_client *uc = p->unicast_client;
+	struct cancel_unicast_xmit_tlv *cancel;
+	struct unicast_master *master;
+	int type;
+
+	if (!uc) {
+		return;
+	}
+	cancel = (struct cancel_unicast_xmit_tlv *) extra->tlv;
+	master = uc_find(uc, &m->address);
+	type = uc_type(cancel->message_type_flags >> 4);
+	if (!master || type < 0 || !(master->granted & UC_BIT(type))) {
+		return;
+	}
+	pr_info("port %hu: unicast master %s canceled %s", portnum(p),
+		addr2str(&master->address),
+		msg_type_string(uc_message_type[type]));
+	master->granted &= ~UC_BIT(type);
+}
+
+void unicast_client_state_changed(struct port *p)
+{
+	struct unicast_client *uc = p->unicast_client;
+	struct unicast_master *selected = NULL;
+	struct ptp_message *msg;
+	int64_t now;
+	int mask;
+
+	if (!uc) {
+		return;
+	}
+	switch (p->state) {
+	case PS_INITIALIZING:
+	case PS_FAULTY:
+	case PS_DISABLED:
+		/* The port's timers are stopped, and the grants will lapse. */
+		uc_reset(uc);
+		return;
+	default:
+		break;
+	}
+
+	now = uc_now();
+	if (!uc->running) {
+		/* Ask all of the masters for their announcements at once. */
+		uc->running = 1;
+		uc->start = now;
+		tmq_timer_set(port_timer(p, FD_UNICAST_REQ_TIMER), 1);
+	}
+
+	if ((p->state == PS_UNCALIBRATED || p->state == PS_SLAVE) && p->best) {
+		msg = TAILQ_FIRST(&p->best->messages);
+		if (msg) {
+			selected = uc_find(uc, &msg->address);
+		}
+	}
+	if (selected != uc->selected) {
+		if (uc->selected) {
+			mask = uc->selected->granted & UC_SYDY;
+			if (mask) {
+				uc_tx_cancel(p, uc->selected, mask);
+			}
+		}
+		uc->selected = selected;
+		uc->locked = 0;
+		if (selected) {
+			uc->selected_at = now;
+			pr_info("port %hu: selected unicast master %s",
+				portnum(p), addr2str(&selected->address));
+			mask = uc_wanted(p, selected) & ~selected->granted;
+			if (mask) {
+				uc_tx_request(p, selected, mask);
+			}
+		}
+	}
+
+	if (selected && p->state == PS_SLAVE && !uc->locked) {
+		uc->locked = 1;
+		pr_info("port %hu: locked to unicast master %s %.3f s after "
+			"start, %.3f s after selection", portnum(p),
+			addr2str(&selected->address),
+			(now - uc->start) / 1e9, (now - uc->selected_at) / 1e9);
+	}
+}
+
+int unicast_client_timer(struct port *p)
+{
+	struct unicast_client *uc = p->unicast_client;
+	unsigned int sent = 0, failed = 0;
+	struct unicast_master *m;
+	int i, type, need, want;
+	int64_t now;
+
+	if (!uc) {
+		return 0;
+	}
+	now = uc_now();
+
+	/* Every master is asked in parallel, not one after another. */
+	for (i = 0; i < uc->count; i++) {
+		m = &uc->master[i];
+		want = uc_wanted(p, m);
+		need = 0;
+		for (type = 0; type < N_UC_TYPES; type++) {
+			if (!(want & UC_BIT(type))) {
+				continue;
+			}
+			if (m->granted & UC_BIT(type) &&
+			    now >= m->expiry[type]) {
+				pr_info("port %hu: unicast %s grant from %s "
+					"lapsed", portnum(p),
+					msg_type_string(uc_message_type[type]),
+					addr2str(&m->address));
+				m->granted &= ~UC_BIT(type);
+			}
+			if (!(m->granted & UC_BIT(type)) ||
+			    now >= m->renew[type]) {
+				need |= UC_BIT(type);
+			}
+		}
+		if (!need) {
+			continue;
+		}
+		if (uc_tx_request(p, m, need)) {
+			failed++;
+		} else {
+			sent++;
+		}
+	}
+
+	if (failed) {
+		pr_debug("port %hu: %u of %u unicast requests failed",
+			 portnum(p), failed, sent + failed);
+	}
+	/* Unreachable masters must not take the port down. */
+	return tmq_timer_set(port_timer(p, FD_UNICAST_REQ_TIMER), uc->period) ?
+		-1 : 0;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file unicast_client.h
+ * @brief Negotiates unicast transmission from the masters of a port.
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_UNICAST_CLIENT_H
+#define HAVE_UNICAST_CLIENT_H
+
+#include "msg.h"
+#include "port_private.h"
+
+/**
+ * Prepare the unicast client of a port, if the port is configured with
+ * a unicast master table.
+ * @param p  The port in question.
+ * @return   Zero on success, non-zero otherwise.
+ */
+int unicast_client_initialize(struct port *p);
+
+/**
+ * Release the unicast client of a port.
+ * @param p  The port in question.
+ */
+void unicast_client_cleanup(struct port *p);
+
+/**
+ * Test whether a port obtains its messages from unicast masters.
+ * @param p  The port in question.
+ * @return   One if the port has a unicast master table, zero otherwise.
+ */
+int unicast_client_enabled(struct port *p);
+
+/**
+ * Handle a GRANT_UNICAST_TRANSMISSION TLV from one of the masters.
+ * @param p      The port on which the grant arrived.
+ * @param m      The signaling message carrying the grant.
+ * @param extra  The GRANT_UNICAST_TRANSMISSION TLV.
+ */
+void unicast_client_grant(struct port *p, struct ptp_message *m,
+			  struct tlv_extra *extra);
+
+/**
+ * Handle the cancellation of a grant by one of the masters.
+ * @param p      The port on which the cancellation arrived.
+ * @param m      The signaling message carrying the cancellation.
+ * @param extra  The CANCEL_UNICAST_TRANSMISSION TLV.
+ */
+void unicast_client_cancel(struct port *p, struct ptp_message *m,
+			   struct tlv_extra *extra);
+
+/**
+ * Follow the state of a port. Requests Sync and Delay_Resp messages
+ * from the master chosen by the BMCA and cancels them from the others.
+ * @param p  The port in question.
+ */
+void unicast_client_state_changed(struct port *p);
+
+/**
+ * Handle the expiration of the unicast request timer. Asks all of the
+ * masters for the messages which are not yet granted or soon expire.
+ * @param p  The port in question.
+ * @return   Zero on success, non-zero otherwise.
+ */
+int unicast_client_timer(struct port *p);
+
+#endif
@@ -0,0 +1,635 @@
+/**
+ * @file unicast_service.c
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "port.h"
+#include "print.h"
+#include "sk.h"
+#include "tmv.h"
+#include "unicast_service.h"
+#include "util.h"
+
+#define UNICAST_HASH_SIZE	1024
+#define UNICAST_MAX_LOG_PERIOD	16
+#define UNICAST_ADDR_MAX	16
+
+enum {
+	GRANT_ANNOUNCE,
+	GRANT_SYNC,
+	GRANT_DELAY_RESP,
+	N_GRANTS,
+};
+
+struct unicast_interval;
+struct unicast_client;
+
+struct unicast_grant {
+	LIST_ENTRY(unicast_grant) list; /* member of the interval */
+	struct unicast_interval *itv;   /* NULL for delay responses */
+	struct unicast_client *client;
+	int64_t expiry;                 /* zero when not granted */
+	Integer8 log_period;
+	UInteger16 seqnum;
+};
+
+struct unicast_client {
+	LIST_ENTRY(unicast_client) hash;
+	struct address addr;
+	struct PortIdentity portIdentity;
+	struct unicast_grant grant[N_GRANTS];
+	int64_t expiry;                 /* the earliest of the grants */
+	int heap_index;
+};
+
+/*
+ * The grants for one message type and rate share a schedule. When it
+ * comes due, the messages go out to all of the clients in one batch.
+ */
+struct unicast_interval {
+	LIST_ENTRY(unicast_interval) list;
+	LIST_HEAD(ugl, unicast_grant) grants;
+	int type;
+	Integer8 log_period;
+	int64_t period;
+	int64_t next;
+	unsigned int count;
+};
+
+struct unicast_service {
+	LIST_HEAD(ucl, unicast_client) index[UNICAST_HASH_SIZE];
+	LIST_HEAD(uil, unicast_interval) intervals;
+	/* The clients in a binary min-heap ordered by lease expiry. */
+	struct unicast_client **heap;
+	int len;
+	int size;
+};
+
+static int64_t unicast_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+static int grant_index(int message_type)
+{
+	switch (message_type) {
+	case ANNOUNCE:
+		return GRANT_ANNOUNCE;
+	case SYNC:
+		return GRANT_SYNC;
+	case DELAY_RESP:
+		return GRANT_DELAY_RESP;
+	}
+	return -1;
+}
+
+/* The fastest rate granted is the one configured for the port. */
+static int grant_min_log_period(struct port *p, int index)
+{
+	switch (index) {
+	case GRANT_ANNOUNCE:
+		return p->logAnnounceInterval;
+	case GRANT_SYNC:
+		return p->logSyncInterval;
+	case GRANT_DELAY_RESP:
+		return p->logMinDelayReqInterval;
+	}
+	return 0;
+}
+
+/*
+ * Clients are told apart by their network address, without the UDP
+ * port, since the event and general messages come from different ports.
+ */
+static int addr_key(struct address *a, unsigned char *key)
+{
+	switch (a->sa.sa_family) {
+	case AF_INET:
+		memcpy(key, &a->sin.sin_addr, sizeof(a->sin.sin_addr));
+		return sizeof(a->sin.sin_addr);
+	case AF_INET6:
+		memcpy(key, &a->sin6.sin6_addr, sizeof(a->sin6.sin6_addr));
+		return sizeof(a->sin6.sin6_addr);
+	case AF_PACKET:
+		if (a->sll.sll_halen > UNICAST_ADDR_MAX) {
+			return 0;
+		}
+		memcpy(key, a->sll.sll_addr, a->sll.sll_halen);
+		return a->sll.sll_halen;
+	}
+	return 0;
+}
+
+static unsigned int unicast_hash(struct address *addr,
+				 struct PortIdentity *pid)
+{
+	unsigned char key[UNICAST_ADDR_MAX], *b = (unsigned char *) pid;
+	unsigned int i, len, h = 2166136261u;
+
+	len = addr_key(addr, key);
+	for (i = 0; i < len; i++) {
+		h = (h ^ key[i]) * 16777619u;
+	}
+	for (i = 0; i < sizeof(*pid); i++) {
+		h = (h ^ b[i]) * 16777619u;
+	}
+	return h % UNICAST_HASH_SIZE;
+}
+
+/* lease heap */
+
+static void heap_place(struct unicast_service *us, struct unicast_client *c,
+		       int i)
+{
+	us->heap[i] = c;
+	c->heap_index = i;
+}
+
+static void heap_sift_up(struct unicast_service *us, int i)
+{
+	struct unicast_client *c = us->heap[i];
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (us->heap[parent]->expiry <= c->expiry) {
+			break;
+		}
+		heap_place(us, us->heap[parent], i);
+		i = parent;
+	}
+	heap_place(us, c, i);
+}
+
+static void heap_sift_down(struct unicast_service *us, int i)
+{
+	struct unicast_client *c = us->heap[i];
+	int child;
+
+	while ((child = 2 * i + 1) < us->len) {
+		if (child + 1 < us->len &&
+		    us->heap[child + 1]->expiry < us->heap[child]->expiry) {
+			child++;
+		}
+		if (c->expiry <= us->heap[child]->expiry) {
+			break;
+		}
+		heap_place(us, us->heap[child], i);
+		i = child;
+	}
+	heap_place(us, c, i);
+}
+
+static int heap_insert(struct unicast_service *us, struct unicast_client *c)
+{
+	struct unicast_client **heap;
+	int size;
+
+	if (us->len == us->size) {
+		size = us->size ? 2 * us->size : 64;
+		heap = realloc(us->heap, size * sizeof(*heap));
+		if (!heap) {
+			return -1;
+		}
+		us->heap = heap;
+		us->size = size;
+	}
+	heap_place(us, c, us->len++);
+	heap_sift_up(us, c->heap_index);
+	return 0;
+}
+
+static void heap_remove(struct unicast_service *us, struct unicast_client *c)
+{
+	struct unicast_client *last;
+	int i = c->heap_index;
+
+	c->heap_index = -1;
+	last = us->heap[--us->len];
+	if (last == c) {
+		return;
+	}
+	heap_place(us, last, i);
+	heap_sift_up(us, i);
+	heap_sift_down(us, last->heap_index);
+}
+
+/* intervals */
+
+static struct unicast_interval *interval_get(struct unicast_service *us,
+					     int type, Integer8 log_period,
+					     int64_t now)
+{
+	struct unicast_interval *itv;
+
+	LIST_FOREACH(itv, &us->intervals, list) {
+		if (itv->type == type && itv->log_period == log_period) {
+			return itv;
+		}
+	}
+	itv = calloc(1, sizeof(*itv));
+	if (!itv) {
+		return NULL;
+	}
+	LIST_INIT(&itv->grants);
+	itv->type = type;
+	itv->log_period = log_period;
+	itv->period = log_period < 0 ?
+		NS_PER_SEC >> -log_period : NS_PER_SEC << log_period;
+	itv->next = now;
+	LIST_INSERT_HEAD(&us->intervals, itv, list);
+	return itv;
+}
+
+static void interval_put(struct unicast_interval *itv)
+{
+	if (--itv->count) {
+		return;
+	}
+	LIST_REMOVE(itv, list);
+	free(itv);
+}
+
+/* clients and grants */
+
+static struct unicast_client *client_find(struct unicast_service *us,
+					  struct address *addr,
+					  struct PortIdentity *pid)
+{
+	struct unicast_client *c;
+	unsigned int h = unicast_hash(addr, pid);
+
+	LIST_FOREACH(c, &us->index[h], hash) {
+		if (pid_eq(&c->portIdentity, pid) &&
+		    addr_host_eq(&c->addr, addr)) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+static void client_update_expiry(struct unicast_service *us,
+				 struct unicast_client *c)
+{
+	int64_t expiry = 0;
+	int i;
+
+	for (i = 0; i < N_GRANTS; i++) {
+		if (c->grant[i].expiry &&
+		    (!expiry || c->grant[i].expiry < expiry)) {
+			expiry = c->grant[i].expiry;
+		}
+	}
+	c->expiry = expiry;
+	heap_sift_up(us, c->heap_index);
+	heap_sift_down(us, c->heap_index);
+}
+
+static void grant_drop(struct unicast_grant *g)
+{
+	if (g->itv) {
+		LIST_REMOVE(g, list);
+		interval_put(g->itv);
+		g->itv = NULL;
+	}
+	g->expiry = 0;
+}
+
+static void client_remove(struct unicast_service *us,
+			  struct unicast_client *c)
+{
+	int i;
+
+	for (i = 0; i < N_GRANTS; i++) {
+		grant_drop(&c->grant[i]);
+	}
+	heap_remove(us, c);
+	LIST_REMOVE(c, hash);
+	free(c);
+}
+
+static void client_expire(struct unicast_service *us,
+			  struct unicast_client *c, int64_t now)
+{
+	int i;
+
+	for (i = 0; i < N_GRANTS; i++) {
+		if (c->grant[i].expiry && c->grant[i].expiry <= now) {
+			grant_drop(&c->grant[i]);
+		}
+	}
+	client_update_expiry(us, c);
+	if (!c->expiry) {
+		pr_debug("unicast client %s expired",
+			 pid2str(&c->portIdentity));
+		client_remove(us, c);
+	}
+}
+
+static int unicast_service_rearm(struct port *p)
+{
+	struct unicast_service *us = p->unicast_service;
+	struct tmq_timer *t = port_timer(p, FD_UNICAST_SRV_TIMER);
+	struct unicast_interval *itv;
+	int64_t next = 0, now;
+
+	if (us->len) {
+		next = us->heap[0]->expiry;
+	}
+	LIST_FOREACH(itv, &us->intervals, list) {
+		if (!next || itv->next < next) {
+			next = itv->next;
+		}
+	}
+	if (!next) {
+		return port_clr_tmo(t);
+	}
+	now = unicast_now();
+	return tmq_timer_set(t, next > now ? next - now : 1);
+}
+
+/* The Announce messages of a schedule go out with one system call per batch. */
+static void unicast_service_announce(struct port *p,
+				     struct unicast_interval *itv,
+				     unsigned int *sent, unsigned int *failed)
+{
+	struct address *dst[SK_TX_BATCH_MAX];
+	UInteger16 seqnum[SK_TX_BATCH_MAX];
+	struct unicast_grant *g;
+	int n = 0, res;
+
+	LIST_FOREACH(g, &itv->grants, list) {
+		/* Each client sees its own sequence of messages. */
+		dst[n] = &g->client->addr;
+		seqnum[n] = g->seqnum++;
+		n++;
+		if (n < SK_TX_BATCH_MAX && LIST_NEXT(g, list)) {
+			continue;
+		}
+		res = port_tx_announce_batch(p, dst, seqnum, n);
+		if (res < 0) {
+			res = 0;
+		}
+		*sent += res;
+		*failed += n - res;
+		n = 0;
+	}
+}
+
+/*
+ * A two step Sync needs its own transmit time stamp from the event
+ * socket, so each one is sent on its own. With tx_timestamp_deferred
+ * the time stamps are collected later, and the sends do not block.
+ */
+static void unicast_service_sync(struct port *p, struct unicast_interval *itv,
+				 unsigned int *sent, unsigned int *failed)
+{
+	struct unicast_grant *g;
+	UInteger16 saved;
+	int err;
+
+	LIST_FOREACH(g, &itv->grants, list) {
+		/* Each client sees its own sequence of messages. */
+		saved = p->seqnum.sync;
+		p->seqnum.sync = g->seqnum;
+		err = port_tx_sync(p, &g->client->addr);
+		g->seqnum = p->seqnum.sync;
+		p->seqnum.sync = saved;
+		if (err) {
+			(*failed)++;
+		} else {
+			(*sent)++;
+		}
+	}
+}
+
+/* public methods */
+
+int unicast_service_initialize(struct port *p)
+{
+	struct config *cfg = clock_config(p->clock);
+	struct unicast_service *us;
+	int i;
+
+	if (!config_get_int(cfg, p->name, "unicast_listen")) {
+		return 0;
+	}
+	us = calloc(1, sizeof(*us));
+	if (!us) {
+		return -1;
+	}
+	for (i = 0; i < UNICAST_HASH_SIZE; i++) {
+		LIST_INIT(&us->index[i]);
+	}
+	LIST_INIT(&us->intervals);
+	p->unicast_service = us;
+	return 0;
+}
+
+void unicast_service_cleanup(struct port *p)
+{
+	if (!p->unicast_service) {
+		return;
+	}
+	unicast_service_clear(p);
+	free(p->unicast_service->heap);
+	free(p->unicast_service);
+	p->unicast_service = NULL;
+}
+
+void unicast_service_clear(struct port *p)
+{
+	struct unicast_service *us = p->unicast_service;
+
+	if (!us) {
+		return;
+	}
+	while (us->len) {
+		client_remove(us, us->heap[0]);
+	}
+	port_clr_tmo(port_timer(p, FD_UNICAST_SRV_TIMER));
+}
+
+int unicast_service_add(struct port *p, struct ptp_message *m,
+			struct tlv_extra *extra)
+{
+	struct unicast_service *us = p->unicast_service;
+	struct request_unicast_xmit_tlv *req;
+	struct unicast_interval *itv = NULL;
+	struct unicast_client *c;
+	struct unicast_grant *g;
+	int64_t now;
+	int index;
+
+	if (!us) {
+		return SERVICE_DISABLED;
+	}
+	req = (struct request_unicast_xmit_tlv *) extra->tlv;
+	index = grant_index(req->message_type >> 4);
+	if (index < 0 || !req->durationField) {
+		return SERVICE_DENIED;
+	}
+	if (index == GRANT_ANNOUNCE && clock_slave_only(p->clock)) {
+		return SERVICE_DENIED;
+	}
+	if (req->logInterMessagePeriod < grant_min_log_period(p, index) ||
+	    req->logInterMessagePeriod > UNICAST_MAX_LOG_PERIOD) {
+		return SERVICE_DENIED;
+	}
+
+	now = unicast_now();
+	c = client_find(us, &m->address, &m->header.sourcePortIdentity);
+	if (!c) {
+		c = calloc(1, sizeof(*c));
+		if (!c) {
+			return SERVICE_DENIED;
+		}
+		c->addr = m->address;
+		c->portIdentity = m->header.sourcePortIdentity;
+		for (index = 0; index < N_GRANTS; index++) {
+			c->grant[index].client = c;
+		}
+		c->expiry = now;
+		if (heap_insert(us, c)) {
+			free(c);
+			return SERVICE_DENIED;
+		}
+		LIST_INSERT_HEAD(&us->index[unicast_hash(&c->addr,
+							 &c->portIdentity)],
+				 c, hash);
+		pr_debug("port %hu: new unicast client %s", portnum(p),
+			 pid2str(&c->portIdentity));
+		index = grant_index(req->message_type >> 4);
+	}
+	g = &c->grant[index];
+
+	if (index != GRANT_DELAY_RESP &&
+	    !(g->itv && g->log_period == req->logInterMessagePeriod)) {
+		itv = interval_get(us, index, req->logInterMessagePeriod, now);
+		if (!itv) {
+			if (!g->expiry) {
+				client_expire(us, c, now);
+			}
+			return SERVICE_DENIED;
+		}
+		grant_drop(g);
+		g->itv = itv;
+		itv->count++;
+		LIST_INSERT_HEAD(&itv->grants, g, list);
+	}
+	g->log_period = req->logInterMessagePeriod;
+	g->expiry = now + (int64_t) req->durationField * NS_PER_SEC;
+	client_update_expiry(us, c);
+
+	if (unicast_service_rearm(p)) {
+		pr_err("port %hu: failed to schedule unicast service",
+		       portnum(p));
+	}
+	return SERVICE_GRANTED;
+}
+
+void unicast_service_remove(struct port *p, struct ptp_message *m,
+			    struct tlv_extra *extra)
+{
+	struct unicast_service *us = p->unicast_service;
+	struct cancel_unicast_xmit_tlv *cancel;
+	struct unicast_client *c;
+	int index;
+
+	if (!us) {
+		return;
+	}
+	cancel = (struct cancel_unicast_xmit_tlv *) extra->tlv;
+	index = grant_index(cancel->message_type_flags >> 4);
+	c = client_find(us, &m->address, &m->header.sourcePortIdentity);
+	if (!c || index < 0) {
+		return;
+	}
+	grant_drop(&c->grant[index]);
+	client_update_expiry(us, c);
+	if (!c->expiry) {
+		client_remove(us, c);
+	}
+	unicast_service_rearm(p);
+}
+
+int unicast_service_granted(struct port *p, struct ptp_message *m,
+			    int message_type)
+{
+	struct unicast_service *us = p->unicast_service;
+	struct unicast_client *c;
+	int index = grant_index(message_type);
+
+	if (!us || index < 0) {
+		return 0;
+	}
+	c = client_find(us, &m->address, &m->header.sourcePortIdentity);
+	if (!c || !c->grant[index].expiry) {
+		return 0;
+	}
+	return c->grant[index].expiry > unicast_now();
+}
+
+int unicast_service_timer(struct port *p)
+{
+	struct unicast_service *us = p->unicast_service;
+	unsigned int sent = 0, failed = 0;
+	struct unicast_interval *itv;
+	int64_t now;
+	int master;
+
+	if (!us) {
+		return 0;
+	}
+	now = unicast_now();
+
+	/* Drop the expired leases first, so that nothing is sent for them. */
+	while (us->len && us->heap[0]->expiry <= now) {
+		client_expire(us, us->heap[0], now);
+	}
+
+	master = p->state == PS_MASTER || p->state == PS_GRAND_MASTER;
+
+	LIST_FOREACH(itv, &us->intervals, list) {
+		if (itv->next > now) {
+			continue;
+		}
+		if (master && itv->type == GRANT_ANNOUNCE) {
+			unicast_service_announce(p, itv, &sent, &failed);
+		} else if (master && itv->type == GRANT_SYNC) {
+			unicast_service_sync(p, itv, &sent, &failed);
+		}
+		itv->next += itv->period;
+		if (itv->next <= now) {
+			/* Fell behind, skip the missed rounds. */
+			itv->next = now + itv->period;
+		}
+	}
+
+	if (failed) {
+		pr_debug("port %hu: %u of %u unicast messages failed",
+			 portnum(p), failed, sent + failed);
+	}
+	/* Unreachable clients must not take the port down. */
+	return unicast_service_rearm(p) ? -1 : 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file unicast_service.h
+ * @brief Grants unicast transmission to the clients of a port.
+ * @note Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_UNICAST_SERVICE_H
+#define HAVE_UNICAST_SERVICE_H
+
+#include "msg.h"
+#include "port_private.h"
+
+#define SERVICE_GRANTED  0
+#define SERVICE_DENIED   1
+#define SERVICE_DISABLED 2
+
+/**
+ * Prepare the unicast service of a port, if the port is configured to
+ * listen for requests.
+ * @param p  The port in question.
+ * @return   Zero on success, non-zero otherwise.
+ */
+int unicast_service_initialize(struct port *p);
+
+/**
+ * Release the unicast service of a port.
+ * @param p  The port in question.
+ */
+void unicast_service_cleanup(struct port *p);
+
+/**
+ * Revoke all of the grants of a port, for example when the port
+ * becomes disabled.
+ * @param p  The port in question.
+ */
+void unicast_service_clear(struct port *p);
+
+/**
+ * Handle a request for unicast transmission.
+ * @param p      The port on which the request arrived.
+ * @param m      The signaling message carrying the request.
+ * @param extra  The REQUEST_UNICAST_TRANSMISSION TLV.
+ * @return       SERVICE_GRANTED, SERVICE_DENIED or SERVICE_DISABLED.
+ */
+int unicast_service_add(struct port *p, struct ptp_message *m,
+			struct tlv_extra *extra);
+
+/**
+ * Handle the cancellation of a grant by a client.
+ * @param p      The port on which the cancellation arrived.
+ * @param m      The signaling message carrying the cancellation.
+ * @param extra  The CANCEL_UNICAST_TRANSMISSION TLV.
+ */
+void unicast_service_remove(struct port *p, struct ptp_message *m,
+			    struct tlv_extra *extra);
+
+/**
+ * Test whether the sender of a message holds a grant.
+ * @param p             The port on which the message arrived.
+ * @param m             A message received from a client.
+ * @param message_type  The type of message the client wants to receive.
+ * @return              One if the client holds a valid grant, zero otherwise.
+ */
+int unicast_service_granted(struct port *p, struct ptp_message *m,
+			    int message_type);
+
+/**
+ * Handle the expiration of the unicast service timer. Sends the messages
+ * of all of the grants that are due and drops the expired grants.
+ * @param p  The port in question.
+ * @return   Zero on success, non-zero otherwise.
+ */
+int unicast_service_timer(struct port *p);
+
+#endif
@@ -168,6 +168,90 @@ int str2pid(const char *s, struct PortIdentity *result)
 	return -1;
 }
 
+int str2addr(enum transport_type type, const char *s, struct address *addr)
+{
+	unsigned char mac[MAC_LEN];
+
+	memset(addr, 0, sizeof(*addr));
+
+	switch (type) {
+	case TRANS_UDS:
+	case TRANS_DEVICENET:
+	case TRANS_CONTROLNET:
+	case TRANS_PROFINET:
+		pr_err("sorry, cannot convert addresses for this transport");
+		return -1;
+	case TRANS_UDP_IPV4:
+		if (!inet_aton(s, &addr->sin.sin_addr)) {
+			pr_err("bad IPv4 address %s", s);
+			return -1;
+		}
+		addr->sin.sin_family = AF_INET;
+		addr->len = sizeof(addr->sin);
+		break;
+	case TRANS_UDP_IPV6:
+		if (1 != inet_pton(AF_INET6, s, &addr->sin6.sin6_addr)) {
+			pr_err("bad IPv6 address %s", s);
+			return -1;
+		}
+		addr->sin6.sin6_family = AF_INET6;
+		addr->len = sizeof(addr->sin6);
+		break;
+	case TRANS_IEEE_802_3:
+		if (str2mac(s, mac)) {
+			pr_err("bad Layer-2 address %s", s);
+			return -1;
+		}
+		addr->sll.sll_family = AF_PACKET;
+		addr->sll.sll_halen = MAC_LEN;
+		memcpy(&addr->sll.sll_addr, mac, MAC_LEN);
+		addr->len = sizeof(addr->sll);
+		break;
+	}
+	return 0;
+}
+
+char *addr2str(struct address *addr)
+{
+	static char buf[INET6_ADDRSTRLEN];
+	unsigned char *a;
+
+	switch (addr->sa.sa_family) {
+	case AF_INET:
+		return inet_ntop(AF_INET, &addr->sin.sin_addr, buf, sizeof(buf))
+			? buf : "?";
+	case AF_INET6:
+		return inet_ntop(AF_INET6, &addr->sin6.sin6_addr, buf,
+				 sizeof(buf)) ? buf : "?";
+	case AF_PACKET:
+		a = addr->sll.sll_addr;
+		snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+			 a[0], a[1], a[2], a[3], a[4], a[5]);
+		return buf;
+	}
+	return "?";
+}
+
+int addr_host_eq(struct address *a, struct address *b)
+{
+	if (a->sa.sa_family != b->sa.sa_family) {
+		return 0;
+	}
+	switch (a->sa.sa_family) {
+	case AF_INET:
+		return !memcmp(&a->sin.sin_addr, &b->sin.sin_addr,
+			       sizeof(a->sin.sin_addr));
+	case AF_INET6:
+		return !memcmp(&a->sin6.sin6_addr, &b->sin6.sin6_addr,
+			       sizeof(a->sin6.sin6_addr));
+	case AF_PACKET:
+		return a->sll.sll_halen == b->sll.sll_halen &&
+			!memcmp(a->sll.sll_addr, b->sll.sll_addr,
+				a->sll.sll_halen);
+	}
+	return 0;
+}
+
 int generate_clock_identity(struct ClockIdentity *ci, const char *name)
 {
 	struct address addr;
@@ -23,8 +23,10 @@
 #include <string.h>
 #include <time.h>
 
+#include "address.h"
 #include "ddt.h"
 #include "ether.h"
+#include "transport.h"
 
 #define MAX_PRINT_BYTES 16
 #define BIN_BUF_SIZE (MAX_PRINT_BYTES * 3 + 1)
@@ -98,6 +100,35 @@ int str2mac(const char *s, unsigned char mac[MAC_LEN]);
  */
 int str2pid(const char *s, struct PortIdentity *result);
 
+/**
+ * Scan a string containing a network address and convert it into binary
+ * form.
+ *
+ * @param type    The network transport type of the address.
+ * @param s       String in human readable form.
+ * @param addr    Pointer to a buffer to hold the result.
+ * @return Zero on success, or -1 if the string is incorrectly formatted.
+ */
+int str2addr(enum transport_type type, const char *s, struct address *addr);
+
+/**
+ * Convert a network address into a string, without the UDP port.
+ *
+ * @param addr    The address to convert.
+ * @return        A pointer to a static string buffer.
+ */
+char *addr2str(struct address *addr);
+
+/**
+ * Compare the host parts of two network addresses, ignoring the UDP
+ * port, since the event and general messages use different ports.
+ *
+ * @param a       The first address.
+ * @param b       The second address.
+ * @return        One if the addresses are equal, zero otherwise.
+ */
+int addr_host_eq(struct address *a, struct address *b);
+
 int generate_clock_identity(struct ClockIdentity *ci, const char *name);
 
 /**